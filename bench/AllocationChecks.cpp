@@ -0,0 +1,155 @@
+//
+// AllocationChecks.cpp
+// ~~~~~~~~~~~~~~~~~~~~
+//
+// Checks that the request path does not allocate in steady state:
+// - the global operator new is replaced by a counting one (for the whole bench program)
+// - each check dispatches a request repeatedly, encoding the reply into a slot of a
+//   ReplyQueue as CountersServer does, and counts the heap allocations
+// - alloc/<protocol>/<request>: prints the number of allocations per request, and
+//   fails if it is not zero
+// The named counters are created beforehand (their creation may grow the tables)
+//
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+#include "Benchmark.h"
+#include "BinaryProtocol.h"
+#include "Configuration.h"
+#include "CountersServerDispatcher.h"
+#include "CountersStore.h"
+#include "MappedFileStorage.h"
+#include "NamedCountersStorage.h"
+#include "ReplyQueue.h"
+
+namespace
+{
+    // Number of heap allocations since startup
+    std::atomic<unsigned long long> allocations(0);
+}
+
+// Counting replacements of the global allocation functions
+void* operator new(std::size_t size)
+{
+    ++allocations;
+    if (void* pointer = std::malloc(size ? size : 1))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+namespace ocs
+{
+namespace Bench
+{
+
+    namespace
+    {
+        // Number of requests dispatched by each check (after a warm-up of as many requests)
+        enum { checkedRequests = 100000 };
+
+        // checkAllocations(options, name, dispatcher, request, size):
+        // Dispatches a request repeatedly, prints the number of allocations per request,
+        // returns false if it is not zero
+        bool checkAllocations(const Options& options, const std::string& name,
+                              const CountersServer::CountersServerDispatcher& dispatcher, const char* request, std::size_t size)
+        {
+            if (!selected(options, name))
+                return true;
+
+            CountersServer::ReplyQueue queue(1);
+            const CountersServer::ReplyQueue::Endpoint endpoint;
+            const auto dispatch = [&]()
+            {
+                auto& reply = queue.push(endpoint);
+                reply.size = dispatcher.dispatchCommand(boost::string_view(request, size), reply.buffer.data(), reply.buffer.size());
+                queue.pop();
+            };
+
+            for (int i = 0; i < checkedRequests; ++i)
+                dispatch();
+            const auto before = allocations.load();
+            for (int i = 0; i < checkedRequests; ++i)
+                dispatch();
+            const auto count = allocations.load() - before;
+
+            std::printf("%-40s %14.3f allocations/request %s\n",
+                name.c_str(), static_cast<double>(count) / checkedRequests, count ? "FAILED" : "ok");
+            std::fflush(stdout);
+            return count == 0;
+        }
+    }
+
+    // runAllocationChecks(options):
+    // Runs the allocation checks selected by the options, returns false if any of them failed
+    bool runAllocationChecks(const Options& options)
+    {
+        if (!selected(options, "alloc/"))
+            return true;
+
+        const auto removeFiles = [&]()
+        {
+            std::remove((options.workDirectory + "/" + CountersServer::MappedFileStorage::theFilename_).c_str());
+            std::remove((options.workDirectory + "/" + CountersServer::NamedCountersStorage::theFilename_).c_str());
+        };
+        removeFiles();
+
+        auto succeeded = true;
+        {
+            CountersServer::Configuration configuration;
+            configuration.workDirectory = options.workDirectory;
+            configuration.durability = CountersServer::Durability::none;
+            auto store = std::make_shared<CountersServer::CountersStore>(configuration);
+            const CountersServer::CountersServerDispatcher dispatcher(configuration, store);
+            store->incrementCounter("requests", 1);
+
+            const char get[] = "GET\n";
+            const char peek[] = "PEEK\n";
+            const char getCounter[] = "GET requests\n";
+            const char incrementCounter[] = "INCR requests 2\n";
+            succeeded &= checkAllocations(options, "alloc/text/get", dispatcher, get, sizeof(get) - 1);
+            succeeded &= checkAllocations(options, "alloc/text/peek", dispatcher, peek, sizeof(peek) - 1);
+            succeeded &= checkAllocations(options, "alloc/text/get-counter", dispatcher, getCounter, sizeof(getCounter) - 1);
+            succeeded &= checkAllocations(options, "alloc/text/incr", dispatcher, incrementCounter, sizeof(incrementCounter) - 1);
+
+            // Binary datagram of 3 operations: GET, GET requests, INCR requests 2
+            char datagram[Constants::defaultBufferSize];
+            BinaryWriter writer(datagram, sizeof(datagram));
+            BinaryHeader header;
+            header.count = 3;
+            writer.writeHeader(header);
+            BinaryOperation operation;
+            operation.code = BinaryProtocol::getQueries;
+            writer.writeOperation(operation);
+            operation.code = BinaryProtocol::getCounter;
+            operation.name = "requests";
+            operation.nameLength = 8;
+            writer.writeOperation(operation);
+            operation.code = BinaryProtocol::incrementCounter;
+            operation.value = 2;
+            writer.writeOperation(operation);
+            succeeded &= checkAllocations(options, "alloc/binary/3ops", dispatcher, datagram, writer.size());
+        }
+        removeFiles();
+        return succeeded;
+    }
+
+} // namespace Bench
+} // namespace ocs
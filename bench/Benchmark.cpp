@@ -0,0 +1,121 @@
+//
+// Benchmark.cpp
+// ~~~~~~~~~~~~~
+//
+// Source for the micro-benchmarking helpers:
+// - report(): prints a result, and records it for writeResults()
+// - writeResults(): writes the recorded results to a JSON file
+//
+#include "Benchmark.h"
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace ocs
+{
+namespace Bench
+{
+
+    namespace
+    {
+        // Results reported so far, in order
+        std::vector<Result> theResults;
+
+        // rate(result), nanoseconds(result):
+        // Return the throughput (operations per second) and the time per operation
+        double rate(const Result& result)
+        {
+            return result.seconds > 0 ? result.operations / result.seconds : 0.0;
+        }
+
+        double nanoseconds(const Result& result)
+        {
+            return result.operations ? result.seconds * 1e9 / result.operations : 0.0;
+        }
+
+        // quote(text):
+        // Returns a text as a JSON string
+        std::string quote(const std::string& text)
+        {
+            std::string quoted = "\"";
+            for (const char c : text)
+            {
+                if (c == '"' || c == '\\')
+                {
+                    quoted += '\\';
+                    quoted += c;
+                }
+                else if (static_cast<unsigned char>(c) < 0x20)
+                {
+                    char escaped[8];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(c));
+                    quoted += escaped;
+                }
+                else
+                    quoted += c;
+            }
+            return quoted + "\"";
+        }
+
+        // number(value, decimals):
+        // Returns a floating-point value as a JSON number, with a fixed number of decimals
+        std::string number(double value, int decimals)
+        {
+            char text[32];
+            std::snprintf(text, sizeof(text), "%.*f", decimals, value);
+            return text;
+        }
+    }
+
+    // report(result):
+    // Prints a result (throughput and time per operation), and records it for writeResults()
+    void report(const Result& result)
+    {
+        std::printf("%-40s threads=%-3d %14.0f ops/s %10.1f ns/op\n",
+            result.name.c_str(), result.threads, rate(result), nanoseconds(result));
+        std::fflush(stdout);
+        theResults.push_back(result);
+    }
+
+    // writeResults(options):
+    // Writes the results reported so far to the options' JSON file, along with the
+    // options of the run, so that the results of two builds can be compared
+    // One result per line, so that a plain diff of two files is readable as well
+    void writeResults(const Options& options)
+    {
+        char date[32];
+        const auto now = std::time(nullptr);
+        std::tm utc;
+        std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", ::gmtime_r(&now, &utc));
+        char host[256] = "";
+        ::gethostname(host, sizeof(host) - 1);
+
+        std::ofstream file(options.json);
+        file << "{\n";
+        file << "  \"date\": " << quote(date) << ",\n";
+        file << "  \"host\": " << quote(host) << ",\n";
+        file << "  \"cpus\": " << std::thread::hardware_concurrency() << ",\n";
+        file << "  \"options\": { \"filter\": " << quote(options.filter) << ", \"duration_ms\": " << options.duration
+             << ", \"max_threads\": " << options.maxThreads << " },\n";
+        file << "  \"results\": [";
+        for (std::size_t i = 0; i < theResults.size(); ++i)
+        {
+            const auto& result = theResults[i];
+            file << (i ? ",\n" : "\n")
+                 << "    { \"name\": " << quote(result.name)
+                 << ", \"threads\": " << result.threads
+                 << ", \"operations\": " << result.operations
+                 << ", \"seconds\": " << number(result.seconds, 6)
+                 << ", \"ops_per_second\": " << number(rate(result), 0)
+                 << ", \"ns_per_op\": " << number(nanoseconds(result), 3) << " }";
+        }
+        file << "\n  ]\n}\n";
+        file.flush();
+        if (!file)
+            throw std::runtime_error("Could not write the results to '" + options.json + "'");
+    }
+
+} // namespace Bench
+} // namespace ocs
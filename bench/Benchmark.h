@@ -0,0 +1,124 @@
+#ifndef OCS_BENCH_BENCHMARK_H
+#define OCS_BENCH_BENCHMARK_H
+//
+// Benchmark.h
+// ~~~~~~~~~~~
+//
+// Header for the micro-benchmarking helpers:
+// - Options structure: the benchmark program's options (filter, duration...)
+// - Result structure: the outcome of a benchmark run
+// - runThreads(): runs a benchmark body on several threads for a fixed duration
+// - report(): prints a result, and records it for writeResults()
+// - writeResults(): writes the recorded results to a JSON file
+//
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ocs
+{
+namespace Bench
+{
+
+    // Options structure:
+    // Container for the benchmark program's options
+    // No logic is required -> implemented as an open struct
+    struct Options
+    {
+        // only the benchmarks whose name contains this text are run (all by default)
+        std::string filter;
+
+        // duration of each measurement, in milliseconds
+        int duration = 500;
+
+        // maximum number of threads of the multi-threaded benchmarks
+        int maxThreads = 64;
+
+        // work directory for the files created by the benchmarks
+        std::string workDirectory = ".";
+
+        // file to which the results are written as JSON, at the end of the run (none by default)
+        std::string json;
+    };
+
+    // Result structure:
+    // Outcome of a benchmark run
+    // No logic is required -> implemented as an open struct
+    struct Result
+    {
+        std::string         name;        // name of the benchmark
+        int                 threads;     // number of threads
+        unsigned long long  operations;  // number of operations performed by all the threads
+        double              seconds;     // elapsed time
+    };
+
+    // selected(options, name):
+    // Returns true if the benchmark must be run according to the options' filter
+    inline bool selected(const Options& options, const std::string& name)
+    {
+        return name.find(options.filter) != std::string::npos;
+    }
+
+    // report(result):
+    // Prints a result (throughput and time per operation), and records it for writeResults()
+    void report(const Result& result);
+
+    // writeResults(options):
+    // Writes the results reported so far to the options' JSON file, along with the
+    // options of the run, so that the results of two builds can be compared
+    // Caution: throws if the file cannot be written
+    void writeResults(const Options& options);
+
+    // runThreads(name, threads, duration, body):
+    // Runs body() in a loop on the given number of threads, for duration milliseconds,
+    // and returns the total number of invocations of body()
+    template<class Body>
+    Result runThreads(const std::string& name, int threads, int duration, Body body)
+    {
+        // Invocations are counted by batches, so as to keep the stop flag off the hot loop
+        enum { batch = 64 };
+
+        std::atomic<bool> start(false);
+        std::atomic<bool> stop(false);
+        std::atomic<unsigned long long> operations(0);
+        std::vector<std::thread> workers;
+        for (int i = 0; i < threads; ++i)
+        {
+            workers.emplace_back([&]()
+            {
+                unsigned long long count = 0;
+                while (!start.load(std::memory_order_acquire))
+                    std::this_thread::yield();
+                while (!stop.load(std::memory_order_relaxed))
+                {
+                    for (int j = 0; j < batch; ++j)
+                        body();
+                    count += batch;
+                }
+                operations += count;
+            });
+        }
+
+        const auto begin = std::chrono::steady_clock::now();
+        start.store(true, std::memory_order_release);
+        std::this_thread::sleep_for(std::chrono::milliseconds(duration));
+        stop.store(true);
+        for (auto& worker : workers)
+            worker.join();
+        const auto end = std::chrono::steady_clock::now();
+
+        Result result;
+        result.name = name;
+        result.threads = threads;
+        result.operations = operations;
+        result.seconds = std::chrono::duration<double>(end - begin).count();
+        return result;
+    }
+
+} // namespace Bench
+} // namespace ocs
+
+#endif // OCS_BENCH_BENCHMARK_H
@@ -0,0 +1,58 @@
+//
+// CounterBenchmarks.cpp
+// ~~~~~~~~~~~~~~~~~~~~~
+//
+// Benchmarks of the counters store's in-memory counter:
+// - counter/mutex:   the former counter, an integer protected by a mutex
+// - counter/sharded: the lock-free ShardedCounter
+// Both are measured from 1 to maxThreads threads, with increments only (no persistence)
+//
+#include <mutex>
+#include "Benchmark.h"
+#include "ShardedCounter.h"
+
+namespace ocs
+{
+namespace Bench
+{
+
+    namespace
+    {
+        // MutexCounter class:
+        // Reference implementation, as found in CountersStore before the ShardedCounter
+        class MutexCounter
+        {
+        public:
+            unsigned long long increment()
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                return ++value_;
+            }
+
+        private:
+            std::mutex          mutex_;
+            unsigned long long  value_ = 0;
+        };
+    }
+
+    // runCounterBenchmarks(options):
+    // Runs the counter benchmarks selected by the options
+    void runCounterBenchmarks(const Options& options)
+    {
+        for (int threads = 1; threads <= options.maxThreads; threads *= 2)
+        {
+            if (selected(options, "counter/mutex"))
+            {
+                MutexCounter counter;
+                report(runThreads("counter/mutex", threads, options.duration, [&]() { counter.increment(); }));
+            }
+            if (selected(options, "counter/sharded"))
+            {
+                CountersServer::ShardedCounter counter(0, 64);
+                report(runThreads("counter/sharded", threads, options.duration, [&]() { counter.increment(); }));
+            }
+        }
+    }
+
+} // namespace Bench
+} // namespace ocs
@@ -0,0 +1,298 @@
+//
+// DispatcherBenchmarks.cpp
+// ~~~~~~~~~~~~~~~~~~~~~~~~
+//
+// Benchmarks of the request processing, without any socket I/O:
+// - dispatch/text/<get|peek|reserve|get-counter|incr|error>: CountersServerDispatcher::dispatchCommand()
+//                                     for a text command (the reservation being of 64 values,
+//                                     the error being an unknown command)
+// - dispatch/binary/<get|incr-16ops>: same, for a binary datagram of one "GET" operation,
+//                                     or of 16 "INCR" operations
+// - dispatch/coalesce/<none|strict>/<separate|batch>-16: 16 text "GET" commands, dispatched
+//                                     one by one (dispatchCommand()) or as a batch whose
+//                                     increments are coalesced (dispatchBatch()), with the
+//                                     mmap storage; one operation is a batch of 16 requests
+// - dispatch/lookup/<table|chain>-<n>: the lookup of a text command among n commands (4, 16
+//                                     and 64, all of them looked up in turn), by the perfect
+//                                     hash of a CommandTable, or by comparing the command with
+//                                     each name in turn (the former dispatch)
+// - store/<storage>/<durability>:     CountersStore::getCounters(), for each storage backend
+//                                     and each persistence mode, on 1 and maxThreads threads
+// The dispatcher benchmarks use a store without persistence (durability none), so that
+// they measure the decoding, the store's in-memory update and the encoding only.
+// The storage files are created in the work directory, and removed afterwards
+//
+#include <array>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <utility>
+#include "Benchmark.h"
+#include "BinaryProtocol.h"
+#include "CommandTable.h"
+#include "Configuration.h"
+#include "Constants.h"
+#include "CountersServerDispatcher.h"
+#include "CountersStore.h"
+#include "JournalStorage.h"
+#include "Logger.h"
+#include "MappedFileStorage.h"
+#include "NamedCountersStorage.h"
+#include "TextFileStorage.h"
+
+namespace ocs
+{
+namespace Bench
+{
+
+    namespace
+    {
+        // Sink for the replies' sizes, so that the processing is not optimized away
+        volatile std::size_t sink;
+
+        // removeFiles(options):
+        // Removes the storage files of the counters store (all backends) from the work directory
+        void removeFiles(const Options& options)
+        {
+            for (const auto& filename : {
+                CountersServer::TextFileStorage::theFilename_, CountersServer::MappedFileStorage::theFilename_,
+                CountersServer::JournalStorage::theSnapshotFilename_, CountersServer::JournalStorage::theJournalFilename_,
+                CountersServer::NamedCountersStorage::theFilename_ })
+                std::remove((options.workDirectory + "/" + filename).c_str());
+        }
+
+        // binaryRequest(operations, request):
+        // Encodes a request of several operations ("GET" for one, "INCR" otherwise),
+        // returns its size
+        std::size_t binaryRequest(int operations, std::array<char, Constants::defaultBufferSize>& request)
+        {
+            BinaryWriter writer(request.data(), request.size());
+            BinaryHeader header;
+            header.requestId = 42;
+            header.count = operations;
+            writer.writeHeader(header);
+            for (int i = 0; i < operations; ++i)
+            {
+                BinaryOperation operation;
+                operation.code = operations == 1 ? BinaryProtocol::getQueries : BinaryProtocol::incrementCounter;
+                operation.value = operations == 1 ? 0 : 1;
+                operation.name = "requests";
+                operation.nameLength = operations == 1 ? 0 : 8;
+                writer.writeOperation(operation);
+            }
+            return writer.size();
+        }
+
+        // Names of the commands of the lookup benchmarks
+        constexpr const char* theCommandNames[] = {
+            "GET", "PEEK", "INCR", "STATS", "TRACE", "SET", "DEL", "DECR",
+            "APPEND", "EXISTS", "EXPIRE", "TTL", "KEYS", "SCAN", "TYPE", "RENAME",
+            "MGET", "MSET", "HGET", "HSET", "HDEL", "HLEN", "LPUSH", "RPUSH",
+            "LPOP", "RPOP", "LLEN", "LRANGE", "SADD", "SREM", "SCARD", "SMEMBERS",
+            "ZADD", "ZREM", "ZCARD", "ZRANGE", "ZSCORE", "PING", "ECHO", "INFO",
+            "TIME", "SAVE", "FLUSH", "QUIT", "AUTH", "SELECT", "WATCH", "MULTI",
+            "EXEC", "DISCARD", "PUBLISH", "SUBSCRIBE", "GETSET", "SETNX", "INCRBY", "DECRBY",
+            "STRLEN", "GETRANGE", "SETRANGE", "PERSIST", "DUMP", "RESTORE", "MOVE", "SORT" };
+
+        // LookupCommands structure:
+        // Commands of a CommandTable made of the first N names, whose handler is their index
+        template<std::size_t N, class = typename CountersServer::MakeIndices<N>::type>
+        struct LookupCommands;
+
+        template<std::size_t N, std::size_t... I>
+        struct LookupCommands<N, CountersServer::Indices<I...>>
+        {
+            typedef std::size_t Handler;
+            static constexpr CountersServer::CommandEntry<Handler> entries[N] = { { theCommandNames[I], 1, I }... };
+        };
+
+        template<std::size_t N, std::size_t... I>
+        constexpr CountersServer::CommandEntry<std::size_t> LookupCommands<N, CountersServer::Indices<I...>>::entries[N];
+
+        // runLookupBenchmarks(options):
+        // Runs the benchmarks of the lookup of a command among N, by the perfect hash of a
+        // CommandTable, and by a chain of comparisons
+        template<std::size_t N>
+        void runLookupBenchmarks(const Options& options)
+        {
+            static_assert((N & (N - 1)) == 0, "The number of commands must be a power of 2");
+            std::array<boost::string_view, N> names;
+            for (std::size_t i = 0; i < N; ++i)
+                names[i] = theCommandNames[i];
+
+            std::size_t next = 0;
+            const auto table = "dispatch/lookup/table-" + std::to_string(N);
+            if (selected(options, table))
+            {
+                report(runThreads(table, 1, options.duration, [&]()
+                {
+                    sink = CountersServer::CommandTable<LookupCommands<N>>::find(names[next++ & (N - 1)], 1)->handler;
+                }));
+            }
+            const auto chain = "dispatch/lookup/chain-" + std::to_string(N);
+            if (selected(options, chain))
+            {
+                report(runThreads(chain, 1, options.duration, [&]()
+                {
+                    const auto command = names[next++ & (N - 1)];
+                    std::size_t index = 0;
+                    while (index < N && command != theCommandNames[index])
+                        ++index;
+                    sink = index;
+                }));
+            }
+        }
+
+        // runDispatchBenchmarks(options):
+        // Runs the dispatcher benchmarks, with a store without persistence
+        void runDispatchBenchmarks(const Options& options)
+        {
+            std::array<char, Constants::defaultBufferSize> get;
+            std::array<char, Constants::defaultBufferSize> increments;
+            const std::pair<std::string, boost::string_view> requests[] = {
+                { "dispatch/text/get", "GET" },
+                { "dispatch/text/peek", "PEEK" },
+                { "dispatch/text/reserve", "GET 64" },
+                { "dispatch/text/get-counter", "GET requests" },
+                { "dispatch/text/incr", "INCR requests 1" },
+                { "dispatch/text/error", "PUT requests 1" },
+                { "dispatch/binary/get", boost::string_view(get.data(), binaryRequest(1, get)) },
+                { "dispatch/binary/incr-16ops", boost::string_view(increments.data(), binaryRequest(16, increments)) } };
+            bool any = false;
+            for (const auto& request : requests)
+                any = any || selected(options, request.first);
+            if (!any)
+                return;
+
+            removeFiles(options);
+            {
+                CountersServer::Configuration configuration;
+                configuration.workDirectory = options.workDirectory;
+                configuration.durability = CountersServer::Durability::none;
+                configuration.maxCounters = 1024;
+                const auto store = std::make_shared<CountersServer::CountersStore>(configuration);
+                const CountersServer::CountersServerDispatcher dispatcher(configuration, store);
+
+                // The errors are logged (rate-limited): the log is silenced, so as to
+                // measure the error path itself (exception and error reply)
+                Logger::setMinLevel(fatal);
+                std::array<char, Constants::defaultBufferSize> reply;
+                for (const auto& request : requests)
+                {
+                    if (!selected(options, request.first))
+                        continue;
+                    report(runThreads(request.first, 1, options.duration, [&]()
+                    {
+                        sink = dispatcher.dispatchCommand(request.second, reply.data(), reply.size());
+                    }));
+                }
+                Logger::setMinLevel(warning);
+            }
+            removeFiles(options);
+        }
+
+        // runCoalescingBenchmarks(options, durabilityName, durability):
+        // Runs the benchmarks of the coalescing of a batch's increments, for a persistence mode
+        void runCoalescingBenchmarks(const Options& options, const std::string& durabilityName, CountersServer::Durability durability)
+        {
+            enum { batchSize = 16 };
+            const auto name = "dispatch/coalesce/" + durabilityName + "/";
+            if (!selected(options, name + "separate-16") && !selected(options, name + "batch-16"))
+                return;
+
+            removeFiles(options);
+            {
+                CountersServer::Configuration configuration;
+                configuration.workDirectory = options.workDirectory;
+                configuration.durability = durability;
+                configuration.maxCounters = 1024;
+                const auto store = std::make_shared<CountersServer::CountersStore>(configuration);
+                const CountersServer::CountersServerDispatcher dispatcher(configuration, store);
+
+                std::array<std::array<char, Constants::defaultBufferSize>, batchSize> replies;
+                std::array<CountersServer::CountersServerDispatcher::BatchEntry, batchSize> entries;
+                for (std::size_t i = 0; i < entries.size(); ++i)
+                {
+                    entries[i].request = "GET";
+                    entries[i].reply = replies[i].data();
+                    entries[i].capacity = replies[i].size();
+                    entries[i].traceRequest = 0;
+                }
+                if (selected(options, name + "separate-16"))
+                {
+                    report(runThreads(name + "separate-16", 1, options.duration, [&]()
+                    {
+                        for (auto& entry : entries)
+                            sink = dispatcher.dispatchCommand(entry.request, entry.reply, entry.capacity);
+                    }));
+                }
+                if (selected(options, name + "batch-16"))
+                {
+                    report(runThreads(name + "batch-16", 1, options.duration, [&]()
+                    {
+                        dispatcher.dispatchBatch(entries.data(), entries.size());
+                        sink = entries[0].size;
+                    }));
+                }
+            }
+            removeFiles(options);
+        }
+
+        // runStoreBenchmarks(options, storageName, storage, durabilityName, durability):
+        // Runs the benchmarks of getCounters() for a storage backend and a persistence mode
+        void runStoreBenchmarks(const Options& options, const std::string& storageName, CountersServer::Storage storage,
+            const std::string& durabilityName, CountersServer::Durability durability)
+        {
+            const auto name = "store/" + storageName + "/" + durabilityName;
+            if (!selected(options, name))
+                return;
+
+            removeFiles(options);
+            {
+                CountersServer::Configuration configuration;
+                configuration.workDirectory = options.workDirectory;
+                configuration.storage = storage;
+                configuration.durability = durability;
+                configuration.maxCounters = 1024;
+                CountersServer::CountersStore store(configuration);
+                for (const int threads : { 1, options.maxThreads })
+                {
+                    report(runThreads(name, threads, options.duration, [&]() { store.getCounters(); }));
+                    if (options.maxThreads == 1)
+                        break;
+                }
+            }
+            removeFiles(options);
+        }
+    }
+
+    // runDispatcherBenchmarks(options):
+    // Runs the dispatcher and store benchmarks selected by the options
+    void runDispatcherBenchmarks(const Options& options)
+    {
+        runDispatchBenchmarks(options);
+        runLookupBenchmarks<4>(options);
+        runLookupBenchmarks<16>(options);
+        runLookupBenchmarks<64>(options);
+        runCoalescingBenchmarks(options, "none", CountersServer::Durability::none);
+        runCoalescingBenchmarks(options, "strict", CountersServer::Durability::strict);
+
+        const std::pair<std::string, CountersServer::Storage> storages[] = {
+            { "text", CountersServer::Storage::text },
+            { "mmap", CountersServer::Storage::mmap },
+            { "wal", CountersServer::Storage::wal } };
+        const std::pair<std::string, CountersServer::Durability> durabilities[] = {
+            { "none", CountersServer::Durability::none },
+            { "interval", CountersServer::Durability::interval },
+            { "write", CountersServer::Durability::write },
+            { "group", CountersServer::Durability::group },
+            { "strict", CountersServer::Durability::strict } };
+        for (const auto& storage : storages)
+        {
+            for (const auto& durability : durabilities)
+                runStoreBenchmarks(options, storage.first, storage.second, durability.first, durability.second);
+        }
+    }
+
+} // namespace Bench
+} // namespace ocs
@@ -0,0 +1,126 @@
+//
+// LoggerBenchmarks.cpp
+// ~~~~~~~~~~~~~~~~~~~~
+//
+// Benchmarks of the cost of a log line for the logging thread, the standard error being
+// redirected to /dev/null:
+// - logger/disabled:      a line below the minimum level (OCS_LOG)
+// - logger/former:        the former Logger, streaming each argument and ending with std::endl
+// - logger/sync:          a line formatted and written by the logging thread
+// - logger/async:         a line handed to the background thread
+// - logger/rate-limited:  a line of a flooding call site (OCS_LOG_RATE_LIMITED)
+// Each line is made of a text, an integer and a string_view, as the dispatcher's debug lines
+//
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+#include "Benchmark.h"
+#include "Logger.h"
+
+namespace ocs
+{
+namespace Bench
+{
+
+    namespace
+    {
+        // FormerLogger class:
+        // Reference implementation, as found in Logger before the asynchronous mode
+        class FormerLogger
+        {
+        public:
+            FormerLogger(std::ostream& os, const LogLevel level)
+            : os_(os)
+            {
+                os_ << logLevelTexts().at(level) << ": ";
+            }
+
+            ~FormerLogger()
+            {
+                os_ << std::endl;
+            }
+
+            template<class T>
+            friend FormerLogger&& operator<<(FormerLogger&& handler, const T& msg)
+            {
+                handler.os_ << msg;
+                return std::move(handler);
+            }
+
+        private:
+            static const std::unordered_map<int, const std::string>& logLevelTexts()
+            {
+                static const std::unordered_map<int, const std::string> texts =
+                {
+                    {trace, "trace"}, {debug, "debug"}, {info, "info"},
+                    {warning, "warning"}, {error, "error"}, {fatal, "fatal"},
+                };
+                return texts;
+            }
+
+            std::ostream&   os_;
+        };
+
+        // Arguments of the log lines
+        const boost::string_view theCommand("INCR requests 1");
+        const unsigned long long theCount = 1234567890123ULL;
+    }
+
+    // runLoggerBenchmarks(options):
+    // Runs the logger benchmarks selected by the options
+    void runLoggerBenchmarks(const Options& options)
+    {
+        // Redirect the standard error to /dev/null for the duration of the benchmarks
+        std::ofstream null("/dev/null");
+        const auto clogBuffer = std::clog.rdbuf(null.rdbuf());
+        const auto cerrBuffer = std::cerr.rdbuf(null.rdbuf());
+
+        if (selected(options, "logger/disabled"))
+        {
+            report(runThreads("logger/disabled", 1, options.duration, [&]()
+            {
+                OCS_LOG(debug) << "Command " << theCommand << " processed, result= " << theCount;
+            }));
+        }
+        if (selected(options, "logger/former"))
+        {
+            report(runThreads("logger/former", 1, options.duration, [&]()
+            {
+                FormerLogger(std::cerr, error) << "Command " << theCommand << " processed, result= " << theCount;
+            }));
+        }
+        if (selected(options, "logger/sync"))
+        {
+            report(runThreads("logger/sync", 1, options.duration, [&]()
+            {
+                OCS_LOG(error) << "Command " << theCommand << " processed, result= " << theCount;
+            }));
+        }
+        if (selected(options, "logger/async"))
+        {
+            Logger::startAsync();
+            const auto dropped = Logger::droppedLines();
+            auto result = runThreads("logger/async", 1, options.duration, [&]()
+            {
+                OCS_LOG(error) << "Command " << theCommand << " processed, result= " << theCount;
+            });
+            Logger::stopAsync();
+            report(result);
+            std::printf("%-40s %llu lines dropped out of %llu (ring full)\n", "logger/async",
+                Logger::droppedLines() - dropped, result.operations);
+        }
+        if (selected(options, "logger/rate-limited"))
+        {
+            report(runThreads("logger/rate-limited", 1, options.duration, [&]()
+            {
+                OCS_LOG_RATE_LIMITED(error, 10) << "Command " << theCommand << " processed, result= " << theCount;
+            }));
+        }
+
+        std::clog.rdbuf(clogBuffer);
+        std::cerr.rdbuf(cerrBuffer);
+    }
+
+} // namespace Bench
+} // namespace ocs
@@ -0,0 +1,98 @@
+//
+// NamedCounterBenchmarks.cpp
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~
+//
+// Benchmarks of the counters store's named counters, at 1K, 1M and 10M counters:
+// - named/<count>/get:  reads of random counters (GET <name>)
+// - named/<count>/incr: increments of random counters (INCR <name> <n>), without
+//                       persistence (the values are written to the mapped file, never flushed)
+// The counters are created beforehand; the storage files are created in the work
+// directory, and removed afterwards
+//
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "Benchmark.h"
+#include "Configuration.h"
+#include "CountersStore.h"
+#include "MappedFileStorage.h"
+#include "NamedCountersStorage.h"
+
+namespace ocs
+{
+namespace Bench
+{
+
+    namespace
+    {
+        // removeFiles(options):
+        // Removes the storage files of the counters store from the work directory
+        void removeFiles(const Options& options)
+        {
+            std::remove((options.workDirectory + "/" + CountersServer::MappedFileStorage::theFilename_).c_str());
+            std::remove((options.workDirectory + "/" + CountersServer::NamedCountersStorage::theFilename_).c_str());
+        }
+
+        // Random generator (xorshift64): cheap enough not to weigh on the measurements
+        class Random
+        {
+        public:
+            std::size_t next(std::size_t bound)
+            {
+                state_ ^= state_ << 13;
+                state_ ^= state_ >> 7;
+                state_ ^= state_ << 17;
+                return state_ % bound;
+            }
+
+        private:
+            unsigned long long state_ = 0x9E3779B97F4A7C15ULL;
+        };
+
+        // runNamedCounterBenchmarks(options, count):
+        // Runs the benchmarks of a store holding the given number of named counters
+        void runNamedCounterBenchmarks(const Options& options, std::size_t count)
+        {
+            const auto name = "named/" + (count >= 1000000 ? std::to_string(count / 1000000) + "M" : std::to_string(count / 1000) + "K");
+            if (!selected(options, name + "/get") && !selected(options, name + "/incr"))
+                return;
+
+            std::vector<std::string> names;
+            names.reserve(count);
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                char buffer[32];
+                std::snprintf(buffer, sizeof(buffer), "counter-%08zu", i);
+                names.emplace_back(buffer);
+            }
+
+            removeFiles(options);
+            {
+                CountersServer::Configuration configuration;
+                configuration.workDirectory = options.workDirectory;
+                configuration.durability = CountersServer::Durability::none;
+                configuration.maxCounters = count;
+                CountersServer::CountersStore store(configuration);
+                for (const auto& counter : names)
+                    store.incrementCounter(counter, 1);
+
+                Random random;
+                if (selected(options, name + "/get"))
+                    report(runThreads(name + "/get", 1, options.duration, [&]() { store.getCounter(names[random.next(count)]); }));
+                if (selected(options, name + "/incr"))
+                    report(runThreads(name + "/incr", 1, options.duration, [&]() { store.incrementCounter(names[random.next(count)], 1); }));
+            }
+            removeFiles(options);
+        }
+    }
+
+    // runNamedCounterBenchmarks(options):
+    // Runs the named counter benchmarks selected by the options
+    void runNamedCounterBenchmarks(const Options& options)
+    {
+        for (const std::size_t count : { 1000, 1000000, 10000000 })
+            runNamedCounterBenchmarks(options, count);
+    }
+
+} // namespace Bench
+} // namespace ocs
@@ -0,0 +1,158 @@
+//
+// ProtocolBenchmarks.cpp
+// ~~~~~~~~~~~~~~~~~~~~~~
+//
+// Benchmarks of the wire protocols' codecs, without any I/O nor store access:
+// - protocol/<text|binary>/server:  decoding of a "GET" request and encoding of its reply
+// - protocol/<text|binary>/client:  decoding of a "GET" reply
+// - protocol/binary/server-16ops:   same as server, for a datagram of 16 "INCR" operations
+// The text codec is the one of CountersServerDispatcher and CountersClient
+//
+#include <array>
+#include <cstdlib>
+#include <string>
+#include <boost/algorithm/string.hpp>
+#include "Benchmark.h"
+#include "BinaryProtocol.h"
+#include "Constants.h"
+
+namespace ocs
+{
+namespace Bench
+{
+
+    namespace
+    {
+        // Sink for the decoded values, so that the decoding is not optimized away
+        volatile unsigned long long sink;
+
+        // Arbitrary count returned by the replies
+        const unsigned long long theCount = 1234567890123ULL;
+
+        // textServer(request, size):
+        // Reference implementation, as found in CountersServerDispatcher:
+        // reads the command into a string, checks it, formats the reply
+        std::string textServer(const char* request, std::size_t size)
+        {
+            if (size && request[size - 1] == '\n')
+                --size;
+            const std::string command(request, size);
+            if (command != "GET")
+                return "ERROR: Unrecognized command\n";
+            return "OK: " + std::to_string(theCount) + "\n";
+        }
+
+        // textClient(reply):
+        // Reference implementation, as found in CountersClient: decodes the count
+        unsigned long long textClient(const std::string& reply)
+        {
+            if (boost::algorithm::starts_with(reply, "OK:"))
+                return std::strtoull(reply.c_str() + 3, nullptr, 10);
+            return 0;
+        }
+
+        // binaryServer(request, size, reply):
+        // Decodes a request and encodes a reply (one result per operation),
+        // returns the size of the reply
+        std::size_t binaryServer(const char* request, std::size_t size, std::array<char, Constants::defaultBufferSize>& reply)
+        {
+            BinaryReader reader(request, size);
+            BinaryWriter writer(reply.data(), reply.size());
+            BinaryHeader header;
+            if (!reader.readHeader(header))
+                return 0;
+            const auto count = header.count;
+            header.opcode = BinaryProtocol::reply;
+            writer.writeHeader(header);
+            for (std::uint16_t i = 0; i < count; ++i)
+            {
+                BinaryOperation operation;
+                if (!reader.readOperation(operation))
+                    break;
+                BinaryOperation result;
+                result.code = operation.code;
+                result.value = theCount + operation.value;
+                writer.writeOperation(result);
+            }
+            return writer.size();
+        }
+
+        // binaryRequest(operations, request):
+        // Encodes a request of several operations ("GET" for one, "INCR" otherwise),
+        // returns its size
+        std::size_t binaryRequest(int operations, std::array<char, Constants::defaultBufferSize>& request)
+        {
+            BinaryWriter writer(request.data(), request.size());
+            BinaryHeader header;
+            header.requestId = 42;
+            header.count = operations;
+            writer.writeHeader(header);
+            for (int i = 0; i < operations; ++i)
+            {
+                BinaryOperation operation;
+                operation.code = operations == 1 ? BinaryProtocol::getQueries : BinaryProtocol::incrementCounter;
+                operation.value = operations == 1 ? 0 : i;
+                operation.name = "requests";
+                operation.nameLength = operations == 1 ? 0 : 8;
+                writer.writeOperation(operation);
+            }
+            return writer.size();
+        }
+    }
+
+    // runProtocolBenchmarks(options):
+    // Runs the protocol benchmarks selected by the options
+    void runProtocolBenchmarks(const Options& options)
+    {
+        if (selected(options, "protocol/text/server"))
+        {
+            const char request[] = "GET\n";
+            report(runThreads("protocol/text/server", 1, options.duration, [&]()
+            {
+                sink = textServer(request, sizeof(request) - 1).size();
+            }));
+        }
+        if (selected(options, "protocol/binary/server"))
+        {
+            std::array<char, Constants::defaultBufferSize> request;
+            std::array<char, Constants::defaultBufferSize> reply;
+            const auto size = binaryRequest(1, request);
+            report(runThreads("protocol/binary/server", 1, options.duration, [&]()
+            {
+                sink = binaryServer(request.data(), size, reply);
+            }));
+        }
+        if (selected(options, "protocol/text/client"))
+        {
+            const auto reply = textServer("GET", 3);
+            report(runThreads("protocol/text/client", 1, options.duration, [&]() { sink = textClient(reply); }));
+        }
+        if (selected(options, "protocol/binary/client"))
+        {
+            std::array<char, Constants::defaultBufferSize> request;
+            std::array<char, Constants::defaultBufferSize> reply;
+            const auto size = binaryServer(request.data(), binaryRequest(1, request), reply);
+            report(runThreads("protocol/binary/client", 1, options.duration, [&]()
+            {
+                BinaryReader reader(reply.data(), size);
+                BinaryHeader header;
+                BinaryOperation operation;
+                reader.readHeader(header);
+                reader.readOperation(operation);
+                sink = operation.value;
+            }));
+        }
+        if (selected(options, "protocol/binary/server-16ops"))
+        {
+            std::array<char, Constants::defaultBufferSize> request;
+            std::array<char, Constants::defaultBufferSize> reply;
+            const auto size = binaryRequest(16, request);
+            report(runThreads("protocol/binary/server-16ops", 1, options.duration, [&]()
+            {
+                sink = binaryServer(request.data(), size, reply);
+            }));
+        }
+    }
+
+} // namespace Bench
+} // namespace ocs
@@ -0,0 +1,94 @@
+//
+// ReadBenchmarks.cpp
+// ~~~~~~~~~~~~~~~~~~
+//
+// Benchmarks of the reads of the query count, while writers are active:
+// - read/peek: CountersStore::peekCounters() ("PEEK"), lock-free
+// - read/get:  CountersStore::getCounters() ("GET"), the only read before "PEEK", which
+//              increments the count and waits for its persistence
+// The readers are measured from 1 to maxThreads threads, while 2 writer threads keep
+// incrementing the count ("GET"), with the mmap storage and the group durability mode
+// (the server's defaults). The storage files are created in the work directory, and
+// removed afterwards
+//
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Benchmark.h"
+#include "Configuration.h"
+#include "CountersStore.h"
+#include "MappedFileStorage.h"
+#include "NamedCountersStorage.h"
+
+namespace ocs
+{
+namespace Bench
+{
+
+    namespace
+    {
+        // Number of writer threads, active during the measurements
+        enum { writers = 2 };
+
+        // Sink for the values read, so that the reads are not optimized away
+        volatile unsigned long long sink;
+
+        // removeFiles(options):
+        // Removes the storage files of the counters store from the work directory
+        void removeFiles(const Options& options)
+        {
+            std::remove((options.workDirectory + "/" + CountersServer::MappedFileStorage::theFilename_).c_str());
+            std::remove((options.workDirectory + "/" + CountersServer::NamedCountersStorage::theFilename_).c_str());
+        }
+
+        // runReadBenchmark(options, name, read):
+        // Runs a read benchmark, from 1 to maxThreads readers, while the writers are active
+        template<class Read>
+        void runReadBenchmark(const Options& options, const std::string& name, Read read)
+        {
+            if (!selected(options, name))
+                return;
+
+            removeFiles(options);
+            {
+                CountersServer::Configuration configuration;
+                configuration.workDirectory = options.workDirectory;
+                configuration.storage = CountersServer::Storage::mmap;
+                configuration.durability = CountersServer::Durability::group;
+                configuration.maxCounters = 1024;
+                CountersServer::CountersStore store(configuration);
+
+                std::atomic<bool> stop(false);
+                std::vector<std::thread> threads;
+                for (int i = 0; i < writers; ++i)
+                {
+                    threads.emplace_back([&]()
+                    {
+                        while (!stop.load(std::memory_order_relaxed))
+                            store.getCounters();
+                    });
+                }
+
+                for (int readers = 1; readers <= options.maxThreads; readers *= 2)
+                    report(runThreads(name, readers, options.duration, [&]() { sink = read(store); }));
+
+                stop.store(true);
+                for (auto& thread : threads)
+                    thread.join();
+            }
+            removeFiles(options);
+        }
+    }
+
+    // runReadBenchmarks(options):
+    // Runs the read benchmarks selected by the options
+    void runReadBenchmarks(const Options& options)
+    {
+        runReadBenchmark(options, "read/peek", [](CountersServer::CountersStore& store) { return store.peekCounters(); });
+        runReadBenchmark(options, "read/get", [](CountersServer::CountersStore& store) { return store.getCounters(); });
+    }
+
+} // namespace Bench
+} // namespace ocs
@@ -0,0 +1,116 @@
+//
+// StorageBenchmarks.cpp
+// ~~~~~~~~~~~~~~~~~~~~~
+//
+// Benchmarks of the persistent storage backends of the counters store:
+// - storage/<backend>/write:      cost of writing the count (without flushing it)
+// - storage/<backend>/write+sync: cost of writing and flushing the count to the disk
+// - storage/<backend>/open:       cost of opening an existing storage (server startup)
+// - storage/wal/recovery:         cost of replaying a large journal, per record
+// The storage files are created in the work directory, and removed afterwards
+//
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include "Benchmark.h"
+#include "Configuration.h"
+#include "CountersStorage.h"
+#include "JournalStorage.h"
+#include "MappedFileStorage.h"
+#include "TextFileStorage.h"
+
+namespace ocs
+{
+namespace Bench
+{
+
+    namespace
+    {
+        // Number of records of the journal replayed by the recovery benchmark (64 MB)
+        enum { recoveryRecords = 4 * 1024 * 1024 };
+
+        // removeFiles(options, filenames):
+        // Removes the storage files of a backend from the work directory
+        void removeFiles(const Options& options, const std::vector<std::string>& filenames)
+        {
+            for (const auto& filename : filenames)
+                std::remove((options.workDirectory + "/" + filename).c_str());
+        }
+
+        // runStorageBenchmarks(options, name, storage, filenames):
+        // Runs the benchmarks of a storage backend
+        void runStorageBenchmarks(const Options& options, const std::string& name, CountersServer::Storage storage, const std::vector<std::string>& filenames)
+        {
+            CountersServer::Configuration configuration;
+            configuration.storage = storage;
+            removeFiles(options, filenames);
+
+            {
+                auto backend = CountersServer::CountersStorage::create(configuration);
+                auto count = backend->open(options.workDirectory);
+
+                if (selected(options, name + "/write"))
+                    report(runThreads(name + "/write", 1, options.duration, [&]() { backend->write(++count); }));
+
+                if (selected(options, name + "/write+sync"))
+                    report(runThreads(name + "/write+sync", 1, options.duration, [&]() { backend->write(++count); backend->sync(); }));
+            }
+
+            if (selected(options, name + "/open"))
+            {
+                report(runThreads(name + "/open", 1, options.duration, [&]()
+                {
+                    auto backend = CountersServer::CountersStorage::create(configuration);
+                    backend->open(options.workDirectory);
+                }));
+            }
+            removeFiles(options, filenames);
+        }
+
+        // runRecoveryBenchmark(options):
+        // Measures the replay of a journal of recoveryRecords records (a single run,
+        // reported per record)
+        void runRecoveryBenchmark(const Options& options)
+        {
+            const std::vector<std::string> filenames = {
+                CountersServer::JournalStorage::theSnapshotFilename_, CountersServer::JournalStorage::theJournalFilename_ };
+            removeFiles(options, filenames);
+
+            {
+                CountersServer::JournalStorage writer(recoveryRecords + 1);
+                auto count = writer.open(options.workDirectory);
+                for (int i = 0; i < recoveryRecords; ++i)
+                    writer.write(++count);
+            }
+
+            const auto begin = std::chrono::steady_clock::now();
+            {
+                CountersServer::JournalStorage reader(recoveryRecords + 1);
+                reader.open(options.workDirectory);
+            }
+            const auto end = std::chrono::steady_clock::now();
+
+            Result result;
+            result.name = "storage/wal/recovery";
+            result.threads = 1;
+            result.operations = recoveryRecords;
+            result.seconds = std::chrono::duration<double>(end - begin).count();
+            report(result);
+            removeFiles(options, filenames);
+        }
+    }
+
+    // runStorageBenchmarks(options):
+    // Runs the storage benchmarks selected by the options
+    void runStorageBenchmarks(const Options& options)
+    {
+        runStorageBenchmarks(options, "storage/text", CountersServer::Storage::text, { CountersServer::TextFileStorage::theFilename_ });
+        runStorageBenchmarks(options, "storage/mmap", CountersServer::Storage::mmap, { CountersServer::MappedFileStorage::theFilename_ });
+        runStorageBenchmarks(options, "storage/wal", CountersServer::Storage::wal,
+            { CountersServer::JournalStorage::theSnapshotFilename_, CountersServer::JournalStorage::theJournalFilename_ });
+        if (selected(options, "storage/wal/recovery"))
+            runRecoveryBenchmark(options);
+    }
+
+} // namespace Bench
+} // namespace ocs
@@ -0,0 +1,278 @@
+//
+// TransportBenchmarks.cpp
+// ~~~~~~~~~~~~~~~~~~~~~~~
+//
+// Benchmarks of the round trip of a request through a CountersServer, socket I/O included:
+// - transport/<udp|unix>/<unbatched|batch-16>: a client thread sends a text "GET" request
+//                                     and waits for its reply, one request at a time, to a
+//                                     CountersServer listening on the loopback udp port or on
+//                                     a unix domain datagram socket, with unbatched or batched
+//                                     I/O; one operation is a round trip, so that the time per
+//                                     operation is the round-trip latency
+// - transport/tcp/<unbatched|pipeline-16>: the same, on a persistent tcp connection to the
+//                                     CountersServer's TcpServer, with one "GET" line at a
+//                                     time, or 16 lines pipelined in a single write; one
+//                                     operation is the round trip of all the lines
+// - transport/<udp|uring>/burst-16: a client thread sends 16 text "GET" requests at once,
+//                                     then waits for their 16 replies, to a CountersServer
+//                                     (asio backend, batch size 16) or to a UringServer (io_uring
+//                                     backend); one operation is the round trip of the burst
+// - transport/uring/unbatched:        the same as transport/udp/unbatched, on a UringServer;
+//                                     the number of io_uring_enter system calls per request is
+//                                     also printed
+// The server runs on its own thread, with a store without persistence (durability none), so
+// that the difference between the transports is the cost of the udp/ip loopback path.
+// The storage files and the unix socket are created in the work directory, and removed afterwards
+//
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <boost/asio.hpp>
+#include "Benchmark.h"
+#include "Configuration.h"
+#include "Constants.h"
+#include "CountersServer.h"
+#include "CountersServerDispatcher.h"
+#include "CountersStore.h"
+#include "MappedFileStorage.h"
+#include "NamedCountersStorage.h"
+#include "TcpServer.h"
+#include "UringServer.h"
+
+namespace ocs
+{
+namespace Bench
+{
+
+    namespace
+    {
+        using Protocol = CountersServer::CountersServer::Protocol;
+
+        // Name of the unix socket of the server, in the work directory
+        const char theSocketFilename[] = "bench.sock";
+
+        // Sink for the replies' sizes, so that the round trips are not optimized away
+        volatile std::size_t sink;
+
+        // removeFiles(options):
+        // Removes the storage files of the counters store from the work directory
+        void removeFiles(const Options& options)
+        {
+            for (const auto& filename : { CountersServer::MappedFileStorage::theFilename_, CountersServer::NamedCountersStorage::theFilename_ })
+                std::remove((options.workDirectory + "/" + filename).c_str());
+        }
+
+        // loopback(endpoint):
+        // Returns the loopback endpoint of a server's udp socket (bound to all the interfaces),
+        // or the endpoint itself for a unix domain socket
+        Protocol::endpoint loopback(const Protocol::endpoint& endpoint)
+        {
+            if (endpoint.protocol().family() != AF_INET6)
+                return endpoint;
+            boost::asio::ip::udp::endpoint local;
+            std::memcpy(local.data(), endpoint.data(), endpoint.size());
+            return Protocol::endpoint(boost::asio::ip::udp::endpoint(boost::asio::ip::address_v6::loopback(), local.port()));
+        }
+
+        // runRoundTripBenchmark(options, transport, batchSize):
+        // Runs the round-trip benchmark of a transport ("udp" or "unix") and a batch size
+        void runRoundTripBenchmark(const Options& options, const std::string& transport, int batchSize)
+        {
+            const auto name = "transport/" + transport + "/" + (batchSize > 1 ? "batch-" + std::to_string(batchSize) : std::string("unbatched"));
+            if (!selected(options, name))
+                return;
+
+            const auto path = options.workDirectory + "/" + theSocketFilename;
+            removeFiles(options);
+            {
+                CountersServer::Configuration configuration;
+                configuration.workDirectory = options.workDirectory;
+                configuration.durability = CountersServer::Durability::none;
+                configuration.maxCounters = 1024;
+                configuration.batchSize = batchSize;
+                const auto store = std::make_shared<CountersServer::CountersStore>(configuration);
+                const auto dispatcher = std::make_shared<CountersServer::CountersServerDispatcher>(configuration, store);
+
+                // The server's socket is bound to an ephemeral port, or to the unix socket
+                boost::asio::io_service serverContext;
+                CountersServer::CountersServer server(configuration, serverContext, dispatcher,
+                    transport == "udp" ? CountersServer::CountersServer::udp_endpoint(0) : CountersServer::CountersServer::unix_endpoint(path));
+                std::thread serverThread([&serverContext]() { serverContext.run(); });
+
+                // The client's socket is blocking; a unix one is bound to an address of its own
+                boost::asio::io_service clientContext;
+                Protocol::socket client(clientContext);
+                const auto target = loopback(server.local_endpoint());
+                client.open(target.protocol());
+                if (transport == "unix")
+                    client.bind(Protocol::endpoint(boost::asio::local::datagram_protocol::endpoint()));
+                client.connect(target);
+
+                static const char request[] = "GET";
+                std::array<char, Constants::defaultBufferSize> reply;
+                report(runThreads(name, 1, options.duration, [&]()
+                {
+                    client.send(boost::asio::buffer(request, sizeof(request) - 1));
+                    sink = client.receive(boost::asio::buffer(reply));
+                }));
+
+                serverContext.stop();
+                serverThread.join();
+            }
+            removeFiles(options);
+        }
+
+        // runTcpBenchmark(options, pipeline):
+        // Runs the round-trip benchmark of the tcp transport, with a number of pipelined requests
+        void runTcpBenchmark(const Options& options, int pipeline)
+        {
+            const auto name = "transport/tcp/" + (pipeline > 1 ? "pipeline-" + std::to_string(pipeline) : std::string("unbatched"));
+            if (!selected(options, name))
+                return;
+
+            removeFiles(options);
+            {
+                CountersServer::Configuration configuration;
+                configuration.workDirectory = options.workDirectory;
+                configuration.durability = CountersServer::Durability::none;
+                configuration.maxCounters = 1024;
+                const auto store = std::make_shared<CountersServer::CountersStore>(configuration);
+                const auto dispatcher = std::make_shared<CountersServer::CountersServerDispatcher>(configuration, store);
+
+                // The server's acceptor is bound to an ephemeral port (tcpPort 0)
+                boost::asio::io_service serverContext;
+                CountersServer::TcpServer server(configuration, serverContext, dispatcher);
+                std::thread serverThread([&serverContext]() { serverContext.run(); });
+
+                // The client's connection is blocking, without Nagle's delay
+                boost::asio::io_service clientContext;
+                boost::asio::ip::tcp::socket client(clientContext);
+                client.connect(boost::asio::ip::tcp::endpoint(boost::asio::ip::address_v6::loopback(), server.local_endpoint().port()));
+                client.set_option(boost::asio::ip::tcp::no_delay(true));
+
+                // Each reply is a line: the round trip completes on the pipeline-th '\n'
+                std::string requests;
+                for (int i = 0; i < pipeline; ++i)
+                    requests += "GET\n";
+                std::array<char, Constants::defaultBufferSize> reply;
+                report(runThreads(name, 1, options.duration, [&]()
+                {
+                    boost::asio::write(client, boost::asio::buffer(requests));
+                    int lines = 0;
+                    while (lines < pipeline)
+                    {
+                        const auto size = client.read_some(boost::asio::buffer(reply));
+                        lines += static_cast<int>(std::count(reply.data(), reply.data() + size, '\n'));
+                        sink = size;
+                    }
+                }));
+
+                client.close();
+                serverContext.stop();
+                serverThread.join();
+            }
+            removeFiles(options);
+        }
+
+        // runBurstBenchmark(options, backend, burst):
+        // Runs the round-trip benchmark of the udp transport on an I/O backend ("udp" for
+        // asio, or "uring"), with bursts of requests; the uring benchmark is skipped if the
+        // kernel does not support the backend
+        void runBurstBenchmark(const Options& options, const std::string& backend, int burst)
+        {
+            const auto name = "transport/" + backend + "/" + (burst > 1 ? "burst-" + std::to_string(burst) : std::string("unbatched"));
+            if (!selected(options, name))
+                return;
+            std::string reason;
+            if (backend == "uring" && !CountersServer::UringServer::supported(reason))
+            {
+                std::printf("%-40s skipped: io_uring is not available (%s)\n", name.c_str(), reason.c_str());
+                return;
+            }
+
+            removeFiles(options);
+            {
+                CountersServer::Configuration configuration;
+                configuration.workDirectory = options.workDirectory;
+                configuration.durability = CountersServer::Durability::none;
+                configuration.maxCounters = 1024;
+                configuration.batchSize = burst;
+                const auto store = std::make_shared<CountersServer::CountersStore>(configuration);
+                const auto dispatcher = std::make_shared<CountersServer::CountersServerDispatcher>(configuration, store);
+
+                // The server's socket is bound to an ephemeral port, and served by the
+                // backend's event loop
+                boost::asio::io_service serverContext;
+                std::unique_ptr<CountersServer::CountersServer> server;
+                std::unique_ptr<CountersServer::UringServer> uringServer;
+                std::thread serverThread;
+                Protocol::endpoint endpoint;
+                if (backend == "uring")
+                {
+                    uringServer.reset(new CountersServer::UringServer(configuration, serverContext, dispatcher, CountersServer::CountersServer::udp_endpoint(0)));
+                    endpoint = uringServer->local_endpoint();
+                    serverThread = std::thread([&uringServer]() { uringServer->run(); });
+                }
+                else
+                {
+                    server.reset(new CountersServer::CountersServer(configuration, serverContext, dispatcher, CountersServer::CountersServer::udp_endpoint(0)));
+                    endpoint = server->local_endpoint();
+                    serverThread = std::thread([&serverContext]() { serverContext.run(); });
+                }
+
+                // The client's socket is blocking
+                boost::asio::io_service clientContext;
+                Protocol::socket client(clientContext);
+                const auto target = loopback(endpoint);
+                client.open(target.protocol());
+                client.connect(target);
+
+                static const char request[] = "GET";
+                std::array<char, Constants::defaultBufferSize> reply;
+                report(runThreads(name, 1, options.duration, [&]()
+                {
+                    for (int i = 0; i < burst; ++i)
+                        client.send(boost::asio::buffer(request, sizeof(request) - 1));
+                    for (int i = 0; i < burst; ++i)
+                        sink = client.receive(boost::asio::buffer(reply));
+                }));
+
+                if (uringServer)
+                {
+                    uringServer->stop();
+                    serverThread.join();
+                    std::printf("%-40s %14.3f system calls/request\n", name.c_str(),
+                        uringServer->requests() ? static_cast<double>(uringServer->enters()) / uringServer->requests() : 0.0);
+                }
+                else
+                {
+                    serverContext.stop();
+                    serverThread.join();
+                }
+            }
+            removeFiles(options);
+        }
+    }
+
+    // runTransportBenchmarks(options):
+    // Runs all the transport benchmarks
+    void runTransportBenchmarks(const Options& options)
+    {
+        for (const auto& transport : { "udp", "unix" })
+        {
+            for (const int batchSize : { 1, 16 })
+                runRoundTripBenchmark(options, transport, batchSize);
+        }
+        for (const int pipeline : { 1, 16 })
+            runTcpBenchmark(options, pipeline);
+        runBurstBenchmark(options, "udp", 16);
+        for (const int burst : { 1, 16 })
+            runBurstBenchmark(options, "uring", burst);
+    }
+
+} // namespace Bench
+} // namespace ocs
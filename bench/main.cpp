@@ -0,0 +1,115 @@
+//
+// main.cpp
+// ~~~~~~~~~~
+//
+// main for the micro-benchmarks of the server components
+//
+#include <iostream>
+#include <string>
+#include <boost/program_options.hpp>
+#include "Benchmark.h"
+#include "Logger.h"
+
+namespace ocs
+{
+namespace Bench
+{
+
+    // Benchmark suites (see the *Benchmarks.cpp files)
+    void runCounterBenchmarks(const Options& options);
+    void runStorageBenchmarks(const Options& options);
+    void runNamedCounterBenchmarks(const Options& options);
+    void runProtocolBenchmarks(const Options& options);
+    void runLoggerBenchmarks(const Options& options);
+    void runDispatcherBenchmarks(const Options& options);
+    void runReadBenchmarks(const Options& options);
+    void runTransportBenchmarks(const Options& options);
+    bool runAllocationChecks(const Options& options);
+
+    // Create an options container:
+    // - Options are set from the command line options by parse_options()
+    // - The structure is then passed to all benchmark suites
+    static Options options;
+
+    // parse_options(argc, argv):
+    // - Parses the command line options and stores them into the static Options object (options)
+    // - If the options include '--help', prints help and returns +1
+    // - Returns 0 otherwise
+    int parse_options(int argc, char *argv[])
+    {
+        // A namespace alias is set for brievety
+        namespace po = boost::program_options;
+
+        // Define the supported options
+        po::options_description desc("Allowed options");
+        desc.add_options()
+            ("help", "produce this help message")
+            ("filter", po::value<>(&options.filter),
+                "only run the benchmarks whose name contains this text (default: all)")
+            ("duration", po::value<>(&options.duration),
+                "set the duration of each measurement, in milliseconds (default: 500)")
+            ("max-threads", po::value<>(&options.maxThreads),
+                "set the maximum number of threads of the multi-threaded benchmarks (default: 64)")
+            ("work-directory", po::value<>(&options.workDirectory),
+                "set the work-directory for the files created by the benchmarks (default: current directory)")
+            ("json", po::value<>(&options.json),
+                "also write the results to this file, as JSON (default: none)");
+
+        // Parse the command line options, which are stored directly into the Options object
+        po::variables_map vm;
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+
+        // If the options include '--help', prints help and returns +1 to the caller
+        if (vm.count("help"))
+        {
+            std::cout << "Usage: bench [options]\n";
+            std::cout << desc << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    // execute(argc, argv):
+    // Benchmarks' main code, invoked directly from main()
+    int execute(int argc, char *argv[])
+    {
+        // Parse command line options
+        // If the benchmarks were launched with the option '--help', perform a clean exit to the shell
+        if (parse_options(argc, argv) == 1)
+            return 0;
+
+        try
+        {
+            // Only the benchmarks' results are printed
+            Logger::setMinLevel(warning);
+
+            runCounterBenchmarks(options);
+            runStorageBenchmarks(options);
+            runNamedCounterBenchmarks(options);
+            runProtocolBenchmarks(options);
+            runLoggerBenchmarks(options);
+            runDispatcherBenchmarks(options);
+            runReadBenchmarks(options);
+            runTransportBenchmarks(options);
+            const auto passed = runAllocationChecks(options);
+            if (!options.json.empty())
+                writeResults(options);
+            return passed ? 0 : 1;
+        }
+        catch (std::exception& e)
+        {
+            std::cerr << "fatal: " << e.what() << std::endl;
+            return -1;
+        }
+    }
+
+} // namespace Bench
+} // namespace ocs
+
+// All the code for main() is moved to ocs::Bench::execute(),
+// so as to be inside the benchmarks' namespace scope
+int main(int argc, char *argv[])
+{
+    return ocs::Bench::execute(argc, argv);
+}
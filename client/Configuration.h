@@ -9,6 +9,7 @@
 //
 
 #include <string>
+#include <vector>
 #include "Constants.h"
 
 namespace ocs
@@ -27,8 +28,55 @@ namespace CountersClient
         // port number or service name, "12345" by default
         std::string service = std::to_string(Constants::defaultPort);
 
+        // path of the server's unix domain datagram socket, used instead of the hostname
+        // and the service when set (none by default)
+        std::string unixSocket;
+
         // minimum log level (info by default)
         int minLogLevel = 0;
+
+        // use the binary protocol instead of the text protocol (disabled by default)
+        // Only the binary protocol carries request ids, so that the text protocol
+        // allows a single request in flight
+        bool binary = false;
+
+        // read the query count with "PEEK" on each poll, without incrementing it (disabled by default)
+        bool peek = false;
+
+        // named counters read on each poll, besides the query count (none by default)
+        std::vector<std::string> counters;
+
+        // delay beyond which a request without reply is retried, or lost, in milliseconds (1000 by default)
+        int timeout = 1000;
+
+        // number of attempts of a request without reply, the first one included (3 by default)
+        int attempts = 3;
+
+        // factor applied to the timeout on each retry (2 by default)
+        double retryBackoff = 2.0;
+
+        // maximum number of requests in flight with the binary protocol, the others being queued (256 by default)
+        int maxInFlight = 256;
+
+        // number of values reserved at once for the local sequence cache, 0 to request
+        // each value from the server (0 by default)
+        unsigned long long blockSize = 0;
+
+        // run the load generator instead of polling the server (disabled by default)
+        bool bench = false;
+
+        // load generator: pipeline the requests on a single tcp connection to the service's
+        // port, instead of sending datagrams (disabled by default)
+        bool tcp = false;
+
+        // load generator: number of requests sent per second, on an open-loop schedule (10000 by default)
+        int rate = 10000;
+
+        // load generator: maximum number of requests in flight, each one on its own socket (64 by default)
+        int concurrency = 64;
+
+        // load generator: duration of the run, in seconds (10 by default)
+        int duration = 10;
     };
 
 } // namespace CountersClient
@@ -3,10 +3,9 @@
 // ~~~~~~~~~~~~~~~~~~
 //
 // Source for the CountersClient class:
-// - opens an udp-v6 socket
-// - provides an API for:
-//      sending a request to a counters server
-//      receiving and displaying the server's reply
+// - opens an udp-v6 socket, or a unix domain datagram socket
+// - provides an asynchronous API for sending requests to a counters server
+// - matches the replies by request id, expires and retries the requests
 //
 // This code is derived from the Boost tutorial here:
 // https://www.boost.org/doc/libs/1_67_0/doc/html/boost_asio/tutorial/tutdaytime4/src.html
@@ -15,9 +14,10 @@
 #include <array>
 #include <cstdlib>
 #include <iostream>
+#include <stdexcept>
 #include <boost/algorithm/string.hpp>
 #include <boost/asio.hpp>
-#include "Constants.h"
+#include "BinaryProtocol.h"
 #include "Logger.h"
 
 namespace ocs
@@ -28,83 +28,384 @@ namespace CountersClient
     using boost::asio::ip::udp;
 
     // Ctor:
-    // Implements the asio's server startup logic
+    // Implements the asio's client startup logic, and starts receiving replies
     CountersClient::CountersClient(const Configuration& configuration, boost::asio::io_service& io_context)
      : configuration_(configuration)
      , io_context_(io_context)
      , socket_(io_context_)
      , receiver_endpoint_()
+     , sender_endpoint_()
+     , recv_buffer_()
+     , requestId_(0)
+     , textRequestId_(0)
+     , socketGeneration_(0)
+     , inFlight_(0)
+     , timer_(io_context_)
+     , timerExpiry_()
+     , timerArmed_(false)
     {
-        // Open a socket
-        socket_.open(udp::v6());
+        // Resolve the target to an endpoint, and open a socket of its protocol
+        receiver_endpoint_ = resolve(configuration_, io_context_);
+        openSocket(socket_, receiver_endpoint_);
 
-        // Resolve the target hostname/service to an endpoint
-        udp::resolver resolver(io_context_);
-        udp::resolver::query query(udp::v6(), configuration_.hostname, configuration_.service);
-        receiver_endpoint_ = *resolver.resolve(query);
-        Logger(debug) << "Endpoint resolved to: " << receiver_endpoint_;
+        startReceive();
     }
 
-    // getCounters():
-    // - sends a request to the target server
-    // - receives the server's reply (message)
-    // - decode the reply (message) into a query count
-    // - display the count to the console (via the logger)
-    // - encapsulate the whole workflow in a try-block so that exceptions should not bubble-up to the main polling loop
-    void CountersClient::getCounters()
+    // resolve(configuration, io_context):
+    // Returns the server's endpoint: its unix domain socket if configured, or else
+    // its hostname and service resolved to a udp-v6 endpoint
+    // Caution: throws if the hostname or the service cannot be resolved
+    CountersClient::Protocol::endpoint CountersClient::resolve(const Configuration& configuration, boost::asio::io_service& io_context)
     {
-        try
+        if (!configuration.unixSocket.empty())
         {
-            Logger(debug) << "Sending a GET command to the server";
-            sendCommand();
-            const auto reply = receiveReply();
-            const auto count = decodeCount(reply);
-            Logger(info) << "Counter was successfully received, new count is: " << count;
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+            OCS_LOG(debug) << "Endpoint is the unix socket: " << configuration.unixSocket;
+            return Protocol::endpoint(boost::asio::local::datagram_protocol::endpoint(configuration.unixSocket));
+#else
+            throw std::logic_error("Unix domain sockets are not supported on this platform");
+#endif
         }
-        catch (const std::exception& e)
+
+        udp::resolver resolver(io_context);
+        udp::resolver::query query(udp::v6(), configuration.hostname, configuration.service);
+        const udp::endpoint endpoint = *resolver.resolve(query);
+        OCS_LOG(debug) << "Endpoint resolved to: " << endpoint;
+        return Protocol::endpoint(endpoint);
+    }
+
+    // openSocket(socket, server):
+    // Opens a socket of the server's protocol; a unix domain socket is bound to an
+    // address of its own (autobind: an empty path binds it to a unique abstract address),
+    // without which the server could not reply
+    void CountersClient::openSocket(Protocol::socket& socket, const Protocol::endpoint& server)
+    {
+        socket.open(server.protocol());
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+        if (server.protocol().family() == AF_UNIX)
+            socket.bind(Protocol::endpoint(boost::asio::local::datagram_protocol::endpoint()));
+#endif
+    }
+
+    // asyncGetCounters(handler):
+    // Sends a "GET" request: increments and returns the server's query count
+    void CountersClient::asyncGetCounters(Handler handler)
+    {
+        submit(BinaryProtocol::getQueries, std::string(), 0, std::move(handler));
+    }
+
+    // asyncPeekCounters(handler):
+    // Sends a "PEEK" request: returns the server's query count, without incrementing it
+    void CountersClient::asyncPeekCounters(Handler handler)
+    {
+        submit(BinaryProtocol::peekQueries, std::string(), 0, std::move(handler));
+    }
+
+    // asyncReserveCounters(count, handler):
+    // Sends a "GET <count>" request: advances the server's query count by count at once,
+    // returns the first value of the reserved range
+    void CountersClient::asyncReserveCounters(unsigned long long count, Handler handler)
+    {
+        submit(BinaryProtocol::reserveQueries, std::string(), count, std::move(handler));
+    }
+
+    // asyncGetCounter(name, handler):
+    // Sends a "GET <name>" request: returns a named counter
+    void CountersClient::asyncGetCounter(const std::string& name, Handler handler)
+    {
+        submit(BinaryProtocol::getCounter, name, 0, std::move(handler));
+    }
+
+    // asyncIncrementCounter(name, value, handler):
+    // Sends an "INCR <name> <value>" request: adds the value to a named counter, returns it
+    // The request is never retried (see submit())
+    void CountersClient::asyncIncrementCounter(const std::string& name, unsigned long long value, Handler handler)
+    {
+        submit(BinaryProtocol::incrementCounter, name, value, std::move(handler));
+    }
+
+    // submit(code, name, value, handler):
+    // Encodes a request (text or binary), then sends it or queues it
+    // The requests are retried according to the configured policy, apart from the
+    // increments of the named counters: the reply of an increment may be lost after the
+    // increment was applied, so that a retry could apply it twice; the requests on the
+    // query count may be applied twice, the values being unique rather than dense
+    void CountersClient::submit(std::uint8_t code, const std::string& name, unsigned long long value, Handler handler)
+    {
+        // The name is checked by the server, only its size matters to the encoding
+        if (name.size() > Constants::maxCounterNameSize)
         {
-            Logger(error) << e.what();
+            Result result;
+            result.status = Status::failed;
+            result.error = "Invalid counter name (too long): '" + name + "'";
+            handler(result);
+            return;
         }
+
+        const auto requestId = ++requestId_;
+        Request request;
+        request.handler = std::move(handler);
+        request.attempt = 0;
+        request.attempts = code == BinaryProtocol::incrementCounter ? 1 : configuration_.attempts;
+        if (configuration_.binary)
+        {
+            std::array<char, BinaryProtocol::headerSize + BinaryProtocol::operationSize + Constants::maxCounterNameSize> datagram;
+            BinaryWriter writer(datagram.data(), datagram.size());
+            BinaryHeader header;
+            header.requestId = requestId;
+            header.count = 1;
+            BinaryOperation operation;
+            operation.code = code;
+            operation.value = value;
+            operation.name = name.data();
+            operation.nameLength = static_cast<std::uint8_t>(name.size());
+            writer.writeHeader(header);
+            writer.writeOperation(operation);
+            request.datagram.assign(datagram.data(), writer.size());
+        }
+        else if (code == BinaryProtocol::getQueries)
+            request.datagram = "GET";
+        else if (code == BinaryProtocol::peekQueries)
+            request.datagram = "PEEK";
+        else if (code == BinaryProtocol::reserveQueries)
+            request.datagram = "GET " + std::to_string(value);
+        else if (code == BinaryProtocol::getCounter)
+            request.datagram = "GET " + name;
+        else
+            request.datagram = "INCR " + name + " " + std::to_string(value);
+
+        requests_.emplace(requestId, std::move(request));
+        queue_.push_back(requestId);
+        sendQueued();
     }
 
-    // sendCommand():
-    // Sends a "GET" command to the target server
-    void CountersClient::sendCommand()
+    // sendQueued():
+    // Sends the queued requests, as long as the number of requests in flight permits
+    // (a single one with the text protocol, whose replies carry no request id)
+    void CountersClient::sendQueued()
     {
-        const std::string command = "GET";
-        socket_.send_to(boost::asio::buffer(command), receiver_endpoint_);
+        const std::size_t maxInFlight = configuration_.binary ? configuration_.maxInFlight : 1;
+        while (!queue_.empty() && inFlight_ < maxInFlight)
+        {
+            const auto requestId = queue_.front();
+            queue_.pop_front();
+            ++inFlight_;
+            if (!configuration_.binary)
+                textRequestId_ = requestId;
+            send(requestId, requests_.at(requestId));
+        }
     }
 
-    // receiveReply():
-    // Receives a reply to a command from the target server
-    std::string CountersClient::receiveReply()
+    // send(requestId, request):
+    // Sends (or re-sends) a request, and schedules its deadline
+    // The timeout of each retry is the former one times the backoff factor
+    void CountersClient::send(std::uint32_t requestId, Request& request)
     {
-        std::array<char, Constants::defaultBufferSize> recv_buffer;
-        udp::endpoint sender_endpoint;
-        size_t len = socket_.receive_from(boost::asio::buffer(recv_buffer), sender_endpoint);
-        return std::string(recv_buffer.begin(), len);
+        auto timeout = std::chrono::duration<double, std::milli>(configuration_.timeout);
+        for (int i = 0; i < request.attempt; ++i)
+            timeout *= configuration_.retryBackoff;
+        ++request.attempt;
+
+        OCS_LOG(debug) << "Sending request " << requestId << " (attempt " << request.attempt << ")";
+        boost::system::error_code ec;
+        socket_.send_to(boost::asio::buffer(request.datagram), receiver_endpoint_, 0, ec);
+        if (ec)
+            OCS_LOG_RATE_LIMITED(warning, Constants::maxErrorLinesPerSecond) << "Could not send a request: " << ec.message();
+
+        Deadline deadline;
+        deadline.when = Clock::now() + std::chrono::duration_cast<Clock::duration>(timeout);
+        deadline.requestId = requestId;
+        deadline.attempt = request.attempt;
+        deadlines_.push(deadline);
+        armTimer();
     }
 
-    // decodeCount():
-    // - decodes a "GET" reply message into a query count
-    // - throws if the reply is an error message or cannot be read
-    unsigned long long CountersClient::decodeCount(const std::string& reply)
+    // complete(requestId, result):
+    // Removes a request and invokes its handler, then sends the queued requests
+    // With the text protocol, whose replies carry no id, the socket of a request sent more
+    // than once, or timed out, is replaced: a late reply to one of its attempts could
+    // otherwise be taken for the reply to the next request
+    void CountersClient::complete(std::uint32_t requestId, const Result& result)
     {
-        if (boost::algorithm::starts_with(reply , "OK:"))
+        const auto it = requests_.find(requestId);
+        if (it == requests_.end() || it->second.attempt == 0)
+            return;     // unknown, or not sent yet
+        const auto handler = std::move(it->second.handler);
+        const auto stray = it->second.attempt > 1 || result.status == Status::timedOut;
+        requests_.erase(it);
+        --inFlight_;
+        if (requestId == textRequestId_)
         {
-            return std::strtoull(reply.c_str() + 3, nullptr, 10);
+            textRequestId_ = 0;
+            if (stray)
+                replaceSocket();
         }
-        else if (boost::algorithm::starts_with(reply , "ERROR:"))
+        handler(result);
+        sendQueued();
+    }
+
+    // replaceSocket():
+    // Closes the socket, dropping the replies not received yet, and opens a new one
+    // (its receive loop is restarted, the former one being aborted)
+    void CountersClient::replaceSocket()
+    {
+        socket_.close();
+        openSocket(socket_, receiver_endpoint_);
+        ++socketGeneration_;
+        startReceive();
+    }
+
+    // startReceive():
+    // Waits for the next reply
+    void CountersClient::startReceive()
+    {
+        // A reception completed before the socket was replaced, but not handled yet, is
+        // dropped along with the former socket
+        const auto generation = socketGeneration_;
+        socket_.async_receive_from(boost::asio::buffer(recv_buffer_), sender_endpoint_,
+            [this, generation] (const boost::system::error_code& ec, std::size_t size)
+            {
+                if (generation == socketGeneration_)
+                    handleReceive(ec, size);
+            });
+    }
+
+    // handleReceive(ec, size):
+    // Decodes a reply and completes the matching request, if any
+    // (late replies, of requests already completed, are ignored)
+    void CountersClient::handleReceive(const boost::system::error_code& ec, std::size_t size)
+    {
+        if (ec == boost::asio::error::operation_aborted)
+            return;     // the socket was closed (and reopened, with its own receive loop)
+        if (ec)
+        {   // e.g. connection refused: the server is not listening, the request will time out
+            OCS_LOG_RATE_LIMITED(warning, Constants::maxErrorLinesPerSecond) << "Could not receive a reply: " << ec.message();
+            startReceive();
+            return;
+        }
+
+        Result result;
+        std::uint32_t requestId;
+        if (configuration_.binary)
+        {
+            BinaryReader reader(recv_buffer_.data(), size);
+            BinaryHeader header;
+            BinaryOperation operation;
+            // A reply refused as a whole (throttled, or rejected) holds no operation: the
+            // request is failed at once, as a retry would not fare better
+            const auto refused = BinaryProtocol::throttled | BinaryProtocol::rejected;
+            if (!reader.readHeader(header) || header.opcode != BinaryProtocol::reply
+                || (!(header.flags & refused) && (header.count != 1 || !reader.readOperation(operation))))
+            {
+                OCS_LOG_RATE_LIMITED(error, Constants::maxErrorLinesPerSecond) << "Could not parse the server's response (invalid, corrupt or unexpected)";
+                startReceive();
+                return;
+            }
+            requestId = header.requestId;
+            if (header.flags & BinaryProtocol::throttled)
+            {
+                result.status = Status::failed;
+                result.error = "The server responded with an error message: throttled";
+            }
+            else if (header.flags & BinaryProtocol::rejected)
+            {
+                result.status = Status::failed;
+                result.error = "The server rejected the request (bad version or opcode)";
+            }
+            else
+                decodeBinary(operation.status, operation.value, result);
+        }
+        else
+        {
+            requestId = textRequestId_;
+            decodeText(std::string(recv_buffer_.data(), size), result);
+        }
+
+        startReceive();
+        complete(requestId, result);
+    }
+
+    // armTimer():
+    // Arms the timer at the earliest deadline, unless it is already armed at least as early
+    void CountersClient::armTimer()
+    {
+        if (deadlines_.empty())
+            return;
+        const auto when = deadlines_.top().when;
+        if (timerArmed_ && timerExpiry_ <= when)
+            return;
+        timerArmed_ = true;
+        timerExpiry_ = when;
+        timer_.expires_at(when);
+        timer_.async_wait([this] (const boost::system::error_code& ec) { handleTimer(ec); });
+    }
+
+    // handleTimer(ec):
+    // Retries the requests whose deadline expired, or fails them after their last attempt
+    void CountersClient::handleTimer(const boost::system::error_code& ec)
+    {
+        if (ec == boost::asio::error::operation_aborted)
+            return;     // re-armed earlier in the meantime
+        timerArmed_ = false;
+
+        const auto now = Clock::now();
+        while (!deadlines_.empty() && deadlines_.top().when <= now)
+        {
+            const auto deadline = deadlines_.top();
+            deadlines_.pop();
+            const auto it = requests_.find(deadline.requestId);
+            if (it == requests_.end() || it->second.attempt != deadline.attempt)
+                continue;   // stale: completed, or retried since
+
+            if (it->second.attempt < it->second.attempts)
+            {
+                OCS_LOG(debug) << "Request " << deadline.requestId << " timed out, retrying";
+                send(deadline.requestId, it->second);
+                continue;
+            }
+
+            Result result;
+            result.status = Status::timedOut;
+            result.error = "No reply from the server after " + std::to_string(deadline.attempt) + " attempt(s)";
+            complete(deadline.requestId, result);
+        }
+        armTimer();
+    }
+
+    // decodeText(reply, result):
+    // Decodes the result of a text reply ("OK: <value>" or "ERROR: <message>")
+    void CountersClient::decodeText(const std::string& reply, Result& result)
+    {
+        if (boost::algorithm::starts_with(reply, "OK:"))
+        {
+            result.status = Status::ok;
+            result.value = std::strtoull(reply.c_str() + 3, nullptr, 10);
+        }
+        else if (boost::algorithm::starts_with(reply, "ERROR:"))
+        {
+            result.status = Status::failed;
+            result.error = "The server responded with an error message: " + boost::algorithm::trim_copy(reply.substr(6));
+        }
+        else
+        {
+            result.status = Status::failed;
+            result.error = "Could not parse the server's response (invalid or corrupt)";
+        }
+    }
+
+    // decodeBinary(status, value, result):
+    // Decodes the result of a binary reply's operation
+    void CountersClient::decodeBinary(std::uint8_t status, unsigned long long value, Result& result)
+    {
+        if (status == BinaryProtocol::ok)
         {
-            std::string msg = "The server responded with an error message: " + reply.substr(6);
-            Logger(error) << msg;
-            throw std::logic_error(msg);
+            result.status = Status::ok;
+            result.value = value;
         }
-        else 
+        else
         {
-            std::string msg = "Could not parse the server's response (invalid or corrupt)";
-            Logger(error) << msg;
-            throw std::logic_error(msg);
+            result.status = Status::failed;
+            result.error = "The server responded with an error status: " + std::to_string(status);
         }
     }
 
@@ -5,59 +5,201 @@
 // ~~~~~~~~~~~~~~~~~
 //
 // Header for the CountersClient class:
-// - opens an udp-v6 socket
-// - provides an API for:
-//      sending a request to a counters server
-//      receiving and displaying the server's reply
+// - opens an udp-v6 socket, or a unix domain datagram socket for a co-located server
+// - provides an asynchronous API for sending requests to a counters server, the
+//   completion handlers being invoked from the io_service's thread when the replies
+//   are received, or when the requests fail
+// - keeps many requests in flight with the binary protocol: each request is tagged with
+//   an id, and the replies are matched by id, in any order. The text protocol carries no
+//   id, so that its requests are sent one at a time, the others being queued
+// - expires the requests without a reply with a single timer, armed at the earliest
+//   deadline of a min-heap of deadlines, and retries them according to the configured
+//   policy (number of attempts, timeout, backoff factor), apart from the increments of
+//   the named counters, which are never retried
 //
 
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include "Configuration.h"
+#include "Constants.h"
 
 namespace ocs
 {
 namespace CountersClient
 {
 
+    // Status enumeration:
+    // Outcome of a request
+    enum class Status
+    {
+        ok,         // the server replied with a value
+        failed,     // the server replied with an error
+        timedOut    // no reply was received, after all the attempts
+    };
+
+    // Result structure:
+    // Outcome of a request, passed to its completion handler
+    // No logic is required -> implemented as an open struct
+    struct Result
+    {
+        Status              status = Status::ok;
+        unsigned long long  value = 0;      // the counter's value, if ok
+        std::string         error;          // the error message, if failed or timed out
+    };
+
     // CountersClient class:
-    // - opens an udp-v6 socket
-    // - provides an API for:
-    //      sending a request to a counters server
-    //      receiving and displaying the server's reply
+    // - opens an udp-v6 socket, or a unix domain datagram socket
+    // - provides an asynchronous API for sending requests to a counters server
+    // - matches the replies by request id, expires and retries the requests
     class CountersClient
     {
     public:
+        // Completion handler of a request
+        using Handler = std::function<void(const Result&)>;
+
+        // Datagram protocol of the sockets: udp or unix, chosen by the server's endpoint
+        using Protocol = boost::asio::generic::datagram_protocol;
+
         // Ctor:
-        // Implements the asio's server startup logic
+        // Implements the asio's client startup logic, and starts receiving replies
         CountersClient(const Configuration& configuration, boost::asio::io_service& io_context);
 
-        // getCounters():
-        // - sends a request to the target server
-        // - receives the server's reply (message)
-        // - decode the reply (message) into a query count
-        // - display the count to the console (via the logger)
-        // - encapsulate the whole workflow in a try-block so that exceptions should not bubble-up to the main polling loop
-        void getCounters();
+        // asyncGetCounters(handler):
+        // Sends a "GET" request: increments and returns the server's query count
+        // Note: as the increments, a retried "GET" may be applied twice by the server
+        void asyncGetCounters(Handler handler);
+
+        // asyncPeekCounters(handler):
+        // Sends a "PEEK" request: returns the server's query count, without incrementing it
+        void asyncPeekCounters(Handler handler);
+
+        // asyncReserveCounters(count, handler):
+        // Sends a "GET <count>" request: advances the server's query count by count at once,
+        // returns the first value of the reserved range (see SequenceCache)
+        // Note: a retried reservation may be applied twice, a range being then lost (never reused)
+        void asyncReserveCounters(unsigned long long count, Handler handler);
+
+        // asyncGetCounter(name, handler):
+        // Sends a "GET <name>" request: returns a named counter
+        void asyncGetCounter(const std::string& name, Handler handler);
+
+        // asyncIncrementCounter(name, value, handler):
+        // Sends an "INCR <name> <value>" request: adds the value to a named counter, returns it
+        // Note: the request is never retried, as a retried increment would be applied twice
+        // if only the reply was lost: it times out after a single attempt, the increment
+        // having been applied or not (at most once)
+        void asyncIncrementCounter(const std::string& name, unsigned long long value, Handler handler);
+
+        // Returns the number of requests not completed yet (in flight or queued)
+        std::size_t pending() const
+        {
+            return requests_.size();
+        }
+
+        // resolve(configuration, io_context):
+        // Returns the server's endpoint: its unix domain socket if configured, or else
+        // its hostname and service resolved to a udp-v6 endpoint
+        // Caution: throws if the hostname or the service cannot be resolved
+        static Protocol::endpoint resolve(const Configuration& configuration, boost::asio::io_service& io_context);
+
+        // openSocket(socket, server):
+        // Opens a socket of the server's protocol; a unix domain socket is bound to an
+        // address of its own (autobind), without which the server could not reply
+        static void openSocket(Protocol::socket& socket, const Protocol::endpoint& server);
 
     private:
-        // sendCommand():
-        // Sends a "GET" command to the target server
-        void sendCommand();
+        using Clock = std::chrono::steady_clock;
+
+        // Request structure:
+        // A request not completed yet
+        // No logic is required -> implemented as an open struct
+        struct Request
+        {
+            std::string     datagram;   // encoded request, kept for the retries
+            Handler         handler;
+            int             attempt;    // number of attempts so far (0 while queued)
+            int             attempts;   // maximum number of attempts (1 if not retried)
+        };
+
+        // Deadline structure:
+        // Entry of the min-heap of deadlines; an entry whose request was completed,
+        // or was retried since, is stale and skipped
+        // No logic is required -> implemented as an open struct
+        struct Deadline
+        {
+            Clock::time_point   when;
+            std::uint32_t       requestId;
+            int                 attempt;
+
+            bool operator>(const Deadline& other) const
+            {
+                return when > other.when;
+            }
+        };
+
+        // submit(code, name, value, handler):
+        // Encodes a request (text or binary), then sends it or queues it
+        void submit(std::uint8_t code, const std::string& name, unsigned long long value, Handler handler);
+
+        // send(requestId, request):
+        // Sends (or re-sends) a request, and schedules its deadline
+        void send(std::uint32_t requestId, Request& request);
+
+        // sendQueued():
+        // Sends the queued requests, as long as the number of requests in flight permits
+        void sendQueued();
+
+        // complete(requestId, result):
+        // Removes a request and invokes its handler, then sends the queued requests
+        // (with the text protocol, replaces the socket of a request sent more than once)
+        void complete(std::uint32_t requestId, const Result& result);
+
+        // replaceSocket():
+        // Closes the socket, dropping the replies not received yet, and opens a new one
+        void replaceSocket();
+
+        // startReceive(), handleReceive(ec, size):
+        // Receive loop: decodes each reply and completes the matching request
+        void startReceive();
+        void handleReceive(const boost::system::error_code& ec, std::size_t size);
 
-        // receiveReply():
-        // Receives a reply to a command from the target server
-        std::string receiveReply();
+        // armTimer(), handleTimer(ec):
+        // Deadline loop: arms the timer at the earliest deadline, then retries or fails
+        // the requests whose deadline expired
+        void armTimer();
+        void handleTimer(const boost::system::error_code& ec);
 
-        // decodeCount():
-        // - decodes a "GET" reply message into a query count
-        // - throws if the reply is an error message or cannot be read
-        unsigned long long decodeCount(const std::string& reply);
+        // decodeText(reply, result), decodeBinary(status, value, result):
+        // Decode the result of a reply
+        static void decodeText(const std::string& reply, Result& result);
+        static void decodeBinary(std::uint8_t status, unsigned long long value, Result& result);
 
     private:
-        const Configuration&             configuration_;
-        boost::asio::io_service&         io_context_;
-        boost::asio::ip::udp::socket     socket_;
-        boost::asio::ip::udp::endpoint   receiver_endpoint_;
+        const Configuration&                configuration_;
+        boost::asio::io_service&            io_context_;
+        Protocol::socket                    socket_;
+        Protocol::endpoint                  receiver_endpoint_;
+        Protocol::endpoint                  sender_endpoint_;
+        std::array<char, Constants::defaultBufferSize> recv_buffer_;
+        std::uint32_t                       requestId_;         // id of the last request
+        std::unordered_map<std::uint32_t, Request> requests_;   // requests not completed yet, by id
+        std::uint32_t                       textRequestId_;     // id of the text request in flight, if any
+        std::uint32_t                       socketGeneration_;  // number of replacements of the socket
+        std::deque<std::uint32_t>           queue_;             // ids of the requests not sent yet
+        std::size_t                         inFlight_;          // number of requests sent, not completed
+        std::priority_queue<Deadline, std::vector<Deadline>, std::greater<Deadline>> deadlines_;
+        boost::asio::steady_timer           timer_;
+        Clock::time_point                   timerExpiry_;       // expiry of the armed timer, if armed
+        bool                                timerArmed_;
     };
 
 } // namespace CountersClient
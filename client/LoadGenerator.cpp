@@ -0,0 +1,404 @@
+//
+// LoadGenerator.cpp
+// ~~~~~~~~~~~~~~~~~
+//
+// Source for the LoadGenerator class, the client's '--bench' mode:
+// - sends requests on an open-loop schedule, with up to 'concurrency' requests in flight,
+//   on as many datagram sockets, or pipelined on a single tcp connection
+// - measures the latencies from the scheduled times, counts the lost requests
+// - prints the throughput, the loss rate and the latency distribution
+//
+#include "LoadGenerator.h"
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <iostream>
+#include <poll.h>
+#include "BinaryProtocol.h"
+#include "Constants.h"
+#include "Logger.h"
+#include "StreamProtocol.h"
+
+namespace ocs
+{
+namespace CountersClient
+{
+
+    using boost::asio::ip::tcp;
+
+    // Ctor:
+    // Resolves the target server, opens one socket per in-flight request (or the tcp
+    // connection, in tcp mode)
+    LoadGenerator::LoadGenerator(const Configuration& configuration, boost::asio::io_service& io_context)
+    : configuration_(configuration)
+    , io_context_(io_context)
+    , receiver_endpoint_()
+    , slots_(configuration.concurrency)
+    , stream_()
+    , stream_endpoint_()
+    , requestId_(0)
+    , sent_(0)
+    , received_(0)
+    , errors_(0)
+    , lost_(0)
+    {
+        // Resolve the target to an endpoint
+        if (configuration_.tcp)
+        {
+            tcp::resolver resolver(io_context_);
+            tcp::resolver::query query(tcp::v6(), configuration_.hostname, configuration_.service);
+            stream_endpoint_ = *resolver.resolve(query);
+            openStream();
+        }
+        else
+            receiver_endpoint_ = CountersClient::resolve(configuration_, io_context_);
+
+        for (std::size_t i = 0; i < slots_.size(); ++i)
+        {
+            if (!stream_)
+                openSocket(slots_[i]);
+            freeSlots_.push_back(slots_.size() - 1 - i);
+        }
+    }
+
+    // run():
+    // Sends the requests for the configured duration, waits for the last replies
+    // (up to the timeout), then prints the results to the console
+    void LoadGenerator::run()
+    {
+        // The k-th request is due at start + k / rate, whatever happened to the former ones
+        const std::uint64_t total = static_cast<std::uint64_t>(configuration_.duration) * configuration_.rate;
+        const auto start = Clock::now();
+        auto scheduled = [&] (std::uint64_t k)
+        {
+            return start + std::chrono::nanoseconds(k * 1000000000ULL / configuration_.rate);
+        };
+
+        std::uint64_t next = 0;
+        auto lastSent = start;
+        while (true)
+        {
+            // Send the requests which are due, as long as a slot is free: the ones which
+            // cannot be sent on time are sent late, their latency including the delay
+            auto now = Clock::now();
+            while (next < total && scheduled(next) <= now && !freeSlots_.empty())
+            {
+                const auto index = freeSlots_.back();
+                freeSlots_.pop_back();
+                send(slots_[index], scheduled(next));
+                ++next;
+                lastSent = now;
+            }
+            if (next == total && freeSlots_.size() == slots_.size())
+                break;
+
+            // Wait for the replies, until the next request is due
+            // (or for 1 ms at most, so as to check the deadlines of the requests in flight)
+            auto until = now + std::chrono::milliseconds(1);
+            if (next < total && !freeSlots_.empty())
+                until = std::min(until, scheduled(next));
+            wait(until);
+            expire(Clock::now());
+        }
+
+        report(std::chrono::duration<double>(std::max(lastSent, scheduled(total)) - start).count());
+    }
+
+    // openSocket(slot):
+    // (Re)opens the slot's socket, non-blocking and connected to the server, so that
+    // the late reply of a lost request cannot be mistaken for the reply of the next one
+    void LoadGenerator::openSocket(Slot& slot)
+    {
+        slot.socket.reset(new CountersClient::Protocol::socket(io_context_));
+        CountersClient::openSocket(*slot.socket, receiver_endpoint_);
+        slot.socket->non_blocking(true);
+        slot.socket->connect(receiver_endpoint_);
+    }
+
+    // openStream():
+    // Tcp mode: (re)connects the tcp connection, non-blocking, so that the late replies
+    // of the lost requests cannot be mistaken for the replies of the next ones
+    // Caution: throws if the server refuses the connection
+    void LoadGenerator::openStream()
+    {
+        stream_.reset(new tcp::socket(io_context_));
+        stream_->connect(stream_endpoint_);
+        stream_->set_option(tcp::no_delay(true));
+        stream_->non_blocking(true);
+        streamInput_.clear();
+        streamOutput_.clear();
+        streamOrder_.clear();
+    }
+
+    // send(slot, scheduled):
+    // Sends a request on a free slot
+    void LoadGenerator::send(Slot& slot, Clock::time_point scheduled)
+    {
+        slot.busy = true;
+        slot.scheduled = scheduled;
+        slot.deadline = Clock::now() + std::chrono::milliseconds(configuration_.timeout);
+        ++sent_;
+
+        // On the tcp connection, a text request is a line (see StreamProtocol)
+        static const char command[] = "GET\n";
+        std::array<char, BinaryProtocol::headerSize + BinaryProtocol::operationSize> datagram;
+        boost::asio::const_buffer request(command, sizeof(command) - (stream_ ? 1 : 2));
+        if (configuration_.binary)
+        {
+            BinaryWriter writer(datagram.data(), datagram.size());
+            BinaryHeader header;
+            header.requestId = slot.requestId = ++requestId_;
+            header.count = 1;
+            BinaryOperation operation;
+            operation.code = BinaryProtocol::getQueries;
+            writer.writeHeader(header);
+            writer.writeOperation(operation);
+            request = boost::asio::const_buffer(datagram.data(), writer.size());
+        }
+
+        // On the tcp connection, the request is queued behind the ones not written yet
+        if (stream_)
+        {
+            const auto* const data = static_cast<const char*>(request.data());
+            streamOutput_.insert(streamOutput_.end(), data, data + request.size());
+            streamOrder_.push_back(&slot - slots_.data());
+            flushStream();
+            return;
+        }
+
+        // A unix domain socket refuses the datagrams while the server's receive queue is full
+        // (net.unix.max_dgram_qlen datagrams), where udp would drop them: the sending then
+        // waits for room, until the request's deadline
+        boost::system::error_code ec;
+        slot.socket->send(request, 0, ec);
+        while (ec == boost::asio::error::would_block)
+        {
+            const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(slot.deadline - Clock::now()).count();
+            pollfd fd = { slot.socket->native_handle(), POLLOUT, 0 };
+            if (left <= 0 || ::poll(&fd, 1, static_cast<int>(left)) <= 0)
+                break;
+            slot.socket->send(request, 0, ec);
+        }
+
+        // A request which could not be sent is lost (it is retried by no one)
+        if (ec)
+            OCS_LOG_RATE_LIMITED(warning, Constants::maxErrorLinesPerSecond) << "Could not send a request: " << ec.message();
+    }
+
+    // flushStream():
+    // Tcp mode: writes the pending requests, as far as the connection accepts them
+    // (the rest is written when the connection is writable again, see wait())
+    void LoadGenerator::flushStream()
+    {
+        while (!streamOutput_.empty())
+        {
+            boost::system::error_code ec;
+            const auto written = stream_->write_some(boost::asio::buffer(streamOutput_), ec);
+            if (ec == boost::asio::error::would_block)
+                return;
+            if (ec)
+            {   // the requests in flight will be counted as lost, and the connection reopened
+                OCS_LOG_RATE_LIMITED(warning, Constants::maxErrorLinesPerSecond) << "Could not send the requests: " << ec.message();
+                streamOutput_.clear();
+                return;
+            }
+            streamOutput_.erase(streamOutput_.begin(), streamOutput_.begin() + written);
+        }
+    }
+
+    // receiveStream(now):
+    // Tcp mode: reads the replies available, completing the oldest requests in flight
+    // (the server answers the requests of a connection in order)
+    void LoadGenerator::receiveStream(Clock::time_point now)
+    {
+        enum { readSize = 4096 };
+        while (true)
+        {
+            const auto size = streamInput_.size();
+            streamInput_.resize(size + readSize);
+            boost::system::error_code ec;
+            const auto read = stream_->read_some(boost::asio::buffer(&streamInput_[size], readSize), ec);
+            streamInput_.resize(size + (ec ? 0 : read));
+            if (ec == boost::asio::error::would_block)
+                break;
+            if (ec)
+            {   // e.g. closed by the server: the requests in flight will be counted as lost
+                OCS_LOG_RATE_LIMITED(warning, Constants::maxErrorLinesPerSecond) << "Could not receive the replies: " << ec.message();
+                break;
+            }
+        }
+
+        std::size_t consumed = 0;
+        std::size_t frameSize = 0;
+        std::size_t payloadSize = 0;
+        while (!streamOrder_.empty()
+            && StreamProtocol::nextFrame(streamInput_.data() + consumed, streamInput_.size() - consumed, frameSize, payloadSize) == StreamProtocol::complete)
+        {
+            auto& slot = slots_[streamOrder_.front()];
+            streamOrder_.pop_front();
+            bool ok;
+            if (!parseReply(slot, streamInput_.data() + consumed, payloadSize, ok))
+                ok = false;     // out of order: not expected from the server
+            complete(slot, ok, now);
+            consumed += frameSize;
+        }
+        streamInput_.erase(streamInput_.begin(), streamInput_.begin() + consumed);
+    }
+
+    // complete(slot, ok, now):
+    // Records the latency of a slot's request, and frees the slot
+    void LoadGenerator::complete(Slot& slot, bool ok, Clock::time_point now)
+    {
+        latencies_.record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - slot.scheduled).count());
+        ++received_;
+        if (!ok)
+            ++errors_;
+        slot.busy = false;
+        freeSlots_.push_back(&slot - slots_.data());
+    }
+
+    // parseReply(slot, reply, size, ok):
+    // Returns true if a reply is the one of the slot's request, and whether it is a success
+    bool LoadGenerator::parseReply(const Slot& slot, const char* reply, std::size_t size, bool& ok) const
+    {
+        if (configuration_.binary)
+        {
+            BinaryReader reader(reply, size);
+            BinaryHeader header;
+            BinaryOperation operation;
+            if (!reader.readHeader(header) || header.opcode != BinaryProtocol::reply || header.requestId != slot.requestId)
+                return false;
+            ok = header.count == 1 && reader.readOperation(operation) && operation.status == BinaryProtocol::ok;
+        }
+        else
+            ok = size >= 3 && reply[0] == 'O' && reply[1] == 'K' && reply[2] == ':';
+        return true;
+    }
+
+    // receive(slot, now):
+    // Reads the replies available on a slot, completing its request if they match
+    void LoadGenerator::receive(Slot& slot, Clock::time_point now)
+    {
+        std::array<char, Constants::defaultBufferSize> reply;
+        while (true)
+        {
+            boost::system::error_code ec;
+            const auto size = slot.socket->receive(boost::asio::buffer(reply), 0, ec);
+            if (ec == boost::asio::error::would_block)
+                return;
+            if (!slot.busy)
+                continue;   // late reply
+            if (ec)
+            {   // e.g. connection refused: the server is not listening, the request will be counted as lost
+                OCS_LOG_RATE_LIMITED(warning, Constants::maxErrorLinesPerSecond) << "Could not receive a reply: " << ec.message();
+                continue;
+            }
+
+            bool ok;
+            if (!parseReply(slot, reply.data(), size, ok))
+                continue;   // reply of another request
+            complete(slot, ok, now);
+        }
+    }
+
+    // expire(now):
+    // Counts the requests in flight beyond their deadline as lost, and frees their slots
+    // On the tcp connection, the replies come in order: when the oldest request expires,
+    // all the requests in flight are counted as lost, and the connection is reopened
+    void LoadGenerator::expire(Clock::time_point now)
+    {
+        if (stream_)
+        {
+            if (streamOrder_.empty() || slots_[streamOrder_.front()].deadline > now)
+                return;
+            for (const auto index : streamOrder_)
+            {
+                ++lost_;
+                slots_[index].busy = false;
+                freeSlots_.push_back(index);
+            }
+            openStream();
+            return;
+        }
+
+        for (auto& slot : slots_)
+        {
+            if (slot.busy && slot.deadline <= now)
+            {
+                ++lost_;
+                slot.busy = false;
+                openSocket(slot);
+                freeSlots_.push_back(&slot - slots_.data());
+            }
+        }
+    }
+
+    // wait(until):
+    // Waits for a reply on any busy slot (or on the tcp connection, which is also waited
+    // for writability while requests are pending), until the given time at the latest
+    void LoadGenerator::wait(Clock::time_point until)
+    {
+        const auto timeout = std::max(Clock::duration::zero(), until - Clock::now());
+        const auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count();
+        const timespec ts = { static_cast<time_t>(nanoseconds / 1000000000), static_cast<long>(nanoseconds % 1000000000) };
+
+        if (stream_)
+        {
+            pollfd fd = { stream_->native_handle(), static_cast<short>(POLLIN | (streamOutput_.empty() ? 0 : POLLOUT)), 0 };
+            if (::ppoll(&fd, 1, &ts, nullptr) <= 0)
+                return;
+            if (fd.revents & POLLOUT)
+                flushStream();
+            if (fd.revents & ~POLLOUT)
+                receiveStream(Clock::now());
+            return;
+        }
+
+        std::vector<pollfd> fds;
+        std::vector<std::size_t> indices;
+        for (std::size_t i = 0; i < slots_.size(); ++i)
+        {
+            if (slots_[i].busy)
+            {
+                fds.push_back(pollfd{ slots_[i].socket->native_handle(), POLLIN, 0 });
+                indices.push_back(i);
+            }
+        }
+
+        if (::ppoll(fds.data(), fds.size(), &ts, nullptr) <= 0)
+            return;
+
+        const auto now = Clock::now();
+        for (std::size_t i = 0; i < fds.size(); ++i)
+        {
+            if (fds[i].revents)
+                receive(slots_[indices[i]], now);
+        }
+    }
+
+    // report(elapsed):
+    // Prints the results to the console
+    void LoadGenerator::report(double elapsed) const
+    {
+        const auto microseconds = [] (std::uint64_t nanoseconds) { return nanoseconds / 1000.0; };
+        std::printf("Load generator results:\n");
+        std::printf("\tSchedule:       %d requests/s for %d s (concurrency %d, timeout %d ms), %s protocol over %s\n",
+            configuration_.rate, configuration_.duration, configuration_.concurrency, configuration_.timeout,
+            configuration_.binary ? "binary" : "text",
+            configuration_.tcp ? "a tcp connection" : configuration_.unixSocket.empty() ? "udp" : "unix socket");
+        std::printf("\tRequests:       %llu sent, %llu answered (%llu errors), %llu lost (%.3f %%)\n",
+            static_cast<unsigned long long>(sent_), static_cast<unsigned long long>(received_),
+            static_cast<unsigned long long>(errors_), static_cast<unsigned long long>(lost_),
+            sent_ ? 100.0 * lost_ / sent_ : 0.0);
+        std::printf("\tThroughput:     %.1f replies/s over %.3f s\n", elapsed > 0 ? received_ / elapsed : 0.0, elapsed);
+        std::printf("\tLatency (us), from the scheduled sending time:\n");
+        std::printf("\t    mean        %10.1f\n", microseconds(static_cast<std::uint64_t>(latencies_.mean())));
+        static const double percentiles[] = { 50, 75, 90, 99, 99.9, 99.99 };
+        for (const auto percent : percentiles)
+            std::printf("\t    p%-10g %10.1f\n", percent, microseconds(latencies_.percentile(percent)));
+        std::printf("\t    max         %10.1f\n", microseconds(latencies_.max()));
+        std::fflush(stdout);
+    }
+
+} // namespace CountersClient
+} // namespace ocs
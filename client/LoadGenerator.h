@@ -0,0 +1,134 @@
+#ifndef OCS_COUNTERS_CLIENT_LOAD_GENERATOR_H
+#define OCS_COUNTERS_CLIENT_LOAD_GENERATOR_H
+//
+// LoadGenerator.h
+// ~~~~~~~~~~~~~~~
+//
+// Header for the LoadGenerator class, the client's '--bench' mode:
+// - sends "GET" requests to a counters server on an open-loop schedule: the k-th request
+//   is due at start + k / rate, whether the former ones were answered or not
+// - keeps up to 'concurrency' requests in flight, each one on its own socket (udp, or unix
+//   domain for a co-located server), or all of them pipelined on a single tcp connection
+//   (the replies then come in the order of the requests)
+// - measures each latency from the request's scheduled time, not from its actual
+//   sending time, so that a stall of the server (or of the generator) is accounted for
+//   in the latencies of all the requests it delayed (no coordinated omission)
+// - counts a request without a reply within the timeout as lost
+// - prints the throughput, the loss rate and the latency distribution
+//
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <boost/asio.hpp>
+#include "Configuration.h"
+#include "CountersClient.h"
+#include "LatencyHistogram.h"
+
+namespace ocs
+{
+namespace CountersClient
+{
+
+    // LoadGenerator class:
+    // - sends requests on an open-loop schedule, with up to 'concurrency' requests in flight
+    // - measures the latencies from the scheduled times, counts the lost requests
+    // - prints the throughput, the loss rate and the latency distribution
+    class LoadGenerator
+    {
+    public:
+        // Ctor:
+        // Resolves the target server, opens one socket per in-flight request
+        LoadGenerator(const Configuration& configuration, boost::asio::io_service& io_context);
+
+        // run():
+        // Sends the requests for the configured duration, waits for the last replies
+        // (up to the timeout), then prints the results to the console
+        void run();
+
+    private:
+        using Clock = std::chrono::steady_clock;
+
+        // Slot structure:
+        // A socket (datagrams only) and the request in flight on it, if any
+        // No logic is required -> implemented as an open struct
+        struct Slot
+        {
+            std::unique_ptr<CountersClient::Protocol::socket> socket;
+            bool                                            busy = false;
+            std::uint32_t                                   requestId = 0;
+            Clock::time_point                               scheduled;  // scheduled sending time
+            Clock::time_point                               deadline;   // the request is lost beyond
+        };
+
+        // openSocket(slot):
+        // (Re)opens the slot's socket, non-blocking and connected to the server, so that
+        // the late reply of a lost request cannot be mistaken for the reply of the next one
+        void openSocket(Slot& slot);
+
+        // openStream():
+        // Tcp mode: (re)connects the tcp connection, non-blocking, so that the late replies
+        // of the lost requests cannot be mistaken for the replies of the next ones
+        void openStream();
+
+        // send(slot, scheduled):
+        // Sends a request on a free slot
+        void send(Slot& slot, Clock::time_point scheduled);
+
+        // flushStream():
+        // Tcp mode: writes the pending requests, as far as the connection accepts them
+        void flushStream();
+
+        // receiveStream(now):
+        // Tcp mode: reads the replies available, completing the oldest requests in flight
+        void receiveStream(Clock::time_point now);
+
+        // complete(slot, ok, now):
+        // Records the latency of a slot's request, and frees the slot
+        void complete(Slot& slot, bool ok, Clock::time_point now);
+
+        // parseReply(slot, reply, size, ok):
+        // Returns true if a reply is the one of the slot's request, and whether it is a success
+        bool parseReply(const Slot& slot, const char* reply, std::size_t size, bool& ok) const;
+
+        // receive(slot, now):
+        // Reads the replies available on a slot, completing its request if they match
+        void receive(Slot& slot, Clock::time_point now);
+
+        // expire(now):
+        // Counts the requests in flight beyond their deadline as lost, and frees their slots
+        void expire(Clock::time_point now);
+
+        // wait(until):
+        // Waits for a reply on any busy slot, until the given time at the latest
+        void wait(Clock::time_point until);
+
+        // report(elapsed):
+        // Prints the results to the console
+        void report(double elapsed) const;
+
+    private:
+        const Configuration&                configuration_;
+        boost::asio::io_service&            io_context_;
+        CountersClient::Protocol::endpoint  receiver_endpoint_;
+        std::vector<Slot>                   slots_;
+        std::vector<std::size_t>            freeSlots_;         // indices of the free slots
+        std::unique_ptr<boost::asio::ip::tcp::socket> stream_;  // tcp connection (tcp mode only)
+        boost::asio::ip::tcp::endpoint      stream_endpoint_;
+        std::vector<char>                   streamInput_;       // replies received, not complete yet
+        std::vector<char>                   streamOutput_;      // requests not written yet
+        std::deque<std::size_t>             streamOrder_;       // indices of the busy slots, in sending order
+        std::uint32_t                       requestId_;         // id of the last binary request
+        LatencyHistogram                    latencies_;         // in nanoseconds
+        std::uint64_t                       sent_;
+        std::uint64_t                       received_;
+        std::uint64_t                       errors_;            // error replies
+        std::uint64_t                       lost_;
+    };
+
+} // namespace CountersClient
+} // namespace ocs
+
+#endif // OCS_COUNTERS_CLIENT_LOAD_GENERATOR_H
@@ -0,0 +1,119 @@
+//
+// SequenceCache.cpp
+// ~~~~~~~~~~~~~~~~~
+//
+// Source for the SequenceCache class:
+// - hands out unique values from blocks reserved on the server
+// - refills ahead of time, in the background
+//
+#include "SequenceCache.h"
+#include "Logger.h"
+
+namespace ocs
+{
+namespace CountersClient
+{
+
+    // Ctor:
+    // Creates an empty cache, reserving blockSize values at a time through the client
+    SequenceCache::SequenceCache(CountersClient& client, unsigned long long blockSize)
+     : client_(client)
+     , blockSize_(blockSize)
+     , blocks_()
+     , available_(0)
+     , waiting_()
+     , refilling_(false)
+    {
+    }
+
+    // tryNext(value):
+    // Takes the next value from the cache, without waiting: returns false if the cache
+    // is empty (a refill is then in progress, see asyncNext())
+    bool SequenceCache::tryNext(unsigned long long& value)
+    {
+        if (!available_ || !waiting_.empty())
+        {
+            refill();
+            return false;
+        }
+        value = take();
+        return true;
+    }
+
+    // asyncNext(handler):
+    // Hands out the next value: right away (the handler being invoked before returning)
+    // if the cache holds one, or else on the completion of the refill in progress
+    // The values are handed out in the order of the calls, the waiting handlers first
+    void SequenceCache::asyncNext(CountersClient::Handler handler)
+    {
+        Result result;
+        if (tryNext(result.value))
+        {
+            handler(result);
+            return;
+        }
+        waiting_.push_back(std::move(handler));
+    }
+
+    // take():
+    // Takes the next value from the cache, and refills it if it is running low
+    // (below half a block), so that the next block is usually reserved before it is needed
+    // Caution: the cache must not be empty
+    unsigned long long SequenceCache::take()
+    {
+        auto& block = blocks_.front();
+        const auto value = block.first++;
+        if (block.first == block.second)
+            blocks_.pop_front();
+        --available_;
+
+        if (available_ < (blockSize_ + 1) / 2)
+            refill();
+        return value;
+    }
+
+    // refill():
+    // Reserves a new block, unless a reservation is already in progress
+    void SequenceCache::refill()
+    {
+        if (refilling_)
+            return;
+        refilling_ = true;
+        OCS_LOG(debug) << "Reserving a block of " << blockSize_ << " values (" << available_ << " left)";
+        client_.asyncReserveCounters(blockSize_, [this] (const Result& result) { handleRefill(result); });
+    }
+
+    // handleRefill(result):
+    // Adds the reserved block to the cache, and hands out its values to the waiting
+    // handlers, or fails them if the reservation failed
+    void SequenceCache::handleRefill(const Result& result)
+    {
+        refilling_ = false;
+        if (result.status != Status::ok)
+        {
+            OCS_LOG_RATE_LIMITED(warning, Constants::maxErrorLinesPerSecond) << "Could not reserve a block of values: " << result.error;
+            auto failed = std::move(waiting_);
+            waiting_.clear();
+            for (const auto& handler : failed)
+                handler(result);
+            return;
+        }
+
+        blocks_.emplace_back(result.value, result.value + blockSize_);
+        available_ += blockSize_;
+
+        // The handlers calling asyncNext() in turn are queued behind the waiting ones
+        while (!waiting_.empty() && available_)
+        {
+            const auto handler = std::move(waiting_.front());
+            waiting_.pop_front();
+            Result next;
+            next.value = take();
+            handler(next);
+        }
+        if (!waiting_.empty())
+            refill();
+    }
+
+} // namespace CountersClient
+} // namespace ocs
@@ -0,0 +1,81 @@
+#ifndef OCS_COUNTERS_CLIENT_SEQUENCE_CACHE_H
+#define OCS_COUNTERS_CLIENT_SEQUENCE_CACHE_H
+//
+// SequenceCache.h
+// ~~~~~~~~~~~~~~~
+//
+// Header for the SequenceCache class:
+// - hands out unique values of the server's query counter, used as a sequence generator,
+//   from blocks reserved with "GET <n>" requests, without a round trip per value
+// - refills ahead of time, in the background: a new block is reserved as soon as the
+//   values left fall below half a block, so that the cache seldom runs dry
+// - the values of a block are handed out in increasing order; a retried reservation may
+//   be applied twice by the server, so that a block may be skipped (never a value reused)
+//
+
+#include <cstddef>
+#include <deque>
+#include <utility>
+#include "CountersClient.h"
+
+namespace ocs
+{
+namespace CountersClient
+{
+
+    // SequenceCache class:
+    // - hands out unique values from blocks reserved on the server
+    // - refills ahead of time, in the background
+    class SequenceCache
+    {
+    public:
+        // Ctor:
+        // Creates an empty cache, reserving blockSize values at a time through the client
+        SequenceCache(CountersClient& client, unsigned long long blockSize);
+
+        // tryNext(value):
+        // Takes the next value from the cache, without waiting: returns false if the cache
+        // is empty (a refill is then in progress, see asyncNext())
+        bool tryNext(unsigned long long& value);
+
+        // asyncNext(handler):
+        // Hands out the next value: right away (the handler being invoked before returning)
+        // if the cache holds one, or else on the completion of the refill in progress
+        // (the handler receiving the error if the refill fails)
+        void asyncNext(CountersClient::Handler handler);
+
+        // available():
+        // Returns the number of values left in the cache
+        unsigned long long available() const
+        {
+            return available_;
+        }
+
+    private:
+        // refill():
+        // Reserves a new block, unless a reservation is already in progress
+        void refill();
+
+        // handleRefill(result):
+        // Adds the reserved block to the cache, and hands out its values to the waiting
+        // handlers, or fails them if the reservation failed
+        void handleRefill(const Result& result);
+
+        // take():
+        // Takes the next value from the cache, and refills it if it is running low
+        // Caution: the cache must not be empty
+        unsigned long long take();
+
+    private:
+        CountersClient&                                             client_;
+        const unsigned long long                                    blockSize_;
+        std::deque<std::pair<unsigned long long, unsigned long long>> blocks_;    // [first, end) ranges not exhausted
+        unsigned long long                                          available_;     // values left in the blocks
+        std::deque<CountersClient::Handler>                         waiting_;       // handlers waiting for a refill
+        bool                                                        refilling_;     // true while a reservation is in progress
+    };
+
+} // namespace CountersClient
+} // namespace ocs
+
+#endif // OCS_COUNTERS_CLIENT_SEQUENCE_CACHE_H
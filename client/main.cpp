@@ -7,14 +7,19 @@
 // A good deal of the asio-related logic is derived from the Boost tutorial here:
 // https://www.boost.org/doc/libs/1_67_0/doc/html/boost_asio/tutorial/tutdaytime4/src.html
 //
+#include <functional>
 #include <iostream>
+#include <memory>
 #include <string>
 #include <boost/asio.hpp>
-#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/algorithm/string/join.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <boost/program_options.hpp>
 #include "Configuration.h"
 #include "Logger.h"
 #include "CountersClient.h"
+#include "LoadGenerator.h"
+#include "SequenceCache.h"
 
 namespace ocs
 {
@@ -42,9 +47,37 @@ namespace CountersClient
             ("host", po::value<>(&configuration.hostname),
                 "set the name/ip of the target server (default: localhost)")
             ("service", po::value<>(&configuration.service), 
-                "set the udp port or service name on the target server (default: 12345)")
+                "set the udp (or tcp, see --tcp) port or service name on the target server (default: 12345)")
+            ("unix-socket", po::value<>(&configuration.unixSocket),
+                "reach the server through its unix domain datagram socket at this path, instead of the host and service (default: none)")
             ("log-level", po::value<>(&configuration.minLogLevel),
-                "set the log-level from -2 for trace to 3 for fatal (default: 0 for info)");
+                "set the log-level from -2 for trace to 3 for fatal (default: 0 for info)")
+            ("binary", po::bool_switch(&configuration.binary),
+                "use the binary protocol instead of the text protocol (default: disabled)")
+            ("peek", po::bool_switch(&configuration.peek),
+                "read the query count with 'PEEK' on each poll, without incrementing it (default: disabled)")
+            ("counters", po::value<>(&configuration.counters)->multitoken()->composing(),
+                "set the named counters read on each poll, besides the query count (default: none)")
+            ("timeout", po::value<>(&configuration.timeout),
+                "set the delay beyond which a request without reply is retried, or lost, in milliseconds (default: 1000)")
+            ("attempts", po::value<>(&configuration.attempts),
+                "set the number of attempts of a request without reply (default: 3)")
+            ("retry-backoff", po::value<>(&configuration.retryBackoff),
+                "set the factor applied to the timeout on each retry (default: 2)")
+            ("max-in-flight", po::value<>(&configuration.maxInFlight),
+                "set the maximum number of requests in flight with the binary protocol (default: 256)")
+            ("block-size", po::value<>(&configuration.blockSize),
+                "take the query count values from a local cache of blocks of this size, reserved with 'GET <n>' (default: 0, disabled)")
+            ("bench", po::bool_switch(&configuration.bench),
+                "run an open-loop load generator instead of polling the server (default: disabled)")
+            ("tcp", po::bool_switch(&configuration.tcp),
+                "load generator: pipeline the requests on a single tcp connection to the service (default: disabled)")
+            ("rate", po::value<>(&configuration.rate),
+                "load generator: set the number of requests sent per second (default: 10000)")
+            ("concurrency", po::value<>(&configuration.concurrency),
+                "load generator: set the maximum number of requests in flight (default: 64)")
+            ("duration", po::value<>(&configuration.duration),
+                "load generator: set the duration of the run, in seconds (default: 10)");
 
 
         // Parse the command line options, which are stored directly into the Configuration object
@@ -59,10 +92,48 @@ namespace CountersClient
             std::cout << desc << std::endl;
             return 1;
         }
+
+        // Check the consistency of the options, returns -1 to the caller on error
+        if (configuration.rate < 1 || configuration.concurrency < 1 || configuration.duration < 1 || configuration.timeout < 1)
+        {
+            std::cerr << "The options '--rate', '--concurrency', '--duration' and '--timeout' must be at least 1" << std::endl;
+            return -1;
+        }
+        if (configuration.attempts < 1 || configuration.maxInFlight < 1 || configuration.retryBackoff < 1.0)
+        {
+            std::cerr << "The options '--attempts', '--max-in-flight' and '--retry-backoff' must be at least 1" << std::endl;
+            return -1;
+        }
+        if (configuration.tcp && (!configuration.bench || !configuration.unixSocket.empty()))
+        {
+            std::cerr << "The option '--tcp' requires the option '--bench', and excludes the option '--unix-socket'" << std::endl;
+            return -1;
+        }
+        if (configuration.blockSize > Constants::maxReservationSize)
+        {
+            std::cerr << "The option '--block-size' must be at most " << Constants::maxReservationSize << std::endl;
+            return -1;
+        }
+        if (configuration.peek && (configuration.blockSize || configuration.bench))
+        {
+            std::cerr << "The option '--peek' excludes the options '--block-size' and '--bench'" << std::endl;
+            return -1;
+        }
         return 0;
     }
 
 
+    // log_result(text, result):
+    // Logs the result of a request: the text followed by the value, or the error
+    void log_result(const std::string& text, const Result& result)
+    {
+        if (result.status == Status::ok)
+            Logger(info) << text << result.value;
+        else
+            Logger(error) << result.error;
+    }
+
+
     // execute(argc, argv):
     // Client's main code, invoked directly from main()
     int execute(int argc, char *argv[])
@@ -72,6 +143,8 @@ namespace CountersClient
         int result = parse_options(argc, argv);
         if (result == 1)
             return 0;;
+        if (result < 0)
+            return -1;
 
         try
         {
@@ -79,9 +152,27 @@ namespace CountersClient
             Logger(info) << "=== client : starting ===";
             Logger(info) << "";
             Logger(info) << "Configuration:";
-            Logger(info) << "\tTarget host:    " << configuration.hostname;
-            Logger(info) << "\tTarget service: " << configuration.service;
+            if (configuration.unixSocket.empty())
+            {
+                Logger(info) << "\tTarget host:    " << configuration.hostname;
+                Logger(info) << "\tTarget service: " << configuration.service;
+            }
+            else
+                Logger(info) << "\tTarget socket:  " << configuration.unixSocket;
             Logger(info) << "\tLog level: "      << configuration.minLogLevel;
+            Logger(info) << "\tProtocol:       " << (configuration.binary ? "binary" : "text");
+            Logger(info) << "\tRetry policy:   " << configuration.attempts << " attempt(s), timeout " << configuration.timeout
+                         << " ms, backoff x" << configuration.retryBackoff;
+            if (configuration.blockSize)
+                Logger(info) << "\tBlock size:     " << configuration.blockSize;
+            if (configuration.peek)
+                Logger(info) << "\tQuery count:    read with PEEK";
+            if (!configuration.counters.empty())
+                Logger(info) << "\tCounters:       " << boost::algorithm::join(configuration.counters, " ");
+            if (configuration.bench)
+                Logger(info) << "\tLoad generator: " << configuration.rate << " requests/s for " << configuration.duration
+                             << " s, concurrency " << configuration.concurrency << ", timeout " << configuration.timeout << " ms"
+                             << (configuration.tcp ? ", pipelined on a tcp connection" : "");
             Logger(info) << "";
 
             // Set minimum log level
@@ -100,20 +191,66 @@ namespace CountersClient
                 }
             );
 
-            // Create a counters client object
+            // In load generator mode, run once and exit
+            if (configuration.bench)
+            {
+                LoadGenerator generator(configuration, io_context);
+                Logger(info) << "Sending requests...";
+                generator.run();
+                Logger(info) << "=== client : shutdown ===";
+                return 0;
+            }
+
+            // Create a counters client object, and the local cache of reserved values if enabled
             CountersClient service(configuration, io_context);
+            std::unique_ptr<SequenceCache> cache(configuration.blockSize ? new SequenceCache(service, configuration.blockSize) : nullptr);
 
-            // Pool the server every 5 seconds
-            Logger(info) << "Pooling...";
-            for (;;)
+            // Poll the server every 5 seconds: the query count and the named counters are
+            // requested at once, their replies being logged as they come
+            boost::asio::steady_timer timer(io_context);
+            std::function<void()> poll = [&] ()
             {
-                boost::asio::deadline_timer t(io_context, boost::posix_time::seconds(5));
-                service.getCounters();
-                t.wait();
-            }
+                if (cache)
+                {
+                    cache->asyncNext([&cache] (const Result& result)
+                    {
+                        log_result("Counter was taken from the reserved blocks (" + std::to_string(cache->available()) + " left), new count is: ", result);
+                    });
+                }
+                else if (configuration.peek)
+                {
+                    service.asyncPeekCounters([] (const Result& result)
+                    {
+                        log_result("Counter was successfully read, current count is: ", result);
+                    });
+                }
+                else
+                {
+                    service.asyncGetCounters([] (const Result& result)
+                    {
+                        log_result("Counter was successfully received, new count is: ", result);
+                    });
+                }
+                for (const auto& name : configuration.counters)
+                {
+                    service.asyncGetCounter(name, [name] (const Result& result)
+                    {
+                        log_result("Counter '" + name + "' was successfully received: ", result);
+                    });
+                }
+                timer.expires_from_now(std::chrono::seconds(5));
+                timer.async_wait([&] (const boost::system::error_code& ec)
+                {
+                    if (!ec)
+                        poll();
+                });
+            };
+            Logger(info) << "Pooling...";
+            poll();
+            io_context.run();
 
             // Log shutdown
-            Logger(info) << "=== server : shutdown ===";
+            Logger(info) << "=== client : shutdown ===";
             return 0;
         }
         catch (std::exception& e)
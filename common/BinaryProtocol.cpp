@@ -0,0 +1,115 @@
+//
+// BinaryProtocol.cpp
+// ~~~~~~~~~~~~~~~~~~
+//
+// Source for the binary wire protocol:
+// - BinaryReader class: decoding of datagrams, in place
+// - BinaryWriter class: encoding of datagrams, into caller-owned buffers
+// The integers are encoded byte by byte, so that the encoding is little-endian
+// whatever the host's byte order and alignment constraints
+//
+
+#include "BinaryProtocol.h"
+#include <cstring>
+
+namespace ocs
+{
+
+    namespace
+    {
+        // load<T>(data):
+        // Decodes a little-endian integer
+        template<class T>
+        T load(const char* data)
+        {
+            T value = 0;
+            for (std::size_t i = 0; i < sizeof(T); ++i)
+                value |= static_cast<T>(static_cast<unsigned char>(data[i])) << (8 * i);
+            return value;
+        }
+
+        // store(data, value):
+        // Encodes a little-endian integer
+        template<class T>
+        void store(char* data, T value)
+        {
+            for (std::size_t i = 0; i < sizeof(T); ++i)
+                data[i] = static_cast<char>(value >> (8 * i));
+        }
+    }
+
+    // readHeader(header):
+    // Decodes the header, returns false if the datagram is too short or has a bad magic
+    bool BinaryReader::readHeader(BinaryHeader& header)
+    {
+        if (end_ - data_ < BinaryProtocol::headerSize || load<std::uint16_t>(data_) != BinaryProtocol::magic)
+            return false;
+        header.version = load<std::uint8_t>(data_ + 2);
+        header.opcode = load<std::uint8_t>(data_ + 3);
+        header.requestId = load<std::uint32_t>(data_ + 4);
+        header.flags = load<std::uint16_t>(data_ + 8);
+        header.count = load<std::uint16_t>(data_ + 10);
+        data_ += BinaryProtocol::headerSize;
+        return true;
+    }
+
+    // readOperation(operation):
+    // Decodes the next operation, returns false if it is truncated
+    bool BinaryReader::readOperation(BinaryOperation& operation)
+    {
+        if (end_ - data_ < BinaryProtocol::operationSize)
+            return false;
+        const auto nameLength = load<std::uint8_t>(data_ + 2);
+        if (end_ - data_ < BinaryProtocol::operationSize + nameLength)
+            return false;
+
+        operation.code = load<std::uint8_t>(data_);
+        operation.status = load<std::uint8_t>(data_ + 1);
+        operation.nameLength = nameLength;
+        operation.value = load<std::uint64_t>(data_ + 4);
+        operation.name = data_ + BinaryProtocol::operationSize;
+        data_ += BinaryProtocol::operationSize + nameLength;
+        return true;
+    }
+
+    // writeHeader(header):
+    // Encodes the header, returns false if the buffer is too small
+    bool BinaryWriter::writeHeader(const BinaryHeader& header)
+    {
+        if (end_ - data_ < BinaryProtocol::headerSize)
+            return false;
+        store<std::uint16_t>(data_, BinaryProtocol::magic);
+        store<std::uint8_t>(data_ + 2, header.version);
+        store<std::uint8_t>(data_ + 3, header.opcode);
+        store<std::uint32_t>(data_ + 4, header.requestId);
+        store<std::uint16_t>(data_ + 8, header.flags);
+        store<std::uint16_t>(data_ + 10, header.count);
+        data_ += BinaryProtocol::headerSize;
+        return true;
+    }
+
+    // writeOperation(operation):
+    // Encodes an operation (and its name, if any), returns false if the buffer is too small
+    bool BinaryWriter::writeOperation(const BinaryOperation& operation)
+    {
+        if (end_ - data_ < BinaryProtocol::operationSize + operation.nameLength)
+            return false;
+        store<std::uint8_t>(data_, operation.code);
+        store<std::uint8_t>(data_ + 1, operation.status);
+        store<std::uint8_t>(data_ + 2, operation.nameLength);
+        store<std::uint8_t>(data_ + 3, 0);
+        store<std::uint64_t>(data_ + 4, operation.value);
+        if (operation.nameLength)
+            std::memcpy(data_ + BinaryProtocol::operationSize, operation.name, operation.nameLength);
+        data_ += BinaryProtocol::operationSize + operation.nameLength;
+        return true;
+    }
+
+    // setCount(count):
+    // Overwrites the count of operations of the encoded header
+    void BinaryWriter::setCount(std::uint16_t count)
+    {
+        store<std::uint16_t>(buffer_ + 10, count);
+    }
+
+} // namespace ocs
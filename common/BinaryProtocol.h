@@ -0,0 +1,174 @@
+#ifndef OCS_COMMON_BINARY_PROTOCOL_H
+#define OCS_COMMON_BINARY_PROTOCOL_H
+//
+// BinaryProtocol.h
+// ~~~~~~~~~~~~~~~~
+//
+// Header for the binary wire protocol, an alternative to the text protocol:
+// - BinaryProtocol structure: the protocol's constants (magic, version, codes...)
+// - BinaryHeader and BinaryOperation structures: the decoded parts of a datagram
+// - BinaryReader and BinaryWriter classes: decoding and encoding of datagrams, in
+//   caller-owned buffers (no allocation)
+//
+// A datagram is a fixed 12-byte header followed by 'count' operations, all integers
+// being little-endian:
+//      header:     magic (u16), version (u8), opcode (u8: request or reply),
+//                  request id (u32, echoed in the reply), flags (u16), count (u16)
+//      operation:  code (u8), status (u8: in replies), name length (u8), reserved (u8),
+//                  value (u64: increment in requests, result in replies),
+//                  followed by the name (requests only)
+// A reply holds one operation per operation of the request, in the same order.
+// The magic's first byte is not ASCII, so that the server tells both protocols apart
+// on each datagram.
+//
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ocs
+{
+
+    // BinaryProtocol structure:
+    // Defines the constants of the binary wire protocol
+    // No logic is required -> implemented as an open struct
+    struct BinaryProtocol
+    {
+        // magic number, and protocol version
+        enum : std::uint16_t { magic = 0xC0B1 };
+        enum : std::uint8_t { version = 1 };
+
+        // size of the header, and of an operation (without its name)
+        enum { headerSize = 12 };
+        enum { operationSize = 12 };
+
+        // datagram opcodes
+        enum Opcode : std::uint8_t
+        {
+            request = 1,
+            reply = 2
+        };
+
+        // datagram flags
+        enum Flags : std::uint16_t
+        {
+            rejected = 0x0001,  // reply: the request could not be decoded (bad version or opcode), count is 0
+            throttled = 0x0002  // reply: the request was refused by the server's rate limit, count is 0
+        };
+
+        // operation codes
+        enum Code : std::uint8_t
+        {
+            getQueries = 1,         // "GET": increments and returns the query count
+            getCounter = 2,         // "GET <name>": returns a named counter
+            incrementCounter = 3,   // "INCR <name> <n>": adds the value to a named counter, returns it
+            reserveQueries = 4,     // "GET <n>": advances the query count by the value, returns the first value of the range
+            peekQueries = 5         // "PEEK": returns the query count, without incrementing it
+        };
+
+        // operation statuses (replies)
+        enum Status : std::uint8_t
+        {
+            ok = 0,
+            failed = 1,             // the operation failed (overflow, persistence failure...)
+            unsupported = 2,        // unknown operation code
+            malformed = 3           // invalid argument (counter name, number of values to reserve), or
+                                    // truncated operation: the following ones were not processed
+        };
+
+        // detect(data, size):
+        // Returns true if a datagram uses the binary protocol (checks its magic)
+        static bool detect(const char* data, std::size_t size)
+        {
+            return size >= 2
+                && static_cast<unsigned char>(data[0]) == (magic & 0xFF)
+                && static_cast<unsigned char>(data[1]) == (magic >> 8);
+        }
+    };
+
+    // BinaryHeader structure:
+    // Decoded datagram header (the magic is implicit)
+    // No logic is required -> implemented as an open struct
+    struct BinaryHeader
+    {
+        std::uint8_t    version = BinaryProtocol::version;
+        std::uint8_t    opcode = BinaryProtocol::request;
+        std::uint32_t   requestId = 0;
+        std::uint16_t   flags = 0;
+        std::uint16_t   count = 0;
+    };
+
+    // BinaryOperation structure:
+    // Decoded operation; the name points into the decoded datagram
+    // No logic is required -> implemented as an open struct
+    struct BinaryOperation
+    {
+        std::uint8_t    code = 0;
+        std::uint8_t    status = BinaryProtocol::ok;
+        std::uint64_t   value = 0;
+        const char*     name = nullptr;
+        std::uint8_t    nameLength = 0;
+    };
+
+    // BinaryReader class:
+    // Decodes a datagram, in place
+    class BinaryReader
+    {
+    public:
+        // Ctor:
+        // Prepares the decoding of a datagram, which must outlive the reader
+        BinaryReader(const char* data, std::size_t size)
+        : data_(data)
+        , end_(data + size)
+        {}
+
+        // readHeader(header):
+        // Decodes the header, returns false if the datagram is too short or has a bad magic
+        bool readHeader(BinaryHeader& header);
+
+        // readOperation(operation):
+        // Decodes the next operation, returns false if it is truncated
+        bool readOperation(BinaryOperation& operation);
+
+    private:
+        const char*     data_;      // next byte to be decoded
+        const char*     end_;       // end of the datagram
+    };
+
+    // BinaryWriter class:
+    // Encodes a datagram into a caller-owned buffer
+    class BinaryWriter
+    {
+    public:
+        // Ctor:
+        // Prepares the encoding of a datagram into a buffer, which must outlive the writer
+        BinaryWriter(char* buffer, std::size_t capacity)
+        : buffer_(buffer)
+        , data_(buffer)
+        , end_(buffer + capacity)
+        {}
+
+        // writeHeader(header):
+        // Encodes the header, returns false if the buffer is too small
+        bool writeHeader(const BinaryHeader& header);
+
+        // writeOperation(operation):
+        // Encodes an operation (and its name, if any), returns false if the buffer is too small
+        bool writeOperation(const BinaryOperation& operation);
+
+        // setCount(count):
+        // Overwrites the count of operations of the encoded header
+        void setCount(std::uint16_t count);
+
+        // size():
+        // Returns the size of the encoded datagram
+        std::size_t size() const { return data_ - buffer_; }
+
+    private:
+        char*           buffer_;    // beginning of the datagram
+        char*           data_;      // next byte to be encoded
+        char*           end_;       // end of the buffer
+    };
+
+} // namespace ocs
+
+#endif // OCS_COMMON_BINARY_PROTOCOL_H
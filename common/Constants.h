@@ -21,6 +21,29 @@ namespace ocs
 
         // default size of reception buffers
         enum { defaultBufferSize = 1024 };
+
+        // maximum number of datagrams per batched receive/send (kernel's UIO_MAXIOV)
+        enum { maxBatchSize = 1024 };
+
+        // maximum size of a request framed on a stream (tcp) connection, far beyond the
+        // size of a datagram (see StreamProtocol)
+        enum { maxFrameSize = 1024 * 1024 };
+
+        // size of a cache line, used to pad the data shared between threads
+        enum { cacheLineSize = 64 };
+
+        // maximum size of the name of a named counter, in bytes
+        enum { maxCounterNameSize = 31 };
+
+        // maximum number of values reserved at once by a "GET <n>" request
+        enum { maxReservationSize = 1000000 };
+
+        // time spent by the kernel polling the device queue of a socket for its packets, in
+        // microseconds, in busy-poll mode (SO_BUSY_POLL)
+        enum { busyPollMicroseconds = 50 };
+
+        // maximum number of lines logged per second by each call site of the per-request error paths
+        enum { maxErrorLinesPerSecond = 10 };
     };
 
 } // namespace ocs
@@ -0,0 +1,82 @@
+//
+// LatencyHistogram.cpp
+// ~~~~~~~~~~~~~~~~~~~~
+//
+// Source for the LatencyHistogram class:
+// - records values in fixed log-linear buckets (1% precision)
+// - provides the percentiles, maximum and mean of the recorded values
+//
+#include "LatencyHistogram.h"
+#include <algorithm>
+#include <cmath>
+
+namespace ocs
+{
+
+    namespace
+    {
+        // Number of buckets: 2*subBuckets exact values, then subBuckets per power of two up to 2^64
+        const unsigned bucketCount = (64 - LatencyHistogram::subBucketBits + 1) * LatencyHistogram::subBuckets;
+    }
+
+    // Ctor:
+    // Initializes an empty histogram
+    LatencyHistogram::LatencyHistogram()
+    : buckets_(bucketCount, 0)
+    , count_(0)
+    , sum_(0)
+    , max_(0)
+    {
+    }
+
+    // merge(other):
+    // Adds the values recorded by another histogram
+    void LatencyHistogram::merge(const LatencyHistogram& other)
+    {
+        for (unsigned i = 0; i < bucketCount; ++i)
+            buckets_[i] += other.buckets_[i];
+        count_ += other.count_;
+        sum_ += other.sum_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    // reset():
+    // Forgets all the recorded values
+    void LatencyHistogram::reset()
+    {
+        std::fill(buckets_.begin(), buckets_.end(), 0);
+        count_ = 0;
+        sum_ = 0;
+        max_ = 0;
+    }
+
+    // percentile(percent):
+    // Returns the smallest value such that percent % of the recorded values are lower or equal
+    std::uint64_t LatencyHistogram::percentile(const double percent) const
+    {
+        if (count_ == 0)
+            return 0;
+        const auto rank = std::max<std::uint64_t>(1,
+            static_cast<std::uint64_t>(std::ceil(std::min(percent, 100.0) / 100.0 * count_)));
+        std::uint64_t seen = 0;
+        for (unsigned i = 0; i < bucketCount; ++i)
+        {
+            seen += buckets_[i];
+            if (seen >= rank)
+                return std::min(highestValue(i), max_);
+        }
+        return max_;
+    }
+
+    // highestValue(index):
+    // Returns the highest value of a bucket
+    std::uint64_t LatencyHistogram::highestValue(const unsigned index)
+    {
+        if (index < 2 * subBuckets)
+            return index;
+        const unsigned shift = index / subBuckets - 1;
+        const std::uint64_t top = index - shift * subBuckets;
+        return ((top + 1) << shift) - 1;
+    }
+
+} // namespace ocs
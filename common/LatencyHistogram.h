@@ -0,0 +1,90 @@
+#ifndef OCS_COMMON_LATENCY_HISTOGRAM_H
+#define OCS_COMMON_LATENCY_HISTOGRAM_H
+//
+// LatencyHistogram.h
+// ~~~~~~~~~~~~~~~~~~
+//
+// Header for the LatencyHistogram class:
+// - records latencies (or any non-negative integer values, e.g. in nanoseconds) in
+//   fixed log-linear buckets, as an HDR histogram does: each power-of-two range is split
+//   into 128 sub-buckets, so that every value is known within 1% (relative precision)
+// - recording costs a few instructions and never allocates
+// - provides the percentiles, maximum and mean of the recorded values
+// Not thread-safe: each thread records into its own histogram, and the histograms are merged
+//
+
+#include <cstdint>
+#include <vector>
+
+namespace ocs
+{
+
+    // LatencyHistogram class:
+    // - records values in fixed log-linear buckets (1% precision)
+    // - provides the percentiles, maximum and mean of the recorded values
+    class LatencyHistogram
+    {
+    public:
+        // Number of sub-buckets per power-of-two range, as a power of two
+        enum { subBucketBits = 7 };
+        enum { subBuckets = 1 << subBucketBits };
+
+        // Ctor:
+        // Initializes an empty histogram (about 60 KB of buckets)
+        LatencyHistogram();
+
+        // record(value):
+        // Records a value
+        void record(const std::uint64_t value)
+        {
+            ++buckets_[bucketIndex(value)];
+            ++count_;
+            sum_ += value;
+            if (value > max_)
+                max_ = value;
+        }
+
+        // merge(other):
+        // Adds the values recorded by another histogram
+        void merge(const LatencyHistogram& other);
+
+        // reset():
+        // Forgets all the recorded values
+        void reset();
+
+        // percentile(percent):
+        // Returns the smallest value such that percent % of the recorded values are lower
+        // or equal (within the 1% precision: the highest value of the matching bucket),
+        // 0 if no value was recorded
+        std::uint64_t percentile(const double percent) const;
+
+        // Accessors
+        std::uint64_t count() const    { return count_; }
+        std::uint64_t max() const      { return max_; }
+        double mean() const            { return count_ ? static_cast<double>(sum_) / count_ : 0.0; }
+
+    private:
+        // bucketIndex(value):
+        // Returns the index of the bucket of a value: the values below 2*subBuckets have
+        // their own buckets, the others are shifted down to their 'subBucketBits + 1' top bits
+        static unsigned bucketIndex(const std::uint64_t value)
+        {
+            if (value < 2 * subBuckets)
+                return static_cast<unsigned>(value);
+            const unsigned shift = 63 - __builtin_clzll(value) - subBucketBits;
+            return shift * subBuckets + static_cast<unsigned>(value >> shift);
+        }
+
+        // highestValue(index):
+        // Returns the highest value of a bucket
+        static std::uint64_t highestValue(const unsigned index);
+
+        std::vector<std::uint64_t>  buckets_;   // count of values per bucket
+        std::uint64_t               count_;     // count of values
+        std::uint64_t               sum_;       // sum of the values (for the mean)
+        std::uint64_t               max_;       // highest value (exact)
+    };
+
+} // namespace ocs
+
+#endif // OCS_COMMON_LATENCY_HISTOGRAM_H
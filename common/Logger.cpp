@@ -4,53 +4,525 @@
 //
 // Source for the Logger class, which serves two purposes:
 // In general: is meant to provide a thin wrapper around some concrete logger facility or library
-// Meant to allow for changing the logger (for e.g. Boost or Google) without too much 
+// Meant to allow for changing the logger (for e.g. Boost or Google) without too much
 // hassle in the client code
-// In my case: is meant to provide me with a logger despite the fact that the boost logger 
+// In my case: is meant to provide me with a logger despite the fact that the boost logger
 // is not willing to compile on my box ;-)
 //
+// The asynchronous mode relies on:
+// - LogRing: a single-producer/single-consumer ring of raw lines, one per logging thread
+// - LogBackend: the background thread, which drains all the rings, formats the lines
+//   and writes them to the standard error by batches
+//
 
 #include "Logger.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 namespace ocs
 {
 
-    // Static map of log-level names
-    const std::unordered_map<LogLevel,const std::string> Logger::logLevelTexts =
+    namespace
     {
-        {trace,"trace"},
-        {debug,"debug"},
-        {info,"info"},
-        {warning,"warning"},
-        {error,"error"},
-        {fatal,"fatal"},
-    };
+        // Log-level names, indexed by level - trace
+        const char* const logLevelTexts[] =
+        {
+            "trace",
+            "debug",
+            "info",
+            "warning",
+            "error",
+            "fatal",
+        };
+
+        // Header of a raw line: its level, size and count of suppressed lines,
+        // followed by the raw arguments
+        struct LineHeader
+        {
+            std::int8_t         level;
+            bool                truncated;
+            std::uint16_t       size;
+            unsigned long long  suppressed;
+        };
+
+        // appendDecimal(value, out):
+        // Appends the decimal digits of value to out (faster than snprintf)
+        void appendDecimal(unsigned long long value, std::string& out)
+        {
+            char digits[20];
+            auto first = digits + sizeof(digits);
+            do
+            {
+                *--first = static_cast<char>('0' + value % 10);
+                value /= 10;
+            }
+            while (value);
+            out.append(first, digits + sizeof(digits) - first);
+        }
+
+        // formatLine(header, arguments, out):
+        // Formats a raw line, appending it to out
+        void formatLine(const LineHeader& header, const char* arguments, std::string& out)
+        {
+            out += logLevelTexts[header.level - trace];
+            out += ": ";
+            std::size_t offset = 0;
+            while (offset < header.size)
+            {
+                const auto tag = static_cast<unsigned char>(arguments[offset++]);
+                switch (tag)
+                {
+                case Logger::signedTag:
+                {
+                    long long value;
+                    std::memcpy(&value, arguments + offset, sizeof(value));
+                    offset += sizeof(value);
+                    if (value < 0)
+                        out += '-';
+                    appendDecimal(value < 0 ? 0ULL - static_cast<unsigned long long>(value) : value, out);
+                    break;
+                }
+                case Logger::unsignedTag:
+                {
+                    unsigned long long value;
+                    std::memcpy(&value, arguments + offset, sizeof(value));
+                    offset += sizeof(value);
+                    appendDecimal(value, out);
+                    break;
+                }
+                case Logger::doubleTag:      // formatted as by an ostream's default settings
+                {
+                    double value;
+                    std::memcpy(&value, arguments + offset, sizeof(value));
+                    offset += sizeof(value);
+                    char number[32];
+                    out.append(number, std::snprintf(number, sizeof(number), "%g", value));
+                    break;
+                }
+                case Logger::charTag:
+                {
+                    out += arguments[offset];
+                    offset += sizeof(char);
+                    break;
+                }
+                default:                    // Logger::stringTag
+                {
+                    std::uint32_t length;
+                    std::memcpy(&length, arguments + offset, sizeof(length));
+                    offset += sizeof(length);
+                    out.append(arguments + offset, length);
+                    offset += length;
+                    break;
+                }
+                }
+            }
+            if (header.truncated)
+                out += "...";
+            if (header.suppressed)
+            {
+                out += " (";
+                appendDecimal(header.suppressed, out);
+                out += " similar lines suppressed)";
+            }
+            out += '\n';
+        }
+
+        // LogRing:
+        // Lock-free single-producer/single-consumer ring of raw lines (header + arguments)
+        // The positions are never wrapped, only their offset in the buffer is
+        class LogRing
+        {
+        public:
+            // Capacity of a ring, in bytes (a power of 2)
+            enum { capacity = 1 << 16 };
+
+            LogRing()
+            : head_(0)
+            , tail_(0)
+            , dropped_(0)
+            , closed_(false)
+            {
+            }
+
+            // push(header, arguments):
+            // Producer side: copies a raw line, returns false if the ring is full
+            bool push(const LineHeader& header, const char* arguments)
+            {
+                const auto tail = tail_.load(std::memory_order_relaxed);
+                const auto size = sizeof(header) + header.size;
+                if (capacity - (tail - head_.load(std::memory_order_acquire)) < size)
+                {
+                    dropped_.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                copyIn(tail, reinterpret_cast<const char*>(&header), sizeof(header));
+                copyIn(tail + sizeof(header), arguments, header.size);
+                tail_.store(tail + size, std::memory_order_release);
+                return true;
+            }
+
+            // drain(out):
+            // Consumer side: formats all the lines available, appending them to out
+            // Returns the number of lines formatted
+            std::size_t drain(std::string& out)
+            {
+                std::size_t lines = 0;
+                auto head = head_.load(std::memory_order_relaxed);
+                const auto tail = tail_.load(std::memory_order_acquire);
+                char arguments[Logger::maxLineSize];
+                while (head != tail)
+                {
+                    LineHeader header;
+                    copyOut(head, reinterpret_cast<char*>(&header), sizeof(header));
+                    copyOut(head + sizeof(header), arguments, header.size);
+                    head += sizeof(header) + header.size;
+                    formatLine(header, arguments, out);
+                    ++lines;
+                }
+                head_.store(head, std::memory_order_release);
+                return lines;
+            }
+
+            // Returns true if the ring holds no line
+            bool empty() const
+            {
+                return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+            }
+
+            // Accessors
+            unsigned long long dropped() const  { return dropped_.load(std::memory_order_relaxed); }
+            bool closed() const                 { return closed_.load(std::memory_order_acquire); }
+            void close()                        { closed_.store(true, std::memory_order_release); }
+
+        private:
+            // copyIn(position, data, size), copyOut(position, data, size):
+            // Copies bytes to/from the buffer, wrapping around its end
+            void copyIn(const unsigned long long position, const char* data, const std::size_t size)
+            {
+                const auto offset = position & (capacity - 1);
+                const auto first = std::min<std::size_t>(size, capacity - offset);
+                std::memcpy(buffer_ + offset, data, first);
+                std::memcpy(buffer_, data + first, size - first);
+            }
+            void copyOut(const unsigned long long position, char* data, const std::size_t size) const
+            {
+                const auto offset = position & (capacity - 1);
+                const auto first = std::min<std::size_t>(size, capacity - offset);
+                std::memcpy(data, buffer_ + offset, first);
+                std::memcpy(data + first, buffer_, size - first);
+            }
+
+            // The consumer's and producer's positions are kept on separate cache lines
+            alignas(64) std::atomic<unsigned long long>     head_;
+            alignas(64) std::atomic<unsigned long long>     tail_;
+            std::atomic<unsigned long long>                 dropped_;
+            std::atomic<bool>                               closed_;    // set when the producer thread exits
+            char                                            buffer_[capacity];
+        };
+
+        // LogBackend:
+        // Background thread of the asynchronous mode, and registry of the rings
+        class LogBackend
+        {
+        public:
+            LogBackend()
+            : stop_(false)
+            , sleeping_(false)
+            , flushRequested_(0)
+            , flushed_(0)
+            , dropped_(0)
+            , reportedDropped_(0)
+            {
+            }
+
+            ~LogBackend()
+            {
+                stop();
+            }
+
+            // start(): starts the background thread
+            void start()
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (thread_.joinable())
+                    return;
+                stop_ = false;
+                thread_ = std::thread([this] () { run(); });
+            }
+
+            // stop(): writes the pending lines and stops the background thread
+            void stop()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (!thread_.joinable())
+                        return;
+                    stop_ = true;
+                }
+                wakeup_.notify_one();
+                thread_.join();
+            }
+
+            // ring(): returns the calling thread's ring, registering it on first use
+            LogRing& ring()
+            {
+                // The holder closes the ring when the thread exits, the backend then discards it
+                struct Holder
+                {
+                    std::shared_ptr<LogRing> ring;
+                    ~Holder() { if (ring) ring->close(); }
+                };
+                static thread_local Holder holder;
+                if (!holder.ring)
+                {
+                    holder.ring = std::make_shared<LogRing>();
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    rings_.push_back(holder.ring);
+                }
+                return *holder.ring;
+            }
+
+            // notify(): wakes the background thread up if it is sleeping
+            // Lock-free, and only the first line after the background thread fell asleep pays
+            // for the wakeup: a missed wakeup only delays the line by the polling period
+            void notify()
+            {
+                if (sleeping_.load(std::memory_order_relaxed) && sleeping_.exchange(false, std::memory_order_relaxed))
+                    wakeup_.notify_one();
+            }
+
+            // flush(): waits until the lines pushed so far are written
+            void flush()
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                if (!thread_.joinable() || stop_)
+                    return;
+                const auto request = ++flushRequested_;
+                wakeup_.notify_one();
+                flushedCondition_.wait(lock, [&] () { return flushed_ >= request; });
+            }
+
+            // Returns the number of lines dropped so far
+            unsigned long long dropped() const
+            {
+                return dropped_.load(std::memory_order_relaxed);
+            }
+
+        private:
+            // Polling period when idle, bounding the delay of a missed wakeup
+            enum { pollingPeriod = 10 };
+
+            // run(): body of the background thread
+            void run()
+            {
+                std::vector<std::shared_ptr<LogRing>> rings;
+                std::string out;
+                while (true)
+                {
+                    // Snapshot the registry, and the requests to serve once this pass is written
+                    bool stopping;
+                    unsigned long long flushRequest;
+                    {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        stopping = stop_;
+                        flushRequest = flushRequested_;
+                        rings.assign(rings_.begin(), rings_.end());
+                    }
+
+                    // Format the lines of all the rings, then write them at once
+                    std::size_t lines = 0;
+                    unsigned long long dropped = 0;
+                    for (auto& ring : rings)
+                    {
+                        lines += ring->drain(out);
+                        dropped += ring->dropped();
+                    }
+                    dropped += retiredDropped_;
+                    dropped_.store(dropped, std::memory_order_relaxed);
+                    if (dropped > reportedDropped_)
+                    {
+                        out += "warning: ";
+                        out += std::to_string(dropped - reportedDropped_);
+                        out += " log lines dropped (log ring full)\n";
+                        reportedDropped_ = dropped;
+                    }
+                    if (!out.empty())
+                    {
+                        std::clog.rdbuf()->sputn(out.data(), out.size());
+                        std::clog.rdbuf()->pubsync();
+                        out.clear();
+                    }
+
+                    // Discard the rings of the exited threads, serve the flush requests
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    for (auto& ring : rings)
+                    {
+                        if (ring->closed() && ring->empty())
+                        {
+                            retiredDropped_ += ring->dropped();
+                            rings_.erase(std::find(rings_.begin(), rings_.end(), ring));
+                        }
+                    }
+                    rings.clear();
+                    if (stopping)
+                        flushRequest = flushRequested_;
+                    if (flushRequest > flushed_)
+                    {
+                        flushed_ = flushRequest;
+                        flushedCondition_.notify_all();
+                    }
+                    if (stopping)
+                        break;
+
+                    // Sleep when idle, until woken up by a producer, a flush or stop request
+                    if (lines == 0 && flushRequested_ == flushed_)
+                    {
+                        sleeping_.store(true, std::memory_order_relaxed);
+                        wakeup_.wait_for(lock, std::chrono::milliseconds(pollingPeriod));
+                        sleeping_.store(false, std::memory_order_relaxed);
+                    }
+                }
+            }
+
+            std::mutex                              mutex_;             // protects everything below but the atomics
+            std::condition_variable                 wakeup_;            // wakes the background thread up
+            std::condition_variable                 flushedCondition_;  // signals the served flush requests
+            std::thread                             thread_;
+            std::vector<std::shared_ptr<LogRing>>   rings_;             // registry of the threads' rings
+            bool                                    stop_;
+            std::atomic<bool>                       sleeping_;
+            unsigned long long                      flushRequested_;
+            unsigned long long                      flushed_;
+            std::atomic<unsigned long long>         dropped_;           // lines dropped so far
+            unsigned long long                      reportedDropped_ = 0;
+            unsigned long long                      retiredDropped_ = 0; // lines dropped by discarded rings
+        };
+
+        // backend(): returns the background thread's singleton, created on first use
+        LogBackend& backend()
+        {
+            static LogBackend instance;
+            return instance;
+        }
+
+    } // namespace
 
     // Static configuration setting for the minimum logging level
     LogLevel Logger::minLevel_ = info;
 
+    // Static flag: true in asynchronous mode
+    std::atomic<bool> Logger::async_(false);
 
-    // Ctor:
-    // Initializes the logging of a new log line
-    Logger::Logger(const LogLevel level)
-    : level_(level)
-    , os_( level>=LogLevel::warning ? std::cerr : std::clog )
+
+    // appendString(text, length):
+    // Records a string argument, truncated to the space left
+    void Logger::appendString(const char* text, std::size_t length)
     {
-        if (level_ >= minLevel_)
-        {    // Start logging only if log level >= minimum level setting
-            os_ << logLevelTexts.at(level) << ": ";
+        const auto header = 1 + sizeof(std::uint32_t);
+        if (size_ + header > sizeof(buffer_))
+        {
+            truncated_ = true;
+            return;
+        }
+        if (length > sizeof(buffer_) - size_ - header)
+        {
+            length = sizeof(buffer_) - size_ - header;
+            truncated_ = true;
         }
+        const auto length32 = static_cast<std::uint32_t>(length);
+        buffer_[size_] = static_cast<char>(stringTag);
+        std::memcpy(buffer_ + size_ + 1, &length32, sizeof(length32));
+        std::memcpy(buffer_ + size_ + header, text, length);
+        size_ += header + length;
+    }
+
+    // commit():
+    // Completes the line: formats and writes it, or hands it to the background thread
+    void Logger::commit()
+    {
+        LineHeader header;
+        header.level = static_cast<std::int8_t>(level_);
+        header.truncated = truncated_;
+        header.size = static_cast<std::uint16_t>(size_);
+        header.suppressed = suppressed_;
+
+        if (async_.load(std::memory_order_relaxed))
+        {
+            auto& logBackend = backend();
+            logBackend.ring().push(header, buffer_);
+            logBackend.notify();
+            if (level_ == fatal)
+                logBackend.flush();
+            return;
+        }
+
+        // Synchronous mode: the line is formatted into a per-thread buffer and written at once,
+        // straight to the stream's buffer (skipping the stream's sentry, and the flush of the tied cout)
+        static thread_local std::string out;
+        out.clear();
+        formatLine(header, buffer_, out);
+        auto buffer = (level_ >= warning ? std::cerr : std::clog).rdbuf();
+        buffer->sputn(out.data(), out.size());
+        buffer->pubsync();
+    }
+
+    // startAsync():
+    // Switches to the asynchronous mode, starting the background thread
+    void Logger::startAsync()
+    {
+        backend().start();
+        async_ = true;
     }
 
-    // Dtor:
-    // Finalizes the logging of a log line
-    Logger::~Logger()
+    // stopAsync():
+    // Writes the pending lines, stops the background thread and switches back to the synchronous mode
+    void Logger::stopAsync()
     {
-        if (level_ >= minLevel_)
-        {    // Finalize logging only if log level >= minimum level setting
-            os_ << std::endl;
+        async_ = false;
+        backend().stop();
+    }
+
+    // flush():
+    // In asynchronous mode, waits until the lines logged so far by this thread are written
+    void Logger::flush()
+    {
+        if (async_.load(std::memory_order_relaxed))
+            backend().flush();
+    }
+
+    // Returns the number of lines dropped so far because a ring was full
+    unsigned long long Logger::droppedLines()
+    {
+        return backend().dropped();
+    }
+
+
+    // acquire():
+    // Returns a granted permit, carrying the number of lines suppressed since the last
+    // granted one, if the call site may log one more line in the current second
+    LogRateLimiter::Permit LogRateLimiter::acquire()
+    {
+        const long long now = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        auto window = window_.load(std::memory_order_relaxed);
+        if (window != now && window_.compare_exchange_strong(window, now))
+            count_.store(0, std::memory_order_relaxed);
+
+        Permit permit;
+        if (count_.fetch_add(1, std::memory_order_relaxed) < limit_)
+        {
+            permit.granted = true;
+            permit.suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
         }
+        else
+            suppressed_.fetch_add(1, std::memory_order_relaxed);
+        return permit;
     }
 
 } // namespace ocs
@@ -7,15 +7,56 @@
 //
 // Header for the Logger class, which serves two purposes:
 // In general: is meant to provide a thin wrapper around some concrete logger facility or library
-// Meant to allow for changing the logger (for e.g. Boost or Google) without too much 
+// Meant to allow for changing the logger (for e.g. Boost or Google) without too much
 // hassle in the client code
-// In my case: is meant to provide me with a logger despite the fact that the boost logger 
+// In my case: is meant to provide me with a logger despite the fact that the boost logger
 // is not willing to compile on my box ;-)
 //
+// A log line is first recorded in raw form (the arguments' bytes, tagged with their type)
+// into a buffer owned by the Logger object, then formatted when the line is complete:
+// - in synchronous mode (the default), by the logging thread, which writes it with a single write
+// - in asynchronous mode (see startAsync()), by a background thread: the logging thread only
+//   copies the raw line into its own lock-free ring, and the background thread formats the
+//   lines of all the rings and writes them by batches
+//
+// The macros OCS_LOG(level) and OCS_LOG_RATE_LIMITED(level, linesPerSecond) are meant for
+// the hot paths: a line below the minimum level costs one branch, and its arguments are
+// not evaluated. Lines below OCS_LOG_MIN_LEVEL (a compile-time setting, e.g.
+// -DOCS_LOG_MIN_LEVEL=0 to drop the trace and debug lines) are compiled away.
+//
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <memory>
 #include <ostream>
-#include <unordered_map>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <boost/utility/string_view.hpp>
+
+// Compile-time minimum logging level (see LogLevel): trace by default, i.e. nothing compiled away
+#ifndef OCS_LOG_MIN_LEVEL
+#define OCS_LOG_MIN_LEVEL -2
+#endif
+
+// OCS_LOG(level):
+// Starts a log line, as in 'OCS_LOG(debug) << "Received " << size << " bytes";'
+// If the level is below the minimum level, costs one branch and skips the arguments' evaluation
+#define OCS_LOG(level) \
+    if (!::ocs::Logger::enabled(level)) {} else ::ocs::Logger(level)
+
+// OCS_LOG_RATE_LIMITED(level, linesPerSecond):
+// Same as OCS_LOG, for a call site logging at most linesPerSecond lines per second
+// (linesPerSecond must be a constant): the lines beyond are suppressed, and their count
+// is appended to the next line logged by the call site
+#define OCS_LOG_RATE_LIMITED(level, linesPerSecond) \
+    for (::ocs::LogRateLimiter::Permit ocsLogPermit_ = !::ocs::Logger::enabled(level) \
+            ? ::ocs::LogRateLimiter::Permit() \
+            : [] () -> ::ocs::LogRateLimiter& { static ::ocs::LogRateLimiter limiter(linesPerSecond); return limiter; } ().acquire(); \
+         ocsLogPermit_.granted; ocsLogPermit_.granted = false) \
+        ::ocs::Logger(level, ocsLogPermit_.suppressed)
 
 namespace ocs
 {
@@ -31,22 +72,37 @@ namespace ocs
         fatal
     };
 
-    // Logger: 
+    // Logger:
     // In general: is meant to provide a thin wrapper around some concrete logger facility or library
-    // Meant to allow for changing the logger (for e.g. Boost or Google) without too much 
+    // Meant to allow for changing the logger (for e.g. Boost or Google) without too much
     // hassle in the client code
-    // In my case: is meant to provide me with a logger despite the fact that the boost logger 
+    // In my case: is meant to provide me with a logger despite the fact that the boost logger
     // is not willing to compile on my box ;-)
     class Logger
     {
     public:
+        // Maximum size of a raw log line: the arguments beyond are truncated
+        enum { maxLineSize = 1024 };
+
         // Ctor:
         // Initializes the logging of a new log line
-        Logger(const LogLevel level);
+        // suppressed is the number of lines suppressed by a rate limiter (see OCS_LOG_RATE_LIMITED)
+        explicit Logger(const LogLevel level, const unsigned long long suppressed = 0)
+        : level_(level)
+        , enabled_(enabled(level))
+        , size_(0)
+        , truncated_(false)
+        , suppressed_(suppressed)
+        {
+        }
 
         // Dtor:
         // Finalizes the logging of a log line
-        ~Logger();
+        ~Logger()
+        {
+            if (enabled_)
+                commit();
+        }
 
         // insertion operator template:
         // Note: since a Logger is always meant to be used as a temporary
@@ -54,28 +110,153 @@ namespace ocs
         template<class T>
         friend Logger&& operator<<(Logger&& handler, const T& msg)
         {
-            if (handler.level_ >= Logger::minLevel_)
+            if (handler.enabled_)
             {    // Log msg only if log level >= minimum level setting
-                handler.os_ << msg;
+                handler.append(msg);
             }
             return std::move(handler);
         }
 
+        // enabled(level):
+        // Returns true if the lines of this level are logged
+        static bool enabled(const LogLevel level)
+        {
+            return level >= OCS_LOG_MIN_LEVEL && level >= minLevel_;
+        }
+
         // Setter for the minimum log level
         static void setMinLevel(const LogLevel value)
         {
             minLevel_ = value;
         }
 
+        // startAsync():
+        // Switches to the asynchronous mode, starting the background thread
+        static void startAsync();
+
+        // stopAsync():
+        // Writes the pending lines, stops the background thread and switches back to the
+        // synchronous mode. Meant to be called at shutdown, once the other threads are stopped
+        static void stopAsync();
+
+        // flush():
+        // In asynchronous mode, waits until the lines logged so far by this thread are written
+        // (fatal lines are flushed automatically)
+        static void flush();
+
+        // Returns the number of lines dropped so far because a ring was full (asynchronous mode only)
+        static unsigned long long droppedLines();
+
+        // Types of the raw arguments, each one recorded as its tag followed by its value
+        enum Tag : unsigned char
+        {
+            signedTag,      // long long
+            unsignedTag,    // unsigned long long
+            doubleTag,      // double
+            charTag,        // char
+            stringTag       // std::uint32_t length, followed by the characters
+        };
+
     private:
-        LogLevel        level_; // Logging level for the current line
-        std::ostream&   os_;    // stream for the current line (cout, cerr, ...)
+        // Raw recording of the arguments:
+        // The common types are recorded as is, the other ones are formatted by their operator<<
+        void append(const char* text)                   { appendString(text, std::strlen(text)); }
+        void append(const std::string& text)            { appendString(text.data(), text.size()); }
+        void append(const boost::string_view& text)     { appendString(text.data(), text.size()); }
+        void append(const char value)                   { appendValue(charTag, value); }
+        void append(const bool value)                   { appendValue(signedTag, static_cast<long long>(value)); }
+        void append(const short value)                  { appendValue(signedTag, static_cast<long long>(value)); }
+        void append(const int value)                    { appendValue(signedTag, static_cast<long long>(value)); }
+        void append(const long value)                   { appendValue(signedTag, static_cast<long long>(value)); }
+        void append(const long long value)              { appendValue(signedTag, value); }
+        void append(const unsigned short value)         { appendValue(unsignedTag, static_cast<unsigned long long>(value)); }
+        void append(const unsigned int value)           { appendValue(unsignedTag, static_cast<unsigned long long>(value)); }
+        void append(const unsigned long value)          { appendValue(unsignedTag, static_cast<unsigned long long>(value)); }
+        void append(const unsigned long long value)     { appendValue(unsignedTag, value); }
+        void append(const float value)                  { appendValue(doubleTag, static_cast<double>(value)); }
+        void append(const double value)                 { appendValue(doubleTag, value); }
+        template<class T>
+        void append(const T& value)
+        {
+            std::ostringstream os;
+            os << value;
+            const auto text = os.str();
+            appendString(text.data(), text.size());
+        }
+
+        // appendValue(tag, value):
+        // Records a fixed-size argument
+        template<class T>
+        void appendValue(const Tag tag, const T value)
+        {
+            static_assert(std::is_trivially_copyable<T>::value, "raw arguments must be trivially copyable");
+            if (size_ + 1 + sizeof(value) > sizeof(buffer_))
+            {
+                truncated_ = true;
+                return;
+            }
+            buffer_[size_] = static_cast<char>(tag);
+            std::memcpy(buffer_ + size_ + 1, &value, sizeof(value));
+            size_ += 1 + sizeof(value);
+        }
 
-        // Static map of log-level names
-        static const std::unordered_map<LogLevel,const std::string> logLevelTexts;
+        // appendString(text, length):
+        // Records a string argument, truncated to the space left
+        void appendString(const char* text, std::size_t length);
+
+        // commit():
+        // Completes the line: formats and writes it, or hands it to the background thread
+        void commit();
+
+        LogLevel            level_;             // Logging level for the current line
+        bool                enabled_;           // true if the current line is logged
+        std::size_t         size_;              // size of the raw arguments recorded so far
+        bool                truncated_;         // true if some arguments did not fit
+        unsigned long long  suppressed_;        // number of lines suppressed by a rate limiter
+        char                buffer_[maxLineSize]; // raw arguments (uninitialized)
 
         // Static configuration setting for the minimum logging level
         static LogLevel minLevel_;
+
+        // Static flag: true in asynchronous mode
+        static std::atomic<bool> async_;
+    };
+
+    // LogRateLimiter:
+    // Per-call-site limiter of the number of lines logged per second (see OCS_LOG_RATE_LIMITED)
+    // Thread-safe and lock-free, with a fixed one-second window (approximate under contention)
+    class LogRateLimiter
+    {
+    public:
+        // Permit structure:
+        // Outcome of acquire(): whether the line may be logged, and how many were suppressed before it
+        // No logic is required -> implemented as an open struct
+        struct Permit
+        {
+            bool                granted = false;
+            unsigned long long  suppressed = 0;
+        };
+
+        // Ctor:
+        // Initializes a limiter of linesPerSecond lines per second
+        explicit LogRateLimiter(const unsigned linesPerSecond)
+        : limit_(linesPerSecond)
+        , window_(0)
+        , count_(0)
+        , suppressed_(0)
+        {
+        }
+
+        // acquire():
+        // Returns a granted permit, carrying the number of lines suppressed since the last
+        // granted one, if the call site may log one more line in the current second
+        Permit acquire();
+
+    private:
+        const unsigned                      limit_;         // lines per second
+        std::atomic<long long>              window_;        // current window, in seconds
+        std::atomic<unsigned>               count_;         // lines requested in the current window
+        std::atomic<unsigned long long>     suppressed_;    // lines suppressed since the last granted one
     };
 
 } // namespace ocs
@@ -0,0 +1,62 @@
+//
+// StreamProtocol.cpp
+// ~~~~~~~~~~~~~~~~~~
+//
+// Source for the framing of the requests and replies on a stream (tcp) connection:
+// text lines, or binary datagrams delimited by their own header and operations
+//
+
+#include "StreamProtocol.h"
+#include <algorithm>
+#include <cstring>
+#include "BinaryProtocol.h"
+#include "Constants.h"
+
+namespace ocs
+{
+
+    // nextFrame(data, size, frameSize, payloadSize):
+    // Frames the first request (or reply) of the data received so far
+    // A binary datagram is walked operation by operation (12-byte header, then 12 bytes
+    // plus the name per operation, the name length being the operation's third byte)
+    StreamProtocol::Status StreamProtocol::nextFrame(const char* data, std::size_t size, std::size_t& frameSize, std::size_t& payloadSize)
+    {
+        if (isBinary(data, size))
+        {
+            if (size < BinaryProtocol::headerSize)
+                return incomplete;
+            const std::size_t count = static_cast<unsigned char>(data[10]) | static_cast<unsigned char>(data[11]) << 8;
+            std::size_t end = BinaryProtocol::headerSize;
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                if (end + 3 > size)
+                    return end + 3 > Constants::maxFrameSize ? invalid : incomplete;
+                end += BinaryProtocol::operationSize + static_cast<unsigned char>(data[end + 2]);
+            }
+            if (end > Constants::maxFrameSize)
+                return invalid;
+            if (end > size)
+                return incomplete;
+            frameSize = payloadSize = end;
+            return complete;
+        }
+
+        const auto* const newline = static_cast<const char*>(std::memchr(data, '\n', std::min<std::size_t>(size, Constants::maxFrameSize)));
+        if (!newline)
+            return size >= Constants::maxFrameSize ? invalid : incomplete;
+        frameSize = newline - data + 1;
+        payloadSize = newline - data;
+        if (payloadSize && data[payloadSize - 1] == '\r')
+            --payloadSize;
+        return complete;
+    }
+
+    // isBinary(data, size):
+    // Returns true if a frame (or the data received so far) is a binary datagram:
+    // its first byte is the first byte of the magic, which no text command starts with
+    bool StreamProtocol::isBinary(const char* data, std::size_t size)
+    {
+        return size && static_cast<unsigned char>(data[0]) == (BinaryProtocol::magic & 0xFF);
+    }
+
+} // namespace ocs
@@ -0,0 +1,50 @@
+#ifndef OCS_COMMON_STREAM_PROTOCOL_H
+#define OCS_COMMON_STREAM_PROTOCOL_H
+//
+// StreamProtocol.h
+// ~~~~~~~~~~~~~~~~
+//
+// Header for the framing of the requests and replies on a stream (tcp) connection,
+// on which the clients pipeline many requests without waiting for the replies:
+// - a text command (or reply) is a line, terminated by '\n' (a '\r' before it is ignored);
+//   on a stream, a reply of several lines ("STATS") is terminated by an empty line
+// - a binary request (or reply) is a datagram of the binary protocol, recognized by its
+//   magic, whose first byte is not ASCII: its length follows from the count of its header
+//   and from the name length of each of its operations, so that it needs no delimiter
+// - a frame is at most Constants::maxFrameSize bytes
+// The replies are sent in the order of the requests.
+//
+
+#include <cstddef>
+
+namespace ocs
+{
+
+    // StreamProtocol structure:
+    // Framing of the requests and replies on a stream connection
+    // No logic is required -> implemented as an open struct
+    struct StreamProtocol
+    {
+        // Status enumeration:
+        // Outcome of the framing of the data received so far
+        enum Status
+        {
+            complete,       // the data starts with a complete frame
+            incomplete,     // more data is needed
+            invalid         // the frame exceeds Constants::maxFrameSize: the stream cannot be resynchronized
+        };
+
+        // nextFrame(data, size, frameSize, payloadSize):
+        // Frames the first request (or reply) of the data received so far: on complete,
+        // sets the size of the frame, and the size of its payload (the frame without the
+        // line terminator of a text command)
+        static Status nextFrame(const char* data, std::size_t size, std::size_t& frameSize, std::size_t& payloadSize);
+
+        // isBinary(data, size):
+        // Returns true if a frame (or the data received so far) is a binary datagram
+        static bool isBinary(const char* data, std::size_t size);
+    };
+
+} // namespace ocs
+
+#endif // OCS_COMMON_STREAM_PROTOCOL_H
@@ -0,0 +1,228 @@
+//
+// AdmissionControl.cpp
+// ~~~~~~~~~~~~~~~~~~~~
+//
+// Source for the AdmissionControl class:
+// - per-client rate limiting, with the token buckets of the clients kept in a
+//   process-wide fixed-size table
+// - load shedding, on the filling of the receive queue of a socket
+//
+#include "AdmissionControl.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <vector>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#ifdef __linux__
+#include <linux/sock_diag.h>
+#endif
+#include "Constants.h"
+#include "CounterTable.h"
+#include "ServerStats.h"
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    bool AdmissionControl::limited_ = false;
+
+    // Table structure:
+    // Token buckets of the clients, in a set-associative table: a client may only be
+    // stored in the ways of the set selected by its hash, so that a lookup touches a
+    // single cache line, and a new client evicts the least recently active one of its set
+    // Each bucket is kept as its theoretical arrival time (generic cell rate algorithm):
+    // the time at which the bucket will be full again, each request pushing it by the
+    // interval between two requests at the sustained rate, and a request being refused
+    // if it would push it more than the burst ahead of now
+    // The sets are spread across shards, each one with its own mutex
+    struct AdmissionControl::Table
+    {
+        // Number of ways per set, and of shards (powers of 2)
+        enum { ways = 4 };
+        enum { shards = 64 };
+
+        // Entry structure:
+        // The bucket of a client, identified by the hash of its address (0 for an empty entry)
+        struct Entry
+        {
+            std::uint64_t   key;
+            std::uint64_t   arrival;    // theoretical arrival time, in nanoseconds
+        };
+
+        // Set structure:
+        // The ways of a set (a cache line)
+        struct Set
+        {
+            std::array<Entry, ways> entries;
+        };
+
+        // Shard structure:
+        // A mutex, padded so that no two mutexes share a cache line
+        struct Shard
+        {
+            std::mutex      mutex;
+            char            padding[Constants::cacheLineSize];
+        };
+
+        std::vector<Set>                sets;
+        std::uint64_t                   mask;           // number of sets - 1
+        std::uint64_t                   interval;       // time between two requests at the sustained rate, in nanoseconds
+        std::uint64_t                   tolerance;      // advance of the arrival time allowed by the burst, in nanoseconds
+        std::array<Shard, shards>       locks;
+    };
+
+    namespace
+    {
+        // nowNanoseconds():
+        // Returns the current time, in nanoseconds (steady clock)
+        std::uint64_t nowNanoseconds()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        // clientKey(address, size):
+        // Returns the key of a client address: the hash of its ip address (the port being
+        // ignored, so that a client cannot escape its limit by opening more sockets), or
+        // of its path for a unix domain socket; never 0
+        std::uint64_t clientKey(const void* address, std::size_t size)
+        {
+            const auto* const bytes = static_cast<const char*>(address);
+            const auto family = size >= sizeof(sa_family_t) ? reinterpret_cast<const sockaddr*>(address)->sa_family : AF_UNSPEC;
+            std::uint64_t hash;
+            if (family == AF_INET6 && size >= sizeof(sockaddr_in6))
+                hash = CounterTable::hash(bytes + offsetof(sockaddr_in6, sin6_addr), sizeof(in6_addr));
+            else if (family == AF_INET && size >= sizeof(sockaddr_in))
+                hash = CounterTable::hash(bytes + offsetof(sockaddr_in, sin_addr), sizeof(in_addr));
+            else if (family == AF_UNIX && size > offsetof(sockaddr_un, sun_path))
+                hash = CounterTable::hash(bytes + offsetof(sockaddr_un, sun_path), size - offsetof(sockaddr_un, sun_path));
+            else
+                hash = CounterTable::hash(bytes, size);
+            return hash ? hash : 1;
+        }
+    }
+
+    std::unique_ptr<AdmissionControl::Table> AdmissionControl::table_;
+
+
+    // enable(configuration):
+    // Enables the rate limiting of the clients, if configured: the table holds at least
+    // '--client-table-size' clients, in sets of 4 ways; or else disables it
+    // The table of a previous invocation is released (each invocation starts afresh)
+    // Caution: must be invoked at startup, before the threads are started
+    void AdmissionControl::enable(const Configuration& configuration)
+    {
+        limited_ = false;
+        table_.reset();
+        if (!configuration.clientRate)
+            return;
+
+        std::size_t sets = 1;
+        while (sets * Table::ways < configuration.clientTableSize)
+            sets *= 2;
+        table_.reset(new Table());
+        table_->sets.resize(sets);
+        table_->mask = sets - 1;
+        table_->interval = std::max<std::uint64_t>(1, 1000000000ULL / configuration.clientRate);
+        table_->tolerance = table_->interval * (std::max<unsigned long>(1, configuration.clientBurst) - 1);
+        limited_ = true;
+    }
+
+    // Ctor:
+    // Prepares the admission control of the requests of a socket
+    AdmissionControl::AdmissionControl(const Configuration& configuration)
+     : threshold_(configuration.shedThreshold)
+     , silent_(configuration.throttleSilently)
+     , countdown_(0)
+     , shedding_(false)
+    {
+    }
+
+    // admitClient(address, size):
+    // Takes a token from the bucket of a client, returns false if it is empty, counting
+    // the request as throttled
+    // A new client replaces an empty way of its set, or else the way whose arrival time
+    // is the oldest: the least recently active client, whose bucket is the fullest, so
+    // that its eviction loses the least (it would find a full bucket anyway)
+    bool AdmissionControl::admitClient(const void* address, std::size_t size)
+    {
+        auto& table = *table_;
+        const auto key = clientKey(address, size);
+        const auto index = key & table.mask;
+        auto& set = table.sets[index];
+        const auto now = nowNanoseconds();
+
+        std::lock_guard<std::mutex> lock(table.locks[index & (Table::shards - 1)].mutex);
+        Table::Entry* entry = nullptr;
+        for (auto& way : set.entries)
+        {
+            if (way.key == key)
+            {
+                entry = &way;
+                break;
+            }
+        }
+        if (!entry)
+        {
+            entry = &set.entries[0];
+            for (auto& way : set.entries)
+            {
+                if (!way.key || way.arrival < entry->arrival)
+                    entry = &way;
+                if (!way.key)
+                    break;
+            }
+            ServerStats::add(entry->key ? ServerStats::admissionEvictions : ServerStats::admissionClients);
+            entry->key = key;
+            entry->arrival = now;
+        }
+
+        const auto arrival = std::max(entry->arrival, now);
+        if (arrival - now > table.tolerance)
+        {
+            ServerStats::add(ServerStats::throttled);
+            return false;
+        }
+        entry->arrival = arrival + table.interval;
+        return true;
+    }
+
+    // shedding(socket):
+    // Returns true while the receive queue of the socket is filled above the threshold,
+    // counting the request as shed
+    // The queue is measured every checkInterval requests (SO_MEMINFO: the memory of the
+    // datagrams queued, against the receive buffer size), the requests being shed from
+    // the threshold until the queue falls below half of it
+    // While shedding, the queue is measured on each request: a stale measurement would
+    // otherwise keep shedding the few requests following a burst
+    // Note: the datagrams of a unix domain socket are charged to their sender, its
+    // receive queue is never found filled
+    bool AdmissionControl::shedding(int socket)
+    {
+#if defined(__linux__) && defined(SO_MEMINFO)
+        if (countdown_ == 0 || shedding_)
+        {
+            countdown_ = checkInterval;
+            std::uint32_t memory[SK_MEMINFO_VARS];
+            socklen_t length = sizeof(memory);
+            if (::getsockopt(socket, SOL_SOCKET, SO_MEMINFO, memory, &length) == 0 && memory[SK_MEMINFO_RCVBUF])
+            {
+                const auto filling = 100ULL * memory[SK_MEMINFO_RMEM_ALLOC] / memory[SK_MEMINFO_RCVBUF];
+                shedding_ = filling >= (shedding_ ? threshold_ / 2 : threshold_);
+            }
+        }
+        --countdown_;
+#else
+        (void)socket;
+#endif
+        if (shedding_)
+            ServerStats::add(ServerStats::shed);
+        return shedding_;
+    }
+
+} // namespace CountersServer
+} // namespace ocs
@@ -0,0 +1,109 @@
+#ifndef OCS_COUNTERS_SERVER_ADMISSION_CONTROL_H
+#define OCS_COUNTERS_SERVER_ADMISSION_CONTROL_H
+//
+// AdmissionControl.h
+// ~~~~~~~~~~~~~~~~~~
+//
+// Header for the AdmissionControl class:
+// - per-client rate limiting ('--client-rate', '--client-burst'): each client address
+//   owns a token bucket, kept in a process-wide fixed-size table shared by all the
+//   workers ('--client-table-size'), the least recently active clients being evicted
+// - load shedding ('--shed-threshold'): the requests are dropped while the receive
+//   queue of their socket is filled above a threshold
+// - the servers check each request before dispatching it: the throttled requests are
+//   answered with a cheap error (see CountersServerDispatcher::rejectCommand()), or
+//   dropped ('--throttle-silently'), the shed requests are dropped
+//
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include "Configuration.h"
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    // AdmissionControl class:
+    // - decides whether the requests received on a socket are dispatched, answered with
+    //   an error, or dropped
+    // - the token buckets of the clients are process-wide (see enable()), the load
+    //   shedding state belongs to each instance (one per socket)
+    // Note: an instance is not thread-safe, it is used by the thread serving its socket
+    class AdmissionControl
+    {
+    public:
+        // Decision enumeration:
+        // Fate of a request
+        enum Decision
+        {
+            admit,      // the request is dispatched
+            reject,     // the request is throttled, and answered with an error
+            drop        // the request is dropped without a reply (throttled silently, or shed)
+        };
+
+        // limited():
+        // Returns true if the clients are rate limited: the single branch of the request
+        // path when the admission control is disabled
+        static bool limited()
+        {
+            return limited_;
+        }
+
+        // enable(configuration):
+        // Enables the rate limiting of the clients, if configured, with a table of
+        // '--client-table-size' clients, or else disables it
+        // The table of a previous invocation is released (each invocation starts afresh)
+        // Caution: must be invoked at startup, before the threads are started
+        static void enable(const Configuration& configuration);
+
+        // Ctor:
+        // Prepares the admission control of the requests of a socket
+        explicit AdmissionControl(const Configuration& configuration);
+
+        // check(socket, address, size):
+        // Returns the fate of a request received on a socket from a client address (a
+        // socket address of the given size)
+        // Counts the requests throttled and shed, for the "STATS" command
+        Decision check(int socket, const void* address, std::size_t size)
+        {
+            if (threshold_ && shedding(socket))
+                return drop;
+            if (!limited_ || admitClient(address, size))
+                return admit;
+            return silent_ ? drop : reject;
+        }
+
+        // admitClient(address, size):
+        // Takes a token from the bucket of a client (a socket address of the given size),
+        // returns false if it is empty, counting the request as throttled
+        // Caution: the clients must be rate limited (see limited())
+        static bool admitClient(const void* address, std::size_t size);
+
+    private:
+        // Table structure (see AdmissionControl.cpp)
+        struct Table;
+
+        // shedding(socket):
+        // Returns true while the receive queue of the socket is filled above the threshold,
+        // counting the request as shed (the queue is measured every checkInterval requests,
+        // and on each request while shedding)
+        bool shedding(int socket);
+
+        // Number of requests between two measurements of the receive queue
+        enum { checkInterval = 64 };
+
+        static bool                     limited_;       // true if the clients are rate limited
+        static std::unique_ptr<Table>   table_;         // token buckets of the clients
+
+        const unsigned                  threshold_;     // receive queue filling, in percent, above which the requests are shed (0: never)
+        const bool                      silent_;        // drop the throttled requests instead of answering them
+        unsigned                        countdown_;     // requests until the next measurement of the receive queue
+        bool                            shedding_;      // receive queue filled above the threshold at the last measurement
+    };
+
+} // namespace CountersServer
+} // namespace ocs
+
+#endif // OCS_COUNTERS_SERVER_ADMISSION_CONTROL_H
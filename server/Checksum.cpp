@@ -0,0 +1,47 @@
+//
+// Checksum.cpp
+// ~~~~~~~~~~~~
+//
+// Source for the checksum functions used to validate the persistent storage files:
+// - 64-bit FNV-1a hash of a memory block: not cryptographic, but cheap and good
+//   enough to detect torn or corrupted records
+// - 64-bit mix of two words: much cheaper than hashing their bytes, meant for the
+//   small fixed-size records which are checked by the millions on recovery
+//
+#include "Checksum.h"
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    // checksum(data, size):
+    // Returns the 64-bit FNV-1a hash of a memory block
+    unsigned long long checksum(const void* data, std::size_t size)
+    {
+        const auto* bytes = static_cast<const unsigned char*>(data);
+        unsigned long long hash = 14695981039346656037ULL;
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    // checksum(first, second):
+    // Returns a 64-bit hash of two words (multiply-xorshift mix)
+    // Note: the constant offset makes the checksum of a zero-filled record non-zero
+    unsigned long long checksum(unsigned long long first, unsigned long long second)
+    {
+        auto hash = (first ^ 0x2545F4914F6CDD1DULL) * 0x9E3779B97F4A7C15ULL ^ second;
+        hash ^= hash >> 33;
+        hash *= 0xFF51AFD7ED558CCDULL;
+        hash ^= hash >> 33;
+        hash *= 0xC4CEB9FE1A85EC53ULL;
+        hash ^= hash >> 33;
+        return hash;
+    }
+
+} // namespace CountersServer
+} // namespace ocs
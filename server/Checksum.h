@@ -0,0 +1,32 @@
+#ifndef OCS_COUNTERS_SERVER_CHECKSUM_H
+#define OCS_COUNTERS_SERVER_CHECKSUM_H
+//
+// Checksum.h
+// ~~~~~~~~~~
+//
+// Header for the checksum functions used to validate the persistent storage files:
+// - 64-bit FNV-1a hash of a memory block: not cryptographic, but cheap and good
+//   enough to detect torn or corrupted records
+// - 64-bit mix of two words: much cheaper than hashing their bytes, meant for the
+//   small fixed-size records which are checked by the millions on recovery
+//
+
+#include <cstddef>
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    // checksum(data, size):
+    // Returns the 64-bit FNV-1a hash of a memory block
+    unsigned long long checksum(const void* data, std::size_t size);
+
+    // checksum(first, second):
+    // Returns a 64-bit hash of two words (multiply-xorshift mix)
+    unsigned long long checksum(unsigned long long first, unsigned long long second);
+
+} // namespace CountersServer
+} // namespace ocs
+
+#endif // OCS_COUNTERS_SERVER_CHECKSUM_H
@@ -0,0 +1,256 @@
+#ifndef OCS_COUNTERS_SERVER_COMMAND_TABLE_H
+#define OCS_COUNTERS_SERVER_COMMAND_TABLE_H
+//
+// CommandTable.h
+// ~~~~~~~~~~~~~~
+//
+// Header for the CommandTable class template:
+// - lookup table of the text commands, built at compile time from a constexpr list of
+//   commands (name of the first word, number of words, handler)
+// - the commands are found with a perfect hash: the seed of the hash function is
+//   searched at compile time, so that no two commands share a slot
+// - a lookup costs a hash of the first word and a single comparison, whatever the
+//   number of commands
+//
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <boost/utility/string_view.hpp>
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    // Indices, MakeIndices<N>:
+    // Compile-time sequence of the indices 0 to N - 1 (std::index_sequence, before C++14),
+    // built by halves so that the instantiation depth is log2(N)
+    template<std::size_t... I>
+    struct Indices
+    {
+    };
+
+    template<class First, class Second>
+    struct ConcatIndices;
+
+    template<std::size_t... I, std::size_t... J>
+    struct ConcatIndices<Indices<I...>, Indices<J...>>
+    {
+        typedef Indices<I..., (sizeof...(I) + J)...> type;
+    };
+
+    template<std::size_t N>
+    struct MakeIndices : ConcatIndices<typename MakeIndices<N / 2>::type, typename MakeIndices<N - N / 2>::type>
+    {
+    };
+
+    template<>
+    struct MakeIndices<0>
+    {
+        typedef Indices<> type;
+    };
+
+    template<>
+    struct MakeIndices<1>
+    {
+        typedef Indices<0> type;
+    };
+
+    // CommandEntry structure:
+    // A command of a CommandTable: the name of its first word, its number of words (the
+    // name included), and its handler (any literal type, e.g. a pointer to member function)
+    template<class Handler>
+    struct CommandEntry
+    {
+        constexpr CommandEntry(const char* name, std::size_t words, Handler handler)
+        : name(name)
+        , length(nameLength(name))
+        , words(words)
+        , handler(handler)
+        {}
+
+        // nameLength(name):
+        // Returns the length of a name (std::strlen, at compile time)
+        static constexpr std::size_t nameLength(const char* name)
+        {
+            return *name ? 1 + nameLength(name + 1) : 0;
+        }
+
+        const char*     name;
+        std::size_t     length;
+        std::size_t     words;
+        Handler         handler;
+    };
+
+    // FixedArray structure:
+    // Array built at compile time (std::array, whose accessors are not constexpr before C++14)
+    template<class T, std::size_t N>
+    struct FixedArray
+    {
+        T values[N];
+    };
+
+    // CommandHash structure template:
+    // Compile-time logic of a CommandTable (kept apart, so that the table's constants can
+    // be evaluated by the functions of a complete class):
+    // - hash of a command: FNV-1a of its first word, from a seeded basis, then of its
+    //   number of words; evaluated at compile time for the slots, and at run time for
+    //   the lookups
+    // - search of the first seed which gives distinct slots to all the commands
+    template<class Commands>
+    struct CommandHash
+    {
+        // Index of an empty slot, and number of seeds tried
+        enum { empty = 255 };
+        enum { maxSeed = 64 };
+
+        // count():
+        // Returns the number of commands
+        static constexpr std::size_t count()
+        {
+            return sizeof(Commands::entries) / sizeof(Commands::entries[0]);
+        }
+
+        // slots():
+        // Returns the number of slots: a power of 2, at least the square of the number of
+        // commands, so that a seed without collisions is found after a few attempts
+        static constexpr std::size_t slots()
+        {
+            return roundUp(count() * count() < 16 ? 16 : count() * count());
+        }
+
+        // roundUp(value):
+        // Returns the lowest power of 2 not below a value
+        static constexpr std::size_t roundUp(std::size_t value, std::size_t power = 1)
+        {
+            return power >= value ? power : roundUp(value, power * 2);
+        }
+
+        // hash(name, length, words, seed):
+        // Returns the hash of a command
+        static constexpr std::uint32_t hash(const char* name, std::size_t length, std::size_t words, std::uint32_t seed)
+        {
+            return hashBytes(name, length, 2166136261u + seed * 0x9E3779B9u) ^ static_cast<std::uint32_t>(words) * 0x85EBCA6Bu;
+        }
+
+        static constexpr std::uint32_t hashBytes(const char* bytes, std::size_t length, std::uint32_t hash)
+        {
+            return length ? hashBytes(bytes + 1, length - 1, (hash ^ static_cast<unsigned char>(*bytes)) * 16777619u) : hash;
+        }
+
+        // slot(hash):
+        // Returns the slot of a hash (its mixed lowest bits)
+        static constexpr std::size_t slot(std::uint32_t hash)
+        {
+            return (hash ^ (hash >> 16)) & (slots() - 1);
+        }
+
+        // entrySlot(index, seed):
+        // Returns the slot of a command, for a seed
+        static constexpr std::size_t entrySlot(std::size_t index, std::uint32_t seed)
+        {
+            return slot(hash(Commands::entries[index].name, Commands::entries[index].length, Commands::entries[index].words, seed));
+        }
+
+        // distinct(index, other, seed):
+        // Returns true if the slot of a command differs from those of the commands from other on
+        static constexpr bool distinct(std::size_t index, std::size_t other, std::uint32_t seed)
+        {
+            return other == count() || (entrySlot(index, seed) != entrySlot(other, seed) && distinct(index, other + 1, seed));
+        }
+
+        // perfect(seed, index):
+        // Returns true if the commands from index on have distinct slots, for a seed
+        static constexpr bool perfect(std::uint32_t seed, std::size_t index = 0)
+        {
+            return index == count() || (distinct(index, index + 1, seed) && perfect(seed, index + 1));
+        }
+
+        // findSeed(seed):
+        // Returns the first seed from the given one which gives distinct slots to all the
+        // commands (maxSeed if none is found)
+        static constexpr std::uint32_t findSeed(std::uint32_t seed)
+        {
+            return seed == maxSeed || perfect(seed) ? seed : findSeed(seed + 1);
+        }
+
+        // makeEntrySlots(seed, indices):
+        // Returns the slot of each command, for a seed
+        template<std::size_t... I>
+        static constexpr FixedArray<std::uint16_t, sizeof...(I)> makeEntrySlots(std::uint32_t seed, Indices<I...>)
+        {
+            return FixedArray<std::uint16_t, sizeof...(I)>{ { static_cast<std::uint16_t>(entrySlot(I, seed))... } };
+        }
+
+        // slotIndex(slot, entrySlots, index):
+        // Returns the command of a slot, searched from index on (empty if none)
+        template<std::size_t N>
+        static constexpr std::uint8_t slotIndex(std::size_t slot, const FixedArray<std::uint16_t, N>& entrySlots, std::size_t index = 0)
+        {
+            return index == N ? static_cast<std::uint8_t>(empty)
+                 : entrySlots.values[index] == slot ? static_cast<std::uint8_t>(index)
+                 : slotIndex(slot, entrySlots, index + 1);
+        }
+
+        // makeSlots(entrySlots, indices):
+        // Returns the slots of the table: the command of each slot
+        template<std::size_t N, std::size_t... S>
+        static constexpr FixedArray<std::uint8_t, sizeof...(S)> makeSlots(const FixedArray<std::uint16_t, N>& entrySlots, Indices<S...>)
+        {
+            return FixedArray<std::uint8_t, sizeof...(S)>{ { slotIndex(S, entrySlots)... } };
+        }
+    };
+
+    // CommandTable class template:
+    // - lookup table of the commands listed by Commands::entries, a constexpr array of
+    //   CommandEntry<Commands::Handler> (adding a command means adding an entry there)
+    // - the seed of the perfect hash is searched at compile time, and the build fails
+    //   if no seed is found
+    // Note: the commands are identified by their first word and their number of words,
+    // so that "GET" and "GET <name>" may have their own handlers
+    template<class Commands>
+    class CommandTable
+    {
+    public:
+        typedef typename Commands::Handler      Handler;
+        typedef CommandEntry<Handler>           Entry;
+        typedef CommandHash<Commands>           Hash;
+
+        // Number of commands, number of slots, and seed of the perfect hash
+        static constexpr std::size_t count = Hash::count();
+        static constexpr std::size_t slots = Hash::slots();
+        static constexpr std::uint32_t seed = Hash::findSeed(0);
+
+        static_assert(count < Hash::empty, "A command table holds at most 254 commands");
+        static_assert(seed < Hash::maxSeed, "No perfect hash was found for the command table");
+
+        // find(name, words):
+        // Returns the command of the given first word and number of words, or nullptr
+        static const Entry* find(boost::string_view name, std::size_t words)
+        {
+            const auto index = table_.values[Hash::slot(Hash::hash(name.data(), name.size(), words, seed))];
+            if (index == Hash::empty)
+                return nullptr;
+            const auto& entry = Commands::entries[index];
+            if (entry.words != words || entry.length != name.size() || std::memcmp(entry.name, name.data(), name.size()) != 0)
+                return nullptr;
+            return &entry;
+        }
+
+    private:
+        // Slot of each command, and command of each slot, computed at compile time
+        static constexpr FixedArray<std::uint16_t, count> entrySlots_ = Hash::makeEntrySlots(seed, typename MakeIndices<count>::type());
+        static constexpr FixedArray<std::uint8_t, slots> table_ = Hash::makeSlots(entrySlots_, typename MakeIndices<slots>::type());
+    };
+
+    template<class Commands>
+    constexpr FixedArray<std::uint16_t, CommandTable<Commands>::count> CommandTable<Commands>::entrySlots_;
+
+    template<class Commands>
+    constexpr FixedArray<std::uint8_t, CommandTable<Commands>::slots> CommandTable<Commands>::table_;
+
+} // namespace CountersServer
+} // namespace ocs
+
+#endif // OCS_COUNTERS_SERVER_COMMAND_TABLE_H
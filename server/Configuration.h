@@ -8,6 +8,7 @@
 // - stores the server startup options (listen port, work directory...)
 //
 
+#include <cstddef>
 #include <string>
 #include "Constants.h"
 
@@ -16,6 +17,34 @@ namespace ocs
 namespace CountersServer
 {
 
+    // Durability enumeration:
+    // Definition of the persistence modes of the counters store, from the fastest to the safest
+    enum class Durability
+    {
+        none,       // in-memory only, the count is persisted at shutdown
+        interval,   // the count is persisted (written and fsync'ed) periodically, in the background
+        write,      // the count is written on every request, without fsync (it survives a crash of the server, not of the system)
+        group,      // the replies are held until a batched fsync covers them (group commit)
+        strict      // the count is persisted (written and fsync'ed) on every request
+    };
+
+    // Storage enumeration:
+    // Definition of the persistent storage backends of the counters store
+    enum class Storage
+    {
+        text,       // text file, rewritten with pwrite and flushed with fsync
+        mmap,       // memory-mapped binary file, updated with plain stores and flushed with msync
+        wal         // write-ahead log of increments, appended to and flushed with fdatasync, plus periodic snapshots
+    };
+
+    // IoBackend enumeration:
+    // Definition of the I/O backends of the worker threads
+    enum class IoBackend
+    {
+        asio,       // asio reactor (epoll), serving all the transports
+        uring       // io_uring event loop, serving the udp port only (Linux 6.0 and later)
+    };
+
     // Configuration structure:
     // Container for the server startup options
     // No logic is required -> implemented as an open struct
@@ -24,11 +53,98 @@ namespace CountersServer
         // listen port, 12345 by default
         int port = Constants::defaultPort;
 
+        // listen on the udp port (enabled by default)
+        bool udp = true;
+
+        // tcp port on which to listen as well, for the clients pipelining their requests
+        // on persistent connections (0 by default: disabled)
+        int tcpPort = 0;
+
+        // path of a unix domain datagram socket on which to listen as well, for co-located
+        // clients (none by default); served by the first worker thread
+        std::string unixSocket;
+
         // Work directory for storing runtime files
         std::string workDirectory = ".";
 
         // minimum log level (info by default)
         int minLogLevel = 0;
+
+        // log asynchronously, from a background thread (disabled by default)
+        bool logAsync = false;
+
+        // number of worker threads, each one listening on its own socket (1 by default)
+        // When greater than 1, the sockets are bound with SO_REUSEPORT so that the
+        // kernel spreads the incoming datagrams across the workers
+        int threads = 1;
+
+        // pin each worker thread to a core (disabled by default)
+        bool pinThreads = false;
+
+        // busy-poll the sockets instead of sleeping in epoll, on worker threads pinned to
+        // their cores (disabled by default); asio backend only
+        bool busyPoll = false;
+
+        // idle time after which a busy-polling worker sleeps in epoll until the next request,
+        // in microseconds (1000 by default)
+        int busyPollIdle = 1000;
+
+        // I/O backend of the worker threads (asio by default)
+        IoBackend ioBackend = IoBackend::asio;
+
+        // maximum sustained rate of the requests of each client address, in requests per
+        // second (0 by default: unlimited), and the burst of requests allowed above it
+        // (100 by default)
+        unsigned long clientRate = 0;
+        unsigned long clientBurst = 100;
+
+        // number of clients whose rate is tracked, the least recently active ones being
+        // evicted (65536 by default)
+        std::size_t clientTableSize = 65536;
+
+        // drop the requests refused by the rate limit, instead of answering them with an
+        // error (disabled by default)
+        bool throttleSilently = false;
+
+        // filling of the receive queue of a udp socket, in percent of its receive buffer,
+        // above which the requests are dropped until it falls below half of it (0 by
+        // default: disabled)
+        int shedThreshold = 0;
+
+        // maximum number of datagrams received (recvmmsg) and answered (sendmmsg)
+        // per socket wakeup (1 by default, i.e. one asio receive/send per datagram)
+        int batchSize = 1;
+
+        // maximum number of replies queued for sending per socket (256 by default)
+        // When the queue is full, the reception of requests is paused until a reply is sent
+        int sendQueueSize = 256;
+
+        // persistent storage backend of the counters store (memory-mapped file by default)
+        Storage storage = Storage::mmap;
+
+        // number of journal records between two snapshots, for the wal storage (1000000 by default)
+        unsigned long long snapshotInterval = 1000000;
+
+        // persistence mode of the counters store (write on every request by default, as the former server)
+        Durability durability = Durability::write;
+
+        // period of the background persistence, in milliseconds, for the interval mode
+        int durabilityInterval = 1000;
+
+        // number of values leased at once by each worker thread from the counter's global sequence
+        // (1 by default, which issues all the values in increasing order; larger blocks spare the
+        // contention on the sequence, the values being then only increasing per worker thread)
+        int counterBlockSize = 1;
+
+        // trace the stages of the requests into a flight recorder (disabled by default)
+        bool trace = false;
+
+        // number of trace events kept per thread, the oldest being overwritten (65536 by default)
+        std::size_t traceEvents = 65536;
+
+        // maximum number of named counters (16M by default)
+        // The address range of the named counters file is reserved accordingly, 64 bytes per counter
+        std::size_t maxCounters = 16 * 1024 * 1024;
     };
 
 } // namespace CountersServer
@@ -0,0 +1,115 @@
+//
+// CounterTable.cpp
+// ~~~~~~~~~~~~~~~~
+//
+// Source for the CounterTable class:
+// - flat open-addressing hash table of named counters (linear probing)
+// - the names are stored inline in the entries: no per-entry heap allocation,
+//   and a lookup usually touches a single cache line
+// - the table grows by doubling its capacity; counters are never removed
+//
+#include "CounterTable.h"
+#include <cstring>
+#include "Checksum.h"
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    namespace
+    {
+        // tagOf(hash):
+        // Returns the tag of a hash: its high bits, with the low bit set so that it is never 0
+        inline std::uint32_t tagOf(unsigned long long hash)
+        {
+            return static_cast<std::uint32_t>(hash >> 32) | 1;
+        }
+    }
+
+    // hash(name, length):
+    // Returns the hash of a counter name, to be passed to find() and insert()
+    // The FNV-1a hash is mixed, so that both its low bits (slot) and its high bits (tag) are spread
+    unsigned long long CounterTable::hash(const char* name, std::size_t length)
+    {
+        return checksum(checksum(name, length), length);
+    }
+
+    // Ctor:
+    // Creates an empty table
+    CounterTable::CounterTable()
+    : entries_(initialCapacity)
+    , mask_(initialCapacity - 1)
+    , size_(0)
+    {
+        static_assert(sizeof(Entry) == 48, "Unexpected entry layout");
+    }
+
+    // find(name, length, hash):
+    // Returns the entry of a counter, or nullptr if there is no such counter
+    CounterTable::Entry* CounterTable::find(const char* name, std::size_t length, unsigned long long hash)
+    {
+        auto* const entry = probe(name, length, hash);
+        return entry->tag ? entry : nullptr;
+    }
+
+    // insert(name, length, hash, inserted):
+    // Returns the entry of a counter, inserting it with a zero value if necessary
+    // (inserted is then set to true); the caller is expected to fill in its record
+    // The table is kept at most 3/4 full, so that the probe sequences stay short
+    CounterTable::Entry* CounterTable::insert(const char* name, std::size_t length, unsigned long long hash, bool& inserted)
+    {
+        auto* entry = probe(name, length, hash);
+        inserted = entry->tag == 0;
+        if (!inserted)
+            return entry;
+
+        if ((size_ + 1) * 4 > entries_.size() * 3)
+        {
+            grow();
+            entry = probe(name, length, hash);
+        }
+        entry->tag = tagOf(hash);
+        entry->record = 0;
+        entry->value = 0;
+        std::memcpy(entry->name, name, length);
+        ++size_;
+        return entry;
+    }
+
+    // probe(name, length, hash):
+    // Returns the slot of a counter, or the empty slot where it would be inserted
+    // The names are only compared when the tags match
+    CounterTable::Entry* CounterTable::probe(const char* name, std::size_t length, unsigned long long hash)
+    {
+        const auto tag = tagOf(hash);
+        for (auto index = static_cast<std::size_t>(hash) & mask_; ; index = (index + 1) & mask_)
+        {
+            auto& entry = entries_[index];
+            if (entry.tag == 0)
+                return &entry;
+            if (entry.tag == tag && entry.name[length] == '\0' && std::memcmp(entry.name, name, length) == 0)
+                return &entry;
+        }
+    }
+
+    // grow():
+    // Doubles the capacity, and moves the entries to their new slots
+    // The hashes are not stored: they are recomputed from the names
+    void CounterTable::grow()
+    {
+        std::vector<Entry> entries(entries_.size() * 2);
+        entries_.swap(entries);
+        mask_ = entries_.size() - 1;
+
+        for (const auto& entry : entries)
+        {
+            if (entry.tag == 0)
+                continue;
+            const auto length = std::strlen(entry.name);
+            *probe(entry.name, length, hash(entry.name, length)) = entry;
+        }
+    }
+
+} // namespace CountersServer
+} // namespace ocs
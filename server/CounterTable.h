@@ -0,0 +1,91 @@
+#ifndef OCS_COUNTERS_SERVER_COUNTER_TABLE_H
+#define OCS_COUNTERS_SERVER_COUNTER_TABLE_H
+//
+// CounterTable.h
+// ~~~~~~~~~~~~~~
+//
+// Header for the CounterTable class:
+// - flat open-addressing hash table of named counters (linear probing)
+// - the names are stored inline in the entries: no per-entry heap allocation,
+//   and a lookup usually touches a single cache line
+// - the table grows by doubling its capacity; counters are never removed
+//
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "Constants.h"
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    // CounterTable class:
+    // - flat open-addressing hash table of named counters (linear probing)
+    // - the names are stored inline in the entries: no per-entry heap allocation,
+    //   and a lookup usually touches a single cache line
+    // - the table grows by doubling its capacity; counters are never removed
+    // Note: a CounterTable is not thread-safe, concurrent accesses must be serialized by the caller
+    class CounterTable
+    {
+    public:
+        // Entry structure:
+        // A table slot: an empty slot has a zero tag
+        // The name is padded with zeroes, so that it is always null-terminated
+        struct Entry
+        {
+            std::uint32_t       tag;        // high bits of the name's hash, never 0 for a used slot
+            std::uint32_t       record;     // index of the counter's record in the persistent storage
+            unsigned long long  value;      // current value of the counter
+            char                name[Constants::maxCounterNameSize + 1];
+        };
+
+        // hash(name, length):
+        // Returns the hash of a counter name, to be passed to find() and insert()
+        static unsigned long long hash(const char* name, std::size_t length);
+
+        // Ctor:
+        // Creates an empty table
+        CounterTable();
+
+        // find(name, length, hash):
+        // Returns the entry of a counter, or nullptr if there is no such counter
+        Entry* find(const char* name, std::size_t length, unsigned long long hash);
+
+        // insert(name, length, hash, inserted):
+        // Returns the entry of a counter, inserting it with a zero value if necessary
+        // (inserted is then set to true); the caller is expected to fill in its record
+        // Caution: the entries returned previously are invalidated by an insertion
+        Entry* insert(const char* name, std::size_t length, unsigned long long hash, bool& inserted);
+
+        // size():
+        // Returns the number of counters
+        std::size_t size() const { return size_; }
+
+        // capacity():
+        // Returns the number of slots
+        std::size_t capacity() const { return entries_.size(); }
+
+    private:
+        // Initial number of slots (a power of 2)
+        enum { initialCapacity = 16 };
+
+        // probe(name, length, hash):
+        // Returns the slot of a counter, or the empty slot where it would be inserted
+        Entry* probe(const char* name, std::size_t length, unsigned long long hash);
+
+        // grow():
+        // Doubles the capacity, and moves the entries to their new slots
+        void grow();
+
+        // Slots, and number of used ones
+        std::vector<Entry>  entries_;
+        std::size_t         mask_;
+        std::size_t         size_;
+    };
+
+} // namespace CountersServer
+} // namespace ocs
+
+#endif // OCS_COUNTERS_SERVER_COUNTER_TABLE_H
@@ -3,16 +3,31 @@
 // ~~~~~~~~~~~~~~~~~~
 //
 // Source for the CountersServer class:
-// - listens on a udp-v6 socket
-// - forwards udp client requests to a CountersServerDispatcher
+// - listens on a udp-v6 socket, or on a unix domain datagram socket
+// - forwards the client requests to a CountersServerDispatcher
 // - forwards back the replies from the CountersServerDispatcher to the clients
 //
 // This code is derived from the Boost tutorial here:
 // https://www.boost.org/doc/libs/1_67_0/doc/html/boost_asio/tutorial/tutdaytime6/src.html
 //
 #include "CountersServer.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <stdexcept>
+#include "FlightRecorder.h"
 #include "Logger.h"
+#include "ServerStats.h"
+#ifdef __linux__
+#include <linux/sockios.h>
+#include <sys/ioctl.h>
+#endif
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
 
 using boost::asio::ip::udp;
 
@@ -21,17 +36,176 @@ namespace ocs
 namespace CountersServer
 {
 
+#ifdef SO_REUSEPORT
+    // Socket option used to let several sockets (one per worker thread) share the same port
+    typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+#endif
+
     // Ctor:
     // - Implements all the asio's server startup logic
-    // - Invokes start_receive() before returning
-    CountersServer::CountersServer(const Configuration& configuration, boost::asio::io_service& io_context, std::shared_ptr<CountersServerDispatcher> dispatcher)
+    // - Invokes resume_receive() before returning
+    CountersServer::CountersServer(const Configuration& configuration, boost::asio::io_service& io_context,
+                                   std::shared_ptr<CountersServerDispatcher> dispatcher, const Protocol::endpoint& endpoint)
      : configuration_(configuration)
-     , socket_(io_context, udp::endpoint(udp::v6(), configuration.port))
+     , socket_(io_context)
      , remote_endpoint_()
+     , socket_path_()
      , recv_buffer_()
      , dispatcher_(dispatcher)
+     , reply_queue_(configuration.sendQueueSize)
+     , sending_(false)
+     , receive_paused_(false)
+     , backpressure_pauses_(0)
+     , admission_(configuration)
+     , batches_(0)
+     , batched_requests_(0)
+     , dropped_replies_(0)
+    {
+        open_socket(endpoint);
+
+        if (configuration_.batchSize > 1)
+        {
+#ifdef __linux__
+            const std::size_t batchSize = configuration_.batchSize;
+            batch_buffers_.resize(batchSize);
+            batch_endpoints_.resize(batchSize);
+            batch_replies_.resize(batchSize);
+            recv_iovecs_.resize(batchSize);
+            recv_messages_.resize(batchSize);
+            send_iovecs_.resize(batchSize);
+            send_messages_.resize(batchSize);
+            batch_controls_.resize(batchSize);
+            batch_entries_.resize(batchSize);
+            batch_origins_.resize(batchSize);
+            send_traces_.resize(batchSize);
+            socket_.non_blocking(true);
+#else
+            Logger(warning) << "Batched I/O is not supported on this platform, falling back to unbatched I/O";
+#endif
+        }
+        resume_receive();
+    }
+
+    // Dtor:
+    // Logs the reply queue statistics and the batched I/O statistics, if batched I/O was enabled
+    // Removes the socket file of a unix domain socket
+    CountersServer::~CountersServer()
     {
-        start_receive();
+        if (!socket_path_.empty())
+            std::remove(socket_path_.c_str());
+        Logger(backpressure_pauses_ ? info : debug)
+            << "Reply queue: high-water mark " << reply_queue_.highWaterMark() << "/" << reply_queue_.capacity()
+            << ", reception paused " << backpressure_pauses_ << " times on a full queue";
+        if (batches_)
+        {
+            Logger(info) << "Batched I/O: " << batched_requests_ << " requests received in " << batches_
+                         << " batches (average batch size: " << static_cast<double>(batched_requests_) / batches_
+                         << "), " << dropped_replies_ << " replies dropped";
+        }
+    }
+
+    // udp_endpoint(port):
+    // Returns the endpoint of a udp-v6 socket listening on a port (on all the interfaces)
+    CountersServer::Protocol::endpoint CountersServer::udp_endpoint(int port)
+    {
+        return Protocol::endpoint(udp::endpoint(udp::v6(), port));
+    }
+
+    // unix_endpoint(path):
+    // Returns the endpoint of a unix domain datagram socket bound to a path
+    // Caution: throws if the path is too long for a socket address
+    CountersServer::Protocol::endpoint CountersServer::unix_endpoint(const std::string& path)
+    {
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+        return Protocol::endpoint(boost::asio::local::datagram_protocol::endpoint(path));
+#else
+        throw std::logic_error("Unix domain sockets are not supported on this platform ('" + path + "')");
+#endif
+    }
+
+    // remove_stale_socket(path):
+    // Removes the socket file left by a server which did not shut down cleanly, if any:
+    // a socket on which no one listens refuses the connections
+    // Caution: throws if the path is a socket another server is listening on, or is not a socket
+    void CountersServer::remove_stale_socket(const std::string& path)
+    {
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+        struct stat status;
+        if (::lstat(path.c_str(), &status) != 0)
+            return;
+        if (!S_ISSOCK(status.st_mode))
+            throw std::runtime_error("Cannot bind the unix socket '" + path + "': the file exists, and is not a socket");
+
+        boost::asio::io_service io_context;
+        boost::asio::local::datagram_protocol::socket probe(io_context, boost::asio::local::datagram_protocol());
+        boost::system::error_code ec;
+        probe.connect(boost::asio::local::datagram_protocol::endpoint(path), ec);
+        if (!ec)
+            throw std::runtime_error("Cannot bind the unix socket '" + path + "': another server is listening on it");
+        if (ec != boost::asio::error::connection_refused)
+            throw std::runtime_error("Cannot bind the unix socket '" + path + "': " + ec.message());
+
+        Logger(warning) << "Removing the stale unix socket '" << path << "'";
+        std::remove(path.c_str());
+#else
+        (void)path;
+#endif
+    }
+
+    // open_socket(endpoint):
+    // Opens and binds the listening socket
+    // When several workers are configured, SO_REUSEPORT is set before binding a udp
+    // socket so that each worker may bind its own socket to the same port
+    // The stale socket file of a unix domain socket is removed before binding, and the
+    // file is removed by the destructor
+    // When tracing, the kernel is asked to timestamp the reception of the datagrams
+    void CountersServer::open_socket(const Protocol::endpoint& endpoint)
+    {
+        std::string path;
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+        if (endpoint.protocol().family() == AF_UNIX)
+        {
+            const auto* const address = reinterpret_cast<const sockaddr_un*>(endpoint.data());
+            path.assign(address->sun_path, endpoint.size() - offsetof(sockaddr_un, sun_path));
+            remove_stale_socket(path);
+        }
+#endif
+
+        socket_.open(endpoint.protocol());
+        if (path.empty() && configuration_.threads > 1)
+        {
+#ifdef SO_REUSEPORT
+            socket_.set_option(reuse_port(true));
+#else
+            throw std::logic_error("Multiple worker threads require SO_REUSEPORT, which is not supported on this platform");
+#endif
+        }
+#ifdef __linux__
+        // The batched I/O mode receives the timestamps as control messages (SO_TIMESTAMPNS),
+        // the unbatched mode reads the one of the last datagram (SIOCGSTAMPNS, whose first
+        // invocation enables the timestamping, and fails as no datagram was received yet)
+        if (FlightRecorder::enabled())
+        {
+            const int enabled = 1;
+            timespec timestamp;
+            if (configuration_.batchSize > 1)
+                ::setsockopt(socket_.native_handle(), SOL_SOCKET, SO_TIMESTAMPNS, &enabled, sizeof(enabled));
+            else
+                ::ioctl(socket_.native_handle(), SIOCGSTAMPNS, &timestamp);
+        }
+#endif
+#ifdef SO_BUSY_POLL
+        // In busy-poll mode, the receptions poll the device queue of a udp socket for its
+        // packets (where the driver supports it), instead of waiting for its interrupt
+        if (configuration_.busyPoll && path.empty())
+        {
+            const int microseconds = Constants::busyPollMicroseconds;
+            if (::setsockopt(socket_.native_handle(), SOL_SOCKET, SO_BUSY_POLL, &microseconds, sizeof(microseconds)) != 0)
+                Logger(warning) << "Could not enable SO_BUSY_POLL on the udp socket: " << std::strerror(errno);
+        }
+#endif
+        socket_.bind(endpoint);
+        socket_path_ = path;
     }
 
     // start_receive():
@@ -49,45 +223,369 @@ namespace CountersServer
 
     // handle_receive():
     // Handles the reception of a client request.
-    // On a valid request:
-    // - Forwards the request to the dispatcher for processing
-    // - initiates the asynchronous sending of a response to the client
-    // Otherwise, falls back to receiving state
+    // On a valid request, unless it is dropped by the admission control (or answered
+    // with an error, if throttled):
+    // - Forwards the request to the dispatcher for processing, which encodes the reply
+    //   directly into a slot of the reply queue (the reception is only armed when
+    //   the queue is not full, see resume_receive())
+    // - initiates the asynchronous sending of the reply to the client
+    // Then re-arms the reception right away, without waiting for the reply to be sent
     void CountersServer::handle_receive(const boost::system::error_code& ec,std::size_t recv_bytes)
     {
         if (!ec)
         {
-            const auto reply = dispatcher_->dispatchCommand(recv_buffer_.cbegin(), recv_bytes);
-            start_reply(reply);
+            ServerStats::add(ServerStats::bytesIn, recv_bytes);
+            const auto decision = admission_.check(socket_.native_handle(), remote_endpoint_.data(), remote_endpoint_.size());
+            if (decision == AdmissionControl::drop)
+            {
+                resume_receive();
+                return;
+            }
+            const auto traceRequest = FlightRecorder::enabled() ? trace_receive(nullptr) : 0;
+            auto& reply = reply_queue_.push(remote_endpoint_);
+            const boost::string_view request(recv_buffer_.data(), recv_bytes);
+            if (decision == AdmissionControl::reject)
+                reply.size = CountersServerDispatcher::rejectCommand(request, reply.buffer.data(), reply.buffer.size());
+            else
+                reply.size = dispatcher_->dispatchCommand(request, reply.buffer.data(), reply.buffer.size());
+            if (FlightRecorder::enabled())
+            {
+                reply.traceRequest = traceRequest;
+                reply.traceQueued = FlightRecorder::now();
+            }
+            send_queued();
         }
         else
         {
-            Logger(warning) << "Received a request in error, ignored";
-            start_receive();
+            ServerStats::add(ServerStats::receiveErrors);
+            OCS_LOG_RATE_LIMITED(warning, Constants::maxErrorLinesPerSecond) << "Received a request in error, ignored";
         }
+        resume_receive();
     }
 
-    // start_reply():
-    // Initiates the asynchronous sending of a response to a client
-    void CountersServer::start_reply(const std::string& reply)
+    // resume_receive():
+    // Re-arms the reception of client requests (start_receive() or start_wait())
+    // unless the reply queue is full: the reception is then paused until a reply is sent,
+    // so that the requests wait in the socket's receive buffer rather than being
+    // processed with nowhere to put their replies
+    void CountersServer::resume_receive()
     {
+        if (reply_queue_.full())
+        {
+            receive_paused_ = true;
+            ++backpressure_pauses_;
+            return;
+        }
+
+        receive_paused_ = false;
+        if (batched())
+            start_wait();
+        else
+            start_receive();
+    }
+
+    // queue_reply(endpoint, data, size):
+    // Queues a copy of a reply for sending (see send_queued())
+    // Caution: the reply queue must not be full
+    void CountersServer::queue_reply(const Protocol::endpoint& endpoint, const char* data, std::size_t size)
+    {
+        reply_queue_.push(endpoint, data, size);
+        send_queued();
+    }
+
+    // send_queued():
+    // Initiates the asynchronous sending of the queued replies,
+    // unless a reply is currently being sent
+    void CountersServer::send_queued()
+    {
+        if (!sending_)
+            start_send();
+    }
+
+    // start_send():
+    // Initiates the asynchronous sending of the oldest queued reply
+    // The reply's buffer and endpoint belong to the queue, hence stay valid until handle_send()
+    void CountersServer::start_send()
+    {
+        sending_ = true;
+        const auto& reply = reply_queue_.front();
         socket_.async_send_to(
-            boost::asio::buffer(reply),
-            remote_endpoint_,
+            boost::asio::buffer(reply.buffer.data(), reply.size),
+            reply.endpoint,
             [this](boost::system::error_code error, std::size_t bytes_transferred) 
             { 
                 handle_send(error, bytes_transferred); 
             });
+    }
 
+    // trace_receive(timestamp):
+    // Tracing mode: numbers a new request, and traces its reception, from its kernel
+    // timestamp (the given one, from a SCM_TIMESTAMPNS message, or else the one of the
+    // last datagram received, from SIOCGSTAMPNS) to now; returns the request number
+    // The reception is not traced if the kernel timestamp is not available
+    std::uint64_t CountersServer::trace_receive(const timespec* timestamp)
+    {
+        const auto request = FlightRecorder::beginRequest();
+#ifdef SIOCGSTAMPNS
+        timespec last;
+        if (!timestamp && ::ioctl(socket_.native_handle(), SIOCGSTAMPNS, &last) == 0)
+            timestamp = &last;
+#endif
+        if (timestamp)
+            FlightRecorder::record(FlightRecorder::receive, FlightRecorder::fromRealtime(*timestamp), FlightRecorder::now());
+        return request;
     }
 
     // handle_send():
     // Handles the completion of an asynchronous response sending
-    // - prepares for processing another query with start_receive()
-    void CountersServer::handle_send(const boost::system::error_code& /*error*/, std::size_t /*bytes_transferred*/)
+    // - traces the sending of the reply, if it was traced
+    // - releases the reply from the queue
+    // - initiates the sending of the next queued reply, if any
+    // - resumes the reception of client requests if it was paused by a full queue
+    void CountersServer::handle_send(const boost::system::error_code& ec, std::size_t bytes_transferred)
+    {
+        if (ec)
+        {
+            ServerStats::add(ServerStats::sendErrors);
+            OCS_LOG_RATE_LIMITED(warning, Constants::maxErrorLinesPerSecond) << "Could not send a reply, dropped: " << ec.message();
+        }
+        else
+            ServerStats::add(ServerStats::bytesOut, bytes_transferred);
+
+        const auto& reply = reply_queue_.front();
+        if (FlightRecorder::enabled() && reply.traceQueued)
+            FlightRecorder::record(FlightRecorder::send, reply.traceQueued, FlightRecorder::now(), reply.traceRequest);
+
+        reply_queue_.pop();
+        sending_ = false;
+        if (!reply_queue_.empty())
+            start_send();
+
+        if (receive_paused_)
+            resume_receive();
+    }
+
+    // batched():
+    // Returns true if the server uses batched I/O (recvmmsg/sendmmsg)
+    bool CountersServer::batched() const
+    {
+#ifdef __linux__
+        return !recv_messages_.empty();
+#else
+        return false;
+#endif
+    }
+
+    // start_wait():
+    // Batched I/O mode: prepares the server for an asynchronous notification
+    // that client requests are ready to be received
+    // Note: null_buffers() is used (rather than async_wait) for compatibility with older boost versions
+    void CountersServer::start_wait()
+    {
+        socket_.async_receive(
+            boost::asio::null_buffers(),
+            [this](boost::system::error_code ec, std::size_t /*bytes*/)
+            {
+                handle_wait(ec);
+            });
+    }
+
+    // handle_wait():
+    // Batched I/O mode: handles the notification that client requests are ready:
+    // - receives up to batchSize requests with a single recvmmsg()
+    // - forwards all of them to the dispatcher for processing
+    // - sends all the replies back with a single sendmmsg()
+    // - then falls back to waiting state
+    void CountersServer::handle_wait(const boost::system::error_code& ec)
+    {
+        if (!ec)
+        {
+            const auto count = receive_batch();
+            if (count)
+                reply_batch(count);
+        }
+        else
+        {
+            OCS_LOG_RATE_LIMITED(warning, Constants::maxErrorLinesPerSecond) << "Waiting for requests failed, ignored: " << ec.message();
+        }
+        resume_receive();
+    }
+
+#ifdef __linux__
+    // receive_batch():
+    // Batched I/O mode: receives up to batchSize pending requests, returns their number
+    // The batch is also limited by the free room in the reply queue, so that all the replies
+    // that cannot be sent right away can be queued
+    // When tracing, the kernel timestamps of the requests are received as well
+    std::size_t CountersServer::receive_batch()
+    {
+        const auto batchSize = std::min(recv_messages_.size(), reply_queue_.capacity() - reply_queue_.size());
+        const auto tracing = FlightRecorder::enabled();
+        for (std::size_t i = 0; i < batchSize; ++i)
+        {
+            recv_iovecs_[i].iov_base = batch_buffers_[i].data();
+            recv_iovecs_[i].iov_len = batch_buffers_[i].size();
+            auto& header = recv_messages_[i].msg_hdr;
+            header.msg_name = &batch_endpoints_[i];
+            header.msg_namelen = sizeof(batch_endpoints_[i]);
+            header.msg_iov = &recv_iovecs_[i];
+            header.msg_iovlen = 1;
+            header.msg_control = tracing ? batch_controls_[i].data() : nullptr;
+            header.msg_controllen = tracing ? batch_controls_[i].size() : 0;
+            header.msg_flags = 0;
+        }
+
+        const auto received = ::recvmmsg(socket_.native_handle(), recv_messages_.data(), batchSize, MSG_DONTWAIT, nullptr);
+        if (received < 0)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            {
+                ServerStats::add(ServerStats::receiveErrors);
+                OCS_LOG_RATE_LIMITED(warning, Constants::maxErrorLinesPerSecond) << "Received a batch of requests in error, ignored: " << std::strerror(errno);
+            }
+            return 0;
+        }
+
+        if (received > 0)
+        {
+            ++batches_;
+            batched_requests_ += received;
+        }
+        return received;
+    }
+
+    // reply_batch(count):
+    // Batched I/O mode: dispatches the count received requests, and sends back all the replies
+    // The requests are first checked by the admission control: those dropped get no reply,
+    // those throttled get an error reply, and the others are dispatched
+    // The replies are sent with as few sendmmsg() calls as possible (usually a single one):
+    // the replies that cannot be sent without blocking (or that would overtake replies already
+    // queued) are queued for asynchronous sending
+    // When tracing, the sending of the replies sent by each sendmmsg() is traced from the
+    // end of the dispatching of the batch (the replies queued are not traced)
+    void CountersServer::reply_batch(std::size_t count)
+    {
+        const auto tracing = FlightRecorder::enabled();
+        std::size_t bytesIn = 0;
+        std::size_t admitted = 0;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            bytesIn += recv_messages_[i].msg_len;
+            const boost::string_view request(batch_buffers_[i].data(), recv_messages_[i].msg_len);
+            send_iovecs_[i].iov_base = batch_replies_[i].data();
+            send_iovecs_[i].iov_len = 0;
+            send_traces_[i] = 0;
+            const auto decision = admission_.check(socket_.native_handle(), &batch_endpoints_[i], recv_messages_[i].msg_hdr.msg_namelen);
+            if (decision != AdmissionControl::admit)
+            {
+                if (decision == AdmissionControl::reject)
+                    send_iovecs_[i].iov_len = CountersServerDispatcher::rejectCommand(request, batch_replies_[i].data(), batch_replies_[i].size());
+                continue;
+            }
+
+            auto& entry = batch_entries_[admitted];
+            batch_origins_[admitted++] = i;
+            entry.request = request;
+            entry.reply = batch_replies_[i].data();
+            entry.capacity = batch_replies_[i].size();
+            if (tracing)
+            {
+                const timespec* timestamp = nullptr;
+                for (auto* message = CMSG_FIRSTHDR(&recv_messages_[i].msg_hdr); message; message = CMSG_NXTHDR(&recv_messages_[i].msg_hdr, message))
+                {
+                    if (message->cmsg_level == SOL_SOCKET && message->cmsg_type == SCM_TIMESTAMPNS)
+                        timestamp = reinterpret_cast<const timespec*>(CMSG_DATA(message));
+                }
+                entry.traceRequest = trace_receive(timestamp);
+            }
+        }
+        ServerStats::add(ServerStats::bytesIn, bytesIn);
+
+        // Dispatch the whole batch at once, so that its query count increments are coalesced
+        dispatcher_->dispatchBatch(batch_entries_.data(), admitted);
+        for (std::size_t k = 0; k < admitted; ++k)
+        {
+            send_iovecs_[batch_origins_[k]].iov_len = batch_entries_[k].size;
+            send_traces_[batch_origins_[k]] = batch_entries_[k].traceRequest;
+        }
+
+        // Prepare the replies, in the order of the requests (the dropped ones have none)
+        std::size_t replies = 0;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            if (!send_iovecs_[i].iov_len)
+                continue;
+            auto& header = send_messages_[replies].msg_hdr;
+            header.msg_name = &batch_endpoints_[i];
+            header.msg_namelen = recv_messages_[i].msg_hdr.msg_namelen;
+            header.msg_iov = &send_iovecs_[i];
+            header.msg_iovlen = 1;
+            header.msg_control = nullptr;
+            header.msg_controllen = 0;
+            header.msg_flags = 0;
+            send_traces_[replies++] = send_traces_[i];
+        }
+        count = replies;
+
+        auto sendStart = tracing ? FlightRecorder::now() : 0;
+        std::size_t sent = 0;
+        while (sent < count && !sending_)
+        {
+            const auto result = ::sendmmsg(socket_.native_handle(), &send_messages_[sent], count - sent, MSG_DONTWAIT);
+            if (result < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                {
+                    // The error is the one of the first reply (e.g. a unix client without an
+                    // address to reply to): it is dropped, the next ones are still sent
+                    OCS_LOG_RATE_LIMITED(warning, Constants::maxErrorLinesPerSecond) << "Could not send a reply, dropped: " << std::strerror(errno);
+                    ++dropped_replies_;
+                    ServerStats::add(ServerStats::sendErrors);
+                    ++sent;
+                    continue;
+                }
+                break;
+            }
+            std::size_t bytesOut = 0;
+            for (int i = 0; i < result; ++i)
+                bytesOut += send_messages_[sent + i].msg_len;
+            ServerStats::add(ServerStats::bytesOut, bytesOut);
+            if (tracing)
+            {
+                const auto sendEnd = FlightRecorder::now();
+                for (int i = 0; i < result; ++i)
+                    FlightRecorder::record(FlightRecorder::send, sendStart, sendEnd, send_traces_[sent + i]);
+                sendStart = sendEnd;
+            }
+            sent += result;
+        }
+
+        // Queue the remaining replies
+        for (; sent < count; ++sent)
+        {
+            const auto& header = send_messages_[sent].msg_hdr;
+            Protocol::endpoint endpoint;
+            std::memcpy(endpoint.data(), header.msg_name, header.msg_namelen);
+            endpoint.resize(header.msg_namelen);
+            queue_reply(endpoint, static_cast<const char*>(header.msg_iov->iov_base), header.msg_iov->iov_len);
+        }
+    }
+#else
+    // receive_batch():
+    // Batched I/O mode: not supported on this platform
+    std::size_t CountersServer::receive_batch()
+    {
+        return 0;
+    }
+
+    // reply_batch(count):
+    // Batched I/O mode: not supported on this platform
+    void CountersServer::reply_batch(std::size_t /*count*/)
     {
-        start_receive();
     }
+#endif
 
 } // namespace CountersServer
 } // namespace ocs
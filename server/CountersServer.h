@@ -5,17 +5,27 @@
 // ~~~~~~~~~~~~~~~~~
 //
 // Header for the CountersServer class:
-// - listens on a udp-v6 socket
-// - forwards udp client requests to a CountersServerDispatcher
+// - listens on a udp-v6 socket, or on a unix domain datagram socket (for co-located
+//   clients, which skip the IP stack)
+// - forwards the client requests to a CountersServerDispatcher
 // - forwards back the replies from the CountersServerDispatcher to the clients
 //
 
 #include <array>
+#include <cstdint>
 #include <string>
+#include <vector>
 #include <boost/asio.hpp>
+#ifdef __linux__
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+#include "AdmissionControl.h"
 #include "Constants.h"
 #include "CountersServerDispatcher.h"
 #include "Configuration.h"
+#include "ReplyQueue.h"
 
 namespace ocs
 {
@@ -23,18 +33,57 @@ namespace CountersServer
 {
 
     // CountersServer class:
-    // - listens on a udp-v6 socket
-    // - forwards udp client requests to a CountersServerDispatcher
+    // - listens on a udp-v6 socket, or on a unix domain datagram socket
+    // - forwards the client requests to a CountersServerDispatcher
     // - forwards back the replies from the CountersServerDispatcher to the clients
     class CountersServer
     {
     public:
+        // Datagram protocol of the sockets: udp or unix, chosen by the endpoint
+        using Protocol = boost::asio::generic::datagram_protocol;
+
         // Ctor:
-        // - Implements all the asio's server startup logic
-        // - Invokes start_receive() before returning
-        CountersServer(const Configuration& configuration, boost::asio::io_service& io_context, std::shared_ptr<CountersServerDispatcher> dispatcher);
+        // - Implements all the asio's server startup logic, the socket being bound to the
+        //   given endpoint (see udp_endpoint() and unix_endpoint())
+        // - Invokes resume_receive() before returning
+        CountersServer(const Configuration& configuration, boost::asio::io_service& io_context,
+                       std::shared_ptr<CountersServerDispatcher> dispatcher, const Protocol::endpoint& endpoint);
+
+        // Dtor:
+        // Logs the reply queue statistics and the batched I/O statistics, if batched I/O was enabled
+        // Removes the socket file of a unix domain socket
+        ~CountersServer();
+
+        // udp_endpoint(port):
+        // Returns the endpoint of a udp-v6 socket listening on a port (on all the interfaces)
+        static Protocol::endpoint udp_endpoint(int port);
+
+        // unix_endpoint(path):
+        // Returns the endpoint of a unix domain datagram socket bound to a path
+        // Caution: throws if the path is too long for a socket address
+        static Protocol::endpoint unix_endpoint(const std::string& path);
+
+        // local_endpoint():
+        // Returns the endpoint the socket is bound to (e.g. the actual port of a udp
+        // socket bound to port 0)
+        Protocol::endpoint local_endpoint() const
+        {
+            return socket_.local_endpoint();
+        }
 
     private:
+        // open_socket(endpoint):
+        // Opens and binds the listening socket
+        // When several workers are configured, SO_REUSEPORT is set before binding a udp
+        // socket so that each worker may bind its own socket to the same port
+        // The stale socket file of a unix domain socket is removed before binding
+        void open_socket(const Protocol::endpoint& endpoint);
+
+        // remove_stale_socket(path):
+        // Removes the socket file left by a server which did not shut down cleanly, if any
+        // Caution: throws if the path is a socket another server is listening on, or is not a socket
+        static void remove_stale_socket(const std::string& path);
+
         // start_receive():
         // Prepares the server for asynchronous reception of client requests
         void start_receive();
@@ -42,30 +91,111 @@ namespace CountersServer
         // handle_receive():
         // Handles the reception of a client request.
         // On a valid request:
-        // - Forwards the request to the dispatcher for processing
-        // - initiates the asynchronous sending of a response to the client
-        // Otherwise, falls back to receivinbg state
+        // - Forwards the request to the dispatcher for processing, which encodes the reply
+        //   directly into a slot of the reply queue
+        // - initiates the asynchronous sending of the reply to the client
+        // Then re-arms the reception right away, without waiting for the reply to be sent
         void handle_receive(const boost::system::error_code& error, std::size_t recv_bytes);
 
-        // start_reply():
-        // Initiates the asynchronous sending of a response to a client
-        void start_reply(const std::string& reply);
+        // resume_receive():
+        // Re-arms the reception of client requests (start_receive() or start_wait())
+        // unless the reply queue is full: the reception is then paused until a reply is sent
+        void resume_receive();
+
+        // queue_reply(endpoint, data, size):
+        // Queues a copy of a reply for sending (see send_queued())
+        // Caution: the reply queue must not be full
+        void queue_reply(const Protocol::endpoint& endpoint, const char* data, std::size_t size);
+
+        // send_queued():
+        // Initiates the asynchronous sending of the queued replies,
+        // unless a reply is currently being sent
+        void send_queued();
+
+        // start_send():
+        // Initiates the asynchronous sending of the oldest queued reply
+        void start_send();
+
+        // trace_receive(timestamp):
+        // Tracing mode: numbers a new request, and traces its reception, from its kernel
+        // timestamp (the given one, from a SCM_TIMESTAMPNS message, or else the one of the
+        // last datagram received, from SIOCGSTAMPNS) to now; returns the request number
+        std::uint64_t trace_receive(const timespec* timestamp);
 
         // handle_send():
         // Handles the completion of an asynchronous response sending
-        // - prepares for processing another query with start_receive()
-        void handle_send(const boost::system::error_code& /*error*/, std::size_t /*bytes_transferred*/);
+        // - releases the reply from the queue
+        // - initiates the sending of the next queued reply, if any
+        // - resumes the reception of client requests if it was paused by a full queue
+        void handle_send(const boost::system::error_code& error, std::size_t bytes_transferred);
+
+        // batched():
+        // Returns true if the server uses batched I/O (recvmmsg/sendmmsg)
+        bool batched() const;
+
+        // start_wait():
+        // Batched I/O mode: prepares the server for an asynchronous notification
+        // that client requests are ready to be received
+        void start_wait();
+
+        // handle_wait():
+        // Batched I/O mode: handles the notification that client requests are ready:
+        // - receives up to batchSize requests with a single recvmmsg()
+        // - forwards all of them to the dispatcher for processing
+        // - sends all the replies back with a single sendmmsg()
+        // - then falls back to waiting state
+        void handle_wait(const boost::system::error_code& error);
+
+        // receive_batch():
+        // Batched I/O mode: receives up to batchSize pending requests, returns their number
+        std::size_t receive_batch();
+
+        // reply_batch(count):
+        // Batched I/O mode: dispatches the count received requests (those admitted by the
+        // admission control), and sends back all the replies
+        void reply_batch(std::size_t count);
 
         // Startup configuration parameters
         const Configuration&                            configuration_;
 
         // Variables used by asio logic
-        boost::asio::ip::udp::socket                    socket_;
-        boost::asio::ip::udp::endpoint                  remote_endpoint_;
+        Protocol::socket                                socket_;
+        Protocol::endpoint                              remote_endpoint_;
+        std::string                                     socket_path_;       // path of a unix domain socket (empty for udp)
         std::array<char, Constants::defaultBufferSize>  recv_buffer_;
 
         // Dispatcher, decoding/encoding layer placed between the CountersServer and the CountersStore
         std::shared_ptr<CountersServerDispatcher>       dispatcher_;
+
+        // Bounded queue of the replies waiting to be sent: the pool of reply buffers,
+        // each one staying alive until the completion of its asynchronous send
+        ReplyQueue                                      reply_queue_;
+        bool                                            sending_;             // true while an asynchronous send is in progress
+        bool                                            receive_paused_;      // true while the reception is paused on a full queue
+        unsigned long long                              backpressure_pauses_; // number of times the reception was paused
+
+        // Admission control of the requests (rate limit of the clients, load shedding)
+        AdmissionControl                                admission_;
+
+#ifdef __linux__
+        // Variables used by the batched I/O logic (one entry per datagram of a batch)
+        std::vector<std::array<char, Constants::defaultBufferSize>> batch_buffers_;
+        std::vector<sockaddr_storage>                   batch_endpoints_;
+        std::vector<std::array<char, Constants::defaultBufferSize>> batch_replies_;
+        std::vector<iovec>                              recv_iovecs_;
+        std::vector<mmsghdr>                            recv_messages_;
+        std::vector<iovec>                              send_iovecs_;
+        std::vector<mmsghdr>                            send_messages_;
+        std::vector<std::array<char, CMSG_SPACE(sizeof(timespec))>> batch_controls_;    // kernel timestamps (tracing mode)
+        std::vector<CountersServerDispatcher::BatchEntry> batch_entries_;   // requests and replies admitted, for the dispatcher
+        std::vector<std::size_t>                        batch_origins_;     // index of the datagram of each entry
+        std::vector<std::uint64_t>                      send_traces_;       // request number of each reply sent (tracing mode)
+#endif
+
+        // Batched I/O statistics
+        unsigned long long                              batches_;           // number of non-empty batches received
+        unsigned long long                              batched_requests_;  // number of requests received in these batches
+        unsigned long long                              dropped_replies_;   // number of replies that could not be sent
     };
 
 } // namespace CountersServer
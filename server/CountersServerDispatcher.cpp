@@ -10,100 +10,547 @@
 // - sends the messages to the CountersServer, which will forward them to the clients
 //
 #include "CountersServerDispatcher.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include "CommandTable.h"
+#include "Constants.h"
+#include "FlightRecorder.h"
 #include "Logger.h"
+#include "ServerStats.h"
 
 namespace ocs
 {
 namespace CountersServer
 {
 
-    // dispatchCommand(buffer, bytes)
+    namespace
+    {
+        // append(reply, size, capacity, text, length):
+        // Appends a text to a reply, truncating it to the reply's capacity, returns the new size
+        std::size_t append(char* reply, std::size_t size, std::size_t capacity, const char* text, std::size_t length)
+        {
+            length = std::min(length, capacity - size);
+            std::memcpy(reply + size, text, length);
+            return size + length;
+        }
+
+        // isNumber(text):
+        // Returns true if a text is made of decimal digits only
+        bool isNumber(boost::string_view text)
+        {
+            return !text.empty() && std::all_of(text.begin(), text.end(), [](char c) { return c >= '0' && c <= '9'; });
+        }
+
+        // InvalidCommand class:
+        // Error of a command which is not understood (as opposed to the failures of the store),
+        // counted as malformed by the "STATS" command, like the invalid arguments rejected by
+        // the store (std::invalid_argument, e.g. an invalid counter name)
+        class InvalidCommand : public std::invalid_argument
+        {
+        public:
+            using std::invalid_argument::invalid_argument;
+        };
+    }
+
+    // dispatchCommand(request, reply, capacity)
     // Public API to be invoked by a CountersServer
     // - Executes the query processing workflow
     //   1) reception, decoding, dispatching of a requests to a CountersStore
-    //   2) encoding and forwarding of the CountersStore's reply
+    //   2) encoding of the CountersStore's reply into the caller's reply buffer
+    // - Returns the size of the reply (truncated to the buffer's capacity)
     // - Encapsulate the workflow in a try-block so that exceptions when processing
     //   queries should never bubble up to the server
-    std::string CountersServerDispatcher::dispatchCommand(const char* buffer, std::size_t bytes) const
+    // - The protocol (text or binary) is detected on each datagram
+    // - Counts the request, and measures its processing time (sampled), for the
+    //   "STATS" command: the clock is only read for one request out of
+    //   ServerStats::dispatchSampling
+    // - Traces the processing of every request, if tracing is enabled
+    std::size_t CountersServerDispatcher::dispatchCommand(boost::string_view request, char* reply, std::size_t capacity) const
+    {
+        QueryValues values;
+        return measureCommand(request, reply, capacity, values);
+    }
+
+
+    // dispatchBatch(entries, count):
+    // Public API to be invoked by a CountersServer, for the requests received together
+    // - Coalesces the query count increments and reservations of the batch: they are
+    //   applied to the store at once, as a single reservation (one lock, and one write of
+    //   the final count), taken from the worker's sequence as any other reservation
+    // - Then executes the requests in order, the increments and reservations being handed
+    //   the sequential values of the reservation, so that the values follow the order of
+    //   the requests, as if they had been executed one by one
+    // If the reservation fails (e.g. its persistence), the requests are applied one by
+    // one instead, so that each request gets its own error
+    void CountersServerDispatcher::dispatchBatch(BatchEntry* entries, std::size_t count) const
+    {
+        std::size_t queries = 0;
+        unsigned long long reserved = 0;
+        for (std::size_t i = 0; i < count; ++i)
+            queries += countQueries(entries[i].request, reserved);
+
+        QueryValues values;
+        if (queries > 1)
+        {
+            try
+            {
+                values.next = store_->reserveCounters(reserved);
+                values.end = values.next + reserved;
+                ServerStats::add(ServerStats::coalescedBatches);
+                ServerStats::add(ServerStats::coalescedQueries, queries);
+            }
+            catch (std::exception& e)
+            {
+                OCS_LOG_RATE_LIMITED(error, Constants::maxErrorLinesPerSecond) << e.what();
+            }
+        }
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            if (FlightRecorder::enabled())
+                FlightRecorder::resumeRequest(entries[i].traceRequest);
+            entries[i].size = measureCommand(entries[i].request, entries[i].reply, entries[i].capacity, values);
+        }
+    }
+
+
+    // measureCommand(request, reply, capacity, values):
+    // Private method invoked by dispatchCommand() and dispatchBatch(): counts the
+    // request, measures (sampled) and traces its processing, and processes it
+    std::size_t CountersServerDispatcher::measureCommand(boost::string_view request, char* reply, std::size_t capacity, QueryValues& values) const
     {
+        const auto sampled = ServerStats::sampled();
+        if (!sampled && !FlightRecorder::enabled())
+            return processCommand(request, reply, capacity, values);
+
+        const auto start = ServerStats::Clock::now();
+        const auto size = processCommand(request, reply, capacity, values);
+        const auto end = ServerStats::Clock::now();
+        if (sampled)
+            ServerStats::record(ServerStats::dispatch, std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+        if (FlightRecorder::enabled())
+            FlightRecorder::record(FlightRecorder::dispatch, FlightRecorder::toNanoseconds(start), FlightRecorder::toNanoseconds(end));
+        return size;
+    }
+
+
+    // processCommand(request, reply, capacity, values):
+    // Private method invoked by measureCommand(): executes the query processing workflow
+    std::size_t CountersServerDispatcher::processCommand(boost::string_view request, char* reply, std::size_t capacity, QueryValues& values) const
+    {
+        if (BinaryProtocol::detect(request.data(), request.size()))
+            return dispatchBinary(request, reply, capacity, values);
+
         try
         {
-            const auto command = readCommand(buffer, bytes);
-            Logger(debug) << "Received a command '" << command << "', dispatching";
+            const auto command = readCommand(request);
+            OCS_LOG(debug) << "Received a command '" << command << "', dispatching";
+            return invokeExecutor(command, reply, capacity, values);
+        }
+        catch (std::exception& e)
+        {
+            ServerStats::add(dynamic_cast<const std::invalid_argument*>(&e) ? ServerStats::malformed : ServerStats::failed);
+            OCS_LOG_RATE_LIMITED(error, Constants::maxErrorLinesPerSecond) << e.what();
+            return formatError(e, reply, capacity);
+        }
+    }
+
+
+    // countQueries(request, values):
+    // Private method invoked by dispatchBatch(): returns the number of query count
+    // increments and reservations of a request (a "GET" or "GET <n>" command, or the "GET"
+    // and "GET <n>" operations of a valid binary datagram), and adds the number of values
+    // they take to values
+    // The invalid reservations take no value, as they fail when executed
+    std::size_t CountersServerDispatcher::countQueries(boost::string_view request, unsigned long long& values) const
+    {
+        if (!BinaryProtocol::detect(request.data(), request.size()))
+        {
+            static const boost::string_view reservePrefix = "GET ";
+            const auto command = readCommand(request);
+            const auto reservation = command.starts_with(reservePrefix) ? reservationSize(command.substr(reservePrefix.size())) : 0;
+            const auto taken = command == "GET" ? 1 : reservation;
+            values += taken;
+            return taken ? 1 : 0;
+        }
+
+        BinaryReader reader(request.data(), request.size());
+        BinaryHeader header;
+        if (!reader.readHeader(header) || header.version != BinaryProtocol::version || header.opcode != BinaryProtocol::request)
+            return 0;
+        std::size_t queries = 0;
+        BinaryOperation operation;
+        for (std::uint16_t i = 0; i < header.count && reader.readOperation(operation); ++i)
+        {
+            const auto taken = operation.code == BinaryProtocol::getQueries ? 1
+                             : operation.code == BinaryProtocol::reserveQueries ? reservationSize(operation.value) : 0;
+            if (taken)
+            {
+                values += taken;
+                ++queries;
+            }
+        }
+        return queries;
+    }
+
 
-            const auto result = invokeExecutor(command);
+    // dispatchBinary(request, reply, capacity, values):
+    // Private method invoked by processCommand() when processing a binary datagram:
+    // - decodes the header and the operations one by one
+    // - executes each operation, errors being reported by the operation's status
+    // - encodes the reply datagram (one result per operation), returns its size
+    // A reply operation is never larger than the request operation, so that the replies
+    // of all the complete operations of a received datagram always fit in a reply buffer
+    // of the reception buffer's size
+    std::size_t CountersServerDispatcher::dispatchBinary(boost::string_view request, char* reply, std::size_t capacity, QueryValues& values) const
+    {
+        BinaryReader reader(request.data(), request.size());
+        BinaryWriter writer(reply, capacity);
+
+        // Decode the header: a datagram of an unknown version is rejected as a whole
+        BinaryHeader header;
+        const auto valid = reader.readHeader(header)
+            && header.version == BinaryProtocol::version
+            && header.opcode == BinaryProtocol::request;
+        header.version = BinaryProtocol::version;
+        header.opcode = BinaryProtocol::reply;
+        header.flags = valid ? 0 : BinaryProtocol::rejected;
+        const auto count = valid ? header.count : 0;
+        header.count = 0;
+        writer.writeHeader(header);
+        if (!valid)
+        {
+            ServerStats::add(ServerStats::malformed);
+            OCS_LOG_RATE_LIMITED(error, Constants::maxErrorLinesPerSecond) << "Rejected a binary datagram (bad version or opcode)";
+            return writer.size();
+        }
 
-            Logger(debug) << "Command was successfully processed, result= " << result;
-            return formatResult(result);
+        // Execute the operations, stopping at the first truncated one
+        std::uint16_t executed = 0;
+        for (auto truncated = false; executed < count && !truncated; ++executed)
+        {
+            BinaryOperation operation;
+            BinaryOperation result;
+            truncated = !reader.readOperation(operation);
+            if (truncated)
+            {
+                ServerStats::add(ServerStats::malformed);
+                OCS_LOG_RATE_LIMITED(error, Constants::maxErrorLinesPerSecond) << "Truncated operation in a binary datagram";
+                result.status = BinaryProtocol::malformed;
+            }
+            else
+            {
+                result.code = operation.code;
+                result.value = executeOperation(operation, result.status, values);
+            }
+            if (!writer.writeOperation(result))
+                break;
+        }
+        writer.setCount(executed);
+        ServerStats::add(ServerStats::operations, executed);
+        return writer.size();
+    }
+
+
+    // executeOperation(operation, status, values):
+    // Private method invoked by dispatchBinary() for each operation:
+    // - invokes the store's method corresponding to the operation's code
+    // - returns the store's answer, and sets the status (ok, failed, unsupported, or
+    //   malformed for an invalid argument: a counter name, or a number of values to reserve)
+    unsigned long long CountersServerDispatcher::executeOperation(const BinaryOperation& operation, std::uint8_t& status, QueryValues& values) const
+    {
+        try
+        {
+            status = BinaryProtocol::ok;
+            switch (operation.code)
+            {
+            case BinaryProtocol::getQueries:
+                return incrementQueries(values);
+            case BinaryProtocol::getCounter:
+                return store_->getCounter(boost::string_view(operation.name, operation.nameLength));
+            case BinaryProtocol::incrementCounter:
+                return store_->incrementCounter(boost::string_view(operation.name, operation.nameLength), operation.value);
+            case BinaryProtocol::reserveQueries:
+                if (!reservationSize(operation.value))
+                    throw InvalidCommand("Invalid number of values to reserve: " + std::to_string(operation.value));
+                return reserveQueries(values, operation.value);
+            case BinaryProtocol::peekQueries:
+                return store_->peekCounters();
+            default:
+                ServerStats::add(ServerStats::unsupported);
+                OCS_LOG_RATE_LIMITED(error, Constants::maxErrorLinesPerSecond) << "Unsupported binary operation: " << static_cast<int>(operation.code);
+                status = BinaryProtocol::unsupported;
+                return 0;
+            }
+        }
+        catch (std::invalid_argument& e)
+        {
+            ServerStats::add(ServerStats::malformed);
+            OCS_LOG_RATE_LIMITED(error, Constants::maxErrorLinesPerSecond) << e.what();
+            status = BinaryProtocol::malformed;
+            return 0;
         }
         catch (std::exception& e)
         {
-            Logger(error) << e.what();
-            return formatError(e);
+            ServerStats::add(ServerStats::failed);
+            OCS_LOG_RATE_LIMITED(error, Constants::maxErrorLinesPerSecond) << e.what();
+            status = BinaryProtocol::failed;
+            return 0;
         }
     }
 
 
-    // readCommand(buffer, bytes):
+    // readCommand(request):
     // Private method invoked by dispatchCommand() when processing a command:
-    // - reads the input buffer into a string
-    // - removes any trailing newline
-    std::string CountersServerDispatcher::readCommand(const char* buffer, std::size_t bytes) const
+    // - removes any trailing newline from the request
+    boost::string_view CountersServerDispatcher::readCommand(boost::string_view request) const
     {
-        if (bytes && buffer[bytes-1] == '\n')
-            --bytes;
-        return std::string(buffer, bytes);
+        if (!request.empty() && request.back() == '\n')
+            request.remove_suffix(1);
+        return request;
     }
 
 
-    // invokeExecutor(command):
-    // Private method invoked by dispatchCommand() when processing a command:
-    // - checks that the command corresponds to an expected command name ("GET")
-    // - forwards the command to a method dedicated to this query (invoke_getCounters)
-    // - formats the result ("OK:..." on success, "ERROR:..." on error)
-    // - returns the formatted result to the caller (dispatchCommand)
-    std::string CountersServerDispatcher::invokeExecutor(const std::string& command) const
+    // Commands structure:
+    // The table of the text commands: one entry per command, by first word and number of
+    // words, with the method executing it (looked up by a perfect hash, see CommandTable)
+    struct CountersServerDispatcher::Commands
     {
-        // Only one command for now, so a simple if-block is used (faster than a LUT search)
+        typedef CommandHandler Handler;
+
+        static constexpr CommandEntry<Handler> entries[] = {
+            { "GET",    1, &CountersServerDispatcher::invoke_getCounters },
+            { "PEEK",   1, &CountersServerDispatcher::invoke_peekCounters },
+            { "GET",    2, &CountersServerDispatcher::invoke_getCounter },
+            { "INCR",   3, &CountersServerDispatcher::invoke_incrementCounter },
+            { "STATS",  1, &CountersServerDispatcher::invoke_stats },
+            { "TRACE",  2, &CountersServerDispatcher::invoke_trace } };
+    };
+
+    constexpr CommandEntry<CountersServerDispatcher::CommandHandler> CountersServerDispatcher::Commands::entries[];
+
+
+    // invokeExecutor(command, reply, capacity, values):
+    // Private method invoked by processCommand() when processing a command:
+    // - answers the plain "GET" command at once, without the table: by far the most
+    //   frequent command, it skips the split and the hash
+    // - splits the other commands into their words (at most 3, separated by single spaces)
+    // - looks up the command in the table of the commands, by its first word and its
+    //   number of words: a hash and a single comparison, whatever the number of commands
+    // - forwards the command to the method dedicated to this query (invoke_getCounters...),
+    //   called through a pointer to member function
+    // - returns the size of the reply to the caller (processCommand)
+    std::size_t CountersServerDispatcher::invokeExecutor(boost::string_view command, char* reply, std::size_t capacity, QueryValues& values) const
+    {
+        // The plain "GET" command is by far the most frequent, it is checked first
         if (command == "GET")
-            return invoke_getCounters(command);
+            return formatResult(incrementQueries(values), reply, capacity);
+
+        // Split the command into its words
+        CommandWords words;
+        std::size_t count = 0;
+        for (auto rest = command; ; )
+        {
+            if (count == words.size())
+            {
+                count = 0;  // too many words: unrecognized command
+                break;
+            }
+            const auto end = rest.find(' ');
+            words[count++] = rest.substr(0, end);
+            if (end == boost::string_view::npos)
+                break;
+            rest.remove_prefix(end + 1);
+        }
 
-        // Throw if the command is not valid: 
-        // dispatchCommand() will convert the exception into an error message
-        const auto msg = "Unrecognized command: '" + command + "'";
-        Logger(error) << msg;
-        throw std::logic_error(msg);
+        const auto* const entry = count ? CommandTable<Commands>::find(words[0], count) : nullptr;
+
+        // Throw if the command is not valid:
+        // processCommand() will log the exception and convert it into an error message
+        if (!entry)
+            throw InvalidCommand("Unrecognized command: '" + command.to_string() + "'");
+        return (this->*entry->handler)(words, reply, capacity, values);
     }
 
 
-    // invoke_getCounters(/*command*/):
+    // invoke_getCounters(words, reply, capacity, values):
     // Private method invoked by invokeExecutor() when processing a "GET" command:
+    // - takes a value reserved for the batch, or invokes the store's corresponding method
+    std::size_t CountersServerDispatcher::invoke_getCounters(const CommandWords& /* words */, char* reply, std::size_t capacity, QueryValues& values) const
+    {
+        return formatResult(incrementQueries(values), reply, capacity);
+    }
+
+
+    // invoke_peekCounters(words, reply, capacity, values):
+    // Private method invoked by invokeExecutor() when processing a "PEEK" command:
+    // - invokes the store's corresponding method (lock-free, without persistence)
+    std::size_t CountersServerDispatcher::invoke_peekCounters(const CommandWords& /* words */, char* reply, std::size_t capacity, QueryValues& /* values */) const
+    {
+        return formatResult(store_->peekCounters(), reply, capacity);
+    }
+
+
+    // invoke_getCounter(words, reply, capacity, values):
+    // Private method invoked by invokeExecutor() when processing a "GET <name>" command:
+    // - "GET <n>" (a number) reserves a range of values, and is forwarded to
+    //   invoke_reserveCounters() (a counter's name may not be a number)
+    // - invokes the store's corresponding method
+    std::size_t CountersServerDispatcher::invoke_getCounter(const CommandWords& words, char* reply, std::size_t capacity, QueryValues& values) const
+    {
+        if (isNumber(words[1]))
+            return invoke_reserveCounters(words, reply, capacity, values);
+        return formatResult(store_->getCounter(words[1]), reply, capacity);
+    }
+
+
+    // invoke_reserveCounters(words, reply, capacity, values):
+    // Private method invoked by invoke_getCounter() when processing a "GET <n>" command:
+    // - decodes the number of values to reserve (1 to Constants::maxReservationSize)
+    // - invokes the store's corresponding method
+    std::size_t CountersServerDispatcher::invoke_reserveCounters(const CommandWords& words, char* reply, std::size_t capacity, QueryValues& values) const
+    {
+        const auto value = reservationSize(words[1]);
+        if (!value)
+            throw InvalidCommand("Invalid number of values to reserve: '" + words[1].to_string() + "' (1 to " + std::to_string(Constants::maxReservationSize) + ")");
+
+        return formatResult(reserveQueries(values, value), reply, capacity);
+    }
+
+
+    // reservationSize(count):
+    // Private method invoked for each reservation: returns the number of values of a
+    // "GET <n>" command, or of a "GET <n>" binary operation, or 0 if it is not valid
+    // (1 to Constants::maxReservationSize)
+    unsigned long long CountersServerDispatcher::reservationSize(boost::string_view count)
+    {
+        if (!isNumber(count))
+            return 0;
+        unsigned long long value = 0;
+        for (const auto c : count)
+        {
+            value = value * 10 + (c - '0');
+            if (value > Constants::maxReservationSize)
+                return 0;
+        }
+        return value;
+    }
+
+    unsigned long long CountersServerDispatcher::reservationSize(unsigned long long count)
+    {
+        return count <= Constants::maxReservationSize ? count : 0;
+    }
+
+
+    // invoke_incrementCounter(words, reply, capacity, values):
+    // Private method invoked by invokeExecutor() when processing a "INCR <name> <n>" command:
+    // - decodes the increment (a decimal number, without sign)
     // - invokes the store's corresponding method
-    // - converts the store's answer into a string
-    std::string CountersServerDispatcher::invoke_getCounters(const std::string& /*command*/) const
+    std::size_t CountersServerDispatcher::invoke_incrementCounter(const CommandWords& words, char* reply, std::size_t capacity, QueryValues& /* values */) const
+    {
+        const auto increment = words[2];
+        unsigned long long value = 0;
+        if (increment.empty())
+            throw InvalidCommand("Invalid increment: ''");
+        for (const auto c : increment)
+        {
+            const unsigned digit = c - '0';
+            if (digit > 9 || value > (~0ULL - digit) / 10)
+                throw InvalidCommand("Invalid increment: '" + increment.to_string() + "'");
+            value = value * 10 + digit;
+        }
+
+        return formatResult(store_->incrementCounter(words[1], value), reply, capacity);
+    }
+
+
+    // invoke_stats(words, reply, capacity, values):
+    // Private method invoked by invokeExecutor() when processing a "STATS" command:
+    // - writes the performance metrics of the server (a multi-line text, not a value)
+    std::size_t CountersServerDispatcher::invoke_stats(const CommandWords& /* words */, char* reply, std::size_t capacity, QueryValues& /* values */) const
+    {
+        return ServerStats::report(configuration_.port, reply, capacity);
+    }
+
+
+    // invoke_trace(words, reply, capacity, values):
+    // Private method invoked by invokeExecutor() when processing a "TRACE DUMP" command:
+    // - dumps the trace events, and writes the path of the trace file
+    std::size_t CountersServerDispatcher::invoke_trace(const CommandWords& words, char* reply, std::size_t capacity, QueryValues& /* values */) const
     {
-        const auto result = store_->getCounters();
-        return std::to_string(result);
+        if (words[1] != "DUMP")
+            throw InvalidCommand("Unrecognized command: 'TRACE " + words[1].to_string() + "'");
+
+        std::size_t events = 0;
+        const auto path = FlightRecorder::dump(configuration_.workDirectory, events);
+        OCS_LOG(info) << "Dumped " << events << " trace events to '" << path << "'";
+        const auto text = "OK: " + path + " (" + std::to_string(events) + " events)\n";
+        return append(reply, 0, capacity, text.data(), text.size());
     }
 
 
-    // formatResult(result):
-    // Private method invoked by dispatchCommand() when processing a result
-    // returned by invokeExecutor():
-    // - prefixes the result with "OK:" for ease of error detection by the client
-    std::string CountersServerDispatcher::formatResult(const std::string& result) const
+    // formatResult(result, reply, capacity):
+    // Private method invoked by the command methods (invoke_getCounters...) when
+    // processing a result returned by the store:
+    // - writes the result, prefixed with "OK:" for ease of error detection by the client
+    // - returns the size of the reply
+    std::size_t CountersServerDispatcher::formatResult(unsigned long long result, char* reply, std::size_t capacity) const
     {
-        return "OK: " + result + "\n";
+        OCS_LOG(debug) << "Command was successfully processed, result= " << result;
+
+        // Format the digits from the end of a local buffer
+        std::array<char, 24> digits;
+        auto* begin = digits.data() + digits.size();
+        do
+        {
+            *--begin = static_cast<char>('0' + result % 10);
+            result /= 10;
+        }
+        while (result);
+
+        auto size = append(reply, 0, capacity, "OK: ", 4);
+        size = append(reply, size, capacity, begin, digits.data() + digits.size() - begin);
+        return append(reply, size, capacity, "\n", 1);
+    }
+
+
+    // rejectCommand(request, reply, capacity):
+    // Encodes the reply of a throttled request, without decoding more than the header of
+    // a binary datagram (whose request id is echoed)
+    std::size_t CountersServerDispatcher::rejectCommand(boost::string_view request, char* reply, std::size_t capacity)
+    {
+        if (!BinaryProtocol::detect(request.data(), request.size()))
+        {
+            static const char text[] = "ERROR: throttled\n";
+            return append(reply, 0, capacity, text, sizeof(text) - 1);
+        }
+
+        BinaryReader reader(request.data(), request.size());
+        BinaryWriter writer(reply, capacity);
+        BinaryHeader header;
+        reader.readHeader(header);
+        header.version = BinaryProtocol::version;
+        header.opcode = BinaryProtocol::reply;
+        header.flags = BinaryProtocol::throttled;
+        header.count = 0;
+        writer.writeHeader(header);
+        return writer.size();
     }
 
 
-    // formatError(exception):
+    // formatError(exception, reply, capacity):
     // Private method invoked by dispatchCommand() when processing an exception
     // raised during the processing of the query:
-    // - prefixes the exception's message with "ERROR:" for ease of error detection by the client
-    std::string CountersServerDispatcher::formatError(const std::exception& e) const
+    // - writes the exception's message, prefixed with "ERROR:" for ease of error detection by the client
+    // - returns the size of the reply
+    std::size_t CountersServerDispatcher::formatError(const std::exception& e, char* reply, std::size_t capacity) const
     {
-        return std::string("ERROR: ") + e.what() + "\n";
+        auto size = append(reply, 0, capacity, "ERROR: ", 7);
+        size = append(reply, size, capacity, e.what(), std::strlen(e.what()));
+        return append(reply, size, capacity, "\n", 1);
     }
 
 } // namespace CountersServer
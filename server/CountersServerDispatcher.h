@@ -12,7 +12,11 @@
 // - sends the messages to the CountersServer, which will forward them to the clients
 //
 
-#include <string>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <boost/utility/string_view.hpp>
+#include "BinaryProtocol.h"
 #include "Configuration.h"
 #include "CountersStore.h"
 
@@ -27,9 +31,25 @@ namespace CountersServer
     // - receives the CountersStore's replies to theses requests
     // - encodes the replies as messages
     // - sends the messages to the CountersServer, which will forward them to the clients
+    //
+    // The requests are decoded in place, and the replies are encoded directly into
+    // a buffer owned by the caller: processing a request does not allocate (apart
+    // from the error messages)
     class CountersServerDispatcher
     {
     public:
+        // BatchEntry structure:
+        // A request of a batch (see dispatchBatch()), its reply buffer, and its reply's size
+        // No logic is required -> implemented as an open struct
+        struct BatchEntry
+        {
+            boost::string_view  request;
+            char*               reply;
+            std::size_t         capacity;
+            std::size_t         size;           // set by dispatchBatch()
+            std::uint64_t       traceRequest;   // request number, if traced (see FlightRecorder)
+        };
+
         // Ctor: 
         // Receives its dependencies from the caller, and stores them into internal variables
         CountersServerDispatcher(const Configuration& configuration, std::shared_ptr<CountersStore> store)
@@ -41,47 +61,185 @@ namespace CountersServer
         // releases shared resources (RAII)
         ~CountersServerDispatcher() = default;
 
-        // dispatchCommand(buffer, bytes):
+        // dispatchCommand(request, reply, capacity):
         // Public API to be invoked by a CountersServer
         // - Executes the query processing workflow
         //   1) reception, decoding, dispatching of a requests to a CountersStore
-        //   2) encoding and forwarding of the CountersStore's reply
+        //   2) encoding of the CountersStore's reply into the caller's reply buffer
+        // - Returns the size of the reply (truncated to the buffer's capacity)
         // - Encapsulate the workflow in a try-block so that exceptions when processing
         //   queries should never bubble up to the server
-        std::string dispatchCommand(const char* buffer, std::size_t bytes) const;
+        // - The protocol (text or binary) is detected on each datagram
+        // - Counts the request, and measures its processing time (sampled), for the
+        //   "STATS" command (see ServerStats)
+        std::size_t dispatchCommand(boost::string_view request, char* reply, std::size_t capacity) const;
+
+        // dispatchBatch(entries, count):
+        // Public API to be invoked by a CountersServer, for the requests received together
+        // - Coalesces the query count increments and reservations of the batch ("GET" and
+        //   "GET <n>" commands, and operations of the binary datagrams): they are applied to
+        //   the store at once, as a single reservation (one lock, and one write of the final
+        //   count), which follows the values already issued by the worker
+        // - Then executes the requests in order (see dispatchCommand()), the increments and
+        //   reservations being handed the sequential values of the reservation, in the order
+        //   of the requests
+        // - Counts the coalesced batches and increments, for the "STATS" command
+        void dispatchBatch(BatchEntry* entries, std::size_t count) const;
+
+        // rejectCommand(request, reply, capacity):
+        // Public API to be invoked by a server for a request refused by its admission
+        // control (see AdmissionControl), instead of dispatching it
+        // - Encodes the cheap reply of a throttled request ("ERROR: throttled", or a binary
+        //   header flagged throttled, echoing the request id, without any operation)
+        // - Returns the size of the reply (truncated to the buffer's capacity)
+        static std::size_t rejectCommand(boost::string_view request, char* reply, std::size_t capacity);
 
     private:
-        // readCommand(buffer, bytes):
-        // Private method invoked by dispatchCommand() when processing a command:
-        // - reads the input buffer into a string
-        // - removes any trailing newline
-        std::string readCommand(const char* buffer, std::size_t bytes) const;
+        // QueryValues structure:
+        // Range of query count values reserved for the increments of a batch, [next, end)
+        // No logic is required -> implemented as an open struct
+        struct QueryValues
+        {
+            unsigned long long  next = 0;
+            unsigned long long  end = 0;
+        };
+
+        // measureCommand(request, reply, capacity, values):
+        // Private method invoked by dispatchCommand() and dispatchBatch(): counts the
+        // request, measures (sampled) and traces its processing, and processes it
+        std::size_t measureCommand(boost::string_view request, char* reply, std::size_t capacity, QueryValues& values) const;
+
+        // processCommand(request, reply, capacity, values):
+        // Private method invoked by measureCommand(): executes the query processing workflow
+        std::size_t processCommand(boost::string_view request, char* reply, std::size_t capacity, QueryValues& values) const;
+
+        // countQueries(request, values):
+        // Private method invoked by dispatchBatch(): returns the number of query count
+        // increments and reservations of a request (a "GET" or "GET <n>" command, or the
+        // "GET" and "GET <n>" operations of a valid binary datagram), and adds the number
+        // of values they take to values
+        std::size_t countQueries(boost::string_view request, unsigned long long& values) const;
+
+        // incrementQueries(values):
+        // Private method invoked for each query count increment: hands out the next value
+        // reserved for the batch, if any, or else increments the store's count
+        unsigned long long incrementQueries(QueryValues& values) const
+        {
+            return values.next != values.end ? values.next++ : store_->getCounters();
+        }
+
+        // reserveQueries(values, count):
+        // Private method invoked for each query count reservation: hands out the next count
+        // values reserved for the batch, if any, or else reserves them from the store
+        unsigned long long reserveQueries(QueryValues& values, unsigned long long count) const
+        {
+            if (values.end - values.next < count)
+                return store_->reserveCounters(count);
+            const auto first = values.next;
+            values.next += count;
+            return first;
+        }
+
+        // reservationSize(count):
+        // Private method invoked for each reservation: returns the number of values of a
+        // "GET <n>" command, or of a "GET <n>" binary operation, or 0 if it is not valid
+        static unsigned long long reservationSize(boost::string_view count);
+        static unsigned long long reservationSize(unsigned long long count);
+
+        // dispatchBinary(request, reply, capacity, values):
+        // Private method invoked by processCommand() when processing a binary datagram:
+        // - decodes the header and the operations one by one
+        // - executes each operation, errors being reported by the operation's status
+        // - encodes the reply datagram (one result per operation), returns its size
+        std::size_t dispatchBinary(boost::string_view request, char* reply, std::size_t capacity, QueryValues& values) const;
+
+        // executeOperation(operation, status, values):
+        // Private method invoked by dispatchBinary() for each operation:
+        // - invokes the store's method corresponding to the operation's code
+        // - returns the store's answer, and sets the status (ok, failed or unsupported)
+        unsigned long long executeOperation(const BinaryOperation& operation, std::uint8_t& status, QueryValues& values) const;
 
-        // invokeExecutor(command):
+        // readCommand(request):
         // Private method invoked by dispatchCommand() when processing a command:
-        // - checks that the command corresponds to an expected command name ("GET")
-        // - forwards the command to a method dedicated to this query (invoke_getCounters)
-        // - formats the result ("OK:..." on success, "ERROR:..." on error)
-        // - returns the formatted result to the caller (dispatchCommand)
-        std::string invokeExecutor(const std::string& command) const;
+        // - removes any trailing newline from the request
+        boost::string_view readCommand(boost::string_view request) const;
 
-        // invoke_getCounters(/*command*/):
+        // CommandWords:
+        // The words of a text command (at most 3), separated by single spaces
+        typedef std::array<boost::string_view, 3> CommandWords;
+
+        // CommandHandler:
+        // Method executing a text command, given its words: encodes the reply into the
+        // caller's reply buffer, and returns its size
+        typedef std::size_t (CountersServerDispatcher::*CommandHandler)(const CommandWords& words, char* reply, std::size_t capacity, QueryValues& values) const;
+
+        // Commands structure:
+        // The table of the text commands, by first word and number of words (see
+        // CountersServerDispatcher.cpp, and CommandTable)
+        struct Commands;
+
+        // invokeExecutor(command, reply, capacity, values):
+        // Private method invoked by processCommand() when processing a command:
+        // - answers the plain "GET" command at once (the most frequent one)
+        // - splits the other commands into their words
+        // - looks up the command in the table of the commands, by its first word and its
+        //   number of words ("GET", "PEEK", "GET <n>", "GET <name>", "INCR <name> <n>",
+        //   "STATS" or "TRACE DUMP")
+        // - forwards the command to the method dedicated to this query (invoke_getCounters...)
+        // - returns the size of the reply to the caller (processCommand)
+        std::size_t invokeExecutor(boost::string_view command, char* reply, std::size_t capacity, QueryValues& values) const;
+
+        // invoke_getCounters(words, reply, capacity, values):
         // Private method invoked by invokeExecutor() when processing a "GET" command:
+        // - takes a value reserved for the batch, or invokes the store's corresponding method
+        std::size_t invoke_getCounters(const CommandWords& words, char* reply, std::size_t capacity, QueryValues& values) const;
+
+        // invoke_peekCounters(words, reply, capacity, values):
+        // Private method invoked by invokeExecutor() when processing a "PEEK" command:
+        // - invokes the store's corresponding method (lock-free, without persistence)
+        std::size_t invoke_peekCounters(const CommandWords& words, char* reply, std::size_t capacity, QueryValues& values) const;
+
+        // invoke_getCounter(words, reply, capacity, values):
+        // Private method invoked by invokeExecutor() when processing a "GET <name>" command
+        // (or a "GET <n>" command, forwarded to invoke_reserveCounters()):
         // - invokes the store's corresponding method
-        // - converts the store's answer into a string
-        std::string invoke_getCounters(const std::string& /*command*/) const;
+        std::size_t invoke_getCounter(const CommandWords& words, char* reply, std::size_t capacity, QueryValues& values) const;
+
+        // invoke_reserveCounters(words, reply, capacity, values):
+        // Private method invoked by invoke_getCounter() when processing a "GET <n>" command:
+        // - decodes the number of values to reserve
+        // - invokes the store's corresponding method
+        std::size_t invoke_reserveCounters(const CommandWords& words, char* reply, std::size_t capacity, QueryValues& values) const;
+
+        // invoke_incrementCounter(words, reply, capacity, values):
+        // Private method invoked by invokeExecutor() when processing a "INCR <name> <n>" command:
+        // - decodes the increment
+        // - invokes the store's corresponding method
+        std::size_t invoke_incrementCounter(const CommandWords& words, char* reply, std::size_t capacity, QueryValues& values) const;
+
+        // invoke_stats(words, reply, capacity, values):
+        // Private method invoked by invokeExecutor() when processing a "STATS" command:
+        // - writes the performance metrics of the server (a multi-line text, not a value)
+        std::size_t invoke_stats(const CommandWords& words, char* reply, std::size_t capacity, QueryValues& values) const;
+
+        // invoke_trace(words, reply, capacity, values):
+        // Private method invoked by invokeExecutor() when processing a "TRACE DUMP" command:
+        // - dumps the trace events, and writes the path of the trace file
+        std::size_t invoke_trace(const CommandWords& words, char* reply, std::size_t capacity, QueryValues& values) const;
 
-        // formatResult(result):
-        // Private method invoked by dispatchCommand() when processing a result
-        // returned by invokeExecutor():
-        // - prefixes the result with "OK:" for ease of error detection by the client
-        std::string formatResult(const std::string& result) const;
+        // formatResult(result, reply, capacity):
+        // Private method invoked by the command methods (invoke_getCounters...) when
+        // processing a result returned by the store:
+        // - writes the result, prefixed with "OK:" for ease of error detection by the client
+        // - returns the size of the reply
+        std::size_t formatResult(unsigned long long result, char* reply, std::size_t capacity) const;
 
-        // formatError(exception):
+        // formatError(exception, reply, capacity):
         // Private method invoked by dispatchCommand() when processing an exception
         // raised during the processing of the query:
-        // - prefixes the exception's message with "ERROR:" for ease of error detection by the client
-        std::string formatError(const std::exception& e) const;
+        // - writes the exception's message, prefixed with "ERROR:" for ease of error detection by the client
+        // - returns the size of the reply
+        std::size_t formatError(const std::exception& e, char* reply, std::size_t capacity) const;
 
         // Internal logic
         const Configuration&            configuration_;    // Startup configuration
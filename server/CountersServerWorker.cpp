@@ -0,0 +1,203 @@
+//
+// CountersServerWorker.cpp
+// ~~~~~~~~~~~~~~~~~~~~~~~~
+//
+// Source for the CountersServerWorker class:
+// - owns a private asio IO context and the CountersServers (hence the sockets) bound to it:
+//   a udp one, plus a unix domain one for the first worker, if configured, and a TcpServer
+//   (hence an acceptor and its connections), if configured
+// - or, with the io_uring backend, a UringServer bound to the udp port
+// - runs the IO context (or the UringServer's event loop) on a dedicated thread,
+//   optionally pinned to a core
+// - in busy-poll mode, polls the IO context in a loop instead of sleeping in epoll,
+//   backing off while idle, and sleeping after a while without requests
+// - all the workers of a server share the same dispatcher (hence the same CountersStore)
+//
+#include "CountersServerWorker.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include "Logger.h"
+#include "ServerStats.h"
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    namespace
+    {
+        // Maximum number of pause instructions between two empty polls of a busy-polling
+        // worker (a few microseconds at most): the upper bound of the latency it adds
+        const unsigned theMaxBackoff = 128;
+
+        // relax():
+        // Hints the core that the thread is spinning (lets the sibling hyperthread run,
+        // and saves power), without yielding the core
+        inline void relax()
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#elif defined(__aarch64__)
+            asm volatile("yield");
+#endif
+        }
+    }
+
+    // Ctor:
+    // Creates the IO context and the CountersServers, which open and bind their sockets:
+    // the udp one (unless disabled), and the unix domain one (first worker only, if configured)
+    // Creates the TcpServer, which opens its acceptor, if configured
+    // With the io_uring backend, creates the UringServer instead, bound to the udp port
+    // (the options exclude the other transports, see main.cpp)
+    // The worker thread is not launched before start() is invoked
+    // Caution: may throw if a socket cannot be opened or bound
+    CountersServerWorker::CountersServerWorker(const Configuration& configuration, std::size_t index, std::shared_ptr<CountersServerDispatcher> dispatcher)
+    : configuration_(configuration)
+    , index_(index)
+    , io_context_()
+    , servers_()
+    , tcp_server_()
+    , uring_server_()
+    , thread_()
+    {
+        if (configuration_.ioBackend == IoBackend::uring)
+        {
+            uring_server_.reset(new UringServer(configuration_, io_context_, dispatcher, CountersServer::udp_endpoint(configuration_.port)));
+            return;
+        }
+        if (configuration_.udp)
+            servers_.emplace_back(new CountersServer(configuration_, io_context_, dispatcher, CountersServer::udp_endpoint(configuration_.port)));
+        if (index_ == 0 && !configuration_.unixSocket.empty())
+            servers_.emplace_back(new CountersServer(configuration_, io_context_, dispatcher, CountersServer::unix_endpoint(configuration_.unixSocket)));
+        if (configuration_.tcpPort)
+            tcp_server_.reset(new TcpServer(configuration_, io_context_, dispatcher));
+    }
+
+    // Dtor:
+    // Stops and joins the worker thread if it is still running
+    CountersServerWorker::~CountersServerWorker()
+    {
+        stop();
+        join();
+    }
+
+    // start():
+    // Launches the worker thread, which runs the IO context (or the UringServer's event
+    // loop) until stop() is invoked
+    void CountersServerWorker::start()
+    {
+        thread_ = std::thread([this]() { run(); });
+    }
+
+    // stop():
+    // Requests the IO context (or the UringServer's event loop) to stop (may be invoked
+    // from any thread)
+    void CountersServerWorker::stop()
+    {
+        io_context_.stop();
+        if (uring_server_)
+            uring_server_->stop();
+    }
+
+    // join():
+    // Waits for the termination of the worker thread
+    void CountersServerWorker::join()
+    {
+        if (thread_.joinable())
+            thread_.join();
+    }
+
+    // run():
+    // Worker thread's main code:
+    // - pins the thread to a core if requested by the configuration
+    // - runs the IO context (or the UringServer's event loop) until it is stopped
+    // - encapsulate the loop in a try-block so that exceptions should not terminate the process
+    void CountersServerWorker::run()
+    {
+        if (configuration_.pinThreads)
+            pinToCore();
+
+        try
+        {
+            Logger(debug) << "Worker " << index_ << " listening...";
+            if (uring_server_)
+                uring_server_->run();
+            else if (configuration_.busyPoll)
+                busyPoll();
+            else
+                io_context_.run();
+            Logger(debug) << "Worker " << index_ << " stopped";
+        }
+        catch (std::exception& e)
+        {
+            Logger(fatal) << "Worker " << index_ << ": " << e.what();
+        }
+    }
+
+    // busyPoll():
+    // Busy-poll mode: polls the IO context (a non-blocking epoll_wait, then the handlers
+    // ready) until it is stopped, so that a request is handled without the wakeup of a
+    // sleeping thread
+    // While idle, the polls are spaced by twice as many pause instructions each time (up
+    // to theMaxBackoff), and once idle for the configured time, the worker sleeps in epoll
+    // until the next handler, so that an idle server does not burn its cores
+    void CountersServerWorker::busyPoll()
+    {
+        typedef std::chrono::steady_clock Clock;
+        const auto idleLimit = std::chrono::microseconds(configuration_.busyPollIdle);
+        auto idleSince = Clock::now();
+        unsigned backoff = 0;
+        while (!io_context_.stopped())
+        {
+            if (io_context_.poll())
+            {
+                backoff = 0;
+                continue;
+            }
+
+            ServerStats::add(ServerStats::busyPolls);
+            const auto now = Clock::now();
+            if (backoff == 0)
+                idleSince = now;
+            else if (now - idleSince >= idleLimit)
+            {
+                ServerStats::add(ServerStats::busyPollSleeps);
+                io_context_.run_one();
+                backoff = 0;
+                continue;
+            }
+            for (unsigned i = 0; i < backoff; ++i)
+                relax();
+            backoff = std::min(std::max(2 * backoff, 1u), theMaxBackoff);
+        }
+    }
+
+    // pinToCore():
+    // Pins the calling thread to the core matching the worker's index
+    // (workers are spread round-robin if there are more workers than cores)
+    void CountersServerWorker::pinToCore()
+    {
+#ifdef __linux__
+        const auto cores = std::thread::hardware_concurrency();
+        const auto core = cores ? index_ % cores : index_;
+
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(core, &cpuset);
+        const auto rc = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+        if (rc != 0)
+            Logger(warning) << "Worker " << index_ << " could not be pinned to core " << core << ": " << std::strerror(rc);
+        else
+            Logger(debug) << "Worker " << index_ << " pinned to core " << core;
+#else
+        Logger(warning) << "Worker " << index_ << " could not be pinned: core pinning is not supported on this platform";
+#endif
+    }
+
+} // namespace CountersServer
+} // namespace ocs
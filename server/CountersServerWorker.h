@@ -0,0 +1,104 @@
+#ifndef OCS_COUNTERS_SERVER_COUNTERS_SERVER_WORKER_H
+#define OCS_COUNTERS_SERVER_COUNTERS_SERVER_WORKER_H
+//
+// CountersServerWorker.h
+// ~~~~~~~~~~~~~~~~~~~~~~
+//
+// Header for the CountersServerWorker class:
+// - owns a private asio IO context and the CountersServers (hence the sockets) bound to it:
+//   a udp one, plus a unix domain one for the first worker, if configured, and a TcpServer
+//   (hence an acceptor and its connections), if configured
+// - or, with the io_uring backend, a UringServer bound to the udp port
+// - runs the IO context (or the UringServer's event loop) on a dedicated thread,
+//   optionally pinned to a core
+// - in busy-poll mode, polls the IO context in a loop instead of sleeping in epoll,
+//   backing off while idle, and sleeping after a while without requests
+// - all the workers of a server share the same dispatcher (hence the same CountersStore)
+//
+
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include "Configuration.h"
+#include "CountersServer.h"
+#include "CountersServerDispatcher.h"
+#include "TcpServer.h"
+#include "UringServer.h"
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    // CountersServerWorker class:
+    // - owns a private asio IO context and the CountersServers (hence the sockets) bound to it
+    // - runs the IO context on a dedicated thread, optionally pinned to a core
+    // - all the workers of a server share the same dispatcher (hence the same CountersStore)
+    class CountersServerWorker
+    {
+    public:
+        // Ctor:
+        // Creates the IO context and the CountersServers, which open and bind their sockets:
+        // the udp one (unless disabled), and the unix domain one (first worker only, if configured)
+        // Creates the TcpServer, which opens its acceptor, if configured
+        // With the io_uring backend, creates the UringServer instead, bound to the udp port
+        // The worker thread is not launched before start() is invoked
+        // Caution: may throw if a socket cannot be opened or bound
+        CountersServerWorker(const Configuration& configuration, std::size_t index, std::shared_ptr<CountersServerDispatcher> dispatcher);
+
+        // Dtor:
+        // Stops and joins the worker thread if it is still running
+        ~CountersServerWorker();
+
+        // start():
+        // Launches the worker thread, which runs the IO context (or the UringServer's event
+        // loop) until stop() is invoked
+        void start();
+
+        // stop():
+        // Requests the IO context (or the UringServer's event loop) to stop (may be invoked
+        // from any thread)
+        void stop();
+
+        // join():
+        // Waits for the termination of the worker thread
+        void join();
+
+    private:
+        // run():
+        // Worker thread's main code:
+        // - pins the thread to a core if requested by the configuration
+        // - runs the IO context (or the UringServer's event loop) until it is stopped
+        void run();
+
+        // busyPoll():
+        // Busy-poll mode: polls the IO context until it is stopped, backing off while idle,
+        // and sleeping until the next handler once idle for the configured time
+        void busyPoll();
+
+        // pinToCore():
+        // Pins the calling thread to the core matching the worker's index
+        void pinToCore();
+
+        // Startup configuration parameters
+        const Configuration&        configuration_;
+
+        // Index of the worker, from 0 to (threads-1)
+        const std::size_t           index_;
+
+        // Private IO context, and the servers attached to it
+        boost::asio::io_service     io_context_;
+        std::vector<std::unique_ptr<CountersServer>> servers_;
+        std::unique_ptr<TcpServer>  tcp_server_;
+        std::unique_ptr<UringServer> uring_server_;
+
+        // Worker thread
+        std::thread                 thread_;
+    };
+
+} // namespace CountersServer
+} // namespace ocs
+
+#endif // OCS_COUNTERS_SERVER_COUNTERS_SERVER_WORKER_H
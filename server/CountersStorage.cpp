@@ -0,0 +1,198 @@
+//
+// CountersStorage.cpp
+// ~~~~~~~~~~~~~~~~~~~
+//
+// Source for the CountersStorage interface:
+// - create() instantiates the backend selected by the configuration
+//
+#include "CountersStorage.h"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include "JournalStorage.h"
+#include "Logger.h"
+#include "MappedFileStorage.h"
+#include "TextFileStorage.h"
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    namespace
+    {
+        // fail(msg):
+        // Logs an error message, and throws it
+        void fail(const std::string& msg)
+        {
+            Logger(error) << msg;
+            throw std::logic_error(msg);
+        }
+
+        // StorageFiles structure:
+        // The files holding the query count of a backend (the first one is always
+        // present, the others are nullptr if unused)
+        struct StorageFiles
+        {
+            Storage             storage;
+            const std::string*  files[2];
+        };
+
+        const StorageFiles theStorageFiles[] = {
+            { Storage::text, { &TextFileStorage::theFilename_, nullptr } },
+            { Storage::mmap, { &MappedFileStorage::theFilename_, nullptr } },
+            { Storage::wal, { &JournalStorage::theSnapshotFilename_, &JournalStorage::theJournalFilename_ } } };
+
+        // Suffix of the files whose count was migrated to another backend
+        const char* const theMigratedSuffix = ".migrated";
+
+        // migratesFrom(storage, previous):
+        // Returns true if the backend migrates the count of the previous one on open()
+        // (mmap from text, wal from text or mmap)
+        bool migratesFrom(Storage storage, Storage previous)
+        {
+            return (storage == Storage::mmap && previous == Storage::text)
+                || (storage == Storage::wal && previous != Storage::wal);
+        }
+    }
+
+
+    // create(configuration):
+    // Factory method: instantiates the (closed) storage backend selected by the configuration
+    std::unique_ptr<CountersStorage> CountersStorage::create(const Configuration& configuration)
+    {
+        switch (configuration.storage)
+        {
+        case Storage::text:
+            return std::unique_ptr<CountersStorage>(new TextFileStorage());
+        case Storage::wal:
+            return std::unique_ptr<CountersStorage>(new JournalStorage(configuration.snapshotInterval));
+        case Storage::mmap:
+            break;
+        }
+        return std::unique_ptr<CountersStorage>(new MappedFileStorage());
+    }
+
+    // filepath(directory, filename):
+    // Helper for the storage classes: returns the path of a file of the given directory
+    std::string CountersStorage::filepath(const std::string& directory, const std::string& filename)
+    {
+        if (!directory.empty() && directory.back() != '/')
+            return directory + '/' + filename;
+        return directory + filename;
+    }
+
+    // exists(path):
+    // Helper for the storage classes: returns true if the file exists
+    bool CountersStorage::exists(const std::string& path)
+    {
+        return ::access(path.c_str(), F_OK) == 0;
+    }
+
+    // previousStorage(directory, storage):
+    // Helper for the storage classes, invoked on open(): returns the backend whose files
+    // hold the directory's query count
+    // - the backend's own files: they hold the count, the files of any other backend
+    //   being stale (a former server would have migrated them)
+    // - the backend's own main file, and the file it migrates from (not retired yet): a
+    //   migration was interrupted after its new file was put in place (and synced), which
+    //   holds the count; the migration is finished by retiring the former file
+    // - no files of any backend: a new count, unless a file was migrated ('*.migrated'),
+    //   to a backend whose files are now missing
+    // - the files of another backend: its count is to be migrated
+    // Caution: throws if the count is ambiguous (the files of several backends), or lost
+    // (a migrated file without the backend's files), or if the migration would overwrite
+    // a former migrated file
+    Storage CountersStorage::previousStorage(const std::string& directory, Storage storage)
+    {
+        std::string ownPath;
+        std::string ownMainPath;
+        std::string otherPath;
+        std::string migratedPath;
+        auto previous = storage;
+        for (const auto& backend : theStorageFiles)
+        {
+            for (const auto* const file : backend.files)
+            {
+                if (!file)
+                    continue;
+                const auto path = filepath(directory, *file);
+                if (exists(path + theMigratedSuffix) && migratedPath.empty())
+                    migratedPath = path + theMigratedSuffix;
+                if (!exists(path))
+                    continue;
+                if (backend.storage == storage)
+                {
+                    ownPath = path;
+                    if (file == backend.files[0])
+                        ownMainPath = path;
+                }
+                else if (otherPath.empty())
+                {
+                    otherPath = path;
+                    previous = backend.storage;
+                }
+                else if (previous != backend.storage)
+                    fail("The work directory holds the query counts of several storage backends (" + otherPath + ", " + path + "): remove the stale files");
+            }
+        }
+
+        if (!ownMainPath.empty() && !otherPath.empty() && migratesFrom(storage, previous) && !exists(otherPath + theMigratedSuffix))
+        {
+            Logger(warning) << "Finishing the interrupted migration of the query count from " << otherPath << " to " << ownMainPath;
+            retireFile(otherPath);
+            return storage;
+        }
+        if (!ownPath.empty() && !otherPath.empty())
+            fail("The work directory holds the query count of the " + std::string(storageName(storage)) + " storage (" + ownPath
+                 + ") and of the " + storageName(previous) + " storage (" + otherPath + "): remove the stale files");
+        if (ownPath.empty() && otherPath.empty() && !migratedPath.empty())
+            fail("The query count was migrated from " + migratedPath + " to another storage, whose files are missing: "
+                 "rename the file back to migrate it again");
+        if (ownPath.empty() && !otherPath.empty() && exists(otherPath + theMigratedSuffix))
+            fail("The query count of " + otherPath + " cannot be migrated, as " + otherPath + theMigratedSuffix
+                 + " already exists (a former migration): remove the stale file");
+        return previous;
+    }
+
+    // retireFile(path):
+    // Helper for the storage classes: renames a migrated file to '<path>.migrated',
+    // never overwriting an existing one (hard link, then unlink)
+    // Caution: throws if the file cannot be renamed
+    void CountersStorage::retireFile(const std::string& path)
+    {
+        const auto migratedPath = path + theMigratedSuffix;
+        if (::link(path.c_str(), migratedPath.c_str()) != 0 || ::unlink(path.c_str()) != 0)
+            fail("Could not rename " + path + " to " + migratedPath + ": " + std::strerror(errno));
+    }
+
+    // syncDirectory(directory):
+    // Helper for the storage classes: flushes the directory's entries to the disk, so that
+    // a file renamed there keeps its new name after a system crash (best effort)
+    void CountersStorage::syncDirectory(const std::string& directory)
+    {
+        const auto fd = ::open(directory.empty() ? "." : directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0)
+        {
+            ::fsync(fd);
+            ::close(fd);
+        }
+    }
+
+    // storageName(storage):
+    // Returns the name of a backend, as given to the '--storage' option
+    const char* CountersStorage::storageName(Storage storage)
+    {
+        switch (storage)
+        {
+        case Storage::text: return "text";
+        case Storage::mmap: return "mmap";
+        case Storage::wal:  return "wal";
+        }
+        return "";
+    }
+
+} // namespace CountersServer
+} // namespace ocs
@@ -0,0 +1,96 @@
+#ifndef OCS_COUNTERS_SERVER_COUNTERS_STORAGE_H
+#define OCS_COUNTERS_SERVER_COUNTERS_STORAGE_H
+//
+// CountersStorage.h
+// ~~~~~~~~~~~~~~~~~
+//
+// Header for the CountersStorage interface:
+// - abstract persistent storage backend of the CountersStore
+// - gives explicit control over durability: writing the count is meant to be cheap,
+//   a separate sync() is required for the count to survive a system crash
+// - create() instantiates the backend selected by the configuration
+// - the backends refuse to start on the files of another backend, unless they can migrate
+//   its count, so that a switch of backend never reissues the values already issued
+//
+
+#include <memory>
+#include <string>
+#include "Configuration.h"
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    // CountersStorage interface:
+    // - abstract persistent storage backend of the CountersStore
+    // - gives explicit control over durability: writing the count is meant to be cheap,
+    //   a separate sync() is required for the count to survive a system crash
+    // Note: a CountersStorage is not thread-safe, concurrent accesses must be serialized by the caller
+    class CountersStorage
+    {
+    public:
+        // create(configuration):
+        // Factory method: instantiates the (closed) storage backend selected by the configuration
+        static std::unique_ptr<CountersStorage> create(const Configuration& configuration);
+
+        // Dtor:
+        // Closes the storage (RAII)
+        virtual ~CountersStorage() = default;
+
+        // open(directory):
+        // - opens the storage in the given directory, or creates it with a zero count
+        // - reads and returns the count stored there by a previous server instance
+        // - keeps the storage open for later use
+        // Caution: throws if the storage cannot be opened or read
+        virtual unsigned long long open(const std::string& directory) = 0;
+
+        // write(count):
+        // Overwrites the stored count (the data is not guaranteed to be on disk, see sync())
+        // Caution: throws if the write fails
+        virtual void write(unsigned long long count) = 0;
+
+        // sync():
+        // Flushes the written count to the disk
+        // Caution: throws if the flush fails
+        virtual void sync() = 0;
+
+        // filepath(directory, filename):
+        // Helper for the storage classes: returns the path of a file of the given directory
+        static std::string filepath(const std::string& directory, const std::string& filename);
+
+        // exists(path):
+        // Helper for the storage classes: returns true if the file exists
+        static bool exists(const std::string& path);
+
+        // previousStorage(directory, storage):
+        // Helper for the storage classes, invoked on open(): returns the backend whose files
+        // hold the directory's query count, i.e. the given one if its files exist or if the
+        // directory holds no count yet, or else the backend to migrate the count from, so
+        // that a switch of backend never restarts the count from 0
+        // A migration interrupted after the backend's file was put in place is finished
+        // (the former file is retired, see retireFile())
+        // Caution: throws if the files of several backends are found, or if the backend's
+        // files are missing while a file was already migrated ('*.migrated')
+        static Storage previousStorage(const std::string& directory, Storage storage);
+
+        // retireFile(path):
+        // Helper for the storage classes: renames a migrated file to '<path>.migrated',
+        // never overwriting an existing one
+        // Caution: throws if the file cannot be renamed
+        static void retireFile(const std::string& path);
+
+        // syncDirectory(directory):
+        // Helper for the storage classes: flushes the directory's entries to the disk, so
+        // that a file renamed there keeps its new name after a system crash (best effort)
+        static void syncDirectory(const std::string& directory);
+
+        // storageName(storage):
+        // Returns the name of a backend, as given to the '--storage' option
+        static const char* storageName(Storage storage);
+    };
+
+} // namespace CountersServer
+} // namespace ocs
+
+#endif // OCS_COUNTERS_SERVER_COUNTERS_STORAGE_H
@@ -4,15 +4,20 @@
 //
 // Source for the CountersStore class:
 // - records the number of queries received by the server
-// - read/writes this query count to persistent storage
+// - read/writes this query count to persistent storage, according to the durability mode
 // - can respond to requests for the query current count
+// - holds named counters, which can be read and incremented independently
 //
 #include "CountersStore.h"
+#include <chrono>
 #include <cstring>
 #include <ctime>
 #include <iostream>
 #include <memory>
+#include <stdexcept>
 #include "Logger.h"
+#include "FlightRecorder.h"
+#include "ServerStats.h"
 
 
 namespace ocs
@@ -20,102 +25,453 @@ namespace ocs
 namespace CountersServer
 {
 
-    // Filename for persistent storage to disk
-    // Note that the filename is fixed:
-    // + allows for easy retrieval of a count stored by a previous instance
-    // - forbids several servers from running on the same machine (e.g. on different ports)
-    const std::string CountersStore::theFilename_ = "query_counters.txt";
+    namespace
+    {
+        // record(histogram, stage, start):
+        // Records the latency elapsed since a start time into the server statistics,
+        // and into the trace if tracing is enabled
+        void record(ServerStats::Histogram histogram, FlightRecorder::Stage stage, ServerStats::Clock::time_point start)
+        {
+            const auto end = ServerStats::Clock::now();
+            ServerStats::record(histogram, std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+            if (FlightRecorder::enabled())
+                FlightRecorder::record(stage, FlightRecorder::toNanoseconds(start), FlightRecorder::toNanoseconds(end));
+        }
+    }
 
 
     // Ctor:
     // Is meant to be executed at server startup:
-    // - opens the persistent storage file
-    // - reads the current count stored there by a previous server instance
-    // - keeps the file open for later use
+    // - opens the persistent storage
+    // - reads the current count and the named counters stored there by a previous server instance
+    // - keeps the storage open for later use
+    // - starts the background persistence thread (interval and group durability modes)
     // Caution: may throw if access to persistent storage fails
     CountersStore::CountersStore(const Configuration& configuration)
     : configuration_(configuration)
-    , persistentStorage_()
-    , queries_(0)
-    , countersAndPersistenceMutex_()
+    , persistentStorage_(CountersStorage::create(configuration))
+    , queries_(openPersistentStorage(), configuration.counterBlockSize)
+    , durableQueries_(queries_.current())
+    , writtenQueries_(durableQueries_)
+    , namedStorage_(configuration.maxCounters)
+    , namedShards_()
+    , namedWrites_(0)
+    , durableNamedWrites_(0)
+    , persistenceMutex_()
+    , persistenceRequested_()
+    , persistenceDone_()
+    , flushes_(0)
+    , failedFlush_(0)
+    , stopping_(false)
+    , persister_()
     {
-        openPersistentStorage();
+        loadNamedCounters();
+        if (configuration_.durability == Durability::interval || configuration_.durability == Durability::group)
+            persister_ = std::thread([this]() { runPersister(); });
+    }
+
+
+    // Dtor:
+    // - stops the background persistence thread
+    // - persists the final count and named counters (snapshot at shutdown)
+    // The persistent storage is then automatically closed (RAII)
+    CountersStore::~CountersStore()
+    {
+        {
+            std::lock_guard<std::mutex> lock(persistenceMutex_);
+            stopping_ = true;
+        }
+        persistenceRequested_.notify_all();
+        persistenceDone_.notify_all();
+        if (persister_.joinable())
+            persister_.join();
+
+        try
+        {
+            std::lock_guard<std::mutex> lock(persistenceMutex_);
+            const auto count = queries_.current();
+            if (count != durableQueries_ || writtenQueries_ != durableQueries_)
+            {
+                persistentStorage_->write(count);
+                persistentStorage_->sync();
+                durableQueries_ = count;
+            }
+            Logger(info) << "Query count was saved to the persistent storage: " << count;
+
+            const auto writes = namedWrites_.load();
+            if (writes != durableNamedWrites_)
+            {
+                namedStorage_.sync();
+                durableNamedWrites_ = writes;
+            }
+        }
+        catch (std::exception& e)
+        {
+            Logger(error) << "The final query count could not be saved: " << e.what();
+        }
     }
 
 
     // getCounters():
     // Public API used by the counters server:
     // - receives a client's count request dispatched by a CountersServerDispatcher
-    // - increments the query counts,
-    // - persists to disk the updated count
+    // - increments the query counts (lock-free),
+    // - persists to disk the updated count, according to the durability mode:
+    //      none, interval: the count is persisted later on
+    //      write: writes the updated count, without fsync (as the former server)
+    //      group: waits until a batched fsync covers the updated count
+    //      strict: writes and fsync's the updated count
     // - returns the updated count to the CountersServerDispatcher
+    // Caution: may throw if the updated count could not be persisted (write, group and strict modes)
     unsigned long long CountersStore::getCounters()
     {
-        unsigned long long result = 0;
+        // The counter is lock-free: concurrent invocations of getCounters() only
+        // contend on the persistence mutex, in the group and strict modes
+        const auto result = queries_.increment();
+        persistQueries(result);
+        return result;
+    }
+
 
-        // Since concurrent invocation of getCounters is possible,
-        // the counter's and fstream's common mutex need be locked
+    // peekCounters():
+    // Public API used by the counters server:
+    // - returns the current query count (the highest value issued so far), without
+    //   incrementing it
+    // - lock-free and wait-free: a merged read of the counter's shards, which neither
+    //   takes the persistence mutex nor touches the persistent storage
+    // - the next value issued is higher than the count returned: with the default
+    //   block size, whichever worker issues it; with larger blocks (see
+    //   Configuration::counterBlockSize), only the next value of the worker which issued
+    //   the highest one
+    // Note: the count may not be durable yet (group and strict modes)
+    unsigned long long CountersStore::peekCounters() const
+    {
+        return queries_.current();
+    }
+
+
+    // reserveCounters(count):
+    // Public API used by the counters server:
+    // - advances the query count by count at once (lock-free), reserving a range of
+    //   consecutive values
+    // - persists to disk the new count (the range's last value), according to the
+    //   durability mode (see getCounters())
+    // - returns the range's first value
+    // Caution: may throw if the new count could not be persisted (write, group and strict modes)
+    unsigned long long CountersStore::reserveCounters(unsigned long long count)
+    {
+        // Only the range's last value matters to the persistence: a single write
+        // covers the whole range, whatever its size
+        const auto first = queries_.reserve(count);
+        persistQueries(first + count - 1);
+        return first;
+    }
+
+
+    // getCounter(name):
+    // Public API used by the counters server:
+    // - returns the value of a named counter (0 if it does not exist yet)
+    // Caution: throws std::invalid_argument if the name is invalid
+    unsigned long long CountersStore::getCounter(boost::string_view name)
+    {
+        unsigned long long hash = 0;
+        auto& shard = namedShard(name, hash);
+
+        std::unique_lock<std::mutex> lock(shard.mutex, std::defer_lock);
+        ServerStats::lock(lock);
+        const auto* const entry = shard.table.find(name.data(), name.size(), hash);
+        return entry ? entry->value : 0;
+    }
+
+
+    // incrementCounter(name, increment):
+    // Public API used by the counters server:
+    // - adds the increment to a named counter, creating it if necessary
+    // - persists to disk the updated value, according to the durability mode (see getCounters())
+    // - returns the updated value
+    // Caution: throws std::invalid_argument if the name is invalid, or else if the counter
+    // would overflow, if there are too many counters, or if the updated value could not be
+    // persisted (group and strict modes)
+    unsigned long long CountersStore::incrementCounter(boost::string_view name, unsigned long long increment)
+    {
+        unsigned long long hash = 0;
+        auto& shard = namedShard(name, hash);
+
+        // Update the counter and its record under the shard's lock, then number the write
+        unsigned long long result = 0;
+        unsigned long long write = 0;
         {
-            std::lock_guard<std::mutex> lock(countersAndPersistenceMutex_);
-            result = ++queries_;
-            persistentStorage_.seekp(0);
-            persistentStorage_ << queries_;
-            persistentStorage_.flush();
+            std::unique_lock<std::mutex> lock(shard.mutex, std::defer_lock);
+            ServerStats::lock(lock);
+            auto* entry = shard.table.find(name.data(), name.size(), hash);
+            if (!entry)
+            {
+                // Allocate the record first: if the counter cannot be persisted, it is not created
+                const auto record = namedStorage_.allocate(name.data(), name.size());
+                auto inserted = false;
+                entry = shard.table.insert(name.data(), name.size(), hash, inserted);
+                entry->record = record;
+            }
+            if (entry->value + increment < entry->value)
+                throw std::logic_error("The counter '" + name.to_string() + "' would overflow");
+
+            entry->value += increment;
+            result = entry->value;
+            namedStorage_.write(entry->record, result);
+            write = namedWrites_.fetch_add(1) + 1;
         }
 
+        persistNamedCounters(write);
         return result;
     }
 
-    // openPersistentStorage():
-    // Function called at startup from the ctor:
-    // - opens the persistent storage file
-    // - reads the current count stored there by a previous server instance
-    // - keeps the file open for later use
-    // Caution: may throw if access to persistent storage fails
-    void CountersStore::openPersistentStorage()
+
+    // namedShard(name, hash):
+    // Checks a counter name, computes its hash, and returns its shard
+    // The names are 1 to maxCounterNameSize bytes long, without spaces or control
+    // characters, and are not numbers (so that "GET <name>" differs from "GET <n>")
+    // Caution: throws std::invalid_argument if the name is invalid (an error of the client,
+    // as opposed to the store's failures, thrown as std::logic_error)
+    CountersStore::NamedShard& CountersStore::namedShard(boost::string_view name, unsigned long long& hash)
     {
-        // Compute the file path
-        auto directory = configuration_.workDirectory;
-        if (!directory.empty() && directory.back() != '/')
-            directory += '/';
-        const auto filepath = directory + theFilename_;
+        if (name.empty() || name.size() > Constants::maxCounterNameSize)
+            throw std::invalid_argument("Invalid counter name: '" + name.to_string() + "' (1 to " + std::to_string(Constants::maxCounterNameSize) + " characters)");
+        auto digits = true;
+        for (const auto c : name)
+        {
+            if (static_cast<unsigned char>(c) <= ' ' || c == '\x7f')
+                throw std::invalid_argument("Invalid counter name: '" + name.to_string() + "' (no spaces or control characters)");
+            digits &= c >= '0' && c <= '9';
+        }
+        if (digits)
+            throw std::invalid_argument("Invalid counter name: '" + name.to_string() + "' (not a number, which 'GET <n>' reserves)");
+
+        hash = CounterTable::hash(name.data(), name.size());
+        return namedShards_[shardIndex(hash)];
+    }
+
+
+    // persistQueries(count):
+    // Persists to disk a query count (or a higher one), according to the durability
+    // mode (see getCounters())
+    void CountersStore::persistQueries(unsigned long long count)
+    {
+        switch (configuration_.durability)
+        {
+        case Durability::none:
+        case Durability::interval:
+            break;
+
+        case Durability::write:
+        {
+            // Write the current count, unless a concurrent request already did it: the count
+            // reaches the page cache (or the mapping), and is synced at shutdown
+            std::unique_lock<std::mutex> lock(persistenceMutex_, std::defer_lock);
+            ServerStats::lock(lock);
+            if (writtenQueries_ < count)
+            {
+                const auto current = queries_.current();
+                persistentStorage_->write(current);
+                writtenQueries_ = current;
+            }
+            break;
+        }
 
-        // Try and open the stream for read/write
-        persistentStorage_.open(filepath);
+        case Durability::group:
+        {
+            // Wake up the persistence thread, and wait until it has persisted a count covering ours
+            const auto start = ServerStats::Clock::now();
+            std::unique_lock<std::mutex> lock(persistenceMutex_, std::defer_lock);
+            ServerStats::lock(lock);
+            if (!waitFlush(lock, durableQueries_, count))
+                throw std::logic_error("The query count could not be persisted");
+            record(ServerStats::persistence, FlightRecorder::persistence, start);
+            break;
+        }
 
-        // If the stream is not open, try and create it
-        if(!persistentStorage_.is_open())
+        case Durability::strict:
         {
-            // Try and force the creation of a new, empty, file
-            persistentStorage_.clear();
-            persistentStorage_.open(filepath, std::ios::out);
+            // Persist the current count, unless a concurrent request already did it
+            const auto start = ServerStats::Clock::now();
+            std::unique_lock<std::mutex> lock(persistenceMutex_, std::defer_lock);
+            ServerStats::lock(lock);
+            if (durableQueries_ < count)
+            {
+                const auto flushStart = ServerStats::Clock::now();
+                const auto current = queries_.current();
+                persistentStorage_->write(current);
+                persistentStorage_->sync();
+                durableQueries_ = current;
+                record(ServerStats::flush, FlightRecorder::flush, flushStart);
+            }
+            record(ServerStats::persistence, FlightRecorder::persistence, start);
+            break;
+        }
+        }
+    }
 
-            // A new storage file must be created with a valid (non-empty) content
-            persistentStorage_ << 0 << std::endl;
 
-            // Close and reopen in rea/write mode
-            persistentStorage_.close();
-            persistentStorage_.open(filepath);
+    // persistNamedCounters(write):
+    // Persists to disk the named counters' write of the given sequence number,
+    // according to the durability mode (see getCounters())
+    void CountersStore::persistNamedCounters(unsigned long long write)
+    {
+        switch (configuration_.durability)
+        {
+        case Durability::none:
+        case Durability::interval:
+        case Durability::write:
+            // The named counters are written into their mapping by incrementCounter()
+            break;
+
+        case Durability::group:
+        {
+            // Wake up the persistence thread, and wait until it has flushed our write
+            const auto start = ServerStats::Clock::now();
+            std::unique_lock<std::mutex> lock(persistenceMutex_, std::defer_lock);
+            ServerStats::lock(lock);
+            if (!waitFlush(lock, durableNamedWrites_, write))
+                throw std::logic_error("The counter could not be persisted");
+            record(ServerStats::persistence, FlightRecorder::persistence, start);
+            break;
         }
 
-        // If the stream is not open, abort on error
-        if(persistentStorage_.fail())
+        case Durability::strict:
         {
-            const auto msg = std::string("Could not open the persistent storage file: ") + std::strerror(errno);
-            Logger(error) << msg;
-            throw std::logic_error(msg);
+            // Flush the named counters, unless a concurrent request already did it
+            const auto start = ServerStats::Clock::now();
+            std::unique_lock<std::mutex> lock(persistenceMutex_, std::defer_lock);
+            ServerStats::lock(lock);
+            if (durableNamedWrites_ < write)
+            {
+                const auto flushStart = ServerStats::Clock::now();
+                const auto writes = namedWrites_.load();
+                namedStorage_.sync();
+                durableNamedWrites_ = writes;
+                record(ServerStats::flush, FlightRecorder::flush, flushStart);
+            }
+            record(ServerStats::persistence, FlightRecorder::persistence, start);
+            break;
         }
+        }
+    }
 
-        // Try and read the current query count
-        persistentStorage_ >> queries_;
-        if (persistentStorage_.fail())
+
+    // waitFlush(lock, durable, target):
+    // Waits until a background flush has persisted the target (durable >= target),
+    // group mode; returns false if a flush started after the call has failed
+    // Every flush started after the call covers the target, which was issued before:
+    // only the failure of such a flush fails the request, so that the requests arriving
+    // after a failure are not failed by it, but wait for the flush to be retried
+    bool CountersStore::waitFlush(std::unique_lock<std::mutex>& lock, const unsigned long long& durable, unsigned long long target)
+    {
+        const auto flush = flushes_;
+        persistenceRequested_.notify_one();
+        persistenceDone_.wait(lock, [this, &durable, target, flush]() { return durable >= target || failedFlush_ > flush || stopping_; });
+        return durable >= target;
+    }
+
+
+    // runPersister():
+    // Main code of the background persistence thread (interval and group modes):
+    // - waits for the next period (interval mode) or for a new count (group mode)
+    // - writes and fsync's the current count, outside of the persistence lock, so that
+    //   the requests arriving meanwhile are covered by the next batched fsync
+    // - wakes up the requests waiting for their count to be durable (group mode)
+    // - after a failure, retries the flush after a delay (the period, or 100 ms in the
+    //   group mode, whose requests are waiting)
+    void CountersStore::runPersister()
+    {
+        const auto period = std::chrono::milliseconds(configuration_.durabilityInterval);
+        const auto isGroup = configuration_.durability == Durability::group;
+        const auto retryDelay = isGroup ? std::chrono::milliseconds(100) : period;
+
+        std::unique_lock<std::mutex> lock(persistenceMutex_);
+        while (!stopping_)
         {
-            const auto msg = "Could not read the current query count from the persistent storage file";
-            Logger(error) << msg;
-            throw std::logic_error(msg);
+            if (isGroup)
+                persistenceRequested_.wait(lock, [this]() { return stopping_ || queries_.current() != durableQueries_ || namedWrites_ != durableNamedWrites_; });
+            else
+                persistenceRequested_.wait_for(lock, period, [this]() { return stopping_; });
+            const auto count = queries_.current();
+            const auto writes = namedWrites_.load();
+            if (stopping_ || (count == durableQueries_ && writes == durableNamedWrites_))
+                continue;
+
+            const auto persistCount = count != durableQueries_;
+            const auto persistNamed = writes != durableNamedWrites_;
+            const auto flush = ++flushes_;
+            lock.unlock();
+            auto failed = false;
+            const auto flushStart = ServerStats::Clock::now();
+            try
+            {
+                if (persistCount)
+                {
+                    persistentStorage_->write(count);
+                    persistentStorage_->sync();
+                }
+                if (persistNamed)
+                    namedStorage_.sync();
+            }
+            catch (std::exception&)
+            {
+                // The error was already logged by the storage
+                failed = true;
+            }
+            if (!failed)
+                record(ServerStats::flush, FlightRecorder::flush, flushStart);
+            lock.lock();
+
+            if (failed)
+                failedFlush_ = flush;
+            else
+            {
+                durableQueries_ = count;
+                durableNamedWrites_ = writes;
+            }
+            persistenceDone_.notify_all();
+
+            // On failure, avoid spinning on the persistent storage: the flush is retried
+            // after the delay, for the requests which arrived meanwhile
+            if (failed)
+                persistenceRequested_.wait_for(lock, retryDelay, [this]() { return stopping_; });
         }
+    }
 
-        Logger(info) << "Query count was read from the persistent storage file: " << queries_;
+
+    // openPersistentStorage():
+    // Function called at startup from the ctor:
+    // - opens the persistent storage
+    // - reads and returns the current count stored there by a previous server instance
+    // - keeps the storage open for later use
+    // Caution: may throw if access to persistent storage fails
+    unsigned long long CountersStore::openPersistentStorage()
+    {
+        // Open the storage and read the current query count
+        const auto count = persistentStorage_->open(configuration_.workDirectory);
+        Logger(info) << "Query count was read from the persistent storage: " << count;
+        return count;
+    }
+
+
+    // loadNamedCounters():
+    // Function called at startup from the ctor:
+    // - opens the named counters' persistent storage
+    // - loads the named counters stored there by a previous server instance
+    // Caution: may throw if access to persistent storage fails
+    void CountersStore::loadNamedCounters()
+    {
+        const auto count = namedStorage_.open(configuration_.workDirectory,
+            [this](const char* name, std::size_t length, unsigned long long value, std::uint32_t record)
+            {
+                const auto hash = CounterTable::hash(name, length);
+                auto inserted = false;
+                auto* const entry = namedShards_[shardIndex(hash)].table.insert(name, length, hash, inserted);
+                entry->record = record;
+                entry->value = value;
+            });
+        Logger(info) << "Named counters were read from the persistent storage: " << count;
     }
 
 } // namespace CountersServer
@@ -6,15 +6,24 @@
 //
 // Header for the CountersStore class:
 // - records the number of queries received by the server
-// - read/writes this query count to persistent storage
+// - read/writes this query count to persistent storage, according to the durability mode
 // - can respond to requests for the query current count
+// - holds named counters, which can be read and incremented independently
 //
 
-#include <fstream>
+#include <array>
+#include <atomic>
+#include <condition_variable>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
+#include <boost/utility/string_view.hpp>
 #include "Configuration.h"
+#include "CounterTable.h"
+#include "CountersStorage.h"
+#include "NamedCountersStorage.h"
+#include "ShardedCounter.h"
 
 namespace ocs
 {
@@ -23,56 +32,183 @@ namespace CountersServer
 
     // CountersStore class:
     // - records the number of queries received by the server
-    // - read/writes this query count to persistent storage
+    // - read/writes this query count to persistent storage, according to the durability mode
     // - can respond to requests for the query current count
+    // - holds named counters, which can be read and incremented independently
+    //
+    // The named counters are spread across shards, by hash: each shard is a flat
+    // open-addressing table protected by its own mutex
+    //
+    // The waits of the requests for the mutexes (only measured on contention) and for
+    // the persistence of their results are recorded for the "STATS" command (see ServerStats)
     class CountersStore
     {
     public:
         // Ctor:
         // Is meant to be executed at server startup:
-        // - opens the persistent storage file
-        // - reads the current count stored there by a previous server instance
-        // - keeps the file open for later use
+        // - opens the persistent storage
+        // - reads the current count and the named counters stored there by a previous server instance
+        // - keeps the storage open for later use
+        // - starts the background persistence thread (interval and group durability modes)
         // Caution: may throw if access to persistent storage fails
         CountersStore(const Configuration& configuration);
 
         // Dtor:
-        // Is defaulted: automatically closes the persistent storage file (RAII)
-        CountersStore() = default;
+        // - stops the background persistence thread
+        // - persists the final count and named counters (snapshot at shutdown)
+        // The persistent storage is then automatically closed (RAII)
+        ~CountersStore();
 
         // getCounters():
         // Public API used by the counters server:
         // - receives a client's count request dispatched by a CountersServerDispatcher
-        // - increments the query counts,
-        // - persists to disk the updated count
+        // - increments the query counts (lock-free),
+        // - persists to disk the updated count, according to the durability mode:
+        //      none, interval: the count is persisted later on
+        //      write: writes the updated count, without fsync (as the former server)
+        //      group: waits until a batched fsync covers the updated count
+        //      strict: writes and fsync's the updated count
         // - returns the updated count to the CountersServerDispatcher
+        // Caution: may throw if the updated count could not be persisted (write, group and strict modes)
         unsigned long long getCounters();
 
+        // peekCounters():
+        // Public API used by the counters server:
+        // - returns the current query count (the highest value issued so far), without
+        //   incrementing it
+        // - lock-free and wait-free: a merged read of the counter's shards, which neither
+        //   takes the persistence mutex nor touches the persistent storage, so that the
+        //   readers do not contend with the writers (nor wait for their persistence)
+        // - the next value issued is higher than the count returned: with the default
+        //   block size, whichever worker issues it; with larger blocks (see
+        //   Configuration::counterBlockSize), only the next value of the worker which issued
+        //   the highest one
+        // Note: the count may not be durable yet (group and strict modes)
+        unsigned long long peekCounters() const;
+
+        // reserveCounters(count):
+        // Public API used by the counters server:
+        // - advances the query count by count at once (lock-free), reserving a range of
+        //   consecutive values
+        // - persists to disk the new count (the range's last value), according to the
+        //   durability mode (see getCounters())
+        // - returns the range's first value
+        // Caution: may throw if the new count could not be persisted (write, group and strict modes)
+        unsigned long long reserveCounters(unsigned long long count);
+
+        // getCounter(name):
+        // Public API used by the counters server:
+        // - returns the value of a named counter (0 if it does not exist yet)
+        // Caution: throws std::invalid_argument if the name is invalid
+        unsigned long long getCounter(boost::string_view name);
+
+        // incrementCounter(name, increment):
+        // Public API used by the counters server:
+        // - adds the increment to a named counter, creating it if necessary
+        // - persists to disk the updated value, according to the durability mode (see getCounters())
+        // - returns the updated value
+        // Caution: throws std::invalid_argument if the name is invalid, or else if the counter
+        // would overflow, if there are too many counters, or if the updated value could not
+        // be persisted (group and strict modes)
+        unsigned long long incrementCounter(boost::string_view name, unsigned long long increment);
+
     private:
+        // Number of shards of the named counters (a power of 2)
+        enum { namedShards = 64 };
+
+        // NamedShard structure:
+        // A shard of the named counters, padded so that no two mutexes share a cache line
+        struct NamedShard
+        {
+            std::mutex      mutex;
+            CounterTable    table;
+            char            padding[Constants::cacheLineSize];
+        };
+
+        // shardIndex(hash):
+        // Returns the shard of a counter, selected by the hash's highest bits
+        // (the table's slots are selected by its lowest bits)
+        static std::size_t shardIndex(unsigned long long hash)
+        {
+            static_assert((namedShards & (namedShards - 1)) == 0, "The number of shards must be a power of 2");
+            return (hash >> 58) & (namedShards - 1);
+        }
+
+        // namedShard(name, hash):
+        // Checks a counter name, computes its hash, and returns its shard
+        // Caution: throws std::invalid_argument if the name is invalid
+        NamedShard& namedShard(boost::string_view name, unsigned long long& hash);
+
+        // loadNamedCounters():
+        // Function called at startup from the ctor:
+        // - opens the named counters' persistent storage
+        // - loads the named counters stored there by a previous server instance
+        // Caution: may throw if access to persistent storage fails
+        void loadNamedCounters();
+
+        // persistQueries(count):
+        // Persists to disk a query count (or a higher one), according to the durability
+        // mode (see getCounters())
+        void persistQueries(unsigned long long count);
+
+        // persistNamedCounters(write):
+        // Persists to disk the named counters' write of the given sequence number,
+        // according to the durability mode (see getCounters())
+        void persistNamedCounters(unsigned long long write);
+
         // openPersistentStorage():
         // Function called at startup from the ctor:
-        // - opens the persistent storage file
-        // - reads the current count stored there by a previous server instance
-        // - keeps the file open for later use
+        // - opens the persistent storage
+        // - reads and returns the current count stored there by a previous server instance
+        // - keeps the storage open for later use
         // Caution: may throw if access to persistent storage fails
-        void openPersistentStorage();
+        unsigned long long openPersistentStorage();
+
+        // runPersister():
+        // Main code of the background persistence thread (interval and group modes):
+        // - waits for the next period (interval mode) or for a new count (group mode)
+        // - writes and fsync's the current count, outside of the persistence lock
+        // - wakes up the requests waiting for their count to be durable (group mode)
+        // - after a failure, retries the flush after a delay
+        void runPersister();
+
+        // waitFlush(lock, durable, target):
+        // Waits until a background flush has persisted the target (durable >= target),
+        // group mode; returns false if a flush started after the call has failed
+        // The requests arriving after a failure are not failed by it: they wait for the retry
+        bool waitFlush(std::unique_lock<std::mutex>& lock, const unsigned long long& durable, unsigned long long target);
 
         // Reference to the structure holding the server startup options
         const Configuration&     configuration_;
 
         // Internal logic
-        std::fstream             persistentStorage_;  // open stream for persistence to disk
-        unsigned long long       queries_;            // current query count
-
-        // Since concurrent invocation of getCounters() is possible,
-        // the counter and/or the fstream are protected by a common mutex
-        mutable std::mutex       countersAndPersistenceMutex_;
-
-        // Filename for persistent storage to disk
-        // Note that the filename is fixed:
-        // + allows for easy retrieval of a count stored by a previous instance
-        // - forbids several servers from running on the same machine (e.g. on different ports)
-        static const std::string theFilename_;
+        std::unique_ptr<CountersStorage> persistentStorage_;  // open storage backend for persistence to disk
+        ShardedCounter                   queries_;            // current query count (lock-free)
+        unsigned long long               durableQueries_;     // query count known to be persisted
+        unsigned long long               writtenQueries_;     // query count written, not synced yet (write mode)
+
+        // Named counters, and their persistence state
+        // Every write of a named counter is numbered: the persistence of the named counters
+        // is tracked by the number of writes covered by the last flush, as for the query count
+        NamedCountersStorage             namedStorage_;       // open storage of the named counters
+        std::array<NamedShard, namedShards> namedShards_;     // named counters, by hash
+        std::atomic<unsigned long long>  namedWrites_;        // number of writes of the named counters
+        unsigned long long               durableNamedWrites_; // number of writes known to be persisted
+
+        // The counter is lock-free: the mutex only protects the persistence state
+        // (durableQueries_, writtenQueries_, durableNamedWrites_, the flags below and, in the
+        // write and strict modes, the persistent storage)
+        // Note: in the interval and group modes, the persistent storage is accessed by the
+        // background persistence thread only, outside of the mutex
+        mutable std::mutex       persistenceMutex_;
+
+        // Background persistence (interval and group modes)
+        std::condition_variable  persistenceRequested_; // signaled on a new count or write (group) or on shutdown
+        std::condition_variable  persistenceDone_;      // signaled when durableQueries_ or durableNamedWrites_ is updated
+        unsigned long long       flushes_;              // number of background flushes started
+        unsigned long long       failedFlush_;          // number of the last background flush which failed (0 if none)
+        bool                     stopping_;             // true when the store is being destroyed
+        std::thread              persister_;            // background persistence thread
     };
 
 } // namespace CountersServer
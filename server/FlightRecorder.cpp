@@ -0,0 +1,250 @@
+//
+// FlightRecorder.cpp
+// ~~~~~~~~~~~~~~~~~~
+//
+// Source for the FlightRecorder class:
+// - optional tracing of the stages of the requests, into per-thread rings
+// - dumps the rings to a Chrome trace file on demand
+//
+#include "FlightRecorder.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+#include <unistd.h>
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    // Ring structure:
+    // Fixed-size ring of the events of a thread, written by the thread only
+    // Each event is protected by a sequence number (a seqlock), so that a dump, which reads
+    // the rings while they are written, skips the events being overwritten
+    struct FlightRecorder::Ring
+    {
+        // Event structure:
+        // The fields are relaxed atomics (plain loads and stores on x86), so that reading
+        // an event while it is overwritten is not a data race
+        struct Event
+        {
+            std::atomic<std::uint64_t>  sequence;   // 0 while the event is written, its number + 1 otherwise
+            std::atomic<std::uint64_t>  start;      // in nanoseconds
+            std::atomic<std::uint64_t>  end;
+            std::atomic<std::uint64_t>  tag;        // request number << 8 | stage
+        };
+
+        explicit Ring(std::size_t capacity)
+        : events(new Event[capacity]())
+        , mask(capacity - 1)
+        , written(0)
+        {}
+
+        std::unique_ptr<Event[]>        events;
+        const std::size_t               mask;       // capacity - 1 (a power of two)
+        std::uint64_t                   written;    // number of events written (owner thread only)
+    };
+
+    bool FlightRecorder::enabled_ = false;
+
+    namespace
+    {
+        // Maximum number of rings: the events of the threads beyond this number are dropped
+        enum { maxRings = 256 };
+
+        // Rings of the threads, allocated on their first event, and never deallocated
+        // (their events stay available to the dumps after the threads terminate)
+        std::array<std::atomic<void*>, maxRings>    theRings;
+        std::atomic<std::size_t>                    theRingCount(0);
+        std::size_t                                 theRingCapacity = 0;
+        std::mutex                                  theRingMutex;
+
+        // Offset between CLOCK_REALTIME and CLOCK_MONOTONIC, sampled when tracing is enabled
+        std::int64_t                                theRealtimeOffset = 0;
+
+        // Number of the dumps written so far
+        std::atomic<unsigned>                       theDumps(0);
+
+        // Ring and current request of the calling thread
+        thread_local void*                          theRing = nullptr;
+        thread_local std::uint64_t                  theRequest = 0;
+
+        // Names of the stages, as displayed by the trace viewers
+        const char* const theStageNames[FlightRecorder::stageCount] = {
+            "receive", "dispatch", "lock", "persistence", "flush", "send" };
+
+        // DumpedEvent structure:
+        // An event copied out of a ring by a dump
+        struct DumpedEvent
+        {
+            std::uint64_t   start;
+            std::uint64_t   end;
+            std::uint64_t   tag;
+            std::size_t     thread;
+
+            bool operator<(const DumpedEvent& other) const
+            {
+                return start < other.start;
+            }
+        };
+    }
+
+
+    // enable(events):
+    // Enables tracing, with rings of the given number of events per thread (rounded
+    // up to a power of two)
+    // Caution: must be invoked at startup, before the threads are started
+    void FlightRecorder::enable(std::size_t events)
+    {
+        theRingCapacity = 1;
+        while (theRingCapacity < events)
+            theRingCapacity *= 2;
+
+        timespec realtime;
+        ::clock_gettime(CLOCK_REALTIME, &realtime);
+        const auto monotonic = now();
+        theRealtimeOffset = static_cast<std::int64_t>(realtime.tv_sec * 1000000000ULL + realtime.tv_nsec) - static_cast<std::int64_t>(monotonic);
+        enabled_ = true;
+    }
+
+
+    // fromRealtime(ts):
+    // Converts a kernel timestamp (CLOCK_REALTIME) to the trace's time base
+    // (approximately: the clocks may drift apart, e.g. on NTP adjustments)
+    std::uint64_t FlightRecorder::fromRealtime(const timespec& ts)
+    {
+        return static_cast<std::uint64_t>(static_cast<std::int64_t>(ts.tv_sec * 1000000000ULL + ts.tv_nsec) - theRealtimeOffset);
+    }
+
+
+    // beginRequest():
+    // Numbers a new request of the calling thread, and returns its number
+    std::uint64_t FlightRecorder::beginRequest()
+    {
+        return ++theRequest;
+    }
+
+
+    // resumeRequest(request):
+    // Attributes the next events recorded by the calling thread to a request it numbered before
+    void FlightRecorder::resumeRequest(std::uint64_t request)
+    {
+        theRequest = request;
+    }
+
+
+    // record(stage, start, end):
+    // Records an event of the calling thread's current request
+    void FlightRecorder::record(Stage stage, std::uint64_t start, std::uint64_t end)
+    {
+        record(stage, start, end, theRequest);
+    }
+
+
+    // record(stage, start, end, request):
+    // Records an event of a given request of the calling thread
+    void FlightRecorder::record(Stage stage, std::uint64_t start, std::uint64_t end, std::uint64_t request)
+    {
+        auto* const ring = FlightRecorder::ring();
+        if (!ring)
+            return;
+
+        auto& event = ring->events[ring->written & ring->mask];
+        event.sequence.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        event.start.store(start, std::memory_order_relaxed);
+        event.end.store(std::max(start, end), std::memory_order_relaxed);
+        event.tag.store(request << 8 | stage, std::memory_order_relaxed);
+        event.sequence.store(++ring->written, std::memory_order_release);
+    }
+
+
+    // ring():
+    // Returns the calling thread's ring, allocating it if necessary,
+    // or nullptr if the maximum number of rings is reached
+    FlightRecorder::Ring* FlightRecorder::ring()
+    {
+        if (!theRing)
+        {
+            std::lock_guard<std::mutex> lock(theRingMutex);
+            const auto count = theRingCount.load(std::memory_order_relaxed);
+            if (count == maxRings)
+                return nullptr;
+            theRing = new Ring(theRingCapacity);
+            theRings[count].store(theRing, std::memory_order_release);
+            theRingCount.store(count + 1, std::memory_order_release);
+        }
+        return static_cast<Ring*>(theRing);
+    }
+
+
+    // dump(directory, events):
+    // Writes the events of all the rings to a new Chrome trace file of the directory,
+    // returns its path, and the number of events written
+    // The events are "complete" events (phase "X"), timestamped in microseconds, one track
+    // per thread, and tagged with their request's number (per thread)
+    // Caution: throws if tracing is disabled, or if the file cannot be written
+    std::string FlightRecorder::dump(const std::string& directory, std::size_t& events)
+    {
+        if (!enabled())
+            throw std::logic_error("Tracing is disabled (see the server's '--trace' option)");
+
+        // Copy the valid events out of the rings
+        std::vector<DumpedEvent> dumped;
+        const auto count = theRingCount.load(std::memory_order_acquire);
+        for (std::size_t thread = 0; thread < count; ++thread)
+        {
+            const auto* const ring = static_cast<const Ring*>(theRings[thread].load(std::memory_order_acquire));
+            for (std::size_t i = 0; i <= ring->mask; ++i)
+            {
+                const auto& event = ring->events[i];
+                const auto sequence = event.sequence.load(std::memory_order_acquire);
+                DumpedEvent copy;
+                copy.start = event.start.load(std::memory_order_relaxed);
+                copy.end = event.end.load(std::memory_order_relaxed);
+                copy.tag = event.tag.load(std::memory_order_relaxed);
+                copy.thread = thread;
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (sequence != 0 && sequence == event.sequence.load(std::memory_order_relaxed))
+                    dumped.push_back(copy);
+            }
+        }
+        std::sort(dumped.begin(), dumped.end());
+
+        const auto path = directory + "/trace-" + std::to_string(::getpid()) + "-" + std::to_string(++theDumps) + ".json";
+        std::ofstream file(path);
+        file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+        for (std::size_t thread = 0; thread < count; ++thread)
+        {
+            file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << ::getpid() << ",\"tid\":" << thread
+                 << ",\"args\":{\"name\":\"thread " << thread << "\"}},\n";
+        }
+        const auto origin = dumped.empty() ? 0 : dumped.front().start;
+        for (std::size_t i = 0; i < dumped.size(); ++i)
+        {
+            const auto& event = dumped[i];
+            char line[256];
+            std::snprintf(line, sizeof(line),
+                "{\"name\":\"%s\",\"cat\":\"request\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%zu,\"args\":{\"request\":%llu}}%s\n",
+                theStageNames[event.tag & 0xFF], (event.start - origin) / 1000.0, (event.end - event.start) / 1000.0,
+                static_cast<int>(::getpid()), event.thread, static_cast<unsigned long long>(event.tag >> 8),
+                i + 1 < dumped.size() ? "," : "");
+            file << line;
+        }
+        file << "]}\n";
+        file.flush();
+        if (!file)
+            throw std::runtime_error("Could not write the trace file '" + path + "'");
+
+        events = dumped.size();
+        return path;
+    }
+
+} // namespace CountersServer
+} // namespace ocs
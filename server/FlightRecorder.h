@@ -0,0 +1,135 @@
+#ifndef OCS_COUNTERS_SERVER_FLIGHT_RECORDER_H
+#define OCS_COUNTERS_SERVER_FLIGHT_RECORDER_H
+//
+// FlightRecorder.h
+// ~~~~~~~~~~~~~~~~
+//
+// Header for the FlightRecorder class:
+// - optional tracing of the stages of the requests (receive, dispatch, lock, persistence,
+//   flush, send), enabled with the server's '--trace' option
+// - each thread records its events into its own fixed-size ring (the oldest events being
+//   overwritten), timestamped with CLOCK_MONOTONIC, the reception being timestamped by
+//   the kernel where possible
+// - on SIGUSR1 or a "TRACE DUMP" command, the rings are dumped to a file in the Chrome
+//   trace event format (JSON), which chrome://tracing and Perfetto load
+// - when tracing is disabled, each instrumentation point costs a single predictable
+//   branch; compiling with -DOCS_NO_TRACE removes them altogether
+//
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <time.h>
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    // FlightRecorder class:
+    // - optional tracing of the stages of the requests, into per-thread rings
+    // - dumps the rings to a Chrome trace file on demand
+    class FlightRecorder
+    {
+    public:
+        // Stage enumeration:
+        // Stages of the processing of a request
+        enum Stage
+        {
+            receive,        // from the kernel's reception of the datagram to its reception by the server
+            dispatch,       // processing of the request by the dispatcher
+            lock,           // wait for a mutex of the store (contended acquisitions only)
+            persistence,    // wait for the persistence of the request's result
+            flush,          // write and flush of the persistent storage
+            send,           // from the queuing of the reply to the completion of its sending
+            stageCount
+        };
+
+        // enabled():
+        // Returns true if tracing is enabled: the single branch of the instrumentation points
+        static bool enabled()
+        {
+#ifdef OCS_NO_TRACE
+            return false;
+#else
+            return enabled_;
+#endif
+        }
+
+        // enable(events):
+        // Enables tracing, with rings of the given number of events per thread (rounded
+        // up to a power of two)
+        // Caution: must be invoked at startup, before the threads are started
+        static void enable(std::size_t events);
+
+        // now():
+        // Returns the current time, in nanoseconds (CLOCK_MONOTONIC)
+        static std::uint64_t now()
+        {
+            timespec ts;
+            ::clock_gettime(CLOCK_MONOTONIC, &ts);
+            return static_cast<std::uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+        }
+
+        // toNanoseconds(time):
+        // Converts a steady_clock time point to the trace's time base
+        // (steady_clock is CLOCK_MONOTONIC with libstdc++)
+        static std::uint64_t toNanoseconds(std::chrono::steady_clock::time_point time)
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+        }
+
+        // fromRealtime(ts):
+        // Converts a kernel timestamp (CLOCK_REALTIME) to the trace's time base
+        static std::uint64_t fromRealtime(const timespec& ts);
+
+        // beginRequest():
+        // Numbers a new request of the calling thread, and returns its number: the events
+        // recorded by the thread are attributed to this request until the next one begins
+        static std::uint64_t beginRequest();
+
+        // resumeRequest(request):
+        // Attributes the next events recorded by the calling thread to a request it numbered
+        // before (e.g. when the requests of a batch are all received, then all dispatched)
+        static void resumeRequest(std::uint64_t request);
+
+        // record(stage, start, end):
+        // Records an event of the calling thread's current request
+        static void record(Stage stage, std::uint64_t start, std::uint64_t end);
+
+        // record(stage, start, end, request):
+        // Records an event of a given request of the calling thread (e.g. the sending of
+        // a reply, completed while another request is being processed)
+        static void record(Stage stage, std::uint64_t start, std::uint64_t end, std::uint64_t request);
+
+        // record(stage, start):
+        // Records an event ending now
+        static void record(Stage stage, std::chrono::steady_clock::time_point start)
+        {
+            record(stage, toNanoseconds(start), now());
+        }
+
+        // dump(directory, events):
+        // Writes the events of all the rings to a new Chrome trace file of the directory,
+        // returns its path, and the number of events written
+        // Caution: throws if tracing is disabled, or if the file cannot be written
+        static std::string dump(const std::string& directory, std::size_t& events);
+
+    private:
+        // Ring structure (see FlightRecorder.cpp)
+        struct Ring;
+
+        // ring():
+        // Returns the calling thread's ring, allocating it if necessary,
+        // or nullptr if the maximum number of rings is reached
+        static Ring* ring();
+
+        // Tracing state, set at startup before the threads are started
+        static bool     enabled_;
+    };
+
+} // namespace CountersServer
+} // namespace ocs
+
+#endif // OCS_COUNTERS_SERVER_FLIGHT_RECORDER_H
@@ -0,0 +1,294 @@
+//
+// IoUring.cpp
+// ~~~~~~~~~~~
+//
+// Source for the IoUring class:
+// - minimal wrapper of a Linux io_uring instance, on top of the raw system calls
+// - probes the kernel's support of the features used by the UringServer
+//
+#include "IoUring.h"
+
+#ifdef OCS_HAS_IO_URING
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    namespace
+    {
+        // System calls of io_uring, which the C library does not wrap
+        int io_uring_setup(unsigned entries, io_uring_params* params)
+        {
+            return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+        }
+
+        int io_uring_enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+        {
+            return static_cast<int>(::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+        }
+
+        int io_uring_register(int fd, unsigned opcode, void* argument, unsigned count)
+        {
+            return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, argument, count));
+        }
+
+        // map(fd, size, offset):
+        // Maps a region of an io_uring instance (a ring, or the submission entries)
+        // Caution: throws on failure
+        void* map(int fd, std::size_t size, off_t offset)
+        {
+            auto* const address = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+            if (address == MAP_FAILED)
+                throw std::system_error(errno, std::generic_category(), "Could not map the io_uring rings");
+            return address;
+        }
+    }
+
+
+    // Ctor:
+    // Creates an io_uring instance with the given numbers of submission and completion
+    // entries, and maps its rings
+    // The instance is set up for a single submitting thread, whose completions are
+    // processed when it enters the kernel (Linux 6.1), or without these hints on older kernels:
+    // it is then created disabled, and bound to the thread which enables it (see enable())
+    // Caution: throws if the kernel refuses the instance (e.g. io_uring disabled)
+    IoUring::IoUring(unsigned entries, unsigned completions)
+     : fd_(-1)
+     , sqRing_(nullptr)
+     , sqRingSize_(0)
+     , cqRing_(nullptr)
+     , cqRingSize_(0)
+     , sqes_(nullptr)
+     , sqesSize_(0)
+     , sqHead_(nullptr)
+     , sqTail_(nullptr)
+     , sqMask_(0)
+     , sqArray_(nullptr)
+     , sqLocalTail_(0)
+     , toSubmit_(0)
+     , cqHead_(nullptr)
+     , cqTail_(nullptr)
+     , cqMask_(0)
+     , cqes_(nullptr)
+     , disabled_(false)
+     , enters_(0)
+    {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = completions;
+#if defined(IORING_SETUP_SINGLE_ISSUER) && defined(IORING_SETUP_DEFER_TASKRUN)
+        params.flags |= IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_R_DISABLED;
+        fd_ = io_uring_setup(entries, &params);
+        disabled_ = fd_ >= 0;
+        if (fd_ < 0 && errno == EINVAL)
+        {
+            std::memset(&params, 0, sizeof(params));
+            params.flags = IORING_SETUP_CQSIZE;
+            params.cq_entries = completions;
+            fd_ = io_uring_setup(entries, &params);
+        }
+#else
+        fd_ = io_uring_setup(entries, &params);
+#endif
+        if (fd_ < 0)
+            throw std::system_error(errno, std::generic_category(), "Could not create an io_uring instance");
+
+        try
+        {
+            sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            if (params.features & IORING_FEAT_SINGLE_MMAP)
+                sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+            sqRing_ = map(fd_, sqRingSize_, IORING_OFF_SQ_RING);
+            cqRing_ = (params.features & IORING_FEAT_SINGLE_MMAP) ? sqRing_ : map(fd_, cqRingSize_, IORING_OFF_CQ_RING);
+            sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+            sqes_ = static_cast<io_uring_sqe*>(map(fd_, sqesSize_, IORING_OFF_SQES));
+        }
+        catch (...)
+        {
+            release();
+            throw;
+        }
+
+        auto* const sq = static_cast<char*>(sqRing_);
+        sqHead_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sqTail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sqLocalTail_ = *sqTail_;
+
+        auto* const cq = static_cast<char*>(cqRing_);
+        cqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        // The submission entries are mapped one to one into the submission ring
+        for (unsigned i = 0; i <= sqMask_; ++i)
+            sqArray_[i] = i;
+    }
+
+    // Dtor:
+    // Unmaps the rings and closes the instance (which cancels the pending operations)
+    IoUring::~IoUring()
+    {
+        release();
+    }
+
+    // release():
+    // Unmaps the rings and closes the instance
+    void IoUring::release()
+    {
+        if (sqes_)
+            ::munmap(sqes_, sqesSize_);
+        if (cqRing_ && cqRing_ != sqRing_)
+            ::munmap(cqRing_, cqRingSize_);
+        if (sqRing_)
+            ::munmap(sqRing_, sqRingSize_);
+        if (fd_ >= 0)
+            ::close(fd_);
+    }
+
+    // enable():
+    // Enables an instance created disabled, which binds it to the calling thread
+    // Caution: throws on failure
+    void IoUring::enable()
+    {
+        if (!disabled_)
+            return;
+        if (io_uring_register(fd_, IORING_REGISTER_ENABLE_RINGS, nullptr, 0) < 0)
+            throw std::system_error(errno, std::generic_category(), "Could not enable the io_uring instance");
+        disabled_ = false;
+    }
+
+    // submission():
+    // Returns a cleared submission entry, to be submitted by the next enter(), or
+    // nullptr if the submission ring is full (enter() must then be invoked first)
+    io_uring_sqe* IoUring::submission()
+    {
+        const auto head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+        if (sqLocalTail_ - head > sqMask_)
+            return nullptr;
+        auto* const sqe = &sqes_[sqLocalTail_ & sqMask_];
+        std::memset(sqe, 0, sizeof(*sqe));
+        ++sqLocalTail_;
+        ++toSubmit_;
+        return sqe;
+    }
+
+    // enter(waitFor):
+    // Publishes the entries prepared since the previous call, submits them and waits
+    // until at least waitFor completions are available, with a single system call
+    // An interruption by a signal is not an error: the caller processes the completions
+    // available, if any, and enters again
+    // Caution: throws on an unexpected error
+    void IoUring::enter(unsigned waitFor)
+    {
+        __atomic_store_n(sqTail_, sqLocalTail_, __ATOMIC_RELEASE);
+        ++enters_;
+        const auto result = io_uring_enter(fd_, toSubmit_, waitFor, waitFor ? IORING_ENTER_GETEVENTS : 0);
+        if (result < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                return;
+            throw std::system_error(errno, std::generic_category(), "Could not enter the io_uring instance");
+        }
+        toSubmit_ -= std::min<unsigned>(toSubmit_, result);
+    }
+
+    // registerBuffers(group, ring, entries):
+    // Registers a ring of provided buffers as the buffer group of the given id
+    // Caution: throws if the kernel refuses the ring (before Linux 5.19)
+    void IoUring::registerBuffers(std::uint16_t group, io_uring_buf_ring* ring, unsigned entries)
+    {
+        io_uring_buf_reg registration;
+        std::memset(&registration, 0, sizeof(registration));
+        registration.ring_addr = reinterpret_cast<std::uintptr_t>(ring);
+        registration.ring_entries = entries;
+        registration.bgid = group;
+        if (io_uring_register(fd_, IORING_REGISTER_PBUF_RING, &registration, 1) < 0)
+            throw std::system_error(errno, std::generic_category(), "Could not register the provided buffers");
+    }
+
+    // supported(reason):
+    // Returns true if the kernel supports the features used by the UringServer, or else
+    // false with the reason
+    // The probe receives a datagram on a socket pair, with a multishot reception of
+    // messages into a ring of provided buffers (Linux 6.0): io_uring may also be missing
+    // (before Linux 5.1), disabled (kernel.io_uring_disabled) or filtered out (seccomp)
+    bool IoUring::supported(std::string& reason)
+    {
+        int sockets[2];
+        if (::socketpair(AF_UNIX, SOCK_DGRAM, 0, sockets) != 0)
+        {
+            reason = std::strerror(errno);
+            return false;
+        }
+
+        void* buffers = MAP_FAILED;
+        try
+        {
+            IoUring ring(4, 8);
+            ring.enable();
+
+            enum { pageSize = 4096, group = 0 };
+            buffers = ::mmap(nullptr, pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (buffers == MAP_FAILED)
+                throw std::system_error(errno, std::generic_category(), "Could not allocate the provided buffers");
+            auto* const bufferRing = static_cast<io_uring_buf_ring*>(buffers);
+            ring.registerBuffers(group, bufferRing, 1);
+            auto& buffer = providedBuffer(bufferRing, 0);
+            buffer.addr = reinterpret_cast<std::uintptr_t>(static_cast<char*>(buffers) + pageSize / 2);
+            buffer.len = pageSize / 2;
+            buffer.bid = 0;
+            __atomic_store_n(&bufferRing->tail, 1, __ATOMIC_RELEASE);
+
+            msghdr header;
+            std::memset(&header, 0, sizeof(header));
+            auto* const sqe = ring.submission();
+            sqe->opcode = IORING_OP_RECVMSG;
+            sqe->fd = sockets[0];
+            sqe->addr = reinterpret_cast<std::uintptr_t>(&header);
+            sqe->len = 1;
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = group;
+
+            const char probe = 'p';
+            if (::send(sockets[1], &probe, 1, 0) != 1)
+                throw std::system_error(errno, std::generic_category(), "Could not send the probe");
+            ring.enter(1);
+            int result = -ETIME;
+            // The first completion is the datagram (the next one may end the reception, as
+            // the only buffer is taken)
+            ring.forEachCompletion([&result](const io_uring_cqe& cqe) { if (result == -ETIME) result = cqe.res; });
+            if (result < 0)
+                throw std::system_error(-result, std::generic_category(), "Multishot receptions are not supported");
+            reason.clear();
+        }
+        catch (std::exception& e)
+        {
+            reason = e.what();
+        }
+
+        if (buffers != MAP_FAILED)
+            ::munmap(buffers, 4096);
+        ::close(sockets[0]);
+        ::close(sockets[1]);
+        return reason.empty();
+    }
+
+} // namespace CountersServer
+} // namespace ocs
+#endif
@@ -0,0 +1,152 @@
+#ifndef OCS_COUNTERS_SERVER_IO_URING_H
+#define OCS_COUNTERS_SERVER_IO_URING_H
+//
+// IoUring.h
+// ~~~~~~~~~
+//
+// Header for the IoUring class:
+// - minimal wrapper of a Linux io_uring instance, on top of the raw system calls
+//   (io_uring_setup, io_uring_enter, io_uring_register), without liburing
+// - maps the submission and completion rings, hands out submission entries, submits
+//   them and waits for completions with a single io_uring_enter
+// - registers rings of provided buffers, from which the kernel picks the buffers of
+//   the multishot receptions
+// - probes the kernel's support of the features used by the UringServer
+//
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+// The multishot receptions of messages are the most recent feature used (Linux 6.0 headers)
+#ifdef IORING_RECV_MULTISHOT
+#define OCS_HAS_IO_URING 1
+#endif
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+#ifdef OCS_HAS_IO_URING
+    // IoUring class:
+    // - minimal wrapper of an io_uring instance, on top of the raw system calls
+    // - the instance is used by a single thread (no locking)
+    class IoUring
+    {
+    public:
+        // Ctor:
+        // Creates an io_uring instance with the given numbers of submission and completion
+        // entries (rounded up to powers of two by the kernel), and maps its rings
+        // Caution: throws if the kernel refuses the instance (e.g. io_uring disabled)
+        IoUring(unsigned entries, unsigned completions);
+
+        // Dtor:
+        // Unmaps the rings and closes the instance (which cancels the pending operations)
+        ~IoUring();
+
+        IoUring(const IoUring&) = delete;
+        IoUring& operator=(const IoUring&) = delete;
+
+        // supported(reason):
+        // Returns true if the kernel supports the features used by the UringServer
+        // (provided buffer rings, multishot receptions of messages), or else false with
+        // the reason; the features are probed with an actual reception on a socket pair
+        static bool supported(std::string& reason);
+
+        // enable():
+        // Enables the instance, to be invoked by the thread which submits the entries
+        // before its first submission (the instance may be created by another thread)
+        // Caution: throws on failure
+        void enable();
+
+        // submission():
+        // Returns a cleared submission entry, to be submitted by the next enter(), or
+        // nullptr if the submission ring is full (enter() must then be invoked first)
+        io_uring_sqe* submission();
+
+        // enter(waitFor):
+        // Submits the entries prepared since the previous call, and waits until at least
+        // waitFor completions are available, with a single system call
+        // Caution: throws on an unexpected error
+        void enter(unsigned waitFor);
+
+        // forEachCompletion(handler):
+        // Invokes the handler on each available completion, in order, then releases them
+        // to the kernel; returns the number of completions handled
+        template <typename Handler>
+        std::size_t forEachCompletion(Handler handler)
+        {
+            auto head = *cqHead_;
+            const auto tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+            std::size_t count = 0;
+            for (; head != tail; ++head, ++count)
+                handler(cqes_[head & cqMask_]);
+            __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+            return count;
+        }
+
+        // registerBuffers(group, ring, entries):
+        // Registers a ring of provided buffers (page-aligned io_uring_buf_ring of entries
+        // slots, a power of two) as the buffer group of the given id
+        // Caution: throws if the kernel refuses the ring
+        void registerBuffers(std::uint16_t group, io_uring_buf_ring* ring, unsigned entries);
+
+        // providedBuffer(ring, index):
+        // Returns a slot of a ring of provided buffers
+        // Note: the slots are not accessed through io_uring_buf_ring::bufs, whose offset
+        // differs in C++ (the kernel header declares the flexible array after an empty
+        // struct, of size 0 in C but 1 in C++)
+        static io_uring_buf& providedBuffer(io_uring_buf_ring* ring, unsigned index)
+        {
+            return reinterpret_cast<io_uring_buf*>(ring)[index];
+        }
+
+        // enters():
+        // Returns the number of io_uring_enter system calls made so far
+        unsigned long long enters() const
+        {
+            return enters_;
+        }
+
+    private:
+        // release():
+        // Unmaps the rings and closes the instance
+        void release();
+
+        int                 fd_;
+        void*               sqRing_;        // mapped submission ring
+        std::size_t         sqRingSize_;
+        void*               cqRing_;        // mapped completion ring (the submission ring's mapping if shared)
+        std::size_t         cqRingSize_;
+        io_uring_sqe*       sqes_;          // mapped submission entries
+        std::size_t         sqesSize_;
+
+        // Submission ring: the kernel consumes from the head, the application produces at the tail
+        unsigned*           sqHead_;
+        unsigned*           sqTail_;
+        unsigned            sqMask_;
+        unsigned*           sqArray_;
+        unsigned            sqLocalTail_;   // tail including the entries not published yet
+        unsigned            toSubmit_;      // entries prepared since the last enter()
+
+        // Completion ring: the kernel produces at the tail, the application consumes from the head
+        unsigned*           cqHead_;
+        unsigned*           cqTail_;
+        unsigned            cqMask_;
+        io_uring_cqe*       cqes_;
+
+        bool                disabled_;      // created disabled, until enable()
+        unsigned long long  enters_;
+    };
+#endif
+
+} // namespace CountersServer
+} // namespace ocs
+
+#endif // OCS_COUNTERS_SERVER_IO_URING_H
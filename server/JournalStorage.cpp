@@ -0,0 +1,337 @@
+//
+// JournalStorage.cpp
+// ~~~~~~~~~~~~~~~~~~
+//
+// Source for the JournalStorage class:
+// - CountersStorage backend persisting the query count as a write-ahead log (journal)
+//   of increments, plus periodic compacted snapshots
+// - writing the count appends a checksummed record to the journal, the file is never
+//   overwritten in place, so that a crash can only tear the last record
+// - every snapshotInterval records, the count is saved into a new snapshot, and the
+//   journal is restarted (a new generation)
+// - on startup, the count is recovered by loading the snapshot, then replaying the
+//   journal's tail up to its last valid record
+//
+#include "JournalStorage.h"
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Checksum.h"
+#include "Logger.h"
+#include "MappedFileStorage.h"
+#include "TextFileStorage.h"
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    namespace
+    {
+        // fail(msg):
+        // Logs an error message, and throws it
+        void fail(const std::string& msg)
+        {
+            Logger(error) << msg;
+            throw std::logic_error(msg);
+        }
+    }
+
+    // Filenames for persistent storage to disk
+    const std::string JournalStorage::theSnapshotFilename_ = "query_counters.snapshot";
+    const std::string JournalStorage::theJournalFilename_ = "query_counters.journal";
+
+    // File layout constants: the magics are "OCSSNAPS" and "OCSJOURN" read as native integers
+    const std::uint64_t JournalStorage::theSnapshotMagic_ = 0x5350414E5353434FULL;
+    const std::uint64_t JournalStorage::theJournalMagic_ = 0x4E52554F4A53434FULL;
+    const std::uint32_t JournalStorage::theVersion_ = 1;
+
+
+    // Ctor:
+    // Creates a closed storage, open() must be invoked before any other method
+    // A snapshot is taken every snapshotInterval journal records
+    JournalStorage::JournalStorage(unsigned long long snapshotInterval)
+    : snapshotInterval_(snapshotInterval)
+    , directory_()
+    , fd_(-1)
+    , generation_(0)
+    , count_(0)
+    , records_(0)
+    {
+        static_assert(sizeof(Snapshot) == 64, "Unexpected snapshot layout");
+        static_assert(sizeof(JournalHeader) == 64, "Unexpected journal header layout");
+        static_assert(sizeof(Record) == 16, "Unexpected journal record layout");
+    }
+
+    // Dtor:
+    // Closes the journal (RAII)
+    JournalStorage::~JournalStorage()
+    {
+        if (fd_ >= 0)
+            ::close(fd_);
+    }
+
+    // open(directory):
+    // - loads the directory's snapshot, and replays the journal's valid records
+    //   (a torn tail is truncated); logs the time taken by the recovery
+    // - if there is no snapshot yet, creates one with the count of the former
+    //   storage files (which are then renamed), or a zero count
+    // - keeps the journal open for later use
+    // Caution: throws if the files cannot be opened, created, or are corrupt, or if the
+    // directory's files are inconsistent (see CountersStorage::previousStorage())
+    unsigned long long JournalStorage::open(const std::string& directory)
+    {
+        directory_ = directory;
+        const auto begin = std::chrono::steady_clock::now();
+
+        const auto previous = previousStorage(directory, Storage::wal);
+        if (previous != Storage::wal)
+        {
+            // Snapshot the migrated count before retiring its file: a crash in between
+            // leaves both files, and the next startup finishes the migration (see
+            // CountersStorage::previousStorage())
+            std::string migratedPath;
+            count_ = migrate(previous, migratedPath);
+            takeSnapshot();
+            retireFile(migratedPath);
+        }
+        else if (readSnapshot())
+        {
+            const auto snapshotCount = count_;
+            replayJournal();
+            const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+            Logger(info) << "Recovered the query count in " << elapsed << " ms: snapshot " << snapshotCount
+                         << " (generation " << generation_ << ") + " << records_ << " journal records ("
+                         << records_ * sizeof(Record) << " bytes)";
+        }
+        else
+        {
+            // The journal is only created after the first snapshot
+            if (exists(filepath(directory_, theJournalFilename_)))
+                fail("The journal file has no snapshot: the query count cannot be recovered");
+            count_ = 0;
+            takeSnapshot();
+        }
+        return count_;
+    }
+
+    // write(count):
+    // Appends a record of the increment since the last written count to the journal
+    // (the data reaches the page cache, see sync()), and takes a snapshot if due
+    // Caution: throws if the write fails
+    void JournalStorage::write(unsigned long long count)
+    {
+        if (count <= count_)
+            return;
+
+        Record record;
+        record.increment = count - count_;
+        record.checksum = checksum(generation_, record.increment);
+        if (::write(fd_, &record, sizeof(record)) != static_cast<ssize_t>(sizeof(record)))
+            fail(std::string("Could not write to the journal file: ") + std::strerror(errno));
+        count_ = count;
+
+        if (++records_ >= snapshotInterval_)
+            takeSnapshot();
+    }
+
+    // sync():
+    // Flushes the journal to the disk (fdatasync)
+    // Caution: throws if the flush fails
+    void JournalStorage::sync()
+    {
+        if (::fdatasync(fd_) != 0)
+            fail(std::string("Could not sync the journal file: ") + std::strerror(errno));
+    }
+
+    // readSnapshot():
+    // Loads the snapshot into generation_ and count_, returns false if there is no snapshot
+    // Caution: throws if the snapshot is corrupt
+    bool JournalStorage::readSnapshot()
+    {
+        const auto path = filepath(directory_, theSnapshotFilename_);
+        const auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno == ENOENT)
+                return false;
+            fail(std::string("Could not open the snapshot file: ") + std::strerror(errno));
+        }
+
+        Snapshot snapshot;
+        const auto bytes = ::pread(fd, &snapshot, sizeof(snapshot), 0);
+        ::close(fd);
+        if (bytes != static_cast<ssize_t>(sizeof(snapshot))
+            || snapshot.magic != theSnapshotMagic_
+            || snapshot.checksum != checksum(&snapshot, offsetof(Snapshot, checksum)))
+            fail("The snapshot file is corrupt");
+        if (snapshot.version != theVersion_)
+            fail("The snapshot file has an unsupported version");
+
+        generation_ = snapshot.generation;
+        count_ = snapshot.count;
+        return true;
+    }
+
+    // migrate(previous, path):
+    // Returns the count of the former storage files (memory-mapped or text), and their
+    // path, to be renamed once the count is saved
+    unsigned long long JournalStorage::migrate(Storage previous, std::string& path)
+    {
+        unsigned long long count = 0;
+        if (previous == Storage::mmap)
+        {
+            MappedFileStorage mappedStorage;
+            count = mappedStorage.open(directory_);
+            path = filepath(directory_, MappedFileStorage::theFilename_);
+        }
+        else
+        {
+            TextFileStorage textStorage;
+            count = textStorage.open(directory_);
+            path = filepath(directory_, TextFileStorage::theFilename_);
+        }
+        Logger(info) << "Migrating the query count from " << path << " to a journal";
+        return count;
+    }
+
+    // replayJournal():
+    // Opens the journal and replays its records into count_, if it belongs to the
+    // snapshot's generation; otherwise, starts a new journal
+    void JournalStorage::replayJournal()
+    {
+        const auto path = filepath(directory_, theJournalFilename_);
+        fd_ = ::open(path.c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+        if (fd_ < 0)
+        {
+            // The journal may be missing after a crash right after a snapshot
+            if (errno != ENOENT)
+                fail(std::string("Could not open the journal file: ") + std::strerror(errno));
+            createJournal();
+            return;
+        }
+
+        struct stat status;
+        if (::fstat(fd_, &status) != 0)
+            fail(std::string("Could not open the journal file: ") + std::strerror(errno));
+        const std::size_t size = status.st_size;
+        if (size < sizeof(JournalHeader))
+        {
+            createJournal();
+            return;
+        }
+
+        // Map the whole journal, which is read sequentially
+        auto* const mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd_, 0);
+        if (mapping == MAP_FAILED)
+            fail(std::string("Could not map the journal file: ") + std::strerror(errno));
+        ::madvise(mapping, size, MADV_SEQUENTIAL);
+
+        // A journal of another generation is fully covered by the snapshot
+        const auto* const header = static_cast<const JournalHeader*>(mapping);
+        if (header->magic != theJournalMagic_
+            || header->checksum != checksum(header, offsetof(JournalHeader, checksum))
+            || header->generation != generation_)
+        {
+            ::munmap(mapping, size);
+            Logger(warning) << "Ignoring a journal which does not match the snapshot";
+            createJournal();
+            return;
+        }
+
+        // Replay the records up to the first invalid one (torn tail)
+        const auto* const records = reinterpret_cast<const Record*>(header + 1);
+        const auto recordCount = (size - sizeof(JournalHeader)) / sizeof(Record);
+        auto count = count_;
+        std::size_t valid = 0;
+        for (; valid < recordCount; ++valid)
+        {
+            if (records[valid].checksum != checksum(generation_, records[valid].increment))
+                break;
+            count += records[valid].increment;
+        }
+        ::munmap(mapping, size);
+        count_ = count;
+        records_ = valid;
+
+        // Truncate the torn tail, if any, so that the next records are appended to the valid ones
+        const auto validSize = sizeof(JournalHeader) + valid * sizeof(Record);
+        if (validSize != size)
+        {
+            Logger(warning) << "Truncating the journal's torn tail (" << size - validSize << " bytes)";
+            if (::ftruncate(fd_, validSize) != 0)
+                fail(std::string("Could not truncate the journal file: ") + std::strerror(errno));
+        }
+    }
+
+    // takeSnapshot():
+    // Saves count_ into a new snapshot of the next generation, then starts a new journal
+    // Crash safety: once the new snapshot is in place, the previous journal is covered by it
+    // (and ignored on recovery since its generation does not match)
+    void JournalStorage::takeSnapshot()
+    {
+        Snapshot snapshot;
+        std::memset(&snapshot, 0, sizeof(snapshot));
+        snapshot.magic = theSnapshotMagic_;
+        snapshot.version = theVersion_;
+        snapshot.generation = generation_ + 1;
+        snapshot.count = count_;
+        snapshot.checksum = checksum(&snapshot, offsetof(Snapshot, checksum));
+        replaceFile(filepath(directory_, theSnapshotFilename_), &snapshot, sizeof(snapshot));
+
+        generation_ = snapshot.generation;
+        createJournal();
+        Logger(debug) << "Took a snapshot of the query count: " << count_ << " (generation " << generation_ << ")";
+    }
+
+    // createJournal():
+    // Starts a new, empty, journal for the current generation (replacing the previous one)
+    void JournalStorage::createJournal()
+    {
+        JournalHeader header;
+        std::memset(&header, 0, sizeof(header));
+        header.magic = theJournalMagic_;
+        header.version = theVersion_;
+        header.generation = generation_;
+        header.checksum = checksum(&header, offsetof(JournalHeader, checksum));
+
+        const auto path = filepath(directory_, theJournalFilename_);
+        replaceFile(path, &header, sizeof(header));
+
+        if (fd_ >= 0)
+            ::close(fd_);
+        fd_ = ::open(path.c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+        if (fd_ < 0)
+            fail(std::string("Could not open the journal file: ") + std::strerror(errno));
+        records_ = 0;
+    }
+
+    // replaceFile(path, data, size):
+    // Atomically replaces a file's content: writes a temporary file, syncs it, renames it
+    // over the file, then syncs the directory
+    void JournalStorage::replaceFile(const std::string& path, const void* data, std::size_t size)
+    {
+        const auto temporaryPath = path + ".tmp";
+        const auto fd = ::open(temporaryPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+            fail("Could not create " + temporaryPath + ": " + std::strerror(errno));
+        const auto written = ::write(fd, data, size);
+        const auto synced = ::fsync(fd) == 0;
+        ::close(fd);
+        if (written != static_cast<ssize_t>(size) || !synced)
+            fail("Could not write " + temporaryPath + ": " + std::strerror(errno));
+
+        if (::rename(temporaryPath.c_str(), path.c_str()) != 0)
+            fail("Could not rename " + temporaryPath + ": " + std::strerror(errno));
+
+        syncDirectory(directory_);
+    }
+
+} // namespace CountersServer
+} // namespace ocs
@@ -0,0 +1,160 @@
+#ifndef OCS_COUNTERS_SERVER_JOURNAL_STORAGE_H
+#define OCS_COUNTERS_SERVER_JOURNAL_STORAGE_H
+//
+// JournalStorage.h
+// ~~~~~~~~~~~~~~~~
+//
+// Header for the JournalStorage class:
+// - CountersStorage backend persisting the query count as a write-ahead log (journal)
+//   of increments, plus periodic compacted snapshots
+// - writing the count appends a checksummed record to the journal, the file is never
+//   overwritten in place, so that a crash can only tear the last record
+// - every snapshotInterval records, the count is saved into a new snapshot, and the
+//   journal is restarted (a new generation)
+// - on startup, the count is recovered by loading the snapshot, then replaying the
+//   journal's tail up to its last valid record
+//
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "CountersStorage.h"
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    // JournalStorage class:
+    // - CountersStorage backend persisting the query count as a write-ahead log (journal)
+    //   of increments, plus periodic compacted snapshots
+    // - writing the count appends a checksummed record to the journal, the file is never
+    //   overwritten in place, so that a crash can only tear the last record
+    // - every snapshotInterval records, the count is saved into a new snapshot, and the
+    //   journal is restarted (a new generation)
+    // - on startup, the count is recovered by loading the snapshot, then replaying the
+    //   journal's tail up to its last valid record
+    // Note: a JournalStorage is not thread-safe, concurrent accesses must be serialized by the caller
+    class JournalStorage : public CountersStorage
+    {
+    public:
+        // Ctor:
+        // Creates a closed storage, open() must be invoked before any other method
+        // A snapshot is taken every snapshotInterval journal records
+        explicit JournalStorage(unsigned long long snapshotInterval);
+
+        // Dtor:
+        // Closes the journal (RAII)
+        ~JournalStorage() override;
+
+        // open(directory):
+        // - loads the directory's snapshot, and replays the journal's valid records
+        //   (a torn tail is truncated); logs the time taken by the recovery
+        // - if there is no snapshot yet, creates one with the count of the former
+        //   storage files (which are then renamed), or a zero count
+        // - keeps the journal open for later use
+        // Caution: throws if the files cannot be opened, created, or are corrupt, or if the
+        // directory's files are inconsistent (see CountersStorage::previousStorage())
+        unsigned long long open(const std::string& directory) override;
+
+        // write(count):
+        // Appends a record of the increment since the last written count to the journal
+        // (the data reaches the page cache, see sync()), and takes a snapshot if due
+        // Caution: throws if the write fails
+        void write(unsigned long long count) override;
+
+        // sync():
+        // Flushes the journal to the disk (fdatasync)
+        // Caution: throws if the flush fails
+        void sync() override;
+
+        // Filenames for persistent storage to disk
+        static const std::string theSnapshotFilename_;
+        static const std::string theJournalFilename_;
+
+    private:
+        // Snapshot structure:
+        // On-disk content of the snapshot file (fixed layout, native byte order)
+        struct Snapshot
+        {
+            std::uint64_t   magic;          // theSnapshotMagic_
+            std::uint32_t   version;        // theVersion_
+            std::uint32_t   reserved;
+            std::uint64_t   generation;     // generation of the journal following the snapshot
+            std::uint64_t   count;          // count at the time of the snapshot
+            std::uint64_t   checksum;       // checksum of the fields above
+            std::uint64_t   padding[3];     // padding up to 64 bytes
+        };
+
+        // JournalHeader structure:
+        // On-disk header of the journal file (fixed layout, native byte order)
+        struct JournalHeader
+        {
+            std::uint64_t   magic;          // theJournalMagic_
+            std::uint32_t   version;        // theVersion_
+            std::uint32_t   reserved;
+            std::uint64_t   generation;     // must match the snapshot's generation
+            std::uint64_t   checksum;       // checksum of the fields above
+            std::uint64_t   padding[4];     // padding up to 64 bytes
+        };
+
+        // Record structure:
+        // On-disk journal record (fixed layout, native byte order)
+        struct Record
+        {
+            std::uint64_t   increment;      // increment since the previous record
+            std::uint64_t   checksum;       // checksum of the generation and the increment
+        };
+
+        // Copy is forbidden (the journal is owned)
+        JournalStorage(const JournalStorage&) = delete;
+        JournalStorage& operator=(const JournalStorage&) = delete;
+
+        // readSnapshot():
+        // Loads the snapshot into generation_ and count_, returns false if there is no snapshot
+        // Caution: throws if the snapshot is corrupt
+        bool readSnapshot();
+
+        // migrate(previous, path):
+        // Returns the count of the former storage files (memory-mapped or text), and their
+        // path, to be renamed once the count is saved
+        unsigned long long migrate(Storage previous, std::string& path);
+
+        // replayJournal():
+        // Opens the journal and replays its records into count_, if it belongs to the
+        // snapshot's generation; otherwise, starts a new journal
+        void replayJournal();
+
+        // takeSnapshot():
+        // Saves count_ into a new snapshot of the next generation, then starts a new journal
+        void takeSnapshot();
+
+        // createJournal():
+        // Starts a new, empty, journal for the current generation (replacing the previous one)
+        void createJournal();
+
+        // replaceFile(path, data, size):
+        // Atomically replaces a file's content: writes a temporary file, syncs it, renames it
+        // over the file, then syncs the directory
+        void replaceFile(const std::string& path, const void* data, std::size_t size);
+
+        // Startup configuration: number of journal records between two snapshots
+        const unsigned long long    snapshotInterval_;
+
+        // State of the storage
+        std::string                 directory_;     // work directory
+        int                         fd_;            // file descriptor of the journal (open for appending)
+        unsigned long long          generation_;    // current generation (snapshot and journal)
+        unsigned long long          count_;         // last count written
+        unsigned long long          records_;       // number of records in the current journal
+
+        // File layout constants
+        static const std::uint64_t  theSnapshotMagic_;
+        static const std::uint64_t  theJournalMagic_;
+        static const std::uint32_t  theVersion_;
+    };
+
+} // namespace CountersServer
+} // namespace ocs
+
+#endif // OCS_COUNTERS_SERVER_JOURNAL_STORAGE_H
@@ -0,0 +1,224 @@
+//
+// MappedFileStorage.cpp
+// ~~~~~~~~~~~~~~~~~~~~~
+//
+// Source for the MappedFileStorage class:
+// - CountersStorage backend persisting the query count in a memory-mapped binary file
+// - writing the count is a couple of plain stores into the mapping, a separate sync()
+//   (msync) is required for the count to survive a system crash
+// - the file has a fixed layout: a header (magic, version, checksum) followed by
+//   the counter slots, each one protected by its own checksum
+// - on first use, migrates the count of the former text file (see TextFileStorage)
+//
+#include "MappedFileStorage.h"
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Checksum.h"
+#include "Logger.h"
+#include "TextFileStorage.h"
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    namespace
+    {
+        // fail(msg):
+        // Logs an error message, and throws it
+        void fail(const std::string& msg)
+        {
+            Logger(error) << msg;
+            throw std::logic_error(msg);
+        }
+    }
+
+    // Filename for persistent storage to disk
+    const std::string MappedFileStorage::theFilename_ = "query_counters.bin";
+
+    // File layout constants:
+    // - the magic is "OCSCOUNT" read as a native integer
+    // - the file is a single page: a 64-byte header, followed by the slots
+    const std::uint64_t MappedFileStorage::theMagic_ = 0x544E554F4353434FULL;
+    const std::uint32_t MappedFileStorage::theVersion_ = 1;
+    const std::uint32_t MappedFileStorage::theSlotCount_ = 2;
+    const std::size_t   MappedFileStorage::theFileSize_ = 4096;
+
+
+    // Ctor:
+    // Creates a closed storage, open() must be invoked before any other method
+    MappedFileStorage::MappedFileStorage()
+    : fd_(-1)
+    , mapping_(MAP_FAILED)
+    , header_(nullptr)
+    , slots_(nullptr)
+    , nextSlot_(0)
+    {
+        static_assert(sizeof(Header) == 64, "Unexpected header layout");
+        static_assert(sizeof(Slot) == 16, "Unexpected slot layout");
+    }
+
+    // Dtor:
+    // Unmaps and closes the file (RAII)
+    MappedFileStorage::~MappedFileStorage()
+    {
+        if (mapping_ != MAP_FAILED)
+            ::munmap(mapping_, theFileSize_);
+        if (fd_ >= 0)
+            ::close(fd_);
+    }
+
+    // open(directory):
+    // - opens and maps the directory's file; if it does not exist, creates it with
+    //   the count of the former text file (which is then renamed), or a zero count
+    // - checks the file's header, and returns the count stored in the slots
+    // - keeps the file mapped for later use
+    // Caution: throws if the file cannot be opened, created, or is corrupt, or if the
+    // directory's files are inconsistent (see CountersStorage::previousStorage())
+    unsigned long long MappedFileStorage::open(const std::string& directory)
+    {
+        const auto path = filepath(directory, theFilename_);
+        const auto previous = previousStorage(directory, Storage::mmap);
+        if (previous == Storage::wal)
+            fail("The work directory holds the query count of the wal storage, which the mmap storage cannot migrate: restart with '--storage wal'");
+        if (previous == Storage::text)
+            create(directory, path, true);
+        else if (!exists(path))
+            create(directory, path, false);
+        map(path);
+
+        // The stored count is the highest valid slot, the next write goes to the other one
+        auto found = false;
+        unsigned long long count = 0;
+        for (std::size_t i = 0; i < theSlotCount_; ++i)
+        {
+            const auto& slot = slots_[i];
+            if (checksum(&slot.value, sizeof(slot.value)) != slot.checksum)
+            {
+                Logger(warning) << "Ignoring a torn slot in the persistent storage file";
+                continue;
+            }
+            if (!found || slot.value >= count)
+            {
+                count = slot.value;
+                nextSlot_ = (i + 1) % theSlotCount_;
+            }
+            found = true;
+        }
+        if (!found)
+            fail("Could not read the current query count from the persistent storage file (corrupt slots)");
+        return count;
+    }
+
+    // write(count):
+    // Overwrites the oldest slot with the count (plain stores, see sync())
+    void MappedFileStorage::write(unsigned long long count)
+    {
+        writeSlot(nextSlot_, count);
+        nextSlot_ = (nextSlot_ + 1) % theSlotCount_;
+    }
+
+    // sync():
+    // Flushes the mapping to the disk (msync)
+    // Caution: throws if the flush fails
+    void MappedFileStorage::sync()
+    {
+        if (::msync(mapping_, theFileSize_, MS_SYNC) != 0)
+            fail(std::string("Could not sync the persistent storage file: ") + std::strerror(errno));
+    }
+
+    // create(directory, path, migrating):
+    // Creates the file with the count of the former text file, if migrating, or a zero count
+    // The file is initialized under a temporary name, then atomically renamed
+    void MappedFileStorage::create(const std::string& directory, const std::string& path, bool migrating)
+    {
+        // Read the count of the former text file, if any
+        const auto textPath = filepath(directory, TextFileStorage::theFilename_);
+        unsigned long long count = 0;
+        if (migrating)
+        {
+            TextFileStorage textStorage;
+            count = textStorage.open(directory);
+            Logger(info) << "Migrating the query count from " << textPath << " to " << path;
+        }
+
+        // Initialize a temporary file, and flush it to the disk
+        const auto temporaryPath = path + ".tmp";
+        ::unlink(temporaryPath.c_str());
+        map(temporaryPath);
+        header_->magic = theMagic_;
+        header_->version = theVersion_;
+        header_->slotCount = theSlotCount_;
+        header_->checksum = checksum(header_, offsetof(Header, checksum));
+        for (std::size_t i = 0; i < theSlotCount_; ++i)
+            writeSlot(i, count);
+        sync();
+        if (::fsync(fd_) != 0)
+            fail(std::string("Could not sync the persistent storage file: ") + std::strerror(errno));
+
+        // Close it, then move it to its final name (and move the former text file away,
+        // once the new name is on disk: a crash in between leaves both files, and the next
+        // startup finishes the migration, see CountersStorage::previousStorage())
+        ::munmap(mapping_, theFileSize_);
+        ::close(fd_);
+        mapping_ = MAP_FAILED;
+        fd_ = -1;
+        if (::rename(temporaryPath.c_str(), path.c_str()) != 0)
+            fail(std::string("Could not create the persistent storage file: ") + std::strerror(errno));
+        syncDirectory(directory);
+        if (migrating)
+            retireFile(textPath);
+    }
+
+    // map(path):
+    // Opens and maps a file, checks its header
+    // A new (empty) file is extended to the expected size, its header is then left for the caller to initialize
+    void MappedFileStorage::map(const std::string& path)
+    {
+        fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd_ < 0)
+            fail(std::string("Could not open the persistent storage file: ") + std::strerror(errno));
+
+        struct stat status;
+        if (::fstat(fd_, &status) != 0)
+            fail(std::string("Could not open the persistent storage file: ") + std::strerror(errno));
+        const auto isNew = status.st_size == 0;
+        if (isNew && ::ftruncate(fd_, theFileSize_) != 0)
+            fail(std::string("Could not create the persistent storage file: ") + std::strerror(errno));
+        if (!isNew && static_cast<std::size_t>(status.st_size) < theFileSize_)
+            fail("The persistent storage file is truncated");
+
+        mapping_ = ::mmap(nullptr, theFileSize_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (mapping_ == MAP_FAILED)
+            fail(std::string("Could not map the persistent storage file: ") + std::strerror(errno));
+        header_ = static_cast<Header*>(mapping_);
+        slots_ = reinterpret_cast<Slot*>(header_ + 1);
+        if (isNew)
+            return;
+
+        // Check the header of an existing file
+        if (header_->magic != theMagic_)
+            fail("The persistent storage file is not a counters file (bad magic)");
+        if (header_->checksum != checksum(header_, offsetof(Header, checksum)))
+            fail("The persistent storage file is corrupt (bad header checksum)");
+        if (header_->version != theVersion_ || header_->slotCount != theSlotCount_)
+            fail("The persistent storage file has an unsupported version or layout");
+    }
+
+    // writeSlot(index, count):
+    // Writes a count and its checksum into a slot
+    void MappedFileStorage::writeSlot(std::size_t index, unsigned long long count)
+    {
+        auto& slot = slots_[index];
+        slot.value = count;
+        slot.checksum = checksum(&slot.value, sizeof(slot.value));
+    }
+
+} // namespace CountersServer
+} // namespace ocs
@@ -0,0 +1,122 @@
+#ifndef OCS_COUNTERS_SERVER_MAPPED_FILE_STORAGE_H
+#define OCS_COUNTERS_SERVER_MAPPED_FILE_STORAGE_H
+//
+// MappedFileStorage.h
+// ~~~~~~~~~~~~~~~~~~~
+//
+// Header for the MappedFileStorage class:
+// - CountersStorage backend persisting the query count in a memory-mapped binary file
+// - writing the count is a couple of plain stores into the mapping, a separate sync()
+//   (msync) is required for the count to survive a system crash
+// - the file has a fixed layout: a header (magic, version, checksum) followed by
+//   the counter slots, each one protected by its own checksum
+// - on first use, migrates the count of the former text file (see TextFileStorage)
+//
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "CountersStorage.h"
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    // MappedFileStorage class:
+    // - CountersStorage backend persisting the query count in a memory-mapped binary file
+    // - writing the count is a couple of plain stores into the mapping, a separate sync()
+    //   (msync) is required for the count to survive a system crash
+    // - the file has a fixed layout: a header (magic, version, checksum) followed by
+    //   the counter slots, each one protected by its own checksum
+    // - on first use, migrates the count of the former text file (see TextFileStorage)
+    // Note: a MappedFileStorage is not thread-safe, concurrent accesses must be serialized by the caller
+    class MappedFileStorage : public CountersStorage
+    {
+    public:
+        // Ctor:
+        // Creates a closed storage, open() must be invoked before any other method
+        MappedFileStorage();
+
+        // Dtor:
+        // Unmaps and closes the file (RAII)
+        ~MappedFileStorage() override;
+
+        // open(directory):
+        // - opens and maps the directory's file; if it does not exist, creates it with
+        //   the count of the former text file (which is then renamed), or a zero count
+        // - checks the file's header, and returns the count stored in the slots
+        // - keeps the file mapped for later use
+        // Caution: throws if the file cannot be opened, created, or is corrupt, or if the
+        // directory's files are inconsistent (see CountersStorage::previousStorage())
+        unsigned long long open(const std::string& directory) override;
+
+        // write(count):
+        // Overwrites the oldest slot with the count (plain stores, see sync())
+        void write(unsigned long long count) override;
+
+        // sync():
+        // Flushes the mapping to the disk (msync)
+        // Caution: throws if the flush fails
+        void sync() override;
+
+        // Filename for persistent storage to disk
+        static const std::string theFilename_;
+
+    private:
+        // Header structure:
+        // On-disk header of the file (fixed layout, native byte order)
+        struct Header
+        {
+            std::uint64_t   magic;          // theMagic_
+            std::uint32_t   version;        // theVersion_
+            std::uint32_t   slotCount;      // number of counter slots following the header
+            std::uint64_t   checksum;       // checksum of the fields above
+            std::uint64_t   reserved[5];    // padding up to 64 bytes
+        };
+
+        // Slot structure:
+        // On-disk counter slot (fixed layout, native byte order)
+        // The count is written alternately into two slots: if a crash tears a slot
+        // (count and checksum not matching), the other slot still holds the previous count
+        struct Slot
+        {
+            std::uint64_t   value;          // stored count
+            std::uint64_t   checksum;       // checksum of the count
+        };
+
+        // Copy is forbidden (the mapping is owned)
+        MappedFileStorage(const MappedFileStorage&) = delete;
+        MappedFileStorage& operator=(const MappedFileStorage&) = delete;
+
+        // create(directory, path, migrating):
+        // Creates the file with the count of the former text file, if migrating, or a zero count
+        // The file is initialized under a temporary name, then atomically renamed
+        void create(const std::string& directory, const std::string& path, bool migrating);
+
+        // map(path):
+        // Opens and maps an existing file, checks its header
+        void map(const std::string& path);
+
+        // writeSlot(index, count):
+        // Writes a count and its checksum into a slot
+        void writeSlot(std::size_t index, unsigned long long count);
+
+        // File descriptor and mapping of the open file
+        int                 fd_;
+        void*               mapping_;
+        Header*             header_;
+        Slot*               slots_;
+        std::size_t         nextSlot_;      // index of the slot to be written next
+
+        // File layout constants
+        static const std::uint64_t  theMagic_;
+        static const std::uint32_t  theVersion_;
+        static const std::uint32_t  theSlotCount_;
+        static const std::size_t    theFileSize_;
+    };
+
+} // namespace CountersServer
+} // namespace ocs
+
+#endif // OCS_COUNTERS_SERVER_MAPPED_FILE_STORAGE_H
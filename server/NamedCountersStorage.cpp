@@ -0,0 +1,242 @@
+//
+// NamedCountersStorage.cpp
+// ~~~~~~~~~~~~~~~~~~~~~~~~
+//
+// Source for the NamedCountersStorage class:
+// - persists the named counters of the CountersStore in a memory-mapped binary file
+// - each counter owns a fixed-size record (its name, and two checksummed value slots),
+//   allocated once and then updated in place with plain stores; a separate sync()
+//   (msync) is required for the values to survive a system crash
+// - the file grows as counters are created, within an address range reserved at
+//   open time, so that the records never move while they are being written
+//
+#include "NamedCountersStorage.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Checksum.h"
+#include "CountersStorage.h"
+#include "Logger.h"
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    namespace
+    {
+        // fail(msg):
+        // Logs an error message, and throws it
+        void fail(const std::string& msg)
+        {
+            Logger(error) << msg;
+            throw std::logic_error(msg);
+        }
+    }
+
+    // Filename for persistent storage to disk
+    const std::string NamedCountersStorage::theFilename_ = "named_counters.bin";
+
+    // File layout constants:
+    // - the magic is "OCSNAMED" read as a native integer
+    // - the file initially holds 1024 records, and doubles its size when full
+    const std::uint64_t NamedCountersStorage::theMagic_ = 0x44454D414E53434FULL;
+    const std::uint32_t NamedCountersStorage::theVersion_ = 1;
+    const std::size_t   NamedCountersStorage::theInitialRecords_ = 1024;
+
+
+    // Ctor:
+    // Creates a closed storage, open() must be invoked before any other method
+    // The storage will hold at most maxCounters counters
+    NamedCountersStorage::NamedCountersStorage(std::size_t maxCounters)
+    : maxRecords_(maxCounters)
+    , fd_(-1)
+    , mapping_(MAP_FAILED)
+    , mappingSize_(0)
+    , header_(nullptr)
+    , records_(nullptr)
+    , nextRecord_(0)
+    , fileRecords_(0)
+    , extensionMutex_()
+    {
+        static_assert(sizeof(Header) == 64, "Unexpected header layout");
+        static_assert(sizeof(Record) == 64, "Unexpected record layout");
+    }
+
+    // Dtor:
+    // Unmaps and closes the file (RAII)
+    NamedCountersStorage::~NamedCountersStorage()
+    {
+        if (mapping_ != MAP_FAILED)
+            ::munmap(mapping_, mappingSize_);
+        if (fd_ >= 0)
+            ::close(fd_);
+    }
+
+    // open(directory, load):
+    // - opens and maps the directory's file, or creates it empty
+    // - invokes load() for each stored counter, and returns their number
+    // - keeps the file mapped for later use
+    // Caution: throws if the file cannot be opened, created, or is corrupt
+    std::size_t NamedCountersStorage::open(const std::string& directory, const Loader& load)
+    {
+        const auto path = CountersStorage::filepath(directory, theFilename_);
+        if (::access(path.c_str(), F_OK) != 0)
+            create(path);
+
+        fd_ = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd_ < 0)
+            fail(std::string("Could not open the named counters file: ") + std::strerror(errno));
+        struct stat status;
+        if (::fstat(fd_, &status) != 0)
+            fail(std::string("Could not open the named counters file: ") + std::strerror(errno));
+        if (static_cast<std::size_t>(status.st_size) < sizeof(Header))
+            fail("The named counters file is truncated");
+        const auto fileRecords = (status.st_size - sizeof(Header)) / sizeof(Record);
+        if (fileRecords > maxRecords_)
+            fail("The named counters file holds more than " + std::to_string(maxRecords_) + " counters");
+
+        // Reserve the address range of the largest file, so that the records never move
+        mappingSize_ = sizeof(Header) + maxRecords_ * sizeof(Record);
+        mapping_ = ::mmap(nullptr, mappingSize_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (mapping_ == MAP_FAILED)
+            fail(std::string("Could not map the named counters file: ") + std::strerror(errno));
+        header_ = static_cast<Header*>(mapping_);
+        records_ = reinterpret_cast<Record*>(header_ + 1);
+
+        if (header_->magic != theMagic_)
+            fail("The named counters file is not a counters file (bad magic)");
+        if (header_->checksum != checksum(header_, offsetof(Header, checksum)))
+            fail("The named counters file has a corrupt header");
+        if (header_->version != theVersion_ || header_->recordSize != sizeof(Record))
+            fail("The named counters file has an unsupported version");
+
+        // Load the used records, whose value is the highest valid slot
+        std::size_t loaded = 0;
+        std::size_t nextRecord = 0;
+        for (std::size_t i = 0; i < fileRecords; ++i)
+        {
+            const auto& record = records_[i];
+            if (record.name[0] == '\0')
+                continue;
+            nextRecord = i + 1;
+
+            const auto length = ::strnlen(record.name, sizeof(record.name));
+            auto found = false;
+            unsigned long long value = 0;
+            for (const auto& slot : record.slots)
+            {
+                if (slot.checksum == checksum(slot.value, i) && (!found || slot.value > value))
+                {
+                    value = slot.value;
+                    found = true;
+                }
+            }
+            if (length == sizeof(record.name) || !found)
+            {
+                Logger(warning) << "Ignoring a torn record in the named counters file";
+                continue;
+            }
+            load(record.name, length, value, static_cast<std::uint32_t>(i));
+            ++loaded;
+        }
+
+        nextRecord_ = nextRecord;
+        fileRecords_ = fileRecords;
+        return loaded;
+    }
+
+    // allocate(name, length):
+    // Allocates the record of a new counter, with a zero value, and returns its index
+    // Allocation is lock-free, unless the file must be extended
+    // The slots are written before the name, which marks the record as used
+    // Caution: throws if the storage is full, or if the file cannot be extended
+    std::uint32_t NamedCountersStorage::allocate(const char* name, std::size_t length)
+    {
+        const auto index = nextRecord_.fetch_add(1);
+        if (index >= maxRecords_)
+            fail("Too many named counters (maximum: " + std::to_string(maxRecords_) + ")");
+        if (index >= fileRecords_.load(std::memory_order_acquire))
+            extend(index + 1);
+
+        auto& record = records_[index];
+        for (auto& slot : record.slots)
+        {
+            slot.value = 0;
+            slot.checksum = checksum(slot.value, index);
+        }
+        std::memcpy(record.name, name, length);
+        return static_cast<std::uint32_t>(index);
+    }
+
+    // write(record, value):
+    // Overwrites the oldest value slot of a record (plain stores, see sync())
+    // A torn slot is considered the oldest one
+    void NamedCountersStorage::write(std::uint32_t record, unsigned long long value)
+    {
+        auto& slots = records_[record].slots;
+        const auto valid0 = slots[0].checksum == checksum(slots[0].value, record);
+        const auto valid1 = slots[1].checksum == checksum(slots[1].value, record);
+        auto& slot = !valid0 || (valid1 && slots[0].value <= slots[1].value) ? slots[0] : slots[1];
+        slot.value = value;
+        slot.checksum = checksum(value, record);
+    }
+
+    // sync():
+    // Flushes the mapping to the disk (msync): only the dirty pages are written
+    // Caution: throws if the flush fails
+    void NamedCountersStorage::sync()
+    {
+        const auto size = sizeof(Header) + fileRecords_.load(std::memory_order_acquire) * sizeof(Record);
+        if (::msync(mapping_, size, MS_SYNC) != 0)
+            fail(std::string("Could not sync the named counters file: ") + std::strerror(errno));
+    }
+
+    // create(path):
+    // Creates an empty file, under a temporary name which is then atomically renamed
+    void NamedCountersStorage::create(const std::string& path)
+    {
+        Header header;
+        std::memset(&header, 0, sizeof(header));
+        header.magic = theMagic_;
+        header.version = theVersion_;
+        header.recordSize = sizeof(Record);
+        header.checksum = checksum(&header, offsetof(Header, checksum));
+
+        const auto temporaryPath = path + ".tmp";
+        const auto fd = ::open(temporaryPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0)
+            fail(std::string("Could not create the named counters file: ") + std::strerror(errno));
+        const auto created = ::write(fd, &header, sizeof(header)) == static_cast<ssize_t>(sizeof(header))
+                          && ::ftruncate(fd, sizeof(Header) + std::min(theInitialRecords_, maxRecords_) * sizeof(Record)) == 0
+                          && ::fsync(fd) == 0;
+        ::close(fd);
+        if (!created || ::rename(temporaryPath.c_str(), path.c_str()) != 0)
+            fail(std::string("Could not create the named counters file: ") + std::strerror(errno));
+    }
+
+    // extend(records):
+    // Extends the file so that it holds at least the given number of records
+    // The size is doubled, so that extensions are rare; the records beyond the end of the file
+    // are already mapped, they become accessible once the file is extended
+    void NamedCountersStorage::extend(std::size_t records)
+    {
+        std::lock_guard<std::mutex> lock(extensionMutex_);
+        const auto fileRecords = fileRecords_.load(std::memory_order_relaxed);
+        if (records <= fileRecords)
+            return;
+
+        const auto newRecords = std::min(std::max(fileRecords * 2, records), maxRecords_);
+        if (::ftruncate(fd_, sizeof(Header) + newRecords * sizeof(Record)) != 0)
+            fail(std::string("Could not extend the named counters file: ") + std::strerror(errno));
+        fileRecords_.store(newRecords, std::memory_order_release);
+    }
+
+} // namespace CountersServer
+} // namespace ocs
@@ -0,0 +1,143 @@
+#ifndef OCS_COUNTERS_SERVER_NAMED_COUNTERS_STORAGE_H
+#define OCS_COUNTERS_SERVER_NAMED_COUNTERS_STORAGE_H
+//
+// NamedCountersStorage.h
+// ~~~~~~~~~~~~~~~~~~~~~~
+//
+// Header for the NamedCountersStorage class:
+// - persists the named counters of the CountersStore in a memory-mapped binary file
+// - each counter owns a fixed-size record (its name, and two checksummed value slots),
+//   allocated once and then updated in place with plain stores; a separate sync()
+//   (msync) is required for the values to survive a system crash
+// - the file grows as counters are created, within an address range reserved at
+//   open time, so that the records never move while they are being written
+//
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include "Constants.h"
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    // NamedCountersStorage class:
+    // - persists the named counters of the CountersStore in a memory-mapped binary file
+    // - each counter owns a fixed-size record (its name, and two checksummed value slots),
+    //   allocated once and then updated in place with plain stores; a separate sync()
+    //   (msync) is required for the values to survive a system crash
+    // - the file grows as counters are created, within an address range reserved at
+    //   open time, so that the records never move while they are being written
+    // Note: allocate(), write() and sync() are thread-safe, as long as a given record is
+    // written by one thread at a time
+    class NamedCountersStorage
+    {
+    public:
+        // Loader type: invoked by open() for each stored counter (name, length, value, record)
+        using Loader = std::function<void(const char*, std::size_t, unsigned long long, std::uint32_t)>;
+
+        // Ctor:
+        // Creates a closed storage, open() must be invoked before any other method
+        // The storage will hold at most maxCounters counters
+        explicit NamedCountersStorage(std::size_t maxCounters);
+
+        // Dtor:
+        // Unmaps and closes the file (RAII)
+        ~NamedCountersStorage();
+
+        // open(directory, load):
+        // - opens and maps the directory's file, or creates it empty
+        // - invokes load() for each stored counter, and returns their number
+        // - keeps the file mapped for later use
+        // Caution: throws if the file cannot be opened, created, or is corrupt
+        std::size_t open(const std::string& directory, const Loader& load);
+
+        // allocate(name, length):
+        // Allocates the record of a new counter, with a zero value, and returns its index
+        // Caution: throws if the storage is full, or if the file cannot be extended
+        std::uint32_t allocate(const char* name, std::size_t length);
+
+        // write(record, value):
+        // Overwrites the oldest value slot of a record (plain stores, see sync())
+        void write(std::uint32_t record, unsigned long long value);
+
+        // sync():
+        // Flushes the mapping to the disk (msync)
+        // Caution: throws if the flush fails
+        void sync();
+
+        // Filename for persistent storage to disk
+        static const std::string theFilename_;
+
+    private:
+        // Header structure:
+        // On-disk header of the file (fixed layout, native byte order)
+        struct Header
+        {
+            std::uint64_t   magic;          // theMagic_
+            std::uint32_t   version;        // theVersion_
+            std::uint32_t   recordSize;     // size of the records following the header
+            std::uint64_t   checksum;       // checksum of the fields above
+            std::uint64_t   reserved[5];    // padding up to 64 bytes
+        };
+
+        // Slot structure:
+        // On-disk value slot (fixed layout, native byte order)
+        // The values are written alternately into two slots: if a crash tears a slot
+        // (value and checksum not matching), the other slot still holds the previous value
+        struct Slot
+        {
+            std::uint64_t   value;          // stored value
+            std::uint64_t   checksum;       // checksum of the value and the record's index
+        };
+
+        // Record structure:
+        // On-disk counter record (fixed layout, native byte order), unused if the name is empty
+        struct Record
+        {
+            Slot            slots[2];
+            char            name[Constants::maxCounterNameSize + 1];   // padded with zeroes
+        };
+
+        // Copy is forbidden (the mapping is owned)
+        NamedCountersStorage(const NamedCountersStorage&) = delete;
+        NamedCountersStorage& operator=(const NamedCountersStorage&) = delete;
+
+        // create(path):
+        // Creates an empty file, under a temporary name which is then atomically renamed
+        void create(const std::string& path);
+
+        // extend(records):
+        // Extends the file so that it holds at least the given number of records
+        void extend(std::size_t records);
+
+        // Startup configuration: maximum number of records
+        const std::size_t           maxRecords_;
+
+        // File descriptor and mapping of the open file (the mapping covers maxRecords_ records)
+        int                         fd_;
+        void*                       mapping_;
+        std::size_t                 mappingSize_;
+        Header*                     header_;
+        Record*                     records_;
+
+        // Allocation state
+        std::atomic<std::size_t>    nextRecord_;    // index of the next record to be allocated
+        std::atomic<std::size_t>    fileRecords_;   // number of records in the file
+        std::mutex                  extensionMutex_;
+
+        // File layout constants
+        static const std::uint64_t  theMagic_;
+        static const std::uint32_t  theVersion_;
+        static const std::size_t    theInitialRecords_;
+    };
+
+} // namespace CountersServer
+} // namespace ocs
+
+#endif // OCS_COUNTERS_SERVER_NAMED_COUNTERS_STORAGE_H
@@ -0,0 +1,68 @@
+//
+// ReplyQueue.cpp
+// ~~~~~~~~~~~~~~
+//
+// Source for the ReplyQueue class:
+// - bounded FIFO queue of the replies waiting to be sent by a CountersServer
+// - each queued reply owns its destination endpoint and its buffer, so that it stays
+//   valid until the completion of the asynchronous send
+// - the slots are preallocated once, so that queuing a reply never allocates
+//
+#include "ReplyQueue.h"
+#include <algorithm>
+#include <cstring>
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    // Ctor:
+    // Preallocates the capacity slots of the queue
+    ReplyQueue::ReplyQueue(std::size_t capacity)
+    : slots_(capacity)
+    , head_(0)
+    , size_(0)
+    , highWaterMark_(0)
+    {
+    }
+
+    // push(endpoint, data, size):
+    // Queues a copy of a reply at the back of the queue
+    // (the reply is truncated if it exceeds the size of a slot's buffer)
+    // Caution: the queue must not be full
+    void ReplyQueue::push(const Endpoint& endpoint, const char* data, std::size_t size)
+    {
+        auto& slot = push(endpoint);
+        slot.size = std::min(size, slot.buffer.size());
+        std::memcpy(slot.buffer.data(), data, slot.size);
+    }
+
+    // push(endpoint):
+    // Queues an empty reply at the back of the queue, and returns it so that the caller
+    // encodes the reply directly into its buffer (and sets its size)
+    // Caution: the queue must not be full
+    ReplyQueue::Reply& ReplyQueue::push(const Endpoint& endpoint)
+    {
+        auto& slot = slots_[(head_ + size_) % slots_.size()];
+        slot.endpoint = endpoint;
+        slot.size = 0;
+        slot.traceRequest = 0;
+        slot.traceQueued = 0;
+
+        ++size_;
+        highWaterMark_ = std::max(highWaterMark_, size_);
+        return slot;
+    }
+
+    // pop():
+    // Removes the oldest queued reply
+    // Caution: the queue must not be empty
+    void ReplyQueue::pop()
+    {
+        head_ = (head_ + 1) % slots_.size();
+        --size_;
+    }
+
+} // namespace CountersServer
+} // namespace ocs
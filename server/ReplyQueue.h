@@ -0,0 +1,96 @@
+#ifndef OCS_COUNTERS_SERVER_REPLY_QUEUE_H
+#define OCS_COUNTERS_SERVER_REPLY_QUEUE_H
+//
+// ReplyQueue.h
+// ~~~~~~~~~~~~
+//
+// Header for the ReplyQueue class:
+// - bounded FIFO queue of the replies waiting to be sent by a CountersServer
+// - each queued reply owns its destination endpoint and its buffer, so that it stays
+//   valid until the completion of the asynchronous send
+// - the slots are preallocated once, so that queuing a reply never allocates
+//
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <boost/asio.hpp>
+#include "Constants.h"
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    // ReplyQueue class:
+    // - bounded FIFO queue of the replies waiting to be sent by a CountersServer
+    // - each queued reply owns its destination endpoint and its buffer, so that it stays
+    //   valid until the completion of the asynchronous send
+    // - the slots are preallocated once, so that queuing a reply never allocates
+    // Note: a ReplyQueue belongs to a single CountersServer, hence is not thread-safe
+    class ReplyQueue
+    {
+    public:
+        // Endpoint of the clients: udp or unix (see CountersServer)
+        using Endpoint = boost::asio::generic::datagram_protocol::endpoint;
+
+        // Reply structure:
+        // A reply waiting to be sent, with its own destination endpoint and buffer
+        struct Reply
+        {
+            Endpoint                                        endpoint;
+            std::array<char, Constants::defaultBufferSize>  buffer;
+            std::size_t                                     size;
+            std::uint64_t                                   traceRequest;   // request number, if traced (see FlightRecorder)
+            std::uint64_t                                   traceQueued;    // queuing time, if traced (0 otherwise)
+        };
+
+        // Ctor:
+        // Preallocates the capacity slots of the queue
+        explicit ReplyQueue(std::size_t capacity);
+
+        // empty(), full(), size(), capacity():
+        // Queue state accessors
+        bool empty() const { return size_ == 0; }
+        bool full() const { return size_ == slots_.size(); }
+        std::size_t size() const { return size_; }
+        std::size_t capacity() const { return slots_.size(); }
+
+        // push(endpoint, data, size):
+        // Queues a copy of a reply at the back of the queue
+        // (the reply is truncated if it exceeds the size of a slot's buffer)
+        // Caution: the queue must not be full
+        void push(const Endpoint& endpoint, const char* data, std::size_t size);
+
+        // push(endpoint):
+        // Queues an empty reply at the back of the queue, and returns it so that the caller
+        // encodes the reply directly into its buffer (and sets its size)
+        // Caution: the queue must not be full
+        Reply& push(const Endpoint& endpoint);
+
+        // front():
+        // Returns the oldest queued reply
+        // Caution: the queue must not be empty
+        const Reply& front() const { return slots_[head_]; }
+
+        // pop():
+        // Removes the oldest queued reply
+        // Caution: the queue must not be empty
+        void pop();
+
+        // highWaterMark():
+        // Returns the maximum number of replies queued simultaneously since startup
+        std::size_t highWaterMark() const { return highWaterMark_; }
+
+    private:
+        std::vector<Reply>  slots_;         // preallocated slots (circular buffer)
+        std::size_t         head_;          // index of the oldest queued reply
+        std::size_t         size_;          // number of queued replies
+        std::size_t         highWaterMark_; // maximum number of replies queued simultaneously
+    };
+
+} // namespace CountersServer
+} // namespace ocs
+
+#endif // OCS_COUNTERS_SERVER_REPLY_QUEUE_H
@@ -0,0 +1,318 @@
+//
+// ServerStats.cpp
+// ~~~~~~~~~~~~~~~
+//
+// Source for the ServerStats class:
+// - process-wide performance metrics of the server, reported by the "STATS" command
+// - each thread updates its own slot, the readers merge the slots
+//
+#include "ServerStats.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    namespace
+    {
+        // Startup time of the process (static initialization), for the uptime and the rates
+        const ServerStats::Clock::time_point theStartTime = ServerStats::Clock::now();
+    }
+
+    // Registry structure:
+    // The slots allocated so far, the free ones, and the state of the reports
+    // The slots are never deallocated: a reader may merge them at any time
+    struct ServerStats::Registry
+    {
+        std::mutex                                      mutex;
+        std::array<std::unique_ptr<Slot>, maxSlots>     slots;
+        std::array<bool, maxSlots>                      used;
+        std::size_t                                     count = 0;      // number of slots allocated
+        Slot                                            overflow;       // shared by the threads without a slot
+        Clock::time_point                               lastReport = theStartTime;
+        std::uint64_t                                   lastRequests = 0;
+    };
+
+    // Registration structure:
+    // Thread-local owner of a slot, releasing it when its thread terminates
+    struct ServerStats::Registration
+    {
+        ~Registration()
+        {
+            if (!slot)
+                return;
+            auto& registry = ServerStats::registry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            for (std::size_t i = 0; i < registry.count; ++i)
+            {
+                if (registry.slots[i].get() == slot)
+                    registry.used[i] = false;
+            }
+        }
+
+        Slot*   slot = nullptr;
+    };
+
+    namespace
+    {
+        // ReplyWriter class:
+        // Appends formatted text to a reply, truncating it to the reply's capacity
+        class ReplyWriter
+        {
+        public:
+            ReplyWriter(char* reply, std::size_t capacity)
+            : reply_(reply)
+            , capacity_(capacity)
+            , size_(0)
+            {}
+
+            void printf(const char* format, ...) __attribute__((format(printf, 2, 3)))
+            {
+                if (size_ >= capacity_)
+                    return;
+                // Format into a local buffer, as vsnprintf writes a terminating null
+                char line[256];
+                va_list arguments;
+                va_start(arguments, format);
+                const auto length = std::vsnprintf(line, sizeof(line), format, arguments);
+                va_end(arguments);
+                if (length <= 0)
+                    return;
+                const auto copied = std::min<std::size_t>(std::min<std::size_t>(length, sizeof(line) - 1), capacity_ - size_);
+                std::copy(line, line + copied, reply_ + size_);
+                size_ += copied;
+            }
+
+            std::size_t size() const
+            {
+                return size_;
+            }
+
+        private:
+            char*       reply_;
+            std::size_t capacity_;
+            std::size_t size_;
+        };
+
+        // SocketQueues structure:
+        // Kernel statistics of the udp sockets bound to a port
+        struct SocketQueues
+        {
+            bool                available = false;
+            std::uint64_t       sockets = 0;
+            std::uint64_t       queued = 0;     // bytes waiting in the receive queues
+            std::uint64_t       drops = 0;      // datagrams dropped on full receive queues
+        };
+
+        // readSocketQueues(filename, port, queues):
+        // Adds the statistics of the sockets bound to a port, from a /proc/net/udp* file:
+        //   sl local_address rem_address st tx_queue:rx_queue tr:tm->when retrnsmt uid timeout inode ref pointer drops
+        void readSocketQueues(const char* filename, int port, SocketQueues& queues)
+        {
+            std::ifstream file(filename);
+            if (!file)
+                return;
+            queues.available = true;
+
+            std::string line;
+            std::getline(file, line);   // header
+            while (std::getline(file, line))
+            {
+                std::istringstream fields(line);
+                std::string slot, local, remote, state, txrx, timer, retransmits, uid, timeout, inode, ref, pointer;
+                unsigned long long drops = 0;
+                if (!(fields >> slot >> local >> remote >> state >> txrx >> timer >> retransmits >> uid >> timeout >> inode >> ref >> pointer >> drops))
+                    continue;
+                const auto colon = local.rfind(':');
+                if (colon == std::string::npos || std::strtol(local.c_str() + colon + 1, nullptr, 16) != port)
+                    continue;
+                const auto separator = txrx.find(':');
+                ++queues.sockets;
+                if (separator != std::string::npos)
+                    queues.queued += std::strtoull(txrx.c_str() + separator + 1, nullptr, 16);
+                queues.drops += drops;
+            }
+        }
+    }
+
+
+    // registry():
+    // Returns the process-wide registry of the slots
+    // The registry is never destroyed, so that the threads terminating after the
+    // static destructors can still release their slots
+    ServerStats::Registry& ServerStats::registry()
+    {
+        static Registry* const theRegistry = []()
+        {
+            auto* const registry = new Registry();
+            registry->overflow.shared = true;
+            return registry;
+        }();
+        return *theRegistry;
+    }
+
+
+    // registerThread():
+    // Slow path of slot(): allocates a slot to the calling thread (a free one, or
+    // the shared overflow slot if all are taken)
+    ServerStats::Slot* ServerStats::registerThread()
+    {
+        static thread_local Registration registration;
+        auto& registry = ServerStats::registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+
+        // Reuse the slot of a terminated thread, if any, or allocate a new one
+        std::size_t index = 0;
+        while (index < registry.count && registry.used[index])
+            ++index;
+        if (index == maxSlots)
+            return &registry.overflow;
+        if (index == registry.count)
+        {
+            registry.slots[index].reset(new Slot());
+            ++registry.count;
+        }
+        registry.used[index] = true;
+        registration.slot = registry.slots[index].get();
+        return registration.slot;
+    }
+
+
+    // highestValue(index):
+    // Returns the highest value of a histogram bucket
+    std::uint64_t ServerStats::highestValue(const unsigned index)
+    {
+        if (index < 2 * subBuckets)
+            return index;
+        const unsigned shift = index / subBuckets - 1;
+        const std::uint64_t top = index - shift * subBuckets;
+        return ((top + 1) << shift) - 1;
+    }
+
+
+    // report(port, reply, capacity):
+    // Formats the merged metrics of all the threads into a text reply, returns its size
+    // (truncated to the capacity); the receive-queue drops are those of the udp
+    // sockets bound to the given port
+    // The slots are read while their threads update them: each value is exact, but the
+    // values are not a consistent snapshot (e.g. a histogram may lag behind a counter)
+    std::size_t ServerStats::report(int port, char* reply, std::size_t capacity)
+    {
+        auto& registry = ServerStats::registry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+
+        // Merge the slots
+        std::array<std::uint64_t, counterCount> counters = {};
+        std::array<std::array<std::uint64_t, bucketCount>, histogramCount> buckets = {};
+        std::array<std::uint64_t, histogramCount> sums = {};
+        std::array<std::uint64_t, histogramCount> maxima = {};
+        std::array<std::uint64_t, maxSlots> threadRequests = {};
+        for (std::size_t i = 0; i <= registry.count; ++i)
+        {
+            const auto& slot = i < registry.count ? *registry.slots[i] : registry.overflow;
+            for (std::size_t c = 0; c < counterCount; ++c)
+                counters[c] += slot.counters[c].load(std::memory_order_relaxed);
+            for (std::size_t h = 0; h < histogramCount; ++h)
+            {
+                for (std::size_t b = 0; b < bucketCount; ++b)
+                    buckets[h][b] += slot.buckets[h][b].load(std::memory_order_relaxed);
+                sums[h] += slot.sums[h].load(std::memory_order_relaxed);
+                maxima[h] = std::max(maxima[h], slot.maxima[h].load(std::memory_order_relaxed));
+            }
+            if (i < registry.count)
+                threadRequests[i] = slot.counters[requests].load(std::memory_order_relaxed);
+        }
+
+        // Request rates: since startup, and since the previous report
+        const auto now = Clock::now();
+        const auto uptime = std::chrono::duration<double>(now - theStartTime).count();
+        const auto interval = std::chrono::duration<double>(now - registry.lastReport).count();
+        const auto recentRate = interval > 0 ? (counters[requests] - registry.lastRequests) / interval : 0.0;
+        registry.lastReport = now;
+        registry.lastRequests = counters[requests];
+
+        SocketQueues queues;
+        readSocketQueues("/proc/net/udp6", port, queues);
+        readSocketQueues("/proc/net/udp", port, queues);
+
+        ReplyWriter writer(reply, capacity);
+        writer.printf("OK: STATS\n");
+        writer.printf("uptime %.3f s\n", uptime);
+        writer.printf("requests %llu rate %.1f/s recent %.1f/s operations %llu\n",
+            static_cast<unsigned long long>(counters[requests]), uptime > 0 ? counters[requests] / uptime : 0.0,
+            recentRate, static_cast<unsigned long long>(counters[operations]));
+        writer.printf("bytes in %llu out %llu\n",
+            static_cast<unsigned long long>(counters[bytesIn]), static_cast<unsigned long long>(counters[bytesOut]));
+        writer.printf("errors malformed %llu unsupported %llu failed %llu receive %llu send %llu\n",
+            static_cast<unsigned long long>(counters[malformed]), static_cast<unsigned long long>(counters[unsupported]),
+            static_cast<unsigned long long>(counters[failed]), static_cast<unsigned long long>(counters[receiveErrors]),
+            static_cast<unsigned long long>(counters[sendErrors]));
+        if (queues.available)
+            writer.printf("socket sockets %llu drops %llu queued %llu bytes\n", static_cast<unsigned long long>(queues.sockets),
+                static_cast<unsigned long long>(queues.drops), static_cast<unsigned long long>(queues.queued));
+        else
+            writer.printf("socket unavailable\n");
+        writer.printf("tcp accepted %llu open %llu\n", static_cast<unsigned long long>(counters[tcpAccepted]),
+            static_cast<unsigned long long>(counters[tcpAccepted] - std::min(counters[tcpAccepted], counters[tcpClosed])));
+        writer.printf("uring requests %llu syscalls %llu per request %.3f\n",
+            static_cast<unsigned long long>(counters[uringRequests]), static_cast<unsigned long long>(counters[uringEnters]),
+            counters[uringRequests] ? static_cast<double>(counters[uringEnters]) / counters[uringRequests] : 0.0);
+        writer.printf("busy-poll empty %llu sleeps %llu\n",
+            static_cast<unsigned long long>(counters[busyPolls]), static_cast<unsigned long long>(counters[busyPollSleeps]));
+        writer.printf("admission throttled %llu shed %llu clients %llu evictions %llu\n",
+            static_cast<unsigned long long>(counters[throttled]), static_cast<unsigned long long>(counters[shed]),
+            static_cast<unsigned long long>(counters[admissionClients]), static_cast<unsigned long long>(counters[admissionEvictions]));
+        writer.printf("coalescing batches %llu queries %llu factor %.2f\n",
+            static_cast<unsigned long long>(counters[coalescedBatches]), static_cast<unsigned long long>(counters[coalescedQueries]),
+            counters[coalescedBatches] ? static_cast<double>(counters[coalescedQueries]) / counters[coalescedBatches] : 0.0);
+        writer.printf("locks contended %llu wait %.1f us\n",
+            static_cast<unsigned long long>(counters[lockContentions]), counters[lockWait] / 1000.0);
+
+        static const char* const names[histogramCount] = { "dispatch", "persistence", "flush" };
+        static const double percents[] = { 50, 90, 99, 99.9 };
+        for (std::size_t h = 0; h < histogramCount; ++h)
+        {
+            std::uint64_t count = 0;
+            for (const auto bucket : buckets[h])
+                count += bucket;
+            writer.printf("%s_ns count %llu mean %.0f", names[h], static_cast<unsigned long long>(count),
+                count ? static_cast<double>(sums[h]) / count : 0.0);
+            for (const auto percent : percents)
+            {
+                // Smallest value such that percent % of the values are lower or equal
+                const auto rank = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(std::ceil(percent / 100.0 * count)));
+                std::uint64_t seen = 0;
+                std::uint64_t value = 0;
+                for (unsigned b = 0; b < bucketCount && count; ++b)
+                {
+                    seen += buckets[h][b];
+                    if (seen >= rank)
+                    {
+                        value = std::min(highestValue(b), maxima[h]);
+                        break;
+                    }
+                }
+                writer.printf(" p%g %llu", percent, static_cast<unsigned long long>(value));
+            }
+            writer.printf(" max %llu\n", static_cast<unsigned long long>(maxima[h]));
+        }
+
+        writer.printf("threads %llu requests", static_cast<unsigned long long>(registry.count));
+        for (std::size_t i = 0; i < registry.count; ++i)
+            writer.printf(" %llu", static_cast<unsigned long long>(threadRequests[i]));
+        writer.printf("\n");
+        return writer.size();
+    }
+
+} // namespace CountersServer
+} // namespace ocs
@@ -0,0 +1,217 @@
+#ifndef OCS_COUNTERS_SERVER_SERVER_STATS_H
+#define OCS_COUNTERS_SERVER_SERVER_STATS_H
+//
+// ServerStats.h
+// ~~~~~~~~~~~~~
+//
+// Header for the ServerStats class:
+// - process-wide performance metrics of the server, reported by the "STATS" command
+// - each thread updates its own cache-line-padded slot of counters and latency
+//   histograms, with plain relaxed loads and stores (no atomic read-modify-write,
+//   no shared cache line): the readers merge the slots
+// - the slots of the terminated threads are reused by the new ones, their counts
+//   being kept, so that the totals never go backwards
+//
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include "Constants.h"
+#include "FlightRecorder.h"
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    // ServerStats class:
+    // - process-wide performance metrics of the server, reported by the "STATS" command
+    // - each thread updates its own slot, the readers merge the slots
+    class ServerStats
+    {
+    public:
+        // Counter enumeration:
+        // Metrics counted by the threads
+        enum Counter
+        {
+            requests,           // requests dispatched (text or binary datagrams)
+            operations,         // operations of the binary requests
+            bytesIn,            // bytes of the requests received
+            bytesOut,           // bytes of the replies sent
+            malformed,          // errors: unrecognized commands, invalid arguments, malformed datagrams
+            unsupported,        // errors: unsupported binary operations
+            failed,             // errors: operations refused or failed by the store
+            receiveErrors,      // errors: requests that could not be received
+            sendErrors,         // errors: replies that could not be sent
+            lockContentions,    // acquisitions of the store's mutexes that had to wait
+            lockWait,           // time spent waiting for the store's mutexes, in nanoseconds
+            coalescedBatches,   // batches whose query count increments and reservations were applied at once
+            coalescedQueries,   // query count increments and reservations applied by these batches
+            tcpAccepted,        // tcp connections accepted
+            tcpClosed,          // tcp connections closed
+            uringRequests,      // requests received by the io_uring backend
+            uringEnters,        // io_uring_enter system calls of the io_uring backend
+            busyPolls,          // polls of the IO contexts that found no work, in busy-poll mode
+            busyPollSleeps,     // sleeps of the busy-polling workers, idle for too long
+            throttled,          // requests refused by the per-client rate limit
+            shed,               // requests dropped on a filled receive queue
+            admissionClients,   // clients entered into the empty entries of the admission control's table
+            admissionEvictions, // clients evicted from the admission control's table by new ones
+            counterCount
+        };
+
+        // Histogram enumeration:
+        // Latencies recorded by the threads, in nanoseconds
+        enum Histogram
+        {
+            dispatch,           // processing of a request by the dispatcher (sampled, see sampled())
+            persistence,        // wait of a request for the persistence of its result (group and strict modes)
+            flush,              // write and flush of the persistent storage
+            histogramCount
+        };
+
+        // One request out of dispatchSampling has its dispatch latency measured
+        enum { dispatchSampling = 64 };
+
+        // Histogram buckets: log-linear, 8 sub-buckets per power of two (12.5% precision)
+        enum { subBucketBits = 3 };
+        enum { subBuckets = 1 << subBucketBits };
+        enum { bucketCount = (64 - subBucketBits + 1) * subBuckets };
+
+        using Clock = std::chrono::steady_clock;
+
+        // add(counter, value):
+        // Adds a value to a counter of the calling thread
+        static void add(Counter counter, std::uint64_t value = 1)
+        {
+            auto& slot = ServerStats::slot();
+            slot.add(slot.counters[counter], value);
+        }
+
+        // record(histogram, nanoseconds):
+        // Records a latency into a histogram of the calling thread
+        static void record(Histogram histogram, std::uint64_t nanoseconds)
+        {
+            auto& slot = ServerStats::slot();
+            slot.add(slot.buckets[histogram][bucketIndex(nanoseconds)], 1);
+            slot.add(slot.sums[histogram], nanoseconds);
+            if (nanoseconds > slot.maxima[histogram].load(std::memory_order_relaxed))
+                slot.maxima[histogram].store(nanoseconds, std::memory_order_relaxed);
+        }
+
+        // record(histogram, start):
+        // Records the latency elapsed since a start time
+        static void record(Histogram histogram, Clock::time_point start)
+        {
+            record(histogram, std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+        }
+
+        // sampled():
+        // Counts a request of the calling thread, returns true if its dispatch latency
+        // must be measured (one request out of dispatchSampling), so that the clock is
+        // not read twice on every request
+        static bool sampled()
+        {
+            auto& slot = ServerStats::slot();
+            const auto count = slot.counters[requests].load(std::memory_order_relaxed);
+            slot.add(slot.counters[requests], 1);
+            return count % dispatchSampling == 0;
+        }
+
+        // lock(lock):
+        // Acquires a unique_lock's mutex, counting and measuring the wait only when the
+        // mutex is already held (the uncontended path costs a try_lock, nothing more)
+        // The wait is traced as well, if tracing is enabled
+        template<class Lock>
+        static void lock(Lock& lock)
+        {
+            if (lock.try_lock())
+                return;
+            const auto start = Clock::now();
+            lock.lock();
+            const auto end = Clock::now();
+            add(lockContentions);
+            add(lockWait, std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+            if (FlightRecorder::enabled())
+                FlightRecorder::record(FlightRecorder::lock, FlightRecorder::toNanoseconds(start), FlightRecorder::toNanoseconds(end));
+        }
+
+        // report(port, reply, capacity):
+        // Formats the merged metrics of all the threads into a text reply, returns its size
+        // (truncated to the capacity); the receive-queue drops are those of the udp
+        // sockets bound to the given port
+        static std::size_t report(int port, char* reply, std::size_t capacity);
+
+    private:
+        // Slot structure:
+        // Metrics of a thread, padded so that no two slots share a cache line
+        // Only the owner thread writes to its slot (except the shared overflow slot)
+        struct Slot
+        {
+            // add(value, n):
+            // Adds n to a value of the slot: a plain load and store for a private slot,
+            // an atomic addition for the shared overflow slot
+            void add(std::atomic<std::uint64_t>& value, std::uint64_t n)
+            {
+                if (shared)
+                    value.fetch_add(n, std::memory_order_relaxed);
+                else
+                    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+            }
+
+            char                                                            paddingBefore[Constants::cacheLineSize];
+            bool                                                            shared = false;
+            std::array<std::atomic<std::uint64_t>, counterCount>            counters;
+            std::array<std::array<std::atomic<std::uint64_t>, bucketCount>, histogramCount> buckets;
+            std::array<std::atomic<std::uint64_t>, histogramCount>          sums;
+            std::array<std::atomic<std::uint64_t>, histogramCount>          maxima;
+            char                                                            paddingAfter[Constants::cacheLineSize];
+        };
+
+        // Maximum number of slots: threads beyond this number share an overflow slot
+        enum { maxSlots = 256 };
+
+        // slot():
+        // Returns the calling thread's slot, registering the thread if necessary
+        // (the pointer is a function-local, constant-initialized thread_local, so that
+        // it is accessed directly, without going through a TLS wrapper function)
+        static Slot& slot()
+        {
+            static thread_local Slot* current = nullptr;
+            if (!current)
+                current = registerThread();
+            return *current;
+        }
+
+        // Registry structure: the slots, and the state of the reports (see ServerStats.cpp)
+        // Registration structure: releases the slot of a thread when the thread terminates
+        struct Registry;
+        struct Registration;
+
+        // registry():
+        // Returns the process-wide registry of the slots
+        static Registry& registry();
+
+        // registerThread():
+        // Slow path of slot(): allocates a slot to the calling thread (a free one, or
+        // the shared overflow slot if all are taken)
+        static Slot* registerThread();
+
+        // bucketIndex(value), highestValue(index):
+        // Histogram buckets, as in LatencyHistogram (with fewer sub-buckets)
+        static unsigned bucketIndex(const std::uint64_t value)
+        {
+            if (value < 2 * subBuckets)
+                return static_cast<unsigned>(value);
+            const unsigned shift = 63 - __builtin_clzll(value) - subBucketBits;
+            return shift * subBuckets + static_cast<unsigned>(value >> shift);
+        }
+        static std::uint64_t highestValue(const unsigned index);
+    };
+
+} // namespace CountersServer
+} // namespace ocs
+
+#endif // OCS_COUNTERS_SERVER_SERVER_STATS_H
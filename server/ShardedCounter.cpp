@@ -0,0 +1,184 @@
+//
+// ShardedCounter.cpp
+// ~~~~~~~~~~~~~~~~~~
+//
+// Source for the ShardedCounter class:
+// - lock-free counter issuing unique values, meant to be incremented by many threads
+// - each thread increments its own cache-line-padded shard, which hands out the values
+//   of a block leased from a global sequence (one atomic operation per block)
+// - the shards are merged on read
+//
+#include "ShardedCounter.h"
+#include <algorithm>
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    namespace
+    {
+        // Source of the counters' unique identifiers (0 is never used)
+        std::atomic<unsigned long long> nextCounterId(1);
+
+        // Per-thread cache of the shard used with the last counter incremented by the thread
+        struct CachedShard
+        {
+            unsigned long long  counterId;
+            void*               shard;
+        };
+        thread_local CachedShard cachedShard = { 0, nullptr };
+    }
+
+
+    // Ctor:
+    // Creates a counter whose first issued value will be (initial + 1)
+    // The values are leased blockSize at a time by each thread
+    ShardedCounter::ShardedCounter(unsigned long long initial, std::size_t blockSize)
+    : reserved_(initial)
+    , initial_(initial)
+    , blockSize_(std::max<std::size_t>(blockSize, 1))
+    , shards_()
+    , owners_()
+    , shardCount_(0)
+    , registrationMutex_()
+    , overflow_()
+    , id_(nextCounterId.fetch_add(1))
+    {
+        for (auto& shard : shards_)
+        {
+            shard.last.store(0, std::memory_order_relaxed);
+            shard.count.store(0, std::memory_order_relaxed);
+            shard.next = shard.end = 0;
+        }
+        overflow_.last.store(0, std::memory_order_relaxed);
+        overflow_.count.store(0, std::memory_order_relaxed);
+    }
+
+
+    // increment():
+    // Issues a new value, lock-free (wait-free except when registering a new thread)
+    unsigned long long ShardedCounter::increment()
+    {
+        auto* const shard = this->shard();
+        if (!shard)
+            return reserve(1);    // overflow path: issue a single value from the global sequence
+
+        // Lease a new block from the global sequence when the current one is exhausted
+        if (shard->next == shard->end)
+        {
+            shard->next = reserved_.fetch_add(blockSize_, std::memory_order_relaxed) + 1;
+            shard->end = shard->next + blockSize_;
+        }
+
+        // Only the owner thread writes to its shard: plain loads and stores are enough
+        const auto value = shard->next++;
+        shard->last.store(value, std::memory_order_release);
+        shard->count.store(shard->count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return value;
+    }
+
+
+    // reserve(count):
+    // Issues count consecutive values at once, and returns the first one
+    // The range follows the values already issued by the calling thread: it is taken from
+    // the thread's current block if enough values are left there, or else from the global
+    // sequence with a single atomic operation, the rest of the block being then retired
+    // (skipped), so that the values issued by a thread keep increasing
+    unsigned long long ShardedCounter::reserve(unsigned long long count)
+    {
+        auto* const shard = this->shard();
+        if (!shard)
+        {
+            // Overflow path: the range is merged into the overflow shard, so that current()
+            // covers its last value
+            const auto first = reserved_.fetch_add(count, std::memory_order_relaxed) + 1;
+            const auto value = first + count - 1;
+            auto last = overflow_.last.load(std::memory_order_relaxed);
+            while (last < value && !overflow_.last.compare_exchange_weak(last, value, std::memory_order_release))
+                ;
+            overflow_.count.fetch_add(count, std::memory_order_relaxed);
+            return first;
+        }
+
+        unsigned long long first;
+        if (shard->end - shard->next >= count)
+        {
+            first = shard->next;
+            shard->next += count;
+        }
+        else
+        {
+            first = reserved_.fetch_add(count, std::memory_order_relaxed) + 1;
+            shard->next = shard->end = first + count;
+        }
+        shard->last.store(first + count - 1, std::memory_order_release);
+        shard->count.store(shard->count.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+        return first;
+    }
+
+
+    // current():
+    // Merged read: returns the highest value issued so far
+    // Persisting this value is enough to never issue a value twice after a restart
+    unsigned long long ShardedCounter::current() const
+    {
+        auto result = std::max(initial_, overflow_.last.load(std::memory_order_acquire));
+        const auto count = shardCount_.load(std::memory_order_acquire);
+        for (std::size_t i = 0; i < count; ++i)
+            result = std::max(result, shards_[i].last.load(std::memory_order_acquire));
+        return result;
+    }
+
+
+    // issued():
+    // Merged read: returns the number of values issued since startup
+    unsigned long long ShardedCounter::issued() const
+    {
+        auto result = overflow_.count.load(std::memory_order_relaxed);
+        const auto count = shardCount_.load(std::memory_order_acquire);
+        for (std::size_t i = 0; i < count; ++i)
+            result += shards_[i].count.load(std::memory_order_relaxed);
+        return result;
+    }
+
+
+    // shard():
+    // Returns the calling thread's shard, registering the thread if necessary,
+    // or nullptr if all the shards are taken
+    ShardedCounter::Shard* ShardedCounter::shard()
+    {
+        if (cachedShard.counterId != id_)
+        {
+            cachedShard.shard = registerThread();
+            cachedShard.counterId = id_;
+        }
+        return static_cast<Shard*>(cachedShard.shard);
+    }
+
+
+    // registerThread():
+    // Slow path of shard(): finds or allocates the calling thread's shard
+    ShardedCounter::Shard* ShardedCounter::registerThread()
+    {
+        const auto self = std::this_thread::get_id();
+        std::lock_guard<std::mutex> lock(registrationMutex_);
+
+        // Find the shard already allocated to the thread, if any
+        const auto count = shardCount_.load(std::memory_order_relaxed);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            if (owners_[i] == self)
+                return &shards_[i];
+        }
+
+        // Allocate a new shard, if any is left
+        if (count == maxShards)
+            return nullptr;
+        owners_[count] = self;
+        shardCount_.store(count + 1, std::memory_order_release);
+        return &shards_[count];
+    }
+
+} // namespace CountersServer
+} // namespace ocs
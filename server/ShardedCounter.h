@@ -0,0 +1,118 @@
+#ifndef OCS_COUNTERS_SERVER_SHARDED_COUNTER_H
+#define OCS_COUNTERS_SERVER_SHARDED_COUNTER_H
+//
+// ShardedCounter.h
+// ~~~~~~~~~~~~~~~~
+//
+// Header for the ShardedCounter class:
+// - lock-free counter issuing unique values, meant to be incremented by many threads
+// - each thread increments its own cache-line-padded shard, which hands out the values
+//   of a block leased from a global sequence (one atomic operation per block)
+// - the shards are merged on read
+//
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include "Constants.h"
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    // ShardedCounter class:
+    // - lock-free counter issuing unique values, meant to be incremented by many threads
+    // - each thread increments its own cache-line-padded shard, which hands out the values
+    //   of a block leased from a global sequence (one atomic operation per block)
+    // - the shards are merged on read
+    //
+    // Sequencing: every value is issued once; the values issued by a given thread
+    // are strictly increasing, but threads hand out values from different blocks, so
+    // that values issued by different threads may interleave (with a block size of 1,
+    // all the values are issued in increasing order)
+    class ShardedCounter
+    {
+    public:
+        // Ctor:
+        // Creates a counter whose first issued value will be (initial + 1)
+        // The values are leased blockSize at a time by each thread
+        ShardedCounter(unsigned long long initial, std::size_t blockSize);
+
+        // increment():
+        // Issues a new value, lock-free (wait-free except when registering a new thread)
+        unsigned long long increment();
+
+        // reserve(count):
+        // Issues count consecutive values at once (lock-free), and returns the first one
+        // The range follows the values already issued by the calling thread: it is taken
+        // from the thread's current block, or else from the global sequence (the rest of
+        // the block being then skipped)
+        unsigned long long reserve(unsigned long long count);
+
+        // current():
+        // Merged read: returns the highest value issued so far
+        // Persisting this value is enough to never issue a value twice after a restart
+        unsigned long long current() const;
+
+        // issued():
+        // Merged read: returns the number of values issued since startup
+        unsigned long long issued() const;
+
+    private:
+        // Shard structure:
+        // Per-thread state, padded so that no two shards share a cache line
+        // The block is only accessed by the owner thread, the other fields are atomics
+        // so that they can be merged by the readers
+        struct Shard
+        {
+            char                            paddingBefore[Constants::cacheLineSize];
+            std::atomic<unsigned long long> last;       // last value issued by the shard (0 if none)
+            std::atomic<unsigned long long> count;      // number of values issued by the shard
+            unsigned long long              next;       // next value of the current block
+            unsigned long long              end;        // end of the current block (excluded)
+            char                            paddingAfter[Constants::cacheLineSize - 4 * sizeof(unsigned long long)];
+        };
+
+        // Maximum number of shards: threads beyond this number share an overflow path
+        // which issues the values one by one from the global sequence
+        enum { maxShards = 256 };
+
+        // shard():
+        // Returns the calling thread's shard, registering the thread if necessary,
+        // or nullptr if all the shards are taken
+        Shard* shard();
+
+        // registerThread():
+        // Slow path of shard(): finds or allocates the calling thread's shard
+        Shard* registerThread();
+
+        // Global sequence: highest value leased to a shard so far (on its own cache line)
+        char                                        paddingBefore_[Constants::cacheLineSize];
+        std::atomic<unsigned long long>             reserved_;
+        char                                        paddingAfter_[Constants::cacheLineSize];
+
+        // Initial value, and size of the leased blocks
+        const unsigned long long                    initial_;
+        const unsigned long long                    blockSize_;
+
+        // Shards, allocated to the threads on their first increment
+        std::array<Shard, maxShards>                shards_;
+        std::array<std::thread::id, maxShards>      owners_;
+        std::atomic<std::size_t>                    shardCount_;
+        std::mutex                                  registrationMutex_;
+
+        // Overflow path: state of the values issued outside of the shards (by the threads
+        // without a shard)
+        Shard                                       overflow_;
+
+        // Unique identifier of the counter, used to validate the threads' cached shards
+        const unsigned long long                    id_;
+    };
+
+} // namespace CountersServer
+} // namespace ocs
+
+#endif // OCS_COUNTERS_SERVER_SHARDED_COUNTER_H
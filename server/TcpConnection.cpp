@@ -0,0 +1,272 @@
+//
+// TcpConnection.cpp
+// ~~~~~~~~~~~~~~~~~
+//
+// Source for the TcpConnection class:
+// - serves a persistent tcp connection, on which the client pipelines its requests
+// - dispatches the complete requests of each read as a batch, and writes all their replies at once
+//
+#include "TcpConnection.h"
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <utility>
+#include "FlightRecorder.h"
+#include "Logger.h"
+#include "ServerStats.h"
+#include "StreamProtocol.h"
+
+using boost::asio::ip::tcp;
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    namespace
+    {
+        // Minimum room for each read, and size of the buffers of an idle connection
+        enum { readSize = 4096 };
+
+        // Size beyond which the buffers are released once empty (after a large request)
+        enum { maxIdleBufferSize = 64 * 1024 };
+
+        // Room kept after each reply, for the line terminator of a truncated text reply,
+        // and for the empty line terminating a reply of several lines (see StreamProtocol)
+        enum { replyTerminatorSize = 2 };
+
+        // shrink(buffer, size):
+        // Releases the memory of a large buffer holding at most size bytes
+        void shrink(std::vector<char>& buffer, std::size_t size)
+        {
+            if (buffer.size() > maxIdleBufferSize && size <= readSize)
+            {
+                std::vector<char> smaller(buffer.begin(), buffer.begin() + readSize);
+                buffer.swap(smaller);
+            }
+        }
+    }
+
+    // Ctor:
+    // Takes over an accepted connection
+    TcpConnection::TcpConnection(tcp::socket socket, std::shared_ptr<CountersServerDispatcher> dispatcher)
+     : socket_(std::move(socket))
+     , dispatcher_(dispatcher)
+     , input_(readSize)
+     , input_size_(0)
+     , output_()
+     , output_size_(0)
+     , entries_()
+     , closing_(false)
+    {
+    }
+
+    // Dtor:
+    // Counts the connection as closed
+    TcpConnection::~TcpConnection()
+    {
+        ServerStats::add(ServerStats::tcpClosed);
+    }
+
+    // start():
+    // Starts reading the requests
+    // Nagle's algorithm is disabled, the replies of a batch being written at once anyway
+    // The client's address is kept for the rate limit of its requests (see AdmissionControl)
+    void TcpConnection::start()
+    {
+        boost::system::error_code ec;
+        socket_.set_option(tcp::no_delay(true), ec);
+        peer_ = socket_.remote_endpoint(ec);
+        OCS_LOG(debug) << "Accepted a connection from " << peer_;
+        start_read();
+    }
+
+    // start_read():
+    // Reads more data, after the data already received
+    void TcpConnection::start_read()
+    {
+        if (input_.size() - input_size_ < readSize)
+            input_.resize(input_size_ + readSize);
+        const auto self = shared_from_this();
+        socket_.async_read_some(boost::asio::buffer(input_.data() + input_size_, input_.size() - input_size_),
+            [this, self](const boost::system::error_code& ec, std::size_t bytes)
+            {
+                handle_read(ec, bytes);
+            });
+    }
+
+    // handle_read(error, bytes):
+    // Handles the reception of data: processes the complete requests, if any,
+    // or else reads more data
+    // The connection is closed (by releasing the last reference to it) when the client
+    // closes it, or on an error
+    void TcpConnection::handle_read(const boost::system::error_code& ec, std::size_t bytes)
+    {
+        if (ec)
+        {
+            if (ec != boost::asio::error::eof && ec != boost::asio::error::connection_reset && ec != boost::asio::error::operation_aborted)
+            {
+                ServerStats::add(ServerStats::receiveErrors);
+                OCS_LOG_RATE_LIMITED(warning, Constants::maxErrorLinesPerSecond) << "Could not receive from a connection, closed: " << ec.message();
+            }
+            return;
+        }
+
+        ServerStats::add(ServerStats::bytesIn, bytes);
+        input_size_ += bytes;
+        process_input();
+    }
+
+    // process_input():
+    // Frames and dispatches the complete requests received so far (up to maxBatchSize),
+    // then writes their replies, or reads more data if there is no complete request
+    // The replies are encoded into the output buffer, each one into a slot of its own
+    // (as large as its request, and at least a datagram), then packed together
+    void TcpConnection::process_input()
+    {
+        const auto tracing = FlightRecorder::enabled();
+        entries_.clear();
+        std::size_t consumed = 0;
+        std::size_t capacity = 0;
+        while (entries_.size() < Constants::maxBatchSize)
+        {
+            std::size_t frameSize = 0;
+            std::size_t payloadSize = 0;
+            const auto status = StreamProtocol::nextFrame(input_.data() + consumed, input_size_ - consumed, frameSize, payloadSize);
+            if (status == StreamProtocol::invalid && entries_.empty())
+            {
+                frame_error();
+                return;
+            }
+            if (status != StreamProtocol::complete)
+                break;
+
+            CountersServerDispatcher::BatchEntry entry;
+            entry.request = boost::string_view(input_.data() + consumed, payloadSize);
+            entry.reply = nullptr;
+            entry.capacity = std::max<std::size_t>(payloadSize, Constants::defaultBufferSize);
+            entry.size = 0;
+            entry.traceRequest = tracing ? FlightRecorder::beginRequest() : 0;
+            // A throttled request is marked by a non-zero size, until its reply is encoded
+            if (AdmissionControl::limited() && !AdmissionControl::admitClient(peer_.data(), peer_.size()))
+                entry.size = 1;
+            entries_.push_back(entry);
+            capacity += entry.capacity + replyTerminatorSize;
+            consumed += frameSize;
+        }
+        if (entries_.empty())
+        {
+            start_read();
+            return;
+        }
+
+        // Dispatch the whole batch at once, so that its query count increments are coalesced
+        // (or else each run of admitted requests, the throttled ones being answered with an
+        // error, always: the replies on a connection come in the order of the requests)
+        if (output_.size() < capacity)
+            output_.resize(capacity);
+        std::size_t position = 0;
+        for (auto& entry : entries_)
+        {
+            entry.reply = output_.data() + position;
+            position += entry.capacity + replyTerminatorSize;
+            if (entry.size)
+                entry.size = CountersServerDispatcher::rejectCommand(entry.request, entry.reply, entry.capacity);
+        }
+        std::size_t first = 0;
+        for (std::size_t i = 0; i <= entries_.size(); ++i)
+        {
+            if (i < entries_.size() && !entries_[i].size)
+                continue;
+            if (i > first)
+                dispatcher_->dispatchBatch(&entries_[first], i - first);
+            first = i + 1;
+        }
+
+        // Pack the replies, terminating the text ones (see StreamProtocol)
+        output_size_ = 0;
+        for (const auto& entry : entries_)
+        {
+            auto size = entry.size;
+            if (!StreamProtocol::isBinary(entry.request.data(), entry.request.size()))
+            {
+                if (!size || entry.reply[size - 1] != '\n')
+                    entry.reply[size++] = '\n';
+                if (std::memchr(entry.reply, '\n', size - 1))
+                    entry.reply[size++] = '\n';
+            }
+            std::memmove(output_.data() + output_size_, entry.reply, size);
+            output_size_ += size;
+        }
+
+        // Keep the incomplete request, if any, at the start of the input buffer
+        input_size_ -= consumed;
+        std::memmove(input_.data(), input_.data() + consumed, input_size_);
+        shrink(input_, input_size_);
+        start_write();
+    }
+
+    // frame_error():
+    // Replies with an error to a request exceeding the maximum frame size, after which
+    // the connection is closed (the stream cannot be resynchronized)
+    void TcpConnection::frame_error()
+    {
+        ServerStats::add(ServerStats::malformed);
+        OCS_LOG_RATE_LIMITED(error, Constants::maxErrorLinesPerSecond) << "Received a request of more than " << Constants::maxFrameSize << " bytes, closing the connection";
+        const auto text = "ERROR: Request of more than " + std::to_string(Constants::maxFrameSize) + " bytes, closing the connection\n";
+        output_.assign(text.begin(), text.end());
+        output_size_ = output_.size();
+        entries_.clear();
+        input_size_ = 0;
+        closing_ = true;
+        start_write();
+    }
+
+    // start_write():
+    // Writes all the replies of the output buffer at once
+    // The buffer stays untouched until handle_write(), as no request is processed meanwhile
+    void TcpConnection::start_write()
+    {
+        const auto self = shared_from_this();
+        const auto started = FlightRecorder::enabled() ? FlightRecorder::now() : 0;
+        boost::asio::async_write(socket_, boost::asio::buffer(output_.data(), output_size_),
+            [this, self, started](const boost::system::error_code& ec, std::size_t bytes)
+            {
+                if (started)
+                {
+                    const auto end = FlightRecorder::now();
+                    for (const auto& entry : entries_)
+                        FlightRecorder::record(FlightRecorder::send, started, end, entry.traceRequest);
+                }
+                handle_write(ec, bytes);
+            });
+    }
+
+    // handle_write(error, bytes):
+    // Handles the completion of the write, then processes the requests left in the input
+    // buffer, if any, or else reads more data (or closes the connection after a frame error)
+    void TcpConnection::handle_write(const boost::system::error_code& ec, std::size_t bytes)
+    {
+        if (ec)
+        {
+            if (ec != boost::asio::error::connection_reset && ec != boost::asio::error::broken_pipe && ec != boost::asio::error::operation_aborted)
+            {
+                ServerStats::add(ServerStats::sendErrors);
+                OCS_LOG_RATE_LIMITED(warning, Constants::maxErrorLinesPerSecond) << "Could not send to a connection, closed: " << ec.message();
+            }
+            return;
+        }
+
+        ServerStats::add(ServerStats::bytesOut, bytes);
+        if (closing_)
+        {
+            boost::system::error_code ignored;
+            socket_.shutdown(tcp::socket::shutdown_both, ignored);
+            return;
+        }
+        shrink(output_, 0);
+        process_input();
+    }
+
+} // namespace CountersServer
+} // namespace ocs
@@ -0,0 +1,103 @@
+#ifndef OCS_COUNTERS_SERVER_TCP_CONNECTION_H
+#define OCS_COUNTERS_SERVER_TCP_CONNECTION_H
+//
+// TcpConnection.h
+// ~~~~~~~~~~~~~~~
+//
+// Header for the TcpConnection class:
+// - serves a persistent tcp connection, on which the client pipelines its requests
+// - frames the requests incrementally, as the data arrives (see StreamProtocol), so that
+//   a request may span several reads, and a read may hold many requests
+// - dispatches all the complete requests of a read as a batch (their query count increments
+//   being coalesced, see CountersServerDispatcher::dispatchBatch()), and sends all their
+//   replies with a single write
+// - stops reading while the replies are being written, so that a client which does not
+//   read its replies is slowed down by tcp's flow control, rather than buffered without limit
+// - owns itself, through the handlers of its pending operations (enable_shared_from_this)
+//
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include <boost/asio.hpp>
+#include "AdmissionControl.h"
+#include "CountersServerDispatcher.h"
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    // TcpConnection class:
+    // - serves a persistent tcp connection, on which the client pipelines its requests
+    // - dispatches the complete requests of each read as a batch, and writes all their replies at once
+    class TcpConnection : public std::enable_shared_from_this<TcpConnection>
+    {
+    public:
+        // Ctor:
+        // Takes over an accepted connection
+        TcpConnection(boost::asio::ip::tcp::socket socket, std::shared_ptr<CountersServerDispatcher> dispatcher);
+
+        // Dtor:
+        // Counts the connection as closed
+        ~TcpConnection();
+
+        // start():
+        // Starts reading the requests
+        void start();
+
+    private:
+        // start_read():
+        // Reads more data, after the data already received
+        void start_read();
+
+        // handle_read(error, bytes):
+        // Handles the reception of data: processes the complete requests, if any,
+        // or else reads more data; closes the connection on an error or at its end
+        void handle_read(const boost::system::error_code& error, std::size_t bytes);
+
+        // process_input():
+        // Frames and dispatches the complete requests received so far (up to maxBatchSize),
+        // then writes their replies, or reads more data if there is no complete request
+        void process_input();
+
+        // frame_error():
+        // Replies with an error to a request exceeding the maximum frame size, after which
+        // the connection is closed (the stream cannot be resynchronized)
+        void frame_error();
+
+        // start_write():
+        // Writes all the replies of the output buffer at once
+        void start_write();
+
+        // handle_write(error, bytes):
+        // Handles the completion of the write, then processes the requests left in the input
+        // buffer, if any, or else reads more data (or closes the connection after a frame error)
+        void handle_write(const boost::system::error_code& error, std::size_t bytes);
+
+        // Variables used by asio logic
+        boost::asio::ip::tcp::socket                    socket_;
+        boost::asio::ip::tcp::endpoint                  peer_;      // address of the client
+
+        // Dispatcher, decoding/encoding layer placed between the connection and the CountersStore
+        std::shared_ptr<CountersServerDispatcher>       dispatcher_;
+
+        // Data received and not processed yet: its first input_size_ bytes are valid
+        std::vector<char>                               input_;
+        std::size_t                                     input_size_;
+
+        // Replies being written: its first output_size_ bytes are valid
+        std::vector<char>                               output_;
+        std::size_t                                     output_size_;
+
+        // Requests and replies of the batch being dispatched
+        std::vector<CountersServerDispatcher::BatchEntry> entries_;
+
+        // true once a frame error was replied to: the connection is closed after the write
+        bool                                            closing_;
+    };
+
+} // namespace CountersServer
+} // namespace ocs
+
+#endif // OCS_COUNTERS_SERVER_TCP_CONNECTION_H
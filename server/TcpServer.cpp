@@ -0,0 +1,113 @@
+//
+// TcpServer.cpp
+// ~~~~~~~~~~~~~
+//
+// Source for the TcpServer class:
+// - listens on a tcp-v6 port
+// - accepts the connections, each one being served by a TcpConnection
+//
+// This code is derived from the Boost tutorial here:
+// https://www.boost.org/doc/libs/1_67_0/doc/html/boost_asio/tutorial/tutdaytime3/src.html
+//
+#include "TcpServer.h"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+#include "Logger.h"
+#include "ServerStats.h"
+#include "TcpConnection.h"
+
+using boost::asio::ip::tcp;
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+#ifdef SO_REUSEPORT
+    // Socket option used to let several acceptors (one per worker thread) share the same port
+    typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+#endif
+
+    // Ctor:
+    // Opens, binds and listens on the acceptor, then starts accepting the connections
+    // Caution: throws if the port cannot be bound
+    TcpServer::TcpServer(const Configuration& configuration, boost::asio::io_service& io_context, std::shared_ptr<CountersServerDispatcher> dispatcher)
+     : configuration_(configuration)
+     , acceptor_(io_context)
+     , socket_(io_context)
+     , retry_timer_(io_context)
+     , dispatcher_(dispatcher)
+    {
+        open_acceptor();
+        start_accept();
+    }
+
+    // open_acceptor():
+    // Opens, binds and listens on the acceptor (with SO_REUSEPORT when several
+    // workers are configured, SO_REUSEADDR so that a restarted server does not
+    // wait for the connections of the former one in TIME_WAIT, and SO_BUSY_POLL
+    // in busy-poll mode)
+    void TcpServer::open_acceptor()
+    {
+        acceptor_.open(tcp::v6());
+        acceptor_.set_option(tcp::acceptor::reuse_address(true));
+        if (configuration_.threads > 1)
+        {
+#ifdef SO_REUSEPORT
+            acceptor_.set_option(reuse_port(true));
+#else
+            throw std::logic_error("Multiple worker threads require SO_REUSEPORT, which is not supported on this platform");
+#endif
+        }
+#ifdef SO_BUSY_POLL
+        // In busy-poll mode, the connections (which inherit the option) poll the device
+        // queue for their packets, where the driver supports it
+        if (configuration_.busyPoll)
+        {
+            const int microseconds = Constants::busyPollMicroseconds;
+            if (::setsockopt(acceptor_.native_handle(), SOL_SOCKET, SO_BUSY_POLL, &microseconds, sizeof(microseconds)) != 0)
+                Logger(warning) << "Could not enable SO_BUSY_POLL on the tcp acceptor: " << std::strerror(errno);
+        }
+#endif
+        acceptor_.bind(tcp::endpoint(tcp::v6(), configuration_.tcpPort));
+        acceptor_.listen(boost::asio::socket_base::max_listen_connections);
+    }
+
+    // start_accept():
+    // Waits for the next connection
+    void TcpServer::start_accept()
+    {
+        acceptor_.async_accept(socket_,
+            [this](boost::system::error_code ec)
+            {
+                handle_accept(ec);
+            });
+    }
+
+    // handle_accept(error):
+    // Hands the accepted connection over to a new TcpConnection, and waits for the next one
+    // The connection owns itself (through the handlers of its pending operations), so that
+    // it lives as long as the client stays connected, or until the IO context is destroyed
+    void TcpServer::handle_accept(const boost::system::error_code& ec)
+    {
+        if (ec)
+        {
+            OCS_LOG_RATE_LIMITED(warning, Constants::maxErrorLinesPerSecond) << "Could not accept a connection: " << ec.message();
+            retry_timer_.expires_from_now(std::chrono::milliseconds(100));
+            retry_timer_.async_wait([this](const boost::system::error_code& error)
+            {
+                if (!error)
+                    start_accept();
+            });
+            return;
+        }
+
+        ServerStats::add(ServerStats::tcpAccepted);
+        std::make_shared<TcpConnection>(std::move(socket_), dispatcher_)->start();
+        start_accept();
+    }
+
+} // namespace CountersServer
+} // namespace ocs
@@ -0,0 +1,76 @@
+#ifndef OCS_COUNTERS_SERVER_TCP_SERVER_H
+#define OCS_COUNTERS_SERVER_TCP_SERVER_H
+//
+// TcpServer.h
+// ~~~~~~~~~~~
+//
+// Header for the TcpServer class:
+// - listens on a tcp-v6 port, beside the datagram sockets, for the clients pipelining
+//   their requests on persistent connections (see StreamProtocol)
+// - accepts the connections, each one being served by a TcpConnection on the same IO
+//   context: thousands of connections, idle or not, share the worker thread
+// - with several workers, each one has its own acceptor, bound with SO_REUSEPORT, so that
+//   the kernel spreads the connections across the workers
+//
+
+#include <memory>
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include "Configuration.h"
+#include "CountersServerDispatcher.h"
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    // TcpServer class:
+    // - listens on a tcp-v6 port
+    // - accepts the connections, each one being served by a TcpConnection
+    class TcpServer
+    {
+    public:
+        // Ctor:
+        // Opens, binds and listens on the acceptor, then starts accepting the connections
+        // Caution: throws if the port cannot be bound
+        TcpServer(const Configuration& configuration, boost::asio::io_service& io_context, std::shared_ptr<CountersServerDispatcher> dispatcher);
+
+        // local_endpoint():
+        // Returns the endpoint the acceptor is bound to (e.g. the actual port when bound to port 0)
+        boost::asio::ip::tcp::endpoint local_endpoint() const
+        {
+            return acceptor_.local_endpoint();
+        }
+
+    private:
+        // open_acceptor():
+        // Opens, binds and listens on the acceptor (with SO_REUSEPORT when several
+        // workers are configured)
+        void open_acceptor();
+
+        // start_accept():
+        // Waits for the next connection
+        void start_accept();
+
+        // handle_accept(error):
+        // Hands the accepted connection over to a new TcpConnection, and waits for the next one
+        // On an error (e.g. out of file descriptors), the accepting is resumed after a delay,
+        // rather than failing again right away
+        void handle_accept(const boost::system::error_code& error);
+
+        // Startup configuration parameters
+        const Configuration&                            configuration_;
+
+        // Variables used by asio logic
+        boost::asio::ip::tcp::acceptor                  acceptor_;
+        boost::asio::ip::tcp::socket                    socket_;        // next connection
+        boost::asio::steady_timer                       retry_timer_;   // delay after an accept error
+
+        // Dispatcher shared by the connections
+        std::shared_ptr<CountersServerDispatcher>       dispatcher_;
+    };
+
+} // namespace CountersServer
+} // namespace ocs
+
+#endif // OCS_COUNTERS_SERVER_TCP_SERVER_H
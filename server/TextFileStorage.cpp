@@ -0,0 +1,127 @@
+//
+// TextFileStorage.cpp
+// ~~~~~~~~~~~~~~~~~~~
+//
+// Source for the TextFileStorage class:
+// - CountersStorage backend persisting the query count as a line of text in a file
+// - writing the count only reaches the page cache, a separate sync() (fsync) is
+//   required for the count to survive a system crash
+//
+#include "TextFileStorage.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include "Logger.h"
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    // Filename for persistent storage to disk
+    // Note that the filename is fixed:
+    // + allows for easy retrieval of a count stored by a previous instance
+    // - forbids several servers from running on the same machine (e.g. on different ports)
+    const std::string TextFileStorage::theFilename_ = "query_counters.txt";
+
+
+    // Ctor:
+    // Creates a closed storage, open() must be invoked before any other method
+    TextFileStorage::TextFileStorage()
+    : fd_(-1)
+    {
+    }
+
+    // Dtor:
+    // Closes the file (RAII)
+    TextFileStorage::~TextFileStorage()
+    {
+        if (fd_ >= 0)
+            ::close(fd_);
+    }
+
+    // open(directory):
+    // - opens the directory's file, or creates it with a zero count if it does not exist
+    // - reads and returns the count stored there by a previous server instance
+    // - keeps the file open for later use
+    // Caution: throws if the file cannot be opened or read, or if the directory holds the
+    // count of another backend (which the text storage does not migrate)
+    unsigned long long TextFileStorage::open(const std::string& directory)
+    {
+        // Never restart from 0 beside the count of another backend
+        const auto previous = previousStorage(directory, Storage::text);
+        if (previous != Storage::text)
+        {
+            const auto msg = std::string("The work directory holds the query count of the ") + storageName(previous)
+                           + " storage, which the text storage cannot migrate: restart with '--storage " + storageName(previous) + "'";
+            Logger(error) << msg;
+            throw std::logic_error(msg);
+        }
+
+        // Try and open the file for read/write, or create it
+        fd_ = ::open(filepath(directory, theFilename_).c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd_ < 0)
+        {
+            const auto msg = std::string("Could not open the persistent storage file: ") + std::strerror(errno);
+            Logger(error) << msg;
+            throw std::logic_error(msg);
+        }
+
+        // Read the file's content: a new (empty) file is initialized with a zero count
+        char buffer[32];
+        const auto bytes = ::pread(fd_, buffer, sizeof(buffer) - 1, 0);
+        if (bytes == 0)
+        {
+            write(0);
+            return 0;
+        }
+
+        // Try and read the current query count
+        char* end = nullptr;
+        buffer[bytes < 0 ? 0 : bytes] = '\0';
+        errno = 0;
+        const auto count = std::strtoull(buffer, &end, 10);
+        if (bytes < 0 || end == buffer || errno != 0)
+        {
+            const auto msg = "Could not read the current query count from the persistent storage file";
+            Logger(error) << msg;
+            throw std::logic_error(msg);
+        }
+        return count;
+    }
+
+    // write(count):
+    // Overwrites the stored count (the data reaches the page cache, see sync())
+    // Note: since the count never decreases, the new line is never shorter than the old one
+    // Caution: throws if the write fails
+    void TextFileStorage::write(unsigned long long count)
+    {
+        char buffer[32];
+        const auto length = std::snprintf(buffer, sizeof(buffer), "%llu\n", count);
+        if (::pwrite(fd_, buffer, length, 0) != length)
+        {
+            const auto msg = std::string("Could not write to the persistent storage file: ") + std::strerror(errno);
+            Logger(error) << msg;
+            throw std::logic_error(msg);
+        }
+    }
+
+    // sync():
+    // Flushes the written count to the disk (fsync)
+    // Caution: throws if the flush fails
+    void TextFileStorage::sync()
+    {
+        if (::fsync(fd_) != 0)
+        {
+            const auto msg = std::string("Could not sync the persistent storage file: ") + std::strerror(errno);
+            Logger(error) << msg;
+            throw std::logic_error(msg);
+        }
+    }
+
+} // namespace CountersServer
+} // namespace ocs
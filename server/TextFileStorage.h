@@ -0,0 +1,73 @@
+#ifndef OCS_COUNTERS_SERVER_TEXT_FILE_STORAGE_H
+#define OCS_COUNTERS_SERVER_TEXT_FILE_STORAGE_H
+//
+// TextFileStorage.h
+// ~~~~~~~~~~~~~~~~~
+//
+// Header for the TextFileStorage class:
+// - CountersStorage backend persisting the query count as a line of text in a file
+// - writing the count only reaches the page cache, a separate sync() (fsync) is
+//   required for the count to survive a system crash
+//
+
+#include <string>
+#include "CountersStorage.h"
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    // TextFileStorage class:
+    // - CountersStorage backend persisting the query count as a line of text in a file
+    // - writing the count only reaches the page cache, a separate sync() (fsync) is
+    //   required for the count to survive a system crash
+    // Note: a TextFileStorage is not thread-safe, concurrent accesses must be serialized by the caller
+    class TextFileStorage : public CountersStorage
+    {
+    public:
+        // Ctor:
+        // Creates a closed storage, open() must be invoked before any other method
+        TextFileStorage();
+
+        // Dtor:
+        // Closes the file (RAII)
+        ~TextFileStorage() override;
+
+        // open(directory):
+        // - opens the directory's file, or creates it with a zero count if it does not exist
+        // - reads and returns the count stored there by a previous server instance
+        // - keeps the file open for later use
+        // Caution: throws if the file cannot be opened or read, or if the directory holds the
+        // count of another backend (which the text storage does not migrate)
+        unsigned long long open(const std::string& directory) override;
+
+        // write(count):
+        // Overwrites the stored count (the data reaches the page cache, see sync())
+        // Caution: throws if the write fails
+        void write(unsigned long long count) override;
+
+        // sync():
+        // Flushes the written count to the disk (fsync)
+        // Caution: throws if the flush fails
+        void sync() override;
+
+        // Filename for persistent storage to disk
+        // Note that the filename is fixed:
+        // + allows for easy retrieval of a count stored by a previous instance
+        // - forbids several servers from running on the same machine (e.g. on different ports)
+        static const std::string theFilename_;
+
+    private:
+        // Copy is forbidden (the file descriptor is owned)
+        TextFileStorage(const TextFileStorage&) = delete;
+        TextFileStorage& operator=(const TextFileStorage&) = delete;
+
+        // File descriptor of the open file (-1 when closed)
+        int fd_;
+    };
+
+} // namespace CountersServer
+} // namespace ocs
+
+#endif // OCS_COUNTERS_SERVER_TEXT_FILE_STORAGE_H
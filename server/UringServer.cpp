@@ -0,0 +1,434 @@
+//
+// UringServer.cpp
+// ~~~~~~~~~~~~~~~
+//
+// Source for the UringServer class, the server's io_uring I/O backend:
+// - listens on a udp-v6 socket, and runs its own io_uring event loop
+// - forwards the client requests to a CountersServerDispatcher, by batches
+// - sends back the replies, submitted along with the wait for the next requests
+//
+#include "UringServer.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include "FlightRecorder.h"
+#include "Logger.h"
+#include "ServerStats.h"
+#ifdef OCS_HAS_IO_URING
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+#ifdef SO_REUSEPORT
+    // Socket option used to let several sockets (one per worker thread) share the same port
+    typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+#endif
+
+    // supported(reason):
+    // Returns true if the kernel supports the io_uring features used by the server,
+    // or else false with the reason
+    bool UringServer::supported(std::string& reason)
+    {
+#ifdef OCS_HAS_IO_URING
+        return IoUring::supported(reason);
+#else
+        reason = "not supported on this platform";
+        return false;
+#endif
+    }
+
+    // Ctor:
+    // Opens and binds the socket (with SO_REUSEPORT when several workers are
+    // configured), creates the io_uring instance and registers the receive buffers
+    // The submission ring is sized for the sends of all the reply slots (up to 4096
+    // entries, the submissions beyond being entered early), the completion ring for
+    // these sends and the receptions into all the buffers
+    // Caution: throws if the socket cannot be bound, or if io_uring is not supported
+    UringServer::UringServer(const Configuration& configuration, boost::asio::io_service& io_context,
+                             std::shared_ptr<CountersServerDispatcher> dispatcher, const CountersServer::Protocol::endpoint& endpoint)
+     : configuration_(configuration)
+     , socket_(io_context)
+     , dispatcher_(dispatcher)
+     , admission_(configuration)
+     , stop_event_(-1)
+     , stop_value_(0)
+     , stopping_(false)
+     , requests_(0)
+     , dropped_replies_(0)
+#ifdef OCS_HAS_IO_URING
+     , ring_()
+     , buffer_ring_(nullptr)
+     , buffer_ring_size_(0)
+     , buffers_()
+     , buffer_size_(0)
+     , buffer_tail_(0)
+     , buffers_held_(0)
+     , receive_header_()
+     , receive_armed_(false)
+     , slots_(configuration.sendQueueSize)
+     , free_slots_()
+     , received_()
+     , entries_()
+     , entry_slots_()
+#endif
+    {
+#ifdef OCS_HAS_IO_URING
+        socket_.open(endpoint.protocol());
+        if (configuration_.threads > 1)
+        {
+#ifdef SO_REUSEPORT
+            socket_.set_option(reuse_port(true));
+#else
+            throw std::logic_error("Multiple worker threads require SO_REUSEPORT, which is not supported on this platform");
+#endif
+        }
+        const auto tracing = FlightRecorder::enabled();
+        if (tracing)
+        {
+            const int enabled = 1;
+            ::setsockopt(socket_.native_handle(), SOL_SOCKET, SO_TIMESTAMPNS, &enabled, sizeof(enabled));
+        }
+        socket_.bind(endpoint);
+
+        stop_event_ = ::eventfd(0, EFD_CLOEXEC);
+        if (stop_event_ < 0)
+            throw std::system_error(errno, std::generic_category(), "Could not create the stop event");
+
+        unsigned entries = 8;
+        while (entries < slots_.size() + 2 && entries < 4096)
+            entries *= 2;
+        ring_.reset(new IoUring(entries, 2 * (entries + receiveBuffers)));
+
+        // Each receive buffer holds the header of the message, the source address, the
+        // control messages (tracing mode) and the datagram, truncated to the usual size
+        receive_header_.msg_namelen = sizeof(sockaddr_storage);
+        receive_header_.msg_controllen = tracing ? CMSG_SPACE(sizeof(timespec)) : 0;
+        buffer_size_ = sizeof(io_uring_recvmsg_out) + receive_header_.msg_namelen + receive_header_.msg_controllen + Constants::defaultBufferSize;
+        buffers_.resize(buffer_size_ * receiveBuffers);
+
+        // The ring of provided buffers must be page-aligned
+        buffer_ring_size_ = (receiveBuffers * sizeof(io_uring_buf) + 4095) & ~std::size_t(4095);
+        auto* const ring = ::mmap(nullptr, buffer_ring_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ring == MAP_FAILED)
+        {
+            ::close(stop_event_);
+            throw std::system_error(errno, std::generic_category(), "Could not allocate the ring of receive buffers");
+        }
+        buffer_ring_ = static_cast<io_uring_buf_ring*>(ring);
+        try
+        {
+            ring_->registerBuffers(bufferGroup, buffer_ring_, receiveBuffers);
+        }
+        catch (...)
+        {
+            ::munmap(buffer_ring_, buffer_ring_size_);
+            ::close(stop_event_);
+            throw;
+        }
+        buffers_held_ = receiveBuffers;
+        for (std::uint16_t i = 0; i < receiveBuffers; ++i)
+            recycle(i);
+        publish_buffers();
+
+        free_slots_.reserve(slots_.size());
+        for (std::size_t i = slots_.size(); i > 0; --i)
+            free_slots_.push_back(static_cast<std::uint32_t>(i - 1));
+        received_.reserve(receiveBuffers);
+        entries_.resize(receiveBuffers);
+        entry_slots_.resize(receiveBuffers);
+#else
+        (void)endpoint;
+        throw std::logic_error("The io_uring backend is not supported on this platform");
+#endif
+    }
+
+    // Dtor:
+    // Logs the statistics of the event loop (system calls per request, replies dropped)
+    // The io_uring instance is closed before its ring of buffers is unmapped
+    UringServer::~UringServer()
+    {
+#ifdef OCS_HAS_IO_URING
+        Logger(requests_ ? info : debug)
+            << "io_uring: " << requests_ << " requests received with " << enters() << " system calls ("
+            << (requests_ ? static_cast<double>(enters()) / requests_ : 0.0) << " per request), "
+            << dropped_replies_ << " replies dropped";
+        ring_.reset();
+        ::munmap(buffer_ring_, buffer_ring_size_);
+        ::close(stop_event_);
+#endif
+    }
+
+    // enters():
+    // Returns the number of io_uring_enter system calls made so far
+    unsigned long long UringServer::enters() const
+    {
+#ifdef OCS_HAS_IO_URING
+        return ring_->enters();
+#else
+        return 0;
+#endif
+    }
+
+    // run():
+    // Runs the event loop until stop() is invoked; each iteration:
+    // - submits the operations prepared by the previous one (replies, re-armed reception)
+    //   and waits for a completion, with a single io_uring_enter
+    // - handles all the completions available
+    // - dispatches the requests received at once, and prepares the sending of their replies
+    // Caution: throws on an unexpected io_uring error
+    void UringServer::run()
+    {
+#ifdef OCS_HAS_IO_URING
+        ring_->enable();
+        arm_stop();
+        while (!stopping_.load(std::memory_order_relaxed))
+        {
+            if (!receive_armed_ && buffers_held_ < receiveBuffers)
+                arm_receive();
+            ring_->enter(1);
+            ServerStats::add(ServerStats::uringEnters);
+            ring_->forEachCompletion([this](const io_uring_cqe& cqe) { handle_completion(cqe); });
+            dispatch_received();
+        }
+#endif
+    }
+
+    // stop():
+    // Requests the event loop to stop, by signaling its stop event
+    void UringServer::stop()
+    {
+        stopping_.store(true, std::memory_order_relaxed);
+#ifdef OCS_HAS_IO_URING
+        const std::uint64_t one = 1;
+        const auto written = ::write(stop_event_, &one, sizeof(one));
+        (void)written;
+#endif
+    }
+
+#ifdef OCS_HAS_IO_URING
+    // submission():
+    // Returns a submission entry, entering the kernel first if the submission ring is full
+    io_uring_sqe* UringServer::submission()
+    {
+        auto* sqe = ring_->submission();
+        while (!sqe)
+        {
+            ring_->enter(0);
+            ServerStats::add(ServerStats::uringEnters);
+            sqe = ring_->submission();
+        }
+        return sqe;
+    }
+
+    // arm_receive():
+    // Submits the multishot reception of the requests: each datagram received is written
+    // into a buffer picked by the kernel from the ring of provided buffers, and completed
+    // on its own, until the kernel runs out of buffers (or fails)
+    void UringServer::arm_receive()
+    {
+        auto* const sqe = submission();
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = socket_.native_handle();
+        sqe->addr = reinterpret_cast<std::uintptr_t>(&receive_header_);
+        sqe->len = 1;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = bufferGroup;
+        sqe->user_data = receiveOperation;
+        receive_armed_ = true;
+    }
+
+    // arm_stop():
+    // Submits the read of the stop event
+    void UringServer::arm_stop()
+    {
+        auto* const sqe = submission();
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = stop_event_;
+        sqe->addr = reinterpret_cast<std::uintptr_t>(&stop_value_);
+        sqe->len = sizeof(stop_value_);
+        sqe->user_data = stopOperation;
+    }
+
+    // handle_completion(cqe):
+    // Handles a completion:
+    // - a request received: queued for dispatching, with its buffer (the reception is
+    //   re-armed by the loop when the kernel ends it, e.g. on running out of buffers)
+    // - a reply sent: its slot is released, and its sending traced
+    // - the stop event: the loop ends
+    void UringServer::handle_completion(const io_uring_cqe& cqe)
+    {
+        const auto operation = cqe.user_data & ~0xFFFFFFFFULL;
+        if (operation == receiveOperation)
+        {
+            if (!(cqe.flags & IORING_CQE_F_MORE))
+                receive_armed_ = false;
+            if (cqe.res < 0)
+            {
+                if (cqe.res != -ENOBUFS)
+                {
+                    ServerStats::add(ServerStats::receiveErrors);
+                    OCS_LOG_RATE_LIMITED(warning, Constants::maxErrorLinesPerSecond) << "Received a request in error, ignored: " << std::strerror(-cqe.res);
+                }
+                return;
+            }
+            if (!(cqe.flags & IORING_CQE_F_BUFFER))
+                return;
+            ++buffers_held_;
+            ++requests_;
+            received_.push_back(Received{ static_cast<std::uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT), static_cast<std::uint32_t>(cqe.res) });
+        }
+        else if (operation == sendOperation)
+        {
+            const auto index = static_cast<std::uint32_t>(cqe.user_data & 0xFFFFFFFFULL);
+            auto& slot = slots_[index];
+            if (cqe.res < 0)
+            {
+                ++dropped_replies_;
+                ServerStats::add(ServerStats::sendErrors);
+                OCS_LOG_RATE_LIMITED(warning, Constants::maxErrorLinesPerSecond) << "Could not send a reply, dropped: " << std::strerror(-cqe.res);
+            }
+            else
+                ServerStats::add(ServerStats::bytesOut, cqe.res);
+            if (FlightRecorder::enabled() && slot.traceQueued)
+                FlightRecorder::record(FlightRecorder::send, slot.traceQueued, FlightRecorder::now(), slot.traceRequest);
+            free_slots_.push_back(index);
+        }
+        else if (operation == stopOperation)
+            stopping_.store(true, std::memory_order_relaxed);
+    }
+
+    // dispatch_received():
+    // Dispatches the requests received, at once (so that their query count increments
+    // are coalesced), as far as the free reply slots allow: the others wait for the
+    // completion of the replies being sent, in their buffers
+    // The requests are first checked by the admission control: those dropped get no
+    // reply, those throttled get an error reply, and the others are dispatched
+    // The replies are encoded straight into their slots, and sent to the requests' source
+    // addresses by the next io_uring_enter; the receive buffers are given back at once
+    void UringServer::dispatch_received()
+    {
+        const auto count = std::min(received_.size(), free_slots_.size());
+        if (!count)
+            return;
+
+        const auto tracing = FlightRecorder::enabled();
+        std::size_t bytesIn = 0;
+        std::size_t admitted = 0;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            // Buffer layout: io_uring_recvmsg_out, source address, control messages, datagram
+            auto* const buffer = &buffers_[received_[i].buffer * buffer_size_];
+            const auto* const message = reinterpret_cast<const io_uring_recvmsg_out*>(buffer);
+            auto* const name = buffer + sizeof(io_uring_recvmsg_out);
+            auto* const control = name + receive_header_.msg_namelen;
+            const auto* const payload = control + receive_header_.msg_controllen;
+            const auto size = std::min<std::size_t>(message->payloadlen, buffer + received_[i].size - payload);
+            const auto namelen = std::min<std::size_t>(message->namelen, receive_header_.msg_namelen);
+            const boost::string_view request(payload, size);
+            bytesIn += size;
+
+            const auto decision = admission_.check(socket_.native_handle(), name, namelen);
+            if (decision == AdmissionControl::drop)
+                continue;
+            const auto index = free_slots_.back();
+            free_slots_.pop_back();
+            auto& slot = slots_[index];
+            std::memcpy(&slot.address, name, namelen);
+            slot.header.msg_namelen = static_cast<socklen_t>(namelen);
+            if (decision == AdmissionControl::reject)
+            {
+                send_reply(index, CountersServerDispatcher::rejectCommand(request, slot.buffer.data(), slot.buffer.size()), 0, 0);
+                continue;
+            }
+
+            entry_slots_[admitted] = index;
+            auto& entry = entries_[admitted++];
+            entry.request = request;
+            entry.reply = slot.buffer.data();
+            entry.capacity = slot.buffer.size();
+            entry.size = 0;
+            entry.traceRequest = 0;
+            if (tracing)
+            {
+                entry.traceRequest = FlightRecorder::beginRequest();
+                msghdr header;
+                std::memset(&header, 0, sizeof(header));
+                header.msg_control = control;
+                header.msg_controllen = message->controllen;
+                for (auto* cmsg = CMSG_FIRSTHDR(&header); cmsg; cmsg = CMSG_NXTHDR(&header, cmsg))
+                {
+                    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+                        FlightRecorder::record(FlightRecorder::receive, FlightRecorder::fromRealtime(*reinterpret_cast<const timespec*>(CMSG_DATA(cmsg))), FlightRecorder::now());
+                }
+            }
+        }
+        ServerStats::add(ServerStats::bytesIn, bytesIn);
+        ServerStats::add(ServerStats::uringRequests, count);
+
+        dispatcher_->dispatchBatch(entries_.data(), admitted);
+
+        const auto queued = tracing ? FlightRecorder::now() : 0;
+        for (std::size_t i = 0; i < admitted; ++i)
+            send_reply(entry_slots_[i], entries_[i].size, entries_[i].traceRequest, queued);
+        for (std::size_t i = 0; i < count; ++i)
+            recycle(received_[i].buffer);
+        received_.erase(received_.begin(), received_.begin() + count);
+        publish_buffers();
+    }
+
+    // send_reply(index, size, traceRequest, traceQueued):
+    // Submits the sending of the reply of a slot, to the address of its request
+    void UringServer::send_reply(std::uint32_t index, std::size_t size, std::uint64_t traceRequest, std::uint64_t traceQueued)
+    {
+        auto& slot = slots_[index];
+        slot.vector.iov_base = slot.buffer.data();
+        slot.vector.iov_len = size;
+        slot.header.msg_name = &slot.address;
+        slot.header.msg_iov = &slot.vector;
+        slot.header.msg_iovlen = 1;
+        slot.header.msg_control = nullptr;
+        slot.header.msg_controllen = 0;
+        slot.header.msg_flags = 0;
+        slot.traceRequest = traceRequest;
+        slot.traceQueued = traceQueued;
+
+        auto* const sqe = submission();
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = socket_.native_handle();
+        sqe->addr = reinterpret_cast<std::uintptr_t>(&slot.header);
+        sqe->len = 1;
+        sqe->user_data = sendOperation | index;
+    }
+
+    // recycle(buffer):
+    // Gives a receive buffer back to the kernel (published by publish_buffers())
+    // Caution: the first slot's reserved field is the ring's tail, hence the field by field copy
+    void UringServer::recycle(std::uint16_t buffer)
+    {
+        auto& slot = IoUring::providedBuffer(buffer_ring_, buffer_tail_ & (receiveBuffers - 1));
+        slot.addr = reinterpret_cast<std::uintptr_t>(&buffers_[buffer * buffer_size_]);
+        slot.len = static_cast<std::uint32_t>(buffer_size_);
+        slot.bid = buffer;
+        ++buffer_tail_;
+        --buffers_held_;
+    }
+
+    // publish_buffers():
+    // Publishes the receive buffers given back since the previous call
+    void UringServer::publish_buffers()
+    {
+        __atomic_store_n(&buffer_ring_->tail, buffer_tail_, __ATOMIC_RELEASE);
+    }
+#endif
+
+} // namespace CountersServer
+} // namespace ocs
@@ -0,0 +1,215 @@
+#ifndef OCS_COUNTERS_SERVER_URING_SERVER_H
+#define OCS_COUNTERS_SERVER_URING_SERVER_H
+//
+// UringServer.h
+// ~~~~~~~~~~~~~
+//
+// Header for the UringServer class, the server's io_uring I/O backend ('--io-backend uring'):
+// - listens on a udp-v6 socket, like a CountersServer, but runs its own event loop on
+//   an io_uring instance (see IoUring) instead of the asio reactor
+// - receives the requests with a single multishot reception, armed once, into a ring of
+//   buffers registered with the kernel (provided buffers)
+// - dispatches all the requests received by an iteration of the loop at once (so that
+//   their query count increments are coalesced), and submits all their replies with the
+//   wait for the next requests, in a single io_uring_enter: under load, the number of
+//   system calls per request falls well below one
+//
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include "AdmissionControl.h"
+#include "Configuration.h"
+#include "Constants.h"
+#include "CountersServer.h"
+#include "CountersServerDispatcher.h"
+#include "IoUring.h"
+#ifdef OCS_HAS_IO_URING
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#endif
+
+namespace ocs
+{
+namespace CountersServer
+{
+
+    // UringServer class:
+    // - listens on a udp-v6 socket, and runs its own io_uring event loop
+    // - forwards the client requests to a CountersServerDispatcher, by batches
+    // - sends back the replies, submitted along with the wait for the next requests
+    class UringServer
+    {
+    public:
+        // supported(reason):
+        // Returns true if the kernel supports the io_uring features used by the server,
+        // or else false with the reason (the server then falls back to the asio backend)
+        static bool supported(std::string& reason);
+
+        // Ctor:
+        // Opens and binds the socket (with SO_REUSEPORT when several workers are
+        // configured), creates the io_uring instance and registers the receive buffers
+        // The socket belongs to the given IO context, which is not run by this server
+        // Caution: throws if the socket cannot be bound, or if io_uring is not supported
+        UringServer(const Configuration& configuration, boost::asio::io_service& io_context,
+                    std::shared_ptr<CountersServerDispatcher> dispatcher, const CountersServer::Protocol::endpoint& endpoint);
+
+        // Dtor:
+        // Logs the statistics of the event loop (system calls per request, replies dropped)
+        ~UringServer();
+
+        // run():
+        // Runs the event loop until stop() is invoked
+        // Caution: throws on an unexpected io_uring error
+        void run();
+
+        // stop():
+        // Requests the event loop to stop (may be invoked from any thread, before or
+        // during run())
+        void stop();
+
+        // local_endpoint():
+        // Returns the endpoint the socket is bound to (e.g. the actual port of a socket
+        // bound to port 0)
+        CountersServer::Protocol::endpoint local_endpoint() const
+        {
+            return socket_.local_endpoint();
+        }
+
+        // enters():
+        // Returns the number of io_uring_enter system calls made so far
+        unsigned long long enters() const;
+
+        // requests():
+        // Returns the number of requests received so far
+        unsigned long long requests() const
+        {
+            return requests_;
+        }
+
+    private:
+        // Startup configuration parameters
+        const Configuration&                            configuration_;
+
+        // Socket, and the dispatcher shared with the other servers
+        CountersServer::Protocol::socket                socket_;
+        std::shared_ptr<CountersServerDispatcher>       dispatcher_;
+
+        // Admission control of the requests (rate limit of the clients, load shedding)
+        AdmissionControl                                admission_;
+
+        // Stop event (eventfd), read by the loop
+        int                                             stop_event_;
+        std::uint64_t                                   stop_value_;
+        std::atomic<bool>                               stopping_;
+
+        // Statistics
+        unsigned long long                              requests_;          // requests received
+        unsigned long long                              dropped_replies_;   // replies that could not be sent
+
+#ifdef OCS_HAS_IO_URING
+        // Number of receive buffers registered with the kernel (a power of two): the
+        // maximum number of requests received and not dispatched yet
+        enum { receiveBuffers = 256 };
+
+        // Id of the group of the receive buffers
+        enum { bufferGroup = 0 };
+
+        // Tags of the operations, in the high bits of the completions' user data (the low
+        // bits holding the index of the reply slot, for a send)
+        enum Operation : std::uint64_t
+        {
+            receiveOperation = 1ULL << 32,
+            sendOperation = 2ULL << 32,
+            stopOperation = 3ULL << 32
+        };
+
+        // ReplySlot structure:
+        // A reply and its message, which stay alive until the completion of its send
+        // No logic is required -> implemented as an open struct
+        struct ReplySlot
+        {
+            std::array<char, Constants::defaultBufferSize> buffer;
+            sockaddr_storage    address;
+            iovec               vector;
+            msghdr              header;
+            std::uint64_t       traceRequest;
+            std::uint64_t       traceQueued;
+        };
+
+        // Received structure:
+        // A request received, waiting for a free reply slot to be dispatched
+        // No logic is required -> implemented as an open struct
+        struct Received
+        {
+            std::uint16_t       buffer;     // index of its receive buffer
+            std::uint32_t       size;       // size of the data received in the buffer
+        };
+
+        // arm_receive():
+        // Submits the multishot reception of the requests, which stays armed until the
+        // kernel runs out of receive buffers (or fails)
+        void arm_receive();
+
+        // arm_stop():
+        // Submits the read of the stop event
+        void arm_stop();
+
+        // handle_completion(cqe):
+        // Handles a completion: a request received (queued for dispatching), a reply
+        // sent (its slot is released), or the stop event
+        void handle_completion(const io_uring_cqe& cqe);
+
+        // dispatch_received():
+        // Dispatches the requests received (those admitted by the admission control), as
+        // far as the reply slots allow, at once, submits the sending of their replies, and
+        // gives their buffers back to the kernel
+        void dispatch_received();
+
+        // send_reply(index, size, traceRequest, traceQueued):
+        // Submits the sending of the reply of a slot, to the address of its request
+        void send_reply(std::uint32_t index, std::size_t size, std::uint64_t traceRequest, std::uint64_t traceQueued);
+
+        // recycle(buffer):
+        // Gives a receive buffer back to the kernel (published by publish_buffers())
+        void recycle(std::uint16_t buffer);
+
+        // publish_buffers():
+        // Publishes the receive buffers given back since the previous call
+        void publish_buffers();
+
+        // submission():
+        // Returns a submission entry, entering the kernel first if the submission ring is full
+        io_uring_sqe* submission();
+
+        // io_uring instance, its ring of provided receive buffers (page-aligned mapping)
+        // and the buffers themselves: each one receives the header of a message, the
+        // source address, the control messages (kernel timestamp) and the datagram
+        std::unique_ptr<IoUring>                        ring_;
+        io_uring_buf_ring*                              buffer_ring_;
+        std::size_t                                     buffer_ring_size_;
+        std::vector<char>                               buffers_;
+        std::size_t                                     buffer_size_;
+        std::uint16_t                                   buffer_tail_;       // tail of the ring, including the buffers not published yet
+        unsigned                                        buffers_held_;      // buffers received, not given back yet
+        msghdr                                          receive_header_;    // name and control lengths of the receptions
+        bool                                            receive_armed_;
+
+        // Reply slots, and the requests waiting for dispatching
+        std::vector<ReplySlot>                          slots_;
+        std::vector<std::uint32_t>                      free_slots_;
+        std::vector<Received>                           received_;
+        std::vector<CountersServerDispatcher::BatchEntry> entries_;
+        std::vector<std::uint32_t>                      entry_slots_;
+#endif
+    };
+
+} // namespace CountersServer
+} // namespace ocs
+
+#endif // OCS_COUNTERS_SERVER_URING_SERVER_H
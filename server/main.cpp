@@ -9,12 +9,18 @@
 //
 #include <iostream>
 #include <string>
+#include <thread>
+#include <vector>
 #include <boost/asio.hpp>
 #include <boost/program_options.hpp>
 #include "Logger.h"
+#include "AdmissionControl.h"
 #include "Configuration.h"
 #include "CountersServerDispatcher.h"
 #include "CountersServer.h"
+#include "CountersServerWorker.h"
+#include "FlightRecorder.h"
+#include "UringServer.h"
 
 namespace ocs
 {
@@ -26,9 +32,102 @@ namespace CountersServer
     // - The structure is then passed to all objects ctors
     static Configuration configuration;
 
+    // parse_durability(text):
+    // - Parses a durability mode ("none", "interval=<ms>", "write", "group" or "strict")
+    //   and stores it into the static Configuration object (configuration)
+    // - Returns false if the text is not a valid durability mode
+    bool parse_durability(const std::string& text)
+    {
+        static const std::string intervalPrefix = "interval";
+        if (text == "none")
+            configuration.durability = Durability::none;
+        else if (text == "write")
+            configuration.durability = Durability::write;
+        else if (text == "group")
+            configuration.durability = Durability::group;
+        else if (text == "strict")
+            configuration.durability = Durability::strict;
+        else if (text.compare(0, intervalPrefix.size(), intervalPrefix) == 0)
+        {
+            configuration.durability = Durability::interval;
+            if (text.size() == intervalPrefix.size())
+                return true;
+            if (text[intervalPrefix.size()] != '=')
+                return false;
+            try
+            {
+                std::size_t end = 0;
+                const auto value = text.substr(intervalPrefix.size() + 1);
+                configuration.durabilityInterval = std::stoi(value, &end);
+                return end == value.size() && configuration.durabilityInterval > 0;
+            }
+            catch (std::exception&)
+            {
+                return false;
+            }
+        }
+        else
+            return false;
+        return true;
+    }
+
+    // durability_text():
+    // Returns a printable description of the configured durability mode
+    std::string durability_text()
+    {
+        switch (configuration.durability)
+        {
+        case Durability::none:      return "none (snapshot at shutdown)";
+        case Durability::interval:  return "interval (every " + std::to_string(configuration.durabilityInterval) + " ms)";
+        case Durability::write:     return "write (written on every request, no fsync)";
+        case Durability::group:     return "group (group commit)";
+        case Durability::strict:    return "strict (fsync on every request)";
+        }
+        return "";
+    }
+
+    // storage_text():
+    // Returns a printable description of the configured storage backend
+    std::string storage_text()
+    {
+        switch (configuration.storage)
+        {
+        case Storage::text: return "text file";
+        case Storage::mmap: return "memory-mapped file";
+        case Storage::wal:  return "write-ahead log (snapshot every " + std::to_string(configuration.snapshotInterval) + " records)";
+        }
+        return "";
+    }
+
+    // wait_trace_signal(signals):
+    // Waits for SIGUSR1, on which the flight recorder is dumped to the work directory,
+    // then waits for the next one
+    void wait_trace_signal(boost::asio::signal_set& signals)
+    {
+        signals.async_wait(
+            [&signals](boost::system::error_code ec, int /* signal_number */)
+            {
+                if (ec)
+                    return;
+                try
+                {
+                    std::size_t events = 0;
+                    const auto path = FlightRecorder::dump(configuration.workDirectory, events);
+                    Logger(info) << "Dumped " << events << " trace events to '" << path << "'";
+                }
+                catch (std::exception& e)
+                {
+                    Logger(warning) << "Could not dump the trace: " << e.what();
+                }
+                wait_trace_signal(signals);
+            }
+        );
+    }
+
     // parse_options(argc, argv):
     // - Parses the command line options and stores them into the static Configuration object (configuration)
     // - If the options include '--help', prints help and returns +1
+    // - If the options are inconsistent, prints an error and returns -1
     // - Returns 0 otherwise
     int parse_options(int argc, char *argv[])
     {
@@ -36,15 +135,65 @@ namespace CountersServer
         namespace po = boost::program_options;
 
         // Define the supported options
+        std::string durability = "write";
+        std::string storage = "mmap";
+        std::string ioBackend = "asio";
+        bool noUdp = false;
         po::options_description desc("Allowed options");
         desc.add_options()
             ("help", "produce this help message")
             ("port", po::value<>(&configuration.port),
                 "set the udp port on which to listen (default: 12345)")
+            ("tcp-port", po::value<>(&configuration.tcpPort),
+                "also listen on this tcp port, for requests pipelined on persistent connections (default: 0, disabled)")
+            ("unix-socket", po::value<>(&configuration.unixSocket),
+                "also listen on a unix domain datagram socket bound to this path, for co-located clients (default: none)")
+            ("no-udp", po::bool_switch(&noUdp),
+                "do not listen on the udp port, only on the tcp port and/or the unix domain socket (default: disabled)")
             ("work-directory", po::value<>(&configuration.workDirectory),
                 "set the work-directory for the persistent storage file (default: current directory)")
             ("log-level", po::value<>(&configuration.minLogLevel),
-                "set the log-level from -2 for trace to 3 for fatal (default: 0 for info)");
+                "set the log-level from -2 for trace to 3 for fatal (default: 0 for info)")
+            ("log-async", po::bool_switch(&configuration.logAsync),
+                "format and write the log lines from a background thread (default: disabled)")
+            ("threads", po::value<>(&configuration.threads),
+                "set the number of worker threads, each with its own SO_REUSEPORT socket (default: 1)")
+            ("pin-threads", po::bool_switch(&configuration.pinThreads),
+                "pin each worker thread to a core (default: disabled)")
+            ("busy-poll", po::bool_switch(&configuration.busyPoll),
+                "spin on the sockets instead of sleeping in epoll, on worker threads pinned to their cores (default: disabled)")
+            ("busy-poll-idle", po::value<>(&configuration.busyPollIdle),
+                "set the idle time, in microseconds, after which a busy-polling worker sleeps until the next request (default: 1000)")
+            ("io-backend", po::value<>(&ioBackend),
+                "set the I/O backend of the worker threads: asio, or uring for an io_uring event loop serving the udp port only (default: asio)")
+            ("batch-size", po::value<>(&configuration.batchSize),
+                "set the maximum number of datagrams received/sent per recvmmsg/sendmmsg (default: 1, no batching)")
+            ("send-queue-size", po::value<>(&configuration.sendQueueSize),
+                "set the maximum number of replies queued for sending per socket (default: 256)")
+            ("client-rate", po::value<>(&configuration.clientRate),
+                "set the sustained number of requests per second allowed to each client address (default: 0, unlimited)")
+            ("client-burst", po::value<>(&configuration.clientBurst),
+                "set the number of requests a client address may send at once above its rate (default: 100)")
+            ("client-table-size", po::value<>(&configuration.clientTableSize),
+                "set the number of client addresses whose rate is tracked, the least recently active ones being evicted (default: 65536)")
+            ("throttle-silently", po::bool_switch(&configuration.throttleSilently),
+                "drop the throttled datagrams instead of answering 'ERROR: throttled' (default: disabled)")
+            ("shed-threshold", po::value<>(&configuration.shedThreshold),
+                "set the filling of a socket's receive queue, in percent, above which the datagrams are dropped (default: 0, never)")
+            ("storage", po::value<>(&storage),
+                "set the persistent storage backend: text, mmap or wal (default: mmap)")
+            ("snapshot-interval", po::value<>(&configuration.snapshotInterval),
+                "set the number of journal records between two snapshots, for the wal storage (default: 1000000)")
+            ("durability", po::value<>(&durability),
+                "set the persistence mode: none, interval=<ms>, write, group or strict (default: write, which does not fsync: use group or strict for the count to survive a system crash)")
+            ("counter-block-size", po::value<>(&configuration.counterBlockSize),
+                "set the number of counter values leased at once by each worker thread; above 1, the values are only increasing per worker thread (default: 1)")
+            ("max-counters", po::value<>(&configuration.maxCounters),
+                "set the maximum number of named counters (default: 16777216)")
+            ("trace", po::bool_switch(&configuration.trace),
+                "trace the stages of the requests, dumped on SIGUSR1 or 'TRACE DUMP' (default: disabled)")
+            ("trace-size", po::value<>(&configuration.traceEvents),
+                "set the number of trace events kept per thread (default: 65536)");
 
         // Parse the command line options, which are stored directly into the Configuration object
         po::variables_map vm;
@@ -58,6 +207,116 @@ namespace CountersServer
             std::cout << desc << std::endl;
             return 1;
         }
+
+        // Check the consistency of the options, returns -1 to the caller on error
+        configuration.udp = !noUdp;
+        if (configuration.tcpPort < 0 || configuration.tcpPort > 65535)
+        {
+            std::cerr << "The option '--tcp-port' must be between 0 and 65535" << std::endl;
+            return -1;
+        }
+        if (!configuration.udp && configuration.unixSocket.empty() && !configuration.tcpPort)
+        {
+            std::cerr << "The option '--no-udp' requires the option '--tcp-port' or '--unix-socket'" << std::endl;
+            return -1;
+        }
+        if (!configuration.udp && !configuration.tcpPort && configuration.threads > 1)
+        {
+            std::cerr << "The option '--no-udp' without '--tcp-port' requires a single thread (the unix domain socket is served by the first one)" << std::endl;
+            return -1;
+        }
+        if (configuration.threads < 1)
+        {
+            std::cerr << "The option '--threads' must be at least 1" << std::endl;
+            return -1;
+        }
+        if (configuration.batchSize < 1 || configuration.batchSize > Constants::maxBatchSize)
+        {
+            std::cerr << "The option '--batch-size' must be between 1 and " << Constants::maxBatchSize << std::endl;
+            return -1;
+        }
+        if (configuration.sendQueueSize < 1)
+        {
+            std::cerr << "The option '--send-queue-size' must be at least 1" << std::endl;
+            return -1;
+        }
+        if (configuration.clientBurst < 1)
+        {
+            std::cerr << "The option '--client-burst' must be at least 1" << std::endl;
+            return -1;
+        }
+        if (configuration.clientTableSize < 1 || configuration.clientTableSize > 0x10000000ULL)
+        {
+            std::cerr << "The option '--client-table-size' must be between 1 and " << 0x10000000ULL << std::endl;
+            return -1;
+        }
+        if (configuration.shedThreshold < 0 || configuration.shedThreshold > 100)
+        {
+            std::cerr << "The option '--shed-threshold' must be between 0 and 100" << std::endl;
+            return -1;
+        }
+        if (configuration.counterBlockSize < 1)
+        {
+            std::cerr << "The option '--counter-block-size' must be at least 1" << std::endl;
+            return -1;
+        }
+        if (configuration.maxCounters < 1 || configuration.maxCounters > 0xFFFFFFFFULL)
+        {
+            std::cerr << "The option '--max-counters' must be between 1 and " << 0xFFFFFFFFULL << std::endl;
+            return -1;
+        }
+        if (configuration.traceEvents < 1 || configuration.traceEvents > 0x10000000ULL)
+        {
+            std::cerr << "The option '--trace-size' must be between 1 and " << 0x10000000ULL << std::endl;
+            return -1;
+        }
+        if (configuration.snapshotInterval < 1)
+        {
+            std::cerr << "The option '--snapshot-interval' must be at least 1" << std::endl;
+            return -1;
+        }
+        if (ioBackend == "asio")
+            configuration.ioBackend = IoBackend::asio;
+        else if (ioBackend == "uring")
+            configuration.ioBackend = IoBackend::uring;
+        else
+        {
+            std::cerr << "The option '--io-backend' must be asio or uring" << std::endl;
+            return -1;
+        }
+        if (configuration.ioBackend == IoBackend::uring && (!configuration.udp || configuration.tcpPort || !configuration.unixSocket.empty()))
+        {
+            std::cerr << "The option '--io-backend uring' serves the udp port only, and excludes the options '--no-udp', '--tcp-port' and '--unix-socket'" << std::endl;
+            return -1;
+        }
+        if (configuration.busyPoll && configuration.ioBackend != IoBackend::asio)
+        {
+            std::cerr << "The option '--busy-poll' requires the asio backend" << std::endl;
+            return -1;
+        }
+        if (configuration.busyPollIdle < 0 || configuration.busyPollIdle > 1000000)
+        {
+            std::cerr << "The option '--busy-poll-idle' must be between 0 and 1000000" << std::endl;
+            return -1;
+        }
+        if (configuration.busyPoll)
+            configuration.pinThreads = true;
+        if (storage == "text")
+            configuration.storage = Storage::text;
+        else if (storage == "mmap")
+            configuration.storage = Storage::mmap;
+        else if (storage == "wal")
+            configuration.storage = Storage::wal;
+        else
+        {
+            std::cerr << "The option '--storage' must be text, mmap or wal" << std::endl;
+            return -1;
+        }
+        if (!parse_durability(durability))
+        {
+            std::cerr << "The option '--durability' must be none, interval=<ms>, write, group or strict" << std::endl;
+            return -1;
+        }
         return 0;
     }
 
@@ -70,22 +329,69 @@ namespace CountersServer
         int result = parse_options(argc, argv);
         if (result == 1)
             return 0;;
+        if (result < 0)
+            return -1;
 
         try
         {
+            // Fall back to the asio backend if the kernel does not support io_uring
+            std::string reason;
+            if (configuration.ioBackend == IoBackend::uring && !UringServer::supported(reason))
+            {
+                Logger(warning) << "The io_uring backend is not available (" << reason << "), falling back to the asio backend";
+                configuration.ioBackend = IoBackend::asio;
+            }
+
+            // The busy-polling workers keep their cores, the other threads (persistence,
+            // logging...) only getting them while the workers sleep
+            const auto cores = std::thread::hardware_concurrency();
+            if (configuration.busyPoll && cores && static_cast<unsigned>(configuration.threads) >= cores)
+                Logger(warning) << "The busy-polling workers (" << configuration.threads << ") take all the cores (" << cores
+                                << "): the other threads only run while the workers are idle";
+
             // Display start-up banner and startup options
             Logger(info) << "=== server : starting ===";
             Logger(info) << "";
             Logger(info) << "Configuration:";
-            Logger(info) << "\tListen port:    " << configuration.port;
+            Logger(info) << "\tListen port:    " << (configuration.udp ? std::to_string(configuration.port) : "disabled");
+            if (configuration.tcpPort)
+                Logger(info) << "\tTcp port:       " << configuration.tcpPort;
+            if (!configuration.unixSocket.empty())
+                Logger(info) << "\tUnix socket:    " << configuration.unixSocket;
             Logger(info) << "\tWork directory: " << configuration.workDirectory;
             Logger(info) << "\tLog level: "      << configuration.minLogLevel;
+            Logger(info) << "\tLog mode:       " << (configuration.logAsync ? "asynchronous" : "synchronous");
+            Logger(info) << "\tThreads:        " << configuration.threads
+                         << (configuration.pinThreads ? " (pinned)" : "");
+            Logger(info) << "\tI/O backend:    " << (configuration.ioBackend == IoBackend::uring ? "io_uring" : "asio");
+            if (configuration.busyPoll)
+                Logger(info) << "\tBusy polling:   sleeping after " << configuration.busyPollIdle << " us idle";
+            Logger(info) << "\tBatch size:     " << configuration.batchSize;
+            Logger(info) << "\tSend queue:     " << configuration.sendQueueSize;
+            Logger(info) << "\tClient rate:    " << (configuration.clientRate ? std::to_string(configuration.clientRate) + "/s, burst " + std::to_string(configuration.clientBurst)
+                                                                                  + ", " + std::to_string(configuration.clientTableSize) + " clients"
+                                                                                  + (configuration.throttleSilently ? ", silent" : "") : "unlimited");
+            Logger(info) << "\tLoad shedding:  " << (configuration.shedThreshold ? std::to_string(configuration.shedThreshold) + "% of the receive queue" : "disabled");
+            Logger(info) << "\tStorage:        " << storage_text();
+            Logger(info) << "\tDurability:     " << durability_text();
+            Logger(info) << "\tCounter blocks: " << configuration.counterBlockSize;
+            Logger(info) << "\tMax counters:   " << configuration.maxCounters;
+            Logger(info) << "\tTracing:        " << (configuration.trace ? std::to_string(configuration.traceEvents) + " events per thread" : "disabled");
             Logger(info) << "";
 
             // Set minimum log level
             Logger::setMinLevel(static_cast<LogLevel>(configuration.minLogLevel));
+            if (configuration.logAsync)
+                Logger::startAsync();
+
+            // Enable tracing before any thread is started
+            if (configuration.trace)
+                FlightRecorder::enable(configuration.traceEvents);
+            AdmissionControl::enable(configuration);
 
             // Create asio IO context
+            // Note: the main thread's IO context only handles signals, the sockets
+            // are attached to the IO contexts of the worker threads
             boost::asio::io_service io_context;
 
             // Set handler for graceful shutdown.
@@ -98,20 +404,36 @@ namespace CountersServer
                 }
             );
 
+            // Set handler for dumping the trace
+            boost::asio::signal_set traceSignals(io_context, SIGUSR1);
+            wait_trace_signal(traceSignals);
+
 
             // Create a counters store
             std::shared_ptr<CountersStore> store(new CountersStore(configuration));
 
-            // Attach a dispatcher to the store, and create a counters server object
+            // Attach a dispatcher to the store, and create the worker threads,
+            // each one owning its own counters server object
             std::shared_ptr<CountersServerDispatcher> dispatcher(new CountersServerDispatcher(configuration, store));
-            CountersServer server(configuration, io_context, dispatcher);
+            std::vector<std::unique_ptr<CountersServerWorker>> workers;
+            for (int index = 0; index < configuration.threads; ++index)
+                workers.emplace_back(new CountersServerWorker(configuration, index, dispatcher));
 
-            // Run the server
+            // Run the workers until a signal is received
             Logger(info) << "Listening...";
+            for (auto& worker : workers)
+                worker->start();
             io_context.run();
 
+            // Stop the workers
+            for (auto& worker : workers)
+                worker->stop();
+            for (auto& worker : workers)
+                worker->join();
+
             // Log shutdown
             Logger(info) << "=== server : shutdown ===";
+            Logger::stopAsync();
             return 0;
         }
         catch (std::exception& e)
@@ -119,6 +441,7 @@ namespace CountersServer
             // On error, log the exception before shutting down
             Logger(fatal) << e.what();
             Logger(info) << "=== server : aborting ===";
+            Logger::stopAsync();
             return -1;
         }
     }